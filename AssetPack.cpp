@@ -0,0 +1,663 @@
+//
+// File name: AssetPack.cpp
+//
+// Description: A packed file of surfaces, stored in the
+//              layouts produced by SetColorBitDepth and
+//              loaded straight out of a mapped view.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "AssetPack.hpp"
+#include "PixelConvert.hpp"
+#include "BlockCompress.hpp"
+
+const DWORD AssetPackMagic   = MAKEFOURCC ( 'D', 'D', 'P', 'K' );
+const DWORD AssetPackVersion = 1;
+
+static BYTE Padding [ AssetAlignment ];
+
+static int NameCompare ( LPCSTR Name1, LPCSTR Name2 ) {
+   LONG Index;
+
+   // Plain byte order, so that the sort order never
+   // depends on the locale of the machine:
+   for ( Index = 0; Index < AssetNameLength; Index++ ) {
+      if ( Name1 [ Index ] != Name2 [ Index ] )
+         return ( BYTE ) Name1 [ Index ] < ( BYTE ) Name2 [ Index ] ?
+            -1 : 1;
+
+      if ( Name1 [ Index ] == 0 )
+         break;
+   }
+
+   return 0;
+}
+
+static void GetLevelLayout ( AssetPackEntry &Entry, LONG Level,
+        LONG *Width, LONG *Height, LONG *Rows, LONG *RowBytes ) {
+
+   LONG BlockBytes;
+
+   ( *Width )  = Entry.Width;
+   ( *Height ) = Entry.Height;
+
+   while ( Level-- > 0 ) {
+      if ( ( *Width )  > 1 ) ( *Width )  /= 2;
+      if ( ( *Height ) > 1 ) ( *Height ) /= 2;
+   }
+
+   // Compressed levels are stored as rows of blocks:
+   BlockBytes = GetBlockBytes ( ( BlockCompression )
+      Entry.Compression );
+
+   if ( BlockBytes != 0 ) {
+      ( *Rows )     = ( ( *Height ) + 3 ) / 4;
+      ( *RowBytes ) = ( ( ( *Width ) + 3 ) / 4 ) * BlockBytes;
+   }
+   else {
+      ( *Rows )     = ( *Height );
+      ( *RowBytes ) = ( *Width ) * ( ( Entry.BPP + 7 ) / 8 );
+   }
+}
+
+static void GetStoredFormat ( AssetPackEntry &Entry,
+        DDPIXELFORMAT &PF ) {
+
+   if ( Entry.Compression != BlockNone )
+      SetCompressedFormat ( PF, ( BlockCompression )
+         Entry.Compression );
+   else
+      SetColorBitDepth ( PF, Entry.BPP, Entry.Alpha != 0 );
+}
+
+AssetPackWriter::AssetPackWriter () {
+   File = INVALID_HANDLE_VALUE;
+
+   Entries    = NULL;
+   EntryCount = EntryCapacity = 0;
+
+   Offset = 0;
+}
+
+AssetPackWriter::~AssetPackWriter () {
+   if ( File != INVALID_HANDLE_VALUE )
+      CloseHandle ( File );
+
+   if ( Entries != NULL )
+      delete [] Entries;
+}
+
+bool AssetPackWriter::WriteBytes ( LPVOID Data, DWORD Bytes ) {
+   DWORD Written;
+
+   if ( Bytes == 0 )
+      return true;
+
+   if ( !WriteFile ( File, Data, Bytes, &Written, NULL ) ||
+        Written != Bytes )
+      return false;
+
+   Offset += Bytes;
+
+   return true;
+}
+
+bool AssetPackWriter::Align ( DWORD Alignment ) {
+   return WriteBytes ( Padding, ( Alignment - Offset % Alignment ) %
+      Alignment );
+}
+
+void AssetPackWriter::Truncate ( DWORD End ) {
+   if ( SetFilePointer ( File, End, NULL, FILE_BEGIN ) == End )
+      SetEndOfFile ( File );
+
+   Offset = End;
+}
+
+bool AssetPackWriter::Create ( LPCSTR FileName ) {
+   AssetPackHeader Header;
+
+   if ( File != INVALID_HANDLE_VALUE )
+      return false;
+
+   File = CreateFile ( FileName, GENERIC_WRITE, 0, NULL,
+      CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+
+   if ( File == INVALID_HANDLE_VALUE )
+      return false;
+
+   EntryCount = 0;
+   Offset     = 0;
+
+   // The header is written again by Close, once the index
+   // is in place:
+   ZeroMemory ( &Header, sizeof Header );
+
+   return WriteBytes ( &Header, sizeof Header );
+}
+
+bool AssetPackWriter::AddSurface ( LPCSTR Name,
+        DirectDrawSurface &Surface ) {
+
+   AssetPackEntry *Entry, *Grown;
+   DDPIXELFORMAT Actual, Stored;
+   LPVOID Memory;
+   LONG Index, Level, Width, Height, Rows, RowBytes, Pitch, Row;
+   DWORD Start;
+   bool Result = true;
+
+   if ( File == INVALID_HANDLE_VALUE || !Surface.IsCreated () )
+      return false;
+
+   if ( Surface.GetSurfaceType () != DirectDrawSurface::Plain &&
+        Surface.GetSurfaceType () != DirectDrawSurface::Texture )
+      return false;
+
+   for ( Index = 0; Name [ Index ] != 0; Index++ )
+      if ( Index == AssetNameLength - 1 )
+         return false;
+
+   for ( Index = 0; Index < EntryCount; Index++ )
+      if ( NameCompare ( Name, Entries [ Index ].Name ) == 0 )
+         return false;
+
+   // The pack only describes SetColorBitDepth layouts, so a
+   // hardware surface the driver gave another layout is
+   // refused rather than converted:
+   if ( !Surface.GetSurfaceFormat ( Actual ) )
+      return false;
+
+   if ( Surface.GetCompression () != BlockNone ) {
+      SetCompressedFormat ( Stored, Surface.GetCompression () );
+
+      if ( ( Actual.dwFlags & DDPF_FOURCC ) == 0 ||
+           Actual.dwFourCC != Stored.dwFourCC )
+         return false;
+   }
+   else {
+      SetColorBitDepth ( Stored, Surface.GetBPP (),
+         Surface.HasAlpha () );
+
+      if ( GetPixelFormat ( Actual ) == FormatUnknown ||
+           GetPixelFormat ( Actual ) != GetPixelFormat ( Stored ) )
+         return false;
+   }
+
+   if ( EntryCount == EntryCapacity ) {
+      Grown = new AssetPackEntry [ EntryCapacity * 2 + 16 ];
+
+      if ( Grown == NULL )
+         return false;
+
+      if ( Entries != NULL ) {
+         CopyMemory ( Grown, Entries, EntryCount *
+            sizeof ( AssetPackEntry ) );
+
+         delete [] Entries;
+      }
+
+      Entries       = Grown;
+      EntryCapacity = EntryCapacity * 2 + 16;
+   }
+
+   Entry = &Entries [ EntryCount ];
+
+   ZeroMemory ( Entry, sizeof ( AssetPackEntry ) );
+
+   for ( Index = 0; Name [ Index ] != 0; Index++ )
+      Entry->Name [ Index ] = Name [ Index ];
+
+   Entry->Type        = Surface.GetSurfaceType ();
+   Entry->Width       = Surface.GetWidth ();
+   Entry->Height      = Surface.GetHeight ();
+   Entry->BPP         = Surface.GetBPP ();
+   Entry->Alpha       = Surface.HasAlpha () ? 1 : 0;
+   Entry->Compression = Surface.GetCompression ();
+   Entry->LevelCount  = Surface.GetMipLevelCount ();
+
+   Start = Offset;
+
+   for ( Level = 0; Level < ( LONG ) Entry->LevelCount &&
+         Result; Level++ ) {
+
+      GetLevelLayout ( *Entry, Level, &Width, &Height, &Rows,
+         &RowBytes );
+
+      Result = Align ( AssetAlignment );
+
+      if ( !Result )
+         break;
+
+      Entry->Offset [ Level ] = Offset;
+      Entry->Pitch  [ Level ] = ( RowBytes + 15 ) & ~15;
+
+      Result = Surface.StartMipLevelAccess ( Level, &Memory, &Pitch );
+
+      if ( !Result )
+         break;
+
+      for ( Row = 0; Row < Rows && Result; Row++ )
+         Result = WriteBytes ( ( LPBYTE ) Memory + Row * Pitch,
+            RowBytes ) && WriteBytes ( Padding,
+            Entry->Pitch [ Level ] - RowBytes );
+
+      Surface.EndMipLevelAccess ( Level );
+   }
+
+   // Cut off whatever part of the record was written, so
+   // that the next surface starts where this one did:
+   if ( !Result ) {
+      Truncate ( Start );
+      return false;
+   }
+
+   EntryCount++;
+
+   return true;
+}
+
+bool AssetPackWriter::Close () {
+   AssetPackHeader Header;
+   AssetPackEntry Swap;
+   LONG Index, Other;
+   bool Result;
+
+   if ( File == INVALID_HANDLE_VALUE )
+      return false;
+
+   // Sort the index so that entries can be found with a
+   // binary search:
+   for ( Index = 1; Index < EntryCount; Index++ ) {
+      Swap = Entries [ Index ];
+
+      for ( Other = Index; Other > 0 && NameCompare ( Swap.Name,
+            Entries [ Other - 1 ].Name ) < 0; Other-- )
+         Entries [ Other ] = Entries [ Other - 1 ];
+
+      Entries [ Other ] = Swap;
+   }
+
+   Result = Align ( AssetAlignment );
+
+   Header.Magic       = AssetPackMagic;
+   Header.Version     = AssetPackVersion;
+   Header.EntryCount  = EntryCount;
+   Header.IndexOffset = Offset;
+
+   if ( Result )
+      Result = WriteBytes ( Entries, EntryCount *
+         sizeof ( AssetPackEntry ) );
+
+   if ( Result )
+      Result = SetFilePointer ( File, 0, NULL, FILE_BEGIN ) == 0 &&
+         WriteBytes ( &Header, sizeof Header );
+
+   CloseHandle ( File );
+
+   File = INVALID_HANDLE_VALUE;
+
+   return Result;
+}
+
+AssetPack::AssetPack () {
+   File = Mapping = NULL;
+   View = NULL;
+
+   ViewSize   = 0;
+   Index      = NULL;
+   EntryCount = 0;
+
+   Manager = NULL;
+   Loaded  = NULL;
+}
+
+AssetPack::~AssetPack () {
+   Close ();
+}
+
+bool AssetPack::Open ( LPCSTR FileName,
+        DirectDrawManager &Manager ) {
+
+   AssetPackHeader *Header;
+
+   Close ();
+
+   File = CreateFile ( FileName, GENERIC_READ, FILE_SHARE_READ,
+      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+   if ( File == INVALID_HANDLE_VALUE ) {
+      File = NULL;
+
+      return false;
+   }
+
+   ViewSize = GetFileSize ( File, NULL );
+
+   if ( ViewSize < sizeof ( AssetPackHeader ) ) {
+      Close ();
+
+      return false;
+   }
+
+   // Nothing is read here but the header and the index;
+   // the pages of an entry are faulted in when it loads:
+   Mapping = CreateFileMapping ( File, NULL, PAGE_WRITECOPY, 0, 0,
+      NULL );
+
+   if ( Mapping != NULL )
+      View = ( LPBYTE ) MapViewOfFile ( Mapping, FILE_MAP_COPY,
+         0, 0, 0 );
+
+   if ( View == NULL ) {
+      Close ();
+
+      return false;
+   }
+
+   Header = ( AssetPackHeader * ) View;
+
+   if ( Header->Magic != AssetPackMagic ||
+        Header->Version != AssetPackVersion ||
+        Header->IndexOffset > ViewSize ||
+        Header->EntryCount > ( ViewSize - Header->IndexOffset ) /
+           sizeof ( AssetPackEntry ) ) {
+
+      Close ();
+
+      return false;
+   }
+
+   Index      = ( AssetPackEntry * ) ( View + Header->IndexOffset );
+   EntryCount = Header->EntryCount;
+
+   Loaded = new DirectDrawSurface * [ EntryCount + 1 ];
+
+   if ( Loaded == NULL ) {
+      Close ();
+
+      return false;
+   }
+
+   ZeroMemory ( Loaded, ( EntryCount + 1 ) *
+      sizeof ( DirectDrawSurface * ) );
+
+   this->Manager = &Manager;
+
+   return true;
+}
+
+void AssetPack::Close () {
+   LONG Entry;
+
+   if ( Loaded != NULL ) {
+      for ( Entry = 0; Entry < EntryCount; Entry++ )
+         if ( Loaded [ Entry ] != NULL )
+            delete Loaded [ Entry ];
+
+      delete [] Loaded;
+   }
+
+   if ( View != NULL )
+      UnmapViewOfFile ( View );
+
+   if ( Mapping != NULL )
+      CloseHandle ( Mapping );
+
+   if ( File != NULL )
+      CloseHandle ( File );
+
+   File = Mapping = NULL;
+   View = NULL;
+
+   ViewSize   = 0;
+   Index      = NULL;
+   EntryCount = 0;
+
+   Manager = NULL;
+   Loaded  = NULL;
+}
+
+AssetPackEntry *AssetPack::GetEntry ( LONG Entry ) {
+   if ( Entry < 0 || Entry >= EntryCount )
+      return NULL;
+
+   return &Index [ Entry ];
+}
+
+LONG AssetPack::FindEntry ( LPCSTR Name ) {
+   LONG Low = 0, High = EntryCount - 1, Middle, Order;
+
+   while ( Low <= High ) {
+      Middle = ( Low + High ) / 2;
+      Order  = NameCompare ( Name, Index [ Middle ].Name );
+
+      if ( Order == 0 )
+         return Middle;
+
+      if ( Order < 0 )
+         High = Middle - 1;
+      else
+         Low  = Middle + 1;
+   }
+
+   return -1;
+}
+
+bool AssetPack::CheckEntry ( AssetPackEntry &Entry ) {
+   LONG Level, Width, Height, Rows, RowBytes;
+
+   // Entries come from a file, so nothing in them is
+   // trusted until it is checked against the view:
+   if ( Entry.Type != DirectDrawSurface::Plain &&
+        Entry.Type != DirectDrawSurface::Texture )
+      return false;
+
+   if ( Entry.Width == 0 || Entry.Width > 65536 ||
+        Entry.Height == 0 || Entry.Height > 65536 )
+      return false;
+
+   if ( Entry.Compression > BlockBC3 || ( Entry.Compression !=
+        BlockNone && Entry.Type != DirectDrawSurface::Texture ) )
+      return false;
+
+   if ( Entry.BPP < 8 || Entry.BPP > 32 )
+      return false;
+
+   if ( Entry.LevelCount < 1 ||
+        Entry.LevelCount > DirectDrawSurface::MaxMipLevels )
+      return false;
+
+   for ( Level = 0; Level < ( LONG ) Entry.LevelCount; Level++ ) {
+      GetLevelLayout ( Entry, Level, &Width, &Height, &Rows,
+         &RowBytes );
+
+      if ( Entry.Pitch [ Level ] < ( DWORD ) RowBytes ||
+           Entry.Offset [ Level ] > ViewSize ||
+           ( ULONGLONG ) Entry.Pitch [ Level ] * Rows >
+              ViewSize - Entry.Offset [ Level ] )
+         return false;
+   }
+
+   return true;
+}
+
+bool AssetPack::CreateFromEntry ( AssetPackEntry &Entry,
+        DirectDrawSurface &Surface ) {
+
+   LPBYTE Levels [ DirectDrawSurface::MaxMipLevels ];
+   LONG   Pitches [ DirectDrawSurface::MaxMipLevels ], Level;
+
+   if ( !CheckEntry ( Entry ) )
+      return false;
+
+   if ( !Surface.SetSurfaceType ( ( DirectDrawSurface::SurfaceType )
+           Entry.Type ) ||
+        !Surface.SetGeneralOptions ( Entry.Width, Entry.Height,
+           Entry.BPP ) )
+      return false;
+
+   if ( Entry.Type == DirectDrawSurface::Texture &&
+        !Surface.SetTextureOptions ( Entry.Alpha != 0,
+           ( BlockCompression ) Entry.Compression ) )
+      return false;
+
+   // On the CPU path the surface is the pack's memory:
+   if ( Manager->GetBackend () == DirectDrawManager::SystemMemory ) {
+      for ( Level = 0; Level < ( LONG ) Entry.LevelCount; Level++ ) {
+         Levels  [ Level ] = View + Entry.Offset [ Level ];
+         Pitches [ Level ] = Entry.Pitch [ Level ];
+      }
+
+      if ( Manager->CreateAliasedSurface ( Surface, Levels,
+              Pitches, Entry.LevelCount ) )
+         return true;
+   }
+
+   if ( !Manager->CreateSurface ( Surface ) )
+      return false;
+
+   return CopyEntry ( Entry, Surface );
+}
+
+bool AssetPack::CopyEntry ( AssetPackEntry &Entry,
+        DirectDrawSurface &Surface ) {
+
+   DDPIXELFORMAT Actual, Stored;
+   PixelFormat From = FormatUnknown, To = FormatUnknown;
+   LPBYTE Src;
+   LPVOID Dest;
+   LONG Level, Count, Width, Height, Rows, RowBytes, Pitch, Row;
+   RECT Rect;
+   bool Result = true;
+
+   if ( !Surface.GetSurfaceFormat ( Actual ) )
+      return false;
+
+   GetStoredFormat ( Entry, Stored );
+
+   // Rows are copied as they are when the layouts agree,
+   // and converted on the way in when the driver chose a
+   // different one. Blocks can only be copied:
+   if ( Entry.Compression != BlockNone ) {
+      if ( ( Actual.dwFlags & DDPF_FOURCC ) == 0 ||
+           Actual.dwFourCC != Stored.dwFourCC )
+         return false;
+   }
+   else {
+      From = GetPixelFormat ( Stored );
+      To   = GetPixelFormat ( Actual );
+
+      if ( From == FormatUnknown || To == FormatUnknown ||
+           ( From != To && ( From == Format8 || To == Format8 ) ) )
+         return false;
+   }
+
+   Count = Surface.GetMipLevelCount ();
+
+   if ( ( LONG ) Entry.LevelCount < Count )
+      Count = Entry.LevelCount;
+
+   for ( Level = 0; Level < Count && Result; Level++ ) {
+      GetLevelLayout ( Entry, Level, &Width, &Height, &Rows,
+         &RowBytes );
+
+      if ( !Surface.StartMipLevelAccess ( Level, &Dest, &Pitch ) )
+         return false;
+
+      Src = View + Entry.Offset [ Level ];
+
+      // An aliased surface already is the entry:
+      if ( Dest != Src && From != To ) {
+         Rect.left = Rect.top = 0;
+         Rect.right = Width; Rect.bottom = Height;
+
+         Result = ConvertPixels ( Dest, Pitch, To, 0, 0, Src,
+            Entry.Pitch [ Level ], From, Rect );
+      }
+      else if ( Dest != Src ) {
+         for ( Row = 0; Row < Rows; Row++ )
+            CopyMemory ( ( LPBYTE ) Dest + Row * Pitch,
+               Src + Row * Entry.Pitch [ Level ], RowBytes );
+      }
+
+      Surface.EndMipLevelAccess ( Level );
+   }
+
+   return Result;
+}
+
+bool AssetPack::LoadSurface ( LPCSTR Name,
+        DirectDrawSurface &Surface ) {
+
+   LONG Entry;
+
+   if ( View == NULL )
+      return false;
+
+   Entry = FindEntry ( Name );
+
+   if ( Entry < 0 )
+      return false;
+
+   return CreateFromEntry ( Index [ Entry ], Surface );
+}
+
+bool AssetPack::ReloadSurface ( LPCSTR Name,
+        DirectDrawSurface &Surface ) {
+
+   LONG Entry;
+
+   if ( View == NULL )
+      return false;
+
+   Entry = FindEntry ( Name );
+
+   if ( Entry < 0 || !CheckEntry ( Index [ Entry ] ) )
+      return false;
+
+   return CopyEntry ( Index [ Entry ], Surface );
+}
+
+DirectDrawSurface *AssetPack::GetSurface ( LPCSTR Name ) {
+   LONG Entry;
+
+   if ( View == NULL )
+      return NULL;
+
+   Entry = FindEntry ( Name );
+
+   if ( Entry < 0 )
+      return NULL;
+
+   if ( Loaded [ Entry ] == NULL ) {
+      Loaded [ Entry ] = new DirectDrawSurface;
+
+      if ( Loaded [ Entry ] == NULL )
+         return NULL;
+
+      if ( !CreateFromEntry ( Index [ Entry ], *Loaded [ Entry ] ) ) {
+         delete Loaded [ Entry ];
+
+         Loaded [ Entry ] = NULL;
+
+         return NULL;
+      }
+   }
+   else if ( Loaded [ Entry ]->NeedsRepainting () ) {
+      // The surface is kept, and reloaded by a later call:
+      if ( !CopyEntry ( Index [ Entry ], *Loaded [ Entry ] ) ) {
+         Loaded [ Entry ]->ShouldRepaint = true;
+
+         return NULL;
+      }
+   }
+
+   return Loaded [ Entry ];
+}
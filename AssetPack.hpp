@@ -0,0 +1,122 @@
+//
+// File name: AssetPack.hpp
+//
+// Description: A packed file of surfaces, stored in the
+//              layouts produced by SetColorBitDepth and
+//              loaded straight out of a mapped view.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __ASSETPACKHPP__
+#define __ASSETPACKHPP__
+
+#include "DirectDraw.hpp"
+
+enum { AssetNameLength = 32, AssetAlignment = 64 };
+
+// A pack is a header, then the pixels of every entry, then
+// the index, sorted by name. Each mip level starts on an
+// AssetAlignment boundary and rows are padded to 16 bytes:
+struct AssetPackHeader {
+   DWORD Magic, Version, EntryCount, IndexOffset;
+};
+
+struct AssetPackEntry {
+   char  Name [ AssetNameLength ];
+   DWORD Type, Width, Height, BPP, Alpha, Compression,
+         LevelCount;
+   DWORD Offset [ DirectDrawSurface::MaxMipLevels ],
+         Pitch  [ DirectDrawSurface::MaxMipLevels ];
+};
+
+// Writes packs from surfaces that are already filled (an
+// offline step, so it favours simplicity over speed):
+class AssetPackWriter {
+   protected:
+      HANDLE File;
+
+      AssetPackEntry *Entries;
+      LONG EntryCount, EntryCapacity;
+
+      DWORD Offset;
+
+      bool WriteBytes ( LPVOID Data, DWORD Bytes );
+      bool Align ( DWORD Alignment );
+      void Truncate ( DWORD End );
+
+   public:
+      AssetPackWriter ();
+      ~AssetPackWriter ();
+
+      bool Create ( LPCSTR FileName );
+
+      // Store every mip level of a Plain or Texture surface,
+      // whose memory must be in the layout SetColorBitDepth
+      // (or SetCompressedFormat) describes:
+      bool AddSurface ( LPCSTR Name, DirectDrawSurface &Surface );
+
+      // Write the index and finish the file:
+      bool Close ();
+};
+
+// Opening a pack maps it and reads only the index; the
+// pixels of an entry are paged in when it is loaded. On a
+// SystemMemory manager, Plain and Texture entries are
+// aliased rather than copied, so the pack must outlive the
+// surfaces loaded from it. The view is copy-on-write, so
+// drawing to an aliased surface never changes the file:
+class AssetPack {
+   protected:
+      HANDLE File, Mapping;
+      LPBYTE View;
+      DWORD  ViewSize;
+
+      AssetPackEntry *Index;
+      LONG EntryCount;
+
+      DirectDrawManager *Manager;
+
+      // Surfaces created by GetSurface, one per entry:
+      DirectDrawSurface **Loaded;
+
+      LONG FindEntry ( LPCSTR Name );
+      bool CheckEntry ( AssetPackEntry &Entry );
+
+      bool CreateFromEntry ( AssetPackEntry &Entry,
+         DirectDrawSurface &Surface );
+      bool CopyEntry ( AssetPackEntry &Entry,
+         DirectDrawSurface &Surface );
+
+   public:
+      AssetPack ();
+      ~AssetPack ();
+
+      bool Open ( LPCSTR FileName, DirectDrawManager &Manager );
+      void Close ();
+
+      LONG GetEntryCount () { return EntryCount; }
+      AssetPackEntry *GetEntry ( LONG Entry );
+
+      // Create an unused surface from an entry:
+      bool LoadSurface ( LPCSTR Name, DirectDrawSurface &Surface );
+
+      // Copy an entry into a surface loaded from it again,
+      // after the surface was lost:
+      bool ReloadSurface ( LPCSTR Name,
+         DirectDrawSurface &Surface );
+
+      // The surface of an entry, created the first time it
+      // is asked for and owned by the pack. A surface that
+      // was lost since the last call is reloaded, and NULL
+      // returned if that fails:
+      DirectDrawSurface *GetSurface ( LPCSTR Name );
+};
+
+#endif
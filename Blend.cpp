@@ -0,0 +1,419 @@
+//
+// File name: Blend.cpp
+//
+// Description: Per-pixel alpha blending of one image into
+//              another, for translucent blits.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "Blend.hpp"
+
+#ifdef PIXELCONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+// Rows are blended in 8888 chunks of this many pixels:
+const LONG BlendChunk = 256;
+
+//
+// Every mode first weights the source: straight alpha
+// scales the colour by alpha (so the source is
+// premultiplied from then on), premultiplied sources are
+// scaled whole by the mask and opacity. With P the
+// weighted source and A its alpha, each channel D of the
+// destination becomes
+//
+//    source-over, premultiplied:  P + D * ( 1 - A )
+//    additive:                    D + P
+//    multiply:                    D * ( P + 1 - A )
+//
+// Additive and multiply leave the destination's alpha as
+// it was. Products are A * B / 255, rounded, in 16 bits,
+// so the scalar and SIMD kernels give the same pixels.
+//
+
+static inline DWORD ScaleChannel ( DWORD A, DWORD B ) {
+   DWORD Product = A * B + 128;
+
+   return ( Product + ( Product >> 8 ) ) >> 8;
+}
+
+static void BlendRowScalar ( DWORD *Dest, DWORD *Src,
+        LPBYTE Mask, LONG Opacity, BlendMode Mode, LONG First,
+        LONG Count ) {
+
+   DWORD Source, Pixel, Result, Weight, Alpha, Channel,
+      Weighted [ 4 ];
+   LONG X, Index;
+
+   for ( X = First; X < Count; X++ ) {
+      Source = Src [ X ];
+      Weight = Mask != NULL ?
+         ScaleChannel ( Mask [ X ], Opacity ) : Opacity;
+      Alpha  = ScaleChannel ( Source >> 24, Weight );
+
+      for ( Index = 0; Index < 3; Index++ ) {
+         Channel = ( Source >> ( Index * 8 ) ) & 0xFF;
+
+         Weighted [ Index ] = ScaleChannel ( Channel,
+            Mode == BlendPremultiplied ? Weight : Alpha );
+      }
+
+      Weighted [ 3 ] = Alpha;
+
+      // A source weighted to nothing changes nothing:
+      if ( ( Weighted [ 0 ] | Weighted [ 1 ] | Weighted [ 2 ] |
+             Alpha ) == 0 )
+         continue;
+
+      Pixel  = Dest [ X ];
+      Result = 0;
+
+      for ( Index = 0; Index < 4; Index++ ) {
+         Channel = ( Pixel >> ( Index * 8 ) ) & 0xFF;
+
+         switch ( Mode ) {
+            case BlendAdditive:
+               if ( Index < 3 )
+                  Channel += Weighted [ Index ];
+            break;
+            case BlendMultiply:
+               if ( Index < 3 ) {
+                  // Premultiplied colour can exceed its
+                  // alpha; such pixels can only brighten as
+                  // far as white:
+                  Weight = Weighted [ Index ] + 255 - Alpha;
+
+                  Channel = ScaleChannel ( Channel,
+                     Weight > 255 ? 255 : Weight );
+               }
+            break;
+            default:
+               Channel = Weighted [ Index ] +
+                  ScaleChannel ( Channel, 255 - Alpha );
+            break;
+         }
+
+         if ( Channel > 255 )
+            Channel = 255;
+
+         Result |= Channel << ( Index * 8 );
+      }
+
+      Dest [ X ] = Result;
+   }
+}
+
+#ifdef PIXELCONVERT_SSE2
+
+// A * B / 255, rounded, for eight 16-bit channels:
+static inline __m128i ScaleChannelsSSE2 ( __m128i A, __m128i B ) {
+   __m128i Product = _mm_add_epi16 ( _mm_mullo_epi16 ( A, B ),
+      _mm_set1_epi16 ( 128 ) );
+
+   return _mm_srli_epi16 ( _mm_add_epi16 ( Product,
+      _mm_srli_epi16 ( Product, 8 ) ), 8 );
+}
+
+// Copy the alpha of each of two unpacked pixels to all
+// four of its channels:
+static inline __m128i BroadcastAlphaSSE2 ( __m128i Pixels ) {
+   return _mm_shufflehi_epi16 ( _mm_shufflelo_epi16 ( Pixels,
+      0xFF ), 0xFF );
+}
+
+static LONG BlendRowSSE2 ( DWORD *Dest, DWORD *Src,
+        LPBYTE Mask, LONG Opacity, BlendMode Mode, LONG Count ) {
+
+   const __m128i Zero       = _mm_setzero_si128 ();
+   const __m128i Full       = _mm_set1_epi16 ( 255 );
+   const __m128i AlphaLanes = _mm_set_epi16 ( -1, 0, 0, 0,
+      -1, 0, 0, 0 );
+   const __m128i Constant   = _mm_set1_epi16 ( ( short ) Opacity );
+
+   __m128i Source, Pixels, Weight, WeightLo, WeightHi, Lo, Hi,
+      AlphaLo, AlphaHi, DestLo, DestHi;
+   bool Weighted = Mask != NULL || Opacity != 255;
+   LONG X;
+
+   WeightLo = WeightHi = Constant;
+
+   for ( X = 0; X + 4 <= Count; X += 4 ) {
+      Source = _mm_loadu_si128 ( ( __m128i * ) &Src [ X ] );
+
+      if ( Mask != NULL ) {
+         // One mask byte per pixel, scaled by the opacity
+         // and spread over its four channels:
+         Weight = ScaleChannelsSSE2 ( _mm_unpacklo_epi8 (
+            _mm_cvtsi32_si128 ( *( int * ) &Mask [ X ] ), Zero ),
+            Constant );
+         Weight = _mm_unpacklo_epi16 ( Weight, Weight );
+
+         WeightLo = _mm_unpacklo_epi32 ( Weight, Weight );
+         WeightHi = _mm_unpackhi_epi32 ( Weight, Weight );
+      }
+
+      Lo = _mm_unpacklo_epi8 ( Source, Zero );
+      Hi = _mm_unpackhi_epi8 ( Source, Zero );
+
+      if ( Mode == BlendPremultiplied ) {
+         if ( Weighted ) {
+            Lo = ScaleChannelsSSE2 ( Lo, WeightLo );
+            Hi = ScaleChannelsSSE2 ( Hi, WeightHi );
+         }
+
+         AlphaLo = BroadcastAlphaSSE2 ( Lo );
+         AlphaHi = BroadcastAlphaSSE2 ( Hi );
+      }
+      else {
+         AlphaLo = BroadcastAlphaSSE2 ( Lo );
+         AlphaHi = BroadcastAlphaSSE2 ( Hi );
+
+         if ( Weighted ) {
+            AlphaLo = ScaleChannelsSSE2 ( AlphaLo, WeightLo );
+            AlphaHi = ScaleChannelsSSE2 ( AlphaHi, WeightHi );
+         }
+
+         // Full alpha lanes leave the weighted alpha there:
+         Lo = ScaleChannelsSSE2 ( _mm_or_si128 ( Lo,
+            _mm_and_si128 ( AlphaLanes, Full ) ), AlphaLo );
+         Hi = ScaleChannelsSSE2 ( _mm_or_si128 ( Hi,
+            _mm_and_si128 ( AlphaLanes, Full ) ), AlphaHi );
+      }
+
+      if ( _mm_movemask_epi8 ( _mm_cmpeq_epi16 (
+              _mm_or_si128 ( Lo, Hi ), Zero ) ) == 0xFFFF )
+         continue;
+
+      Pixels = _mm_loadu_si128 ( ( __m128i * ) &Dest [ X ] );
+
+      DestLo = _mm_unpacklo_epi8 ( Pixels, Zero );
+      DestHi = _mm_unpackhi_epi8 ( Pixels, Zero );
+
+      switch ( Mode ) {
+         case BlendAdditive:
+            DestLo = _mm_add_epi16 ( DestLo,
+               _mm_andnot_si128 ( AlphaLanes, Lo ) );
+            DestHi = _mm_add_epi16 ( DestHi,
+               _mm_andnot_si128 ( AlphaLanes, Hi ) );
+         break;
+         case BlendMultiply:
+            Lo = _mm_min_epi16 ( _mm_sub_epi16 (
+               _mm_add_epi16 ( Lo, Full ), AlphaLo ), Full );
+            Hi = _mm_min_epi16 ( _mm_sub_epi16 (
+               _mm_add_epi16 ( Hi, Full ), AlphaHi ), Full );
+
+            DestLo = ScaleChannelsSSE2 ( DestLo, _mm_or_si128 (
+               _mm_andnot_si128 ( AlphaLanes, Lo ),
+               _mm_and_si128 ( AlphaLanes, Full ) ) );
+            DestHi = ScaleChannelsSSE2 ( DestHi, _mm_or_si128 (
+               _mm_andnot_si128 ( AlphaLanes, Hi ),
+               _mm_and_si128 ( AlphaLanes, Full ) ) );
+         break;
+         default:
+            DestLo = _mm_add_epi16 ( Lo, ScaleChannelsSSE2 ( DestLo,
+               _mm_sub_epi16 ( Full, AlphaLo ) ) );
+            DestHi = _mm_add_epi16 ( Hi, ScaleChannelsSSE2 ( DestHi,
+               _mm_sub_epi16 ( Full, AlphaHi ) ) );
+         break;
+      }
+
+      _mm_storeu_si128 ( ( __m128i * ) &Dest [ X ],
+         _mm_packus_epi16 ( DestLo, DestHi ) );
+   }
+
+   return X;
+}
+
+#endif
+
+static inline DWORD ReadRawPixel ( LPBYTE Pixel,
+        LONG BytesPerPixel ) {
+
+   switch ( BytesPerPixel ) {
+      case 1:
+         return Pixel [ 0 ];
+      case 2:
+         return *( WORD * ) Pixel;
+      case 3:
+         return Pixel [ 0 ] | ( Pixel [ 1 ] << 8 ) |
+            ( Pixel [ 2 ] << 16 );
+   }
+
+   return *( DWORD * ) Pixel;
+}
+
+bool BlendPixels ( LPVOID Dest, LONG DestPitch,
+        PixelFormat DestFormat, LPVOID Src, LONG SrcPitch,
+        PixelFormat SrcFormat, LONG Width, LONG Height,
+        BlendMode Mode, BYTE Opacity, LPBYTE Mask,
+        LONG MaskPitch, DWORD *Lookup, bool Keyed,
+        DWORD KeyLow, DWORD KeyHigh ) {
+
+   DWORD SrcChunk [ BlendChunk ], DestChunk [ BlendChunk ],
+      *Source, *Target, Raw;
+   LPBYTE SrcRow, DestRow, MaskRow = NULL;
+   LONG SrcSize, DestSize, X, Y, I, Count, First;
+   bool InPlace;
+   RECT Rect;
+
+#ifdef PIXELCONVERT_SSE2
+   bool UseSIMD;
+#endif
+
+   SrcSize  = GetFormatBytesPerPixel ( SrcFormat );
+   DestSize = GetFormatBytesPerPixel ( DestFormat );
+
+   if ( Dest == NULL || Src == NULL || SrcSize == 0 ||
+        DestSize == 0 || DestFormat == Format8 ||
+        ( SrcFormat == Format8 && Lookup == NULL ) ||
+        Width <= 0 || Height <= 0 || Mode == BlendOpaque )
+      return false;
+
+#ifdef PIXELCONVERT_SSE2
+   UseSIMD = GetConversionPath () != ScalarPath;
+#endif
+
+   // 32-bit destinations are blended where they are; the
+   // fourth byte of FormatX888 is kept as if it were alpha:
+   InPlace = DestFormat == Format8888 || DestFormat == FormatX888;
+
+   Rect.top = 0; Rect.bottom = 1;
+
+   for ( Y = 0; Y < Height; Y++ ) {
+      SrcRow  = ( LPBYTE ) Src  + Y * SrcPitch;
+      DestRow = ( LPBYTE ) Dest + Y * DestPitch;
+
+      if ( Mask != NULL )
+         MaskRow = Mask + Y * MaskPitch;
+
+      for ( X = 0; X < Width; X += BlendChunk ) {
+         Count = Width - X;
+
+         if ( Count > BlendChunk )
+            Count = BlendChunk;
+
+         Rect.left = X; Rect.right = X + Count;
+
+         // The source as 8888, used where it is when it
+         // already is and nothing is keyed out:
+         if ( SrcFormat == Format8888 && !Keyed )
+            Source = ( DWORD * ) SrcRow + X;
+         else {
+            Source = SrcChunk;
+
+            if ( SrcFormat == Format8 ) {
+               for ( I = 0; I < Count; I++ )
+                  SrcChunk [ I ] = Lookup [ SrcRow [ X + I ] ];
+            }
+            else ConvertPixels ( SrcChunk, 0, Format8888, 0, 0,
+                    SrcRow, 0, SrcFormat, Rect );
+
+            // Keyed pixels become transparent black, which
+            // every mode leaves alone:
+            if ( Keyed ) {
+               for ( I = 0; I < Count; I++ ) {
+                  Raw = ReadRawPixel ( SrcRow + ( X + I ) * SrcSize,
+                     SrcSize );
+
+                  if ( Raw >= KeyLow && Raw <= KeyHigh )
+                     SrcChunk [ I ] = 0;
+               }
+            }
+         }
+
+         if ( InPlace )
+            Target = ( DWORD * ) DestRow + X;
+         else {
+            Target = DestChunk;
+
+            ConvertPixels ( DestChunk, 0, Format8888, 0, 0,
+               DestRow, 0, DestFormat, Rect );
+         }
+
+         First = 0;
+
+#ifdef PIXELCONVERT_SSE2
+         if ( UseSIMD )
+            First = BlendRowSSE2 ( Target, Source,
+               MaskRow != NULL ? MaskRow + X : NULL, Opacity,
+               Mode, Count );
+#endif
+
+         BlendRowScalar ( Target, Source,
+            MaskRow != NULL ? MaskRow + X : NULL, Opacity, Mode,
+            First, Count );
+
+         if ( !InPlace ) {
+            Rect.left = 0; Rect.right = Count;
+
+            ConvertPixels ( DestRow, 0, DestFormat, X, 0,
+               DestChunk, 0, Format8888, Rect );
+         }
+      }
+   }
+
+   return true;
+}
+
+double MeasureBlendThroughput ( PixelFormat DestFormat,
+        BlendMode Mode, LONG Size, LONG Repeats, bool Mask ) {
+
+   LPBYTE Src, Dest, Alpha = NULL;
+   LONG BytesPerPixel, Repeat, I;
+   LARGE_INTEGER Start, Stop, Frequency;
+   DWORD Seed = 12345;
+   double Seconds;
+
+   BytesPerPixel = GetFormatBytesPerPixel ( DestFormat );
+
+   if ( Size <= 0 || Repeats <= 0 || BytesPerPixel < 2 ||
+        Mode == BlendOpaque )
+      return 0.0;
+
+   Src  = new BYTE [ Size * Size * 4 ];
+   Dest = new BYTE [ Size * Size * BytesPerPixel ];
+
+   if ( Mask )
+      Alpha = new BYTE [ Size * Size ];
+
+   for ( I = 0; I < Size * Size * 4; I++ ) {
+      Seed = Seed * 1103515245 + 12345;
+      Src [ I ] = ( BYTE ) ( Seed >> 16 );
+   }
+
+   for ( I = 0; I < Size * Size * BytesPerPixel; I++ )
+      Dest [ I ] = ( BYTE ) ( I * 7 );
+
+   for ( I = 0; Alpha != NULL && I < Size * Size; I++ )
+      Alpha [ I ] = ( BYTE ) ( I * 13 );
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ )
+      BlendPixels ( Dest, Size * BytesPerPixel, DestFormat, Src,
+         Size * 4, Format8888, Size, Size, Mode, 255, Alpha,
+         Size );
+
+   QueryPerformanceCounter ( &Stop );
+
+   delete [] Src;
+   delete [] Dest;
+   delete [] Alpha;
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return ( double ) Size * Size * Repeats / Seconds / 1e6;
+}
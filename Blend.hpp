@@ -0,0 +1,43 @@
+//
+// File name: Blend.hpp
+//
+// Description: Per-pixel alpha blending of one image into
+//              another, for translucent blits.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __BLENDHPP__
+#define __BLENDHPP__
+
+#include "PixelConvert.hpp"
+
+// Blend Width x Height source pixels into Dest by Mode.
+// Source alpha comes from the source format (formats
+// without alpha are opaque) and is scaled by the matching
+// byte of Mask, if any, and by Opacity; BlendPremultiplied
+// scales the whole source pixel instead. Format8 sources
+// read through Lookup, 256 Format8888 pixels (such as
+// DirectDrawPalette::GetLookup returns). With Keyed, raw
+// source pixels from KeyLow to KeyHigh leave the
+// destination as it was. Dest may not be Format8:
+bool BlendPixels ( LPVOID Dest, LONG DestPitch,
+   PixelFormat DestFormat, LPVOID Src, LONG SrcPitch,
+   PixelFormat SrcFormat, LONG Width, LONG Height,
+   BlendMode Mode, BYTE Opacity = 255, LPBYTE Mask = NULL,
+   LONG MaskPitch = 0, DWORD *Lookup = NULL, bool Keyed = false,
+   DWORD KeyLow = 0, DWORD KeyHigh = 0 );
+
+// Blend a Size x Size 8888 image into DestFormat Repeats
+// times and return the throughput in megapixels per
+// second:
+double MeasureBlendThroughput ( PixelFormat DestFormat,
+   BlendMode Mode, LONG Size, LONG Repeats, bool Mask = false );
+
+#endif
@@ -0,0 +1,464 @@
+//
+// File name: BlitBatch.cpp
+//
+// Description: Records blits and fills against DirectDraw
+//              surfaces and submits them in one pass.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "BlitBatch.hpp"
+
+BlitBatch::BlitBatch ( DWORD Flags ) {
+   Commands = NULL;
+   CommandCount = CommandCapacity = 0;
+
+   PropFlags = Flags;
+
+   ZeroMemory ( &Stats, sizeof ( BlitBatchStats ) );
+}
+
+BlitBatch::~BlitBatch () {
+   if ( Commands != NULL )
+      delete [] Commands;
+}
+
+BlitBatch::Command *BlitBatch::NewCommand () {
+   Command *Grown;
+
+   if ( CommandCount == CommandCapacity ) {
+      Grown = new Command [ CommandCapacity ?
+         CommandCapacity * 2 : 64 ];
+
+      if ( Grown == NULL )
+         return NULL;
+
+      if ( Commands != NULL ) {
+         memcpy ( Grown, Commands,
+            CommandCount * sizeof ( Command ) );
+
+         delete [] Commands;
+      }
+
+      Commands = Grown;
+      CommandCapacity = CommandCapacity ?
+         CommandCapacity * 2 : 64;
+   }
+
+   return &Commands [ CommandCount++ ];
+}
+
+bool BlitBatch::Blit ( DirectDrawSurface &Src, RECT &Portion,
+        DirectDrawSurface &Dest, RECT &DestRect ) {
+
+   Command *Cmd;
+
+   if ( !Src.Created || !Dest.Created )
+      return false;
+
+   Cmd = NewCommand ();
+
+   if ( Cmd == NULL )
+      return false;
+
+   Cmd->Type         = BlitCommand;
+   Cmd->Src          = &Src;
+   Cmd->Dest         = &Dest;
+   Cmd->SrcRect      = Portion;
+   Cmd->DestRect     = DestRect;
+   Cmd->WholeSurface = false;
+   Cmd->Value        = 0;
+
+   return true;
+}
+
+bool BlitBatch::Blit ( DirectDrawSurface &Src, RECT &Portion,
+        DirectDrawSurface &Dest, LONG DestX, LONG DestY ) {
+
+   RECT DestRect;
+
+   DestRect.left   = DestX;
+   DestRect.right  = DestX + Portion.right - Portion.left;
+   DestRect.top    = DestY;
+   DestRect.bottom = DestY + Portion.bottom - Portion.top;
+
+   return Blit ( Src, Portion, Dest, DestRect );
+}
+
+bool BlitBatch::FillColor ( DirectDrawSurface &Dest,
+        DWORD Color, RECT *Rect ) {
+
+   Command *Cmd;
+
+   if ( !Dest.Created )
+      return false;
+
+   Cmd = NewCommand ();
+
+   if ( Cmd == NULL )
+      return false;
+
+   Cmd->Type         = ColorFillCommand;
+   Cmd->Src          = NULL;
+   Cmd->Dest         = &Dest;
+   Cmd->WholeSurface = ( Rect == NULL );
+   Cmd->Value        = Color;
+
+   if ( Rect != NULL )
+      Cmd->DestRect = *Rect;
+
+   return true;
+}
+
+bool BlitBatch::FillDepth ( DirectDrawSurface &Dest,
+        DWORD Depth, RECT *Rect ) {
+
+   if ( Dest.PropSurfaceType != DirectDrawSurface::ZBuffer )
+      return false;
+
+   if ( !FillColor ( Dest, Depth, Rect ) )
+      return false;
+
+   Commands [ CommandCount - 1 ].Type = DepthFillCommand;
+
+   return true;
+}
+
+void BlitBatch::Reset () {
+   CommandCount = 0;
+}
+
+bool BlitBatch::OrderCommands ( LONG *Order, DWORD &Segments ) {
+   DirectDrawSurface **Written, **Read, *Dest, *Src, *Mask;
+   LONG Start, End, WrittenCount, ReadCount, Emitted = 0,
+      I, J, K;
+   bool *Done, Conflict;
+
+   // Split the commands into segments in which no command
+   // reads a surface another one writes. Within a segment
+   // the order between destinations does not matter, so
+   // each destination's commands are emitted together, in
+   // recording order (or, with Unordered, grouped by
+   // source as well):
+
+   Written = new DirectDrawSurface * [ CommandCount ];
+   Read    = new DirectDrawSurface * [ CommandCount * 2 ];
+   Done    = new bool [ CommandCount ];
+
+   if ( Written == NULL || Read == NULL || Done == NULL ) {
+      delete [] Written;
+      delete [] Read;
+      delete [] Done;
+
+      return false;
+   }
+
+   Segments = 0;
+
+   for ( Start = 0; Start < CommandCount; Start = End ) {
+      WrittenCount = ReadCount = 0;
+
+      for ( End = Start; End < CommandCount; End++ ) {
+         Dest = Commands [ End ].Dest;
+         Src  = Commands [ End ].Src;
+         Mask = MaskOf ( Commands [ End ] );
+
+         Conflict = false;
+
+         // A blended blit reads its mask as well:
+         for ( I = 0; I < WrittenCount; I++ )
+            if ( Src != NULL && ( Written [ I ] == Src ||
+                 Written [ I ] == Mask ) )
+               Conflict = true;
+
+         for ( I = 0; I < ReadCount; I++ )
+            if ( Read [ I ] == Dest )
+               Conflict = true;
+
+         if ( Conflict && End > Start )
+            break;
+
+         for ( I = 0; I < WrittenCount; I++ )
+            if ( Written [ I ] == Dest )
+               break;
+
+         if ( I == WrittenCount )
+            Written [ WrittenCount++ ] = Dest;
+
+         if ( Src != NULL ) {
+            for ( I = 0; I < ReadCount; I++ )
+               if ( Read [ I ] == Src )
+                  break;
+
+            if ( I == ReadCount )
+               Read [ ReadCount++ ] = Src;
+         }
+
+         if ( Mask != NULL ) {
+            for ( I = 0; I < ReadCount; I++ )
+               if ( Read [ I ] == Mask )
+                  break;
+
+            if ( I == ReadCount )
+               Read [ ReadCount++ ] = Mask;
+         }
+
+         Done [ End ] = false;
+      }
+
+      Segments++;
+
+      for ( I = Start; I < End; I++ ) {
+         if ( Done [ I ] )
+            continue;
+
+         Dest = Commands [ I ].Dest;
+
+         for ( J = I; J < End; J++ ) {
+            if ( Done [ J ] || Commands [ J ].Dest != Dest )
+               continue;
+
+            if ( !( PropFlags & Unordered ) ) {
+               Order [ Emitted++ ] = J;
+               Done [ J ] = true;
+
+               continue;
+            }
+
+            Src = Commands [ J ].Src;
+
+            for ( K = J; K < End; K++ ) {
+               if ( Done [ K ] || Commands [ K ].Dest != Dest ||
+                    Commands [ K ].Src != Src )
+                  continue;
+
+               Order [ Emitted++ ] = K;
+               Done [ K ] = true;
+            }
+         }
+      }
+   }
+
+   delete [] Written;
+   delete [] Read;
+   delete [] Done;
+
+   return true;
+}
+
+bool BlitBatch::NeedsCPU ( Command &Cmd ) {
+   return Cmd.Src->PropBlendMode != BlendOpaque ||
+      ( Cmd.Src->Palette != NULL &&
+        Cmd.Dest->SurfBytesPerPixel > 1 );
+}
+
+DirectDrawSurface *BlitBatch::MaskOf ( Command &Cmd ) {
+   if ( Cmd.Src == NULL ||
+        Cmd.Src->PropBlendMode == BlendOpaque )
+      return NULL;
+
+   return Cmd.Src->BlendMask;
+}
+
+HRESULT BlitBatch::Execute ( Command &Cmd, DDBLTFX &BlitFX ) {
+   LPDIRECTDRAWSURFACE7 Target;
+   DWORD Flags = DDBLT_WAIT;
+   RECT *DestRect, *Covered;
+   HRESULT Val;
+
+   DestRect = Cmd.WholeSurface ? NULL : &Cmd.DestRect;
+
+   // Blended blits and palette expansion are done on the
+   // CPU, by the same path a single blit takes (which
+   // recovers from loss itself):
+   if ( Cmd.Type == BlitCommand && NeedsCPU ( Cmd ) )
+      return Cmd.Src->BlitPortionTo ( Cmd.SrcRect, *Cmd.Dest,
+         Cmd.DestRect ) ? DD_OK : E_FAIL;
+
+   // Fills and opaque blits overwrite their destination,
+   // so pending fast clears are not written there; they
+   // are dropped once the command has succeeded:
+   if ( Cmd.Type == BlitCommand ) {
+      Covered = Cmd.Src->UseSourceColorKey ? NULL :
+         &Cmd.DestRect;
+
+      if ( !Cmd.Src->ResolveClear ( &Cmd.SrcRect ) ||
+           !Cmd.Dest->ResolveClear ( &Cmd.DestRect, Covered ) )
+         return E_FAIL;
+   }
+   else {
+      Covered = DestRect;
+
+      if ( DestRect != NULL &&
+           !Cmd.Dest->ResolveClear ( DestRect, DestRect ) )
+         return E_FAIL;
+   }
+
+   // Keep the depth pyramid of a z-buffer in step:
+   if ( Cmd.Type == DepthFillCommand ) {
+      if ( DestRect != NULL )
+         Cmd.Dest->HiZ.Fill ( *DestRect, Cmd.Value );
+      else Cmd.Dest->HiZ.Clear ( Cmd.Value );
+   }
+   else if ( DestRect != NULL || Cmd.Type == BlitCommand )
+      Cmd.Dest->HiZ.Invalidate ( Cmd.DestRect );
+   else Cmd.Dest->HiZ.Clear ( Cmd.Value );
+
+   // Surfaces in system memory are handled on the CPU
+   // (E_FAIL marks a CPU failure); mixing them with
+   // hardware surfaces is not supported:
+   if ( Cmd.Dest->SysMemory != NULL ) {
+      if ( Cmd.Type != BlitCommand )
+         Val = Cmd.Dest->SystemFill ( Cmd.Value, DestRect ) ?
+            DD_OK : E_FAIL;
+      else
+         Val = Cmd.Src->SystemBlit ( Cmd.SrcRect, *Cmd.Dest,
+            Cmd.DestRect ) ? DD_OK : E_FAIL;
+
+      if ( SUCCEEDED ( Val ) ) {
+         Cmd.Dest->Dirty.Add ( DestRect );
+
+         if ( Covered != NULL )
+            Cmd.Dest->CoverClear ( *Covered );
+         else if ( Cmd.Type != BlitCommand )
+            Cmd.Dest->DiscardClear ();
+      }
+
+      return Val;
+   }
+
+   if ( Cmd.Type == BlitCommand && Cmd.Src->Surface7 == NULL )
+      return DDERR_INVALIDOBJECT;
+
+   Val = Cmd.Dest->GetDrawTarget ( &Target );
+
+   if ( FAILED ( Val ) )
+      return Val;
+
+   switch ( Cmd.Type ) {
+      case BlitCommand:
+         if ( Cmd.Src->UseSourceColorKey )
+            Flags |= DDBLT_KEYSRC;
+
+         Val = Target->Blt ( &Cmd.DestRect, Cmd.Src->Surface7,
+            &Cmd.SrcRect, Flags, &BlitFX );
+         break;
+
+      case ColorFillCommand:
+         BlitFX.dwFillColor = Cmd.Value;
+
+         Val = Target->Blt ( DestRect, NULL, NULL,
+            Flags | DDBLT_COLORFILL, &BlitFX );
+         break;
+
+      case DepthFillCommand:
+         BlitFX.dwFillDepth = Cmd.Value;
+
+         Val = Target->Blt ( DestRect, NULL, NULL,
+            Flags | DDBLT_DEPTHFILL, &BlitFX );
+         break;
+
+      default:
+         Val = DDERR_INVALIDPARAMS;
+   }
+
+   if ( SUCCEEDED ( Val ) ) {
+      Cmd.Dest->Dirty.Add ( DestRect );
+
+      if ( Covered != NULL )
+         Cmd.Dest->CoverClear ( *Covered );
+      else if ( Cmd.Type != BlitCommand )
+         Cmd.Dest->DiscardClear ();
+   }
+
+   return Val;
+}
+
+bool BlitBatch::Submit () {
+   LARGE_INTEGER Start, Stop, Frequency;
+   DDBLTFX BlitFX;
+   LONG *Order, I, Attempts = 0;
+   Command *Cmd, *Last = NULL;
+   HRESULT Val, FirstError = DD_OK;
+
+   QueryPerformanceCounter ( &Start );
+
+   Stats.Commands = CommandCount;
+   Stats.Groups = Stats.Segments = Stats.Failures = 0;
+   Stats.LossRecoveries = 0;
+
+   if ( CommandCount == 0 )
+      return true;
+
+   Order = new LONG [ CommandCount ];
+
+   if ( Order == NULL )
+      return false;
+
+   if ( !OrderCommands ( Order, Stats.Segments ) ) {
+      delete [] Order;
+
+      return false;
+   }
+
+   ZeroMemory ( ( void * ) &BlitFX, sizeof ( DDBLTFX ) );
+   BlitFX.dwSize = sizeof ( DDBLTFX );
+
+   for ( I = 0; I < CommandCount; I++ ) {
+      Cmd = &Commands [ Order [ I ] ];
+
+      if ( Last == NULL || Last->Dest != Cmd->Dest ||
+           Last->Src != Cmd->Src )
+         Stats.Groups++;
+
+      Last = Cmd;
+
+      Val = Execute ( *Cmd, BlitFX );
+
+      // Surfaces are not checked for loss up front; the
+      // first command to find one restores them all, once
+      // per batch, and is sent again:
+      if ( Cmd->Dest->RetryAfterLoss ( Val, Attempts ) ) {
+         Stats.LossRecoveries++;
+
+         Val = Execute ( *Cmd, BlitFX );
+      }
+
+      if ( FAILED ( Val ) ) {
+         if ( Stats.Failures++ == 0 )
+            FirstError = Val;
+      }
+   }
+
+   delete [] Order;
+
+   QueryPerformanceCounter ( &Stop );
+   QueryPerformanceFrequency ( &Frequency );
+
+   Stats.SubmitMicroseconds = ( double ) ( Stop.QuadPart -
+      Start.QuadPart ) * 1e6 / ( double ) Frequency.QuadPart;
+
+   Stats.MicrosecondsPerCommand = Stats.SubmitMicroseconds /
+      CommandCount;
+
+   // Report only the first DirectDraw failure, so a bad
+   // batch does not raise one error per command:
+   if ( Stats.Failures > 0 ) {
+      if ( FirstError != E_FAIL )
+         return PrintDirectDrawError ( FirstError );
+
+      return false;
+   }
+
+   return true;
+}
+
+void BlitBatch::GetStatistics ( BlitBatchStats &Statistics ) {
+   Statistics = Stats;
+}
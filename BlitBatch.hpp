@@ -0,0 +1,93 @@
+//
+// File name: BlitBatch.hpp
+//
+// Description: Records blits and fills against DirectDraw
+//              surfaces and submits them in one pass.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __BLITBATCHHPP__
+#define __BLITBATCHHPP__
+
+#include "DirectDraw.hpp"
+
+struct BlitBatchStats {
+   DWORD Commands, Groups, Segments, LossRecoveries,
+         Failures;
+
+   double SubmitMicroseconds, MicrosecondsPerCommand;
+};
+
+class BlitBatch {
+   public:
+      // With Unordered, commands drawing to the same
+      // destination may also be regrouped by source, so
+      // their destination rects must not overlap:
+      enum { Unordered = 0x1 };
+
+   protected:
+      enum CommandType { BlitCommand, ColorFillCommand,
+         DepthFillCommand };
+
+      struct Command {
+         CommandType        Type;
+         DirectDrawSurface *Src, *Dest;
+         RECT               SrcRect, DestRect;
+         bool               WholeSurface;
+         DWORD              Value;
+      };
+
+      Command *Commands;
+      LONG     CommandCount, CommandCapacity;
+
+      DWORD    PropFlags;
+
+      BlitBatchStats Stats;
+
+      Command *NewCommand ();
+
+      // Whether a blit blends or expands a palette, and the
+      // mask it blends through:
+      static bool NeedsCPU ( Command &Cmd );
+      static DirectDrawSurface *MaskOf ( Command &Cmd );
+
+      bool OrderCommands ( LONG *Order, DWORD &Segments );
+      HRESULT Execute ( Command &Cmd, DDBLTFX &BlitFX );
+
+   public:
+      BlitBatch ( DWORD Flags = 0 );
+      ~BlitBatch ();
+
+      // Blits draw as BlitPortionTo would, with the source's
+      // colour key, palette and blend mode as they are when
+      // the batch is submitted:
+      bool Blit ( DirectDrawSurface &Src, RECT &Portion,
+         DirectDrawSurface &Dest, RECT &DestRect );
+      bool Blit ( DirectDrawSurface &Src, RECT &Portion,
+         DirectDrawSurface &Dest, LONG DestX, LONG DestY );
+
+      // A NULL Rect fills the whole surface, as ClearToColor
+      // and ClearToDepth do:
+      bool FillColor ( DirectDrawSurface &Dest, DWORD Color,
+         RECT *Rect = NULL );
+      bool FillDepth ( DirectDrawSurface &Dest, DWORD Depth,
+         RECT *Rect = NULL );
+
+      // Submitting leaves the commands in place, so a static
+      // batch can be submitted every frame:
+      bool Submit ();
+      void Reset  ();
+
+      LONG GetCount () { return CommandCount; }
+
+      void GetStatistics ( BlitBatchStats &Statistics );
+};
+
+#endif
@@ -0,0 +1,1096 @@
+//
+// File name: BlockCompress.cpp
+//
+// Description: BC1 and BC3 (DXT1 and DXT5) block
+//              compression of textures.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "BlockCompress.hpp"
+
+#ifdef PIXELCONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+// Each task works on a band of block rows covering about
+// this many bytes of 8888 pixels:
+const LONG BandBytes = 65536;
+
+// Index to store for each step along the line from the
+// smaller endpoint to the larger one:
+static const BYTE Map4 [ 4 ] = { 1, 3, 2, 0 },
+                  Map3 [ 3 ] = { 0, 2, 1 },
+                  Map8 [ 8 ] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+
+// Pixels are encoded from, and decoded to, a scratch
+// buffer of four 8888 rows per thread:
+struct BlockJob {
+   LPBYTE Image, Blocks, Scratch;
+   LONG   ImagePitch, BlockPitch, Width, Height, BlocksAcross,
+          BlocksDown, RowsPerTask, ScratchPitch, BlockBytes;
+
+   PixelFormat      Format;
+   BlockCompression Compression;
+   bool             UseSIMD;
+};
+
+// The line the indices of a colour block are measured
+// along: from Base towards Base + Axis in Steps steps.
+// Three colour blocks (BC1 with transparent pixels) have
+// the smaller endpoint first:
+struct ColorLine {
+   LONG  Base [ 3 ], Axis [ 3 ], Steps;
+   float Scale;
+   WORD  Color0, Color1;
+   bool  ThreeColor, Empty;
+
+   const BYTE *Map;
+};
+
+LONG GetBlockBytes ( BlockCompression Compression ) {
+   switch ( Compression ) {
+      case BlockBC1:
+         return BC1Bytes;
+      case BlockBC3:
+         return BC3Bytes;
+      default:
+         break;
+   }
+
+   return 0;
+}
+
+DWORD GetImageSize ( LONG Width, LONG Height, LONG BPP,
+        BlockCompression Compression, bool Mipmaps ) {
+
+   DWORD Size = 0;
+
+   if ( Width <= 0 || Height <= 0 )
+      return 0;
+
+   for ( ;; ) {
+      if ( Compression == BlockNone )
+         Size += Width * Height * ( ( BPP + 7 ) / 8 );
+      else
+         Size += ( ( Width + 3 ) / 4 ) * ( ( Height + 3 ) / 4 ) *
+            GetBlockBytes ( Compression );
+
+      if ( !Mipmaps || ( Width == 1 && Height == 1 ) )
+         break;
+
+      if ( Width  > 1 ) Width  /= 2;
+      if ( Height > 1 ) Height /= 2;
+   }
+
+   return Size;
+}
+
+static inline WORD To565 ( LONG *Color ) {
+   // Color is B, G, R, as in the bytes of an 8888 pixel:
+   return ( WORD ) ( ( ( Color [ 2 ] * 31 + 127 ) / 255 ) << 11 |
+      ( ( Color [ 1 ] * 63 + 127 ) / 255 ) << 5 |
+      ( ( Color [ 0 ] * 31 + 127 ) / 255 ) );
+}
+
+static inline void Expand565 ( WORD Packed, LONG *Color ) {
+   LONG R = ( Packed >> 11 ) & 0x1F, G = ( Packed >> 5 ) & 0x3F,
+        B = Packed & 0x1F;
+
+   Color [ 0 ] = ( B << 3 ) | ( B >> 2 );
+   Color [ 1 ] = ( G << 2 ) | ( G >> 4 );
+   Color [ 2 ] = ( R << 3 ) | ( R >> 2 );
+}
+
+static void SetupColorLine ( LPBYTE Pixels, LONG Pitch,
+        DWORD OpaqueBits, LONG *Min, LONG *Max, ColorLine &Line ) {
+
+   LONG Start [ 3 ], End [ 3 ], Centre [ 3 ], Covariance [ 3 ],
+        Delta [ 3 ], Inset, Channel, Major = 0, Index, Swap,
+        Length = 0;
+   DWORD Pixel;
+
+   Line.ThreeColor = OpaqueBits != 0xFFFF;
+   Line.Empty      = OpaqueBits == 0;
+
+   if ( Line.Empty ) {
+      Line.Color0 = Line.Color1 = 0;
+
+      return;
+   }
+
+   // Pull the bounding box in by a sixteenth, so that
+   // outliers do not stretch the whole palette:
+   for ( Channel = 0; Channel < 3; Channel++ ) {
+      Inset = ( Max [ Channel ] - Min [ Channel ] ) >> 4;
+
+      Start  [ Channel ] = Min [ Channel ] + Inset;
+      End    [ Channel ] = Max [ Channel ] - Inset;
+      Centre [ Channel ] = ( Min [ Channel ] + Max [ Channel ] ) / 2;
+
+      Covariance [ Channel ] = 0;
+
+      if ( Max [ Channel ] - Min [ Channel ] >
+           Max [ Major ] - Min [ Major ] )
+         Major = Channel;
+   }
+
+   // The box has four diagonals. Take the one along which
+   // each channel varies with the channel that varies most:
+   for ( Index = 0; Index < 16; Index++ ) {
+      if ( ( OpaqueBits & ( 1 << Index ) ) == 0 )
+         continue;
+
+      Pixel = ( ( DWORD * ) ( Pixels + ( Index / 4 ) * Pitch ) )
+         [ Index % 4 ];
+
+      for ( Channel = 0; Channel < 3; Channel++ )
+         Delta [ Channel ] = ( LONG ) ( ( Pixel >> ( Channel * 8 ) ) &
+            0xFF ) - Centre [ Channel ];
+
+      for ( Channel = 0; Channel < 3; Channel++ )
+         Covariance [ Channel ] += Delta [ Channel ] * Delta [ Major ];
+   }
+
+   for ( Channel = 0; Channel < 3; Channel++ ) {
+      if ( Covariance [ Channel ] < 0 ) {
+         Swap = Start [ Channel ];
+
+         Start [ Channel ] = End [ Channel ];
+         End   [ Channel ] = Swap;
+      }
+   }
+
+   // The line runs from the smaller endpoint. Four colour
+   // blocks need Color0 > Color1; three colour blocks need
+   // Color0 <= Color1:
+   if ( To565 ( Start ) > To565 ( End ) ) {
+      for ( Channel = 0; Channel < 3; Channel++ ) {
+         Swap = Start [ Channel ];
+
+         Start [ Channel ] = End [ Channel ];
+         End   [ Channel ] = Swap;
+      }
+   }
+
+   if ( Line.ThreeColor ) {
+      Line.Color0 = To565 ( Start );
+      Line.Color1 = To565 ( End );
+      Line.Steps  = 2;
+      Line.Map    = Map3;
+   }
+   else {
+      Line.Color0 = To565 ( End );
+      Line.Color1 = To565 ( Start );
+      Line.Steps  = 3;
+      Line.Map    = Map4;
+   }
+
+   Expand565 ( To565 ( Start ), Line.Base );
+   Expand565 ( To565 ( End ), End );
+
+   for ( Channel = 0; Channel < 3; Channel++ ) {
+      Line.Axis [ Channel ] = End [ Channel ] - Line.Base [ Channel ];
+
+      Length += Line.Axis [ Channel ] * Line.Axis [ Channel ];
+   }
+
+   Line.Scale = Length > 0 ? ( float ) Line.Steps /
+      ( float ) Length : 0.0f;
+}
+
+static void WriteColorBlock ( LPBYTE Out, ColorLine &Line,
+        DWORD Indices ) {
+
+   *( WORD * )  ( Out )     = Line.Color0;
+   *( WORD * )  ( Out + 2 ) = Line.Color1;
+   *( DWORD * ) ( Out + 4 ) = Indices;
+}
+
+static void WriteAlphaBlock ( LPBYTE Out, LONG Alpha0,
+        LONG Alpha1, BYTE *Steps ) {
+
+   DWORD Low = 0, High = 0;
+   LONG Index;
+
+   // Sixteen 3-bit indices, the first in the lowest bits:
+   for ( Index = 0; Index < 8; Index++ )
+      Low  |= ( DWORD ) Steps [ Index ] << ( Index * 3 );
+
+   for ( Index = 0; Index < 8; Index++ )
+      High |= ( DWORD ) Steps [ Index + 8 ] << ( Index * 3 );
+
+   Out [ 0 ] = ( BYTE ) Alpha0;
+   Out [ 1 ] = ( BYTE ) Alpha1;
+   Out [ 2 ] = ( BYTE ) ( Low );
+   Out [ 3 ] = ( BYTE ) ( Low  >> 8 );
+   Out [ 4 ] = ( BYTE ) ( Low  >> 16 );
+   Out [ 5 ] = ( BYTE ) ( High );
+   Out [ 6 ] = ( BYTE ) ( High >> 8 );
+   Out [ 7 ] = ( BYTE ) ( High >> 16 );
+}
+
+//
+// The encoder fits each block's colours to the inset
+// diagonal of their bounding box and alpha to its range,
+// then rounds every pixel's projection onto that line to
+// the nearest palette step. The scalar and SIMD kernels
+// do the same integer and float operations, so they write
+// the same blocks.
+//
+
+static void EncodeColorScalar ( LPBYTE Out, LPBYTE Pixels,
+        LONG Pitch, bool PunchThrough ) {
+
+   ColorLine Line;
+   DWORD Pixel [ 16 ], Indices = 0, OpaqueBits = 0;
+   LONG Min [ 3 ] = { 255, 255, 255 }, Max [ 3 ] = { 0, 0, 0 },
+        Index, Channel, Value, Dot, Step;
+
+   for ( Index = 0; Index < 16; Index++ )
+      Pixel [ Index ] = ( ( DWORD * ) ( Pixels +
+         ( Index / 4 ) * Pitch ) ) [ Index % 4 ];
+
+   for ( Index = 0; Index < 16; Index++ ) {
+      if ( PunchThrough && ( Pixel [ Index ] >> 24 ) < 128 )
+         continue;
+
+      OpaqueBits |= 1 << Index;
+
+      for ( Channel = 0; Channel < 3; Channel++ ) {
+         Value = ( Pixel [ Index ] >> ( Channel * 8 ) ) & 0xFF;
+
+         if ( Value < Min [ Channel ] ) Min [ Channel ] = Value;
+         if ( Value > Max [ Channel ] ) Max [ Channel ] = Value;
+      }
+   }
+
+   SetupColorLine ( Pixels, Pitch, OpaqueBits, Min, Max, Line );
+
+   for ( Index = 0; Index < 16; Index++ ) {
+      if ( ( OpaqueBits & ( 1 << Index ) ) == 0 ) {
+
+         Indices |= 3 << ( Index * 2 );
+
+         continue;
+      }
+
+      Dot = 0;
+
+      for ( Channel = 0; Channel < 3; Channel++ )
+         Dot += ( ( LONG ) ( ( Pixel [ Index ] >> ( Channel * 8 ) ) &
+            0xFF ) - Line.Base [ Channel ] ) * Line.Axis [ Channel ];
+
+      Step = ( LONG ) ( ( float ) Dot * Line.Scale + 0.5f );
+
+      if ( Step < 0 ) Step = 0;
+      if ( Step > Line.Steps ) Step = Line.Steps;
+
+      Indices |= ( DWORD ) Line.Map [ Step ] << ( Index * 2 );
+   }
+
+   WriteColorBlock ( Out, Line, Indices );
+}
+
+static void EncodeAlphaScalar ( LPBYTE Out, LPBYTE Pixels,
+        LONG Pitch ) {
+
+   BYTE Steps [ 16 ];
+   LONG Alpha [ 16 ], Min = 255, Max = 0, Index, Step;
+   float Scale;
+
+   for ( Index = 0; Index < 16; Index++ ) {
+      Alpha [ Index ] = Pixels [ ( Index / 4 ) * Pitch +
+         ( Index % 4 ) * 4 + 3 ];
+
+      if ( Alpha [ Index ] < Min ) Min = Alpha [ Index ];
+      if ( Alpha [ Index ] > Max ) Max = Alpha [ Index ];
+   }
+
+   // Alpha0 > Alpha1 selects the eight value palette:
+   Scale = Max > Min ? 7.0f / ( float ) ( Max - Min ) : 0.0f;
+
+   for ( Index = 0; Index < 16; Index++ ) {
+      Step = ( LONG ) ( ( float ) ( Alpha [ Index ] - Min ) *
+         Scale + 0.5f );
+
+      if ( Step > 7 ) Step = 7;
+
+      Steps [ Index ] = Max > Min ? Map8 [ Step ] : 0;
+   }
+
+   WriteAlphaBlock ( Out, Max, Min, Steps );
+}
+
+#ifdef PIXELCONVERT_SSE2
+
+static inline __m128i HorizontalMin8 ( __m128i Value ) {
+   Value = _mm_min_epu8 ( Value, _mm_shuffle_epi32 ( Value,
+      _MM_SHUFFLE ( 1, 0, 3, 2 ) ) );
+
+   return _mm_min_epu8 ( Value, _mm_shuffle_epi32 ( Value,
+      _MM_SHUFFLE ( 2, 3, 0, 1 ) ) );
+}
+
+static inline __m128i HorizontalMax8 ( __m128i Value ) {
+   Value = _mm_max_epu8 ( Value, _mm_shuffle_epi32 ( Value,
+      _MM_SHUFFLE ( 1, 0, 3, 2 ) ) );
+
+   return _mm_max_epu8 ( Value, _mm_shuffle_epi32 ( Value,
+      _MM_SHUFFLE ( 2, 3, 0, 1 ) ) );
+}
+
+// Round the projections of four pixels (32-bit lanes)
+// onto the line to palette steps:
+static inline __m128i ProjectSSE2 ( __m128i Dot,
+        __m128 Scale ) {
+
+   return _mm_cvttps_epi32 ( _mm_add_ps ( _mm_mul_ps (
+      _mm_cvtepi32_ps ( Dot ), Scale ), _mm_set1_ps ( 0.5f ) ) );
+}
+
+// The dot products of four 8888 pixels with Axis, after
+// subtracting Base; both hold B, G, R, 0 twice as words:
+static inline __m128i DotSSE2 ( __m128i Pixels,
+        __m128i Base, __m128i Axis ) {
+
+   const __m128i Zero = _mm_setzero_si128 ();
+   __m128i Low, High;
+
+   Low  = _mm_madd_epi16 ( _mm_sub_epi16 (
+      _mm_unpacklo_epi8 ( Pixels, Zero ), Base ), Axis );
+   High = _mm_madd_epi16 ( _mm_sub_epi16 (
+      _mm_unpackhi_epi8 ( Pixels, Zero ), Base ), Axis );
+
+   // Each pixel left B+G in one lane and R+0 in the next:
+   Low  = _mm_add_epi32 ( Low,  _mm_srli_epi64 ( Low,  32 ) );
+   High = _mm_add_epi32 ( High, _mm_srli_epi64 ( High, 32 ) );
+
+   return _mm_castps_si128 ( _mm_shuffle_ps (
+      _mm_castsi128_ps ( Low ), _mm_castsi128_ps ( High ),
+      _MM_SHUFFLE ( 2, 0, 2, 0 ) ) );
+}
+
+static void EncodeColorSSE2 ( LPBYTE Out, LPBYTE Pixels,
+        LONG Pitch, bool PunchThrough ) {
+
+   ColorLine Line;
+   __m128i Row [ 4 ], Opaque [ 4 ], Low, High, Base, Axis,
+      Steps, Limit;
+   __m128 Scale;
+   DWORD Indices = 0, MinPixel, MaxPixel, OpaqueBits = 0xFFFF;
+   LONG Min [ 3 ], Max [ 3 ], Index, Channel;
+   WORD Step [ 16 ];
+
+   const __m128i Half = _mm_set1_epi32 ( 127 );
+   const __m128i Ones = _mm_set1_epi32 ( -1 );
+
+   for ( Index = 0; Index < 4; Index++ ) {
+      Row [ Index ] = _mm_loadu_si128 ( ( __m128i * ) ( Pixels +
+         Index * Pitch ) );
+
+      Opaque [ Index ] = Ones;
+   }
+
+   if ( PunchThrough ) {
+      OpaqueBits = 0;
+
+      for ( Index = 0; Index < 4; Index++ ) {
+         Opaque [ Index ] = _mm_cmpgt_epi32 ( _mm_srli_epi32 (
+            Row [ Index ], 24 ), Half );
+
+         OpaqueBits |= _mm_movemask_ps ( _mm_castsi128_ps (
+            Opaque [ Index ] ) ) << ( Index * 4 );
+      }
+   }
+
+   // Transparent pixels count as white for the minimum and
+   // black for the maximum, so they drop out of both:
+   Low  = Ones;
+   High = _mm_setzero_si128 ();
+
+   for ( Index = 0; Index < 4; Index++ ) {
+      Low  = _mm_min_epu8 ( Low, _mm_or_si128 ( Row [ Index ],
+         _mm_andnot_si128 ( Opaque [ Index ], Ones ) ) );
+      High = _mm_max_epu8 ( High, _mm_and_si128 ( Row [ Index ],
+         Opaque [ Index ] ) );
+   }
+
+   MinPixel = _mm_cvtsi128_si32 ( HorizontalMin8 ( Low ) );
+   MaxPixel = _mm_cvtsi128_si32 ( HorizontalMax8 ( High ) );
+
+   for ( Channel = 0; Channel < 3; Channel++ ) {
+      Min [ Channel ] = ( MinPixel >> ( Channel * 8 ) ) & 0xFF;
+      Max [ Channel ] = ( MaxPixel >> ( Channel * 8 ) ) & 0xFF;
+   }
+
+   SetupColorLine ( Pixels, Pitch, OpaqueBits, Min, Max, Line );
+
+   if ( Line.Empty ) {
+      WriteColorBlock ( Out, Line, 0xFFFFFFFF );
+
+      return;
+   }
+
+   Base  = _mm_set_epi16 ( 0, ( short ) Line.Base [ 2 ],
+      ( short ) Line.Base [ 1 ], ( short ) Line.Base [ 0 ],
+      0, ( short ) Line.Base [ 2 ],
+      ( short ) Line.Base [ 1 ], ( short ) Line.Base [ 0 ] );
+   Axis  = _mm_set_epi16 ( 0, ( short ) Line.Axis [ 2 ],
+      ( short ) Line.Axis [ 1 ], ( short ) Line.Axis [ 0 ],
+      0, ( short ) Line.Axis [ 2 ],
+      ( short ) Line.Axis [ 1 ], ( short ) Line.Axis [ 0 ] );
+   Scale = _mm_set1_ps ( Line.Scale );
+   Limit = _mm_set1_epi16 ( ( short ) Line.Steps );
+
+   for ( Index = 0; Index < 2; Index++ ) {
+      Steps = _mm_packs_epi32 (
+         ProjectSSE2 ( DotSSE2 ( Row [ Index * 2 ], Base, Axis ),
+            Scale ),
+         ProjectSSE2 ( DotSSE2 ( Row [ Index * 2 + 1 ], Base, Axis ),
+            Scale ) );
+
+      Steps = _mm_min_epi16 ( _mm_max_epi16 ( Steps,
+         _mm_setzero_si128 () ), Limit );
+
+      _mm_storeu_si128 ( ( __m128i * ) ( Step + Index * 8 ),
+         Steps );
+   }
+
+   for ( Index = 0; Index < 16; Index++ ) {
+      if ( OpaqueBits & ( 1 << Index ) )
+         Indices |= ( DWORD ) Line.Map [ Step [ Index ] ] <<
+            ( Index * 2 );
+      else
+         Indices |= 3 << ( Index * 2 );
+   }
+
+   WriteColorBlock ( Out, Line, Indices );
+}
+
+static void EncodeAlphaSSE2 ( LPBYTE Out, LPBYTE Pixels,
+        LONG Pitch ) {
+
+   __m128i Alpha [ 4 ], Words, Low, High, Min;
+   __m128 Scale;
+   BYTE Steps [ 16 ];
+   WORD Step [ 16 ];
+   LONG Index, MinAlpha, MaxAlpha;
+
+   for ( Index = 0; Index < 4; Index++ )
+      Alpha [ Index ] = _mm_srli_epi32 ( _mm_loadu_si128 (
+         ( __m128i * ) ( Pixels + Index * Pitch ) ), 24 );
+
+   Low  = _mm_packs_epi32 ( Alpha [ 0 ], Alpha [ 1 ] );
+   High = _mm_packs_epi32 ( Alpha [ 2 ], Alpha [ 3 ] );
+
+   Words = Low;
+   Low   = _mm_min_epi16 ( Words, High );
+   High  = _mm_max_epi16 ( Words, High );
+
+   Low  = _mm_min_epi16 ( Low,  _mm_srli_si128 ( Low,  8 ) );
+   High = _mm_max_epi16 ( High, _mm_srli_si128 ( High, 8 ) );
+   Low  = _mm_min_epi16 ( Low,  _mm_srli_si128 ( Low,  4 ) );
+   High = _mm_max_epi16 ( High, _mm_srli_si128 ( High, 4 ) );
+   Low  = _mm_min_epi16 ( Low,  _mm_srli_si128 ( Low,  2 ) );
+   High = _mm_max_epi16 ( High, _mm_srli_si128 ( High, 2 ) );
+
+   MinAlpha = _mm_extract_epi16 ( Low,  0 );
+   MaxAlpha = _mm_extract_epi16 ( High, 0 );
+
+   if ( MaxAlpha == MinAlpha ) {
+      ZeroMemory ( Steps, sizeof ( Steps ) );
+
+      WriteAlphaBlock ( Out, MaxAlpha, MinAlpha, Steps );
+
+      return;
+   }
+
+   Min   = _mm_set1_epi32 ( MinAlpha );
+   Scale = _mm_set1_ps ( 7.0f / ( float ) ( MaxAlpha - MinAlpha ) );
+
+   for ( Index = 0; Index < 2; Index++ ) {
+      Words = _mm_min_epi16 ( _mm_packs_epi32 (
+         ProjectSSE2 ( _mm_sub_epi32 ( Alpha [ Index * 2 ], Min ),
+            Scale ),
+         ProjectSSE2 ( _mm_sub_epi32 ( Alpha [ Index * 2 + 1 ], Min ),
+            Scale ) ), _mm_set1_epi16 ( 7 ) );
+
+      _mm_storeu_si128 ( ( __m128i * ) ( Step + Index * 8 ),
+         Words );
+   }
+
+   for ( Index = 0; Index < 16; Index++ )
+      Steps [ Index ] = Map8 [ Step [ Index ] ];
+
+   WriteAlphaBlock ( Out, MaxAlpha, MinAlpha, Steps );
+}
+
+#endif
+
+static void BuildColorPalette ( LPBYTE Block, bool FourColor,
+        DWORD *Palette ) {
+
+   WORD Color0 = *( WORD * ) Block, Color1 = *( WORD * ) ( Block + 2 );
+   LONG End0 [ 3 ], End1 [ 3 ], Channel;
+
+   Expand565 ( Color0, End0 );
+   Expand565 ( Color1, End1 );
+
+   // BC3 colour blocks always have four colours; BC1
+   // blocks only when Color0 > Color1:
+   FourColor = FourColor || Color0 > Color1;
+
+   Palette [ 0 ] = Palette [ 1 ] = 0xFF000000;
+   Palette [ 2 ] = 0xFF000000;
+   Palette [ 3 ] = FourColor ? 0xFF000000 : 0;
+
+   for ( Channel = 0; Channel < 3; Channel++ ) {
+      Palette [ 0 ] |= End0 [ Channel ] << ( Channel * 8 );
+      Palette [ 1 ] |= End1 [ Channel ] << ( Channel * 8 );
+
+      if ( FourColor ) {
+         Palette [ 2 ] |= ( ( 2 * End0 [ Channel ] + End1 [ Channel ] +
+            1 ) / 3 ) << ( Channel * 8 );
+         Palette [ 3 ] |= ( ( End0 [ Channel ] + 2 * End1 [ Channel ] +
+            1 ) / 3 ) << ( Channel * 8 );
+      }
+      else
+         Palette [ 2 ] |= ( ( End0 [ Channel ] + End1 [ Channel ] +
+            1 ) / 2 ) << ( Channel * 8 );
+   }
+}
+
+static void BuildAlphaPalette ( LPBYTE Block, DWORD *Palette ) {
+   LONG Alpha0 = Block [ 0 ], Alpha1 = Block [ 1 ], Index;
+
+   // Palette entries are shifted into the alpha byte:
+   Palette [ 0 ] = Alpha0 << 24;
+   Palette [ 1 ] = Alpha1 << 24;
+
+   if ( Alpha0 > Alpha1 ) {
+      for ( Index = 2; Index < 8; Index++ )
+         Palette [ Index ] = ( ( ( 8 - Index ) * Alpha0 +
+            ( Index - 1 ) * Alpha1 + 3 ) / 7 ) << 24;
+   }
+   else {
+      for ( Index = 2; Index < 6; Index++ )
+         Palette [ Index ] = ( ( ( 6 - Index ) * Alpha0 +
+            ( Index - 1 ) * Alpha1 + 2 ) / 5 ) << 24;
+
+      Palette [ 6 ] = 0;
+      Palette [ 7 ] = 0xFF000000;
+   }
+}
+
+static inline ULONGLONG AlphaIndices ( LPBYTE Block ) {
+   return ( ULONGLONG ) Block [ 2 ] |
+      ( ( ULONGLONG ) Block [ 3 ] << 8 )  |
+      ( ( ULONGLONG ) Block [ 4 ] << 16 ) |
+      ( ( ULONGLONG ) Block [ 5 ] << 24 ) |
+      ( ( ULONGLONG ) Block [ 6 ] << 32 ) |
+      ( ( ULONGLONG ) Block [ 7 ] << 40 );
+}
+
+static void DecodeBlockScalar ( LPBYTE Block,
+        BlockCompression Compression, LPBYTE Out, LONG Pitch ) {
+
+   DWORD Palette [ 4 ], Alpha [ 8 ], Bits, Pixel;
+   ULONGLONG AlphaBits = 0;
+   LONG Index;
+
+   if ( Compression == BlockBC3 ) {
+      BuildAlphaPalette ( Block, Alpha );
+
+      AlphaBits = AlphaIndices ( Block );
+
+      Block += 8;
+   }
+
+   BuildColorPalette ( Block, Compression == BlockBC3, Palette );
+
+   Bits = *( DWORD * ) ( Block + 4 );
+
+   for ( Index = 0; Index < 16; Index++ ) {
+      Pixel = Palette [ ( Bits >> ( Index * 2 ) ) & 3 ];
+
+      if ( Compression == BlockBC3 )
+         Pixel = ( Pixel & 0x00FFFFFF ) |
+            Alpha [ ( AlphaBits >> ( Index * 3 ) ) & 7 ];
+
+      ( ( DWORD * ) ( Out + ( Index / 4 ) * Pitch ) ) [ Index % 4 ] =
+         Pixel;
+   }
+}
+
+#ifdef PIXELCONVERT_SSE2
+
+static void DecodeBlockSSE2 ( LPBYTE Block,
+        BlockCompression Compression, LPBYTE Out, LONG Pitch ) {
+
+   DWORD Palette [ 4 ], Alpha [ 8 ], Bits, RowBits;
+   ULONGLONG AlphaBits = 0;
+   LONG Row;
+   __m128i Entry [ 4 ], Index, Pixels, Lanes;
+
+   if ( Compression == BlockBC3 ) {
+      BuildAlphaPalette ( Block, Alpha );
+
+      AlphaBits = AlphaIndices ( Block );
+
+      Block += 8;
+   }
+
+   BuildColorPalette ( Block, Compression == BlockBC3, Palette );
+
+   Bits = *( DWORD * ) ( Block + 4 );
+
+   for ( Row = 0; Row < 4; Row++ )
+      Entry [ Row ] = _mm_set1_epi32 ( Palette [ Row ] );
+
+   // Select each row's colours by comparing its indices
+   // against all four palette entries at once:
+   for ( Row = 0; Row < 4; Row++ ) {
+      RowBits = Bits >> ( Row * 8 );
+
+      Index = _mm_set_epi32 ( ( RowBits >> 6 ) & 3,
+         ( RowBits >> 4 ) & 3, ( RowBits >> 2 ) & 3, RowBits & 3 );
+
+      Pixels = _mm_and_si128 ( _mm_cmpeq_epi32 ( Index,
+         _mm_setzero_si128 () ), Entry [ 0 ] );
+
+      Lanes = _mm_set1_epi32 ( 1 );
+      Pixels = _mm_or_si128 ( Pixels, _mm_and_si128 (
+         _mm_cmpeq_epi32 ( Index, Lanes ), Entry [ 1 ] ) );
+
+      Lanes = _mm_set1_epi32 ( 2 );
+      Pixels = _mm_or_si128 ( Pixels, _mm_and_si128 (
+         _mm_cmpeq_epi32 ( Index, Lanes ), Entry [ 2 ] ) );
+
+      Lanes = _mm_set1_epi32 ( 3 );
+      Pixels = _mm_or_si128 ( Pixels, _mm_and_si128 (
+         _mm_cmpeq_epi32 ( Index, Lanes ), Entry [ 3 ] ) );
+
+      if ( Compression == BlockBC3 ) {
+         RowBits = ( DWORD ) ( AlphaBits >> ( Row * 12 ) );
+
+         Pixels = _mm_or_si128 ( _mm_and_si128 ( Pixels,
+            _mm_set1_epi32 ( 0x00FFFFFF ) ), _mm_set_epi32 (
+            Alpha [ ( RowBits >> 9 ) & 7 ],
+            Alpha [ ( RowBits >> 6 ) & 7 ],
+            Alpha [ ( RowBits >> 3 ) & 7 ],
+            Alpha [ RowBits & 7 ] ) );
+      }
+
+      _mm_storeu_si128 ( ( __m128i * ) ( Out + Row * Pitch ),
+         Pixels );
+   }
+}
+
+#endif
+
+static void EncodeBlock ( BlockJob &Job, LPBYTE Out,
+        LPBYTE Pixels ) {
+
+#ifdef PIXELCONVERT_SSE2
+   if ( Job.UseSIMD ) {
+      if ( Job.Compression == BlockBC3 ) {
+         EncodeAlphaSSE2 ( Out, Pixels, Job.ScratchPitch );
+         EncodeColorSSE2 ( Out + 8, Pixels, Job.ScratchPitch,
+            false );
+      }
+      else EncodeColorSSE2 ( Out, Pixels, Job.ScratchPitch, true );
+
+      return;
+   }
+#endif
+
+   if ( Job.Compression == BlockBC3 ) {
+      EncodeAlphaScalar ( Out, Pixels, Job.ScratchPitch );
+      EncodeColorScalar ( Out + 8, Pixels, Job.ScratchPitch,
+         false );
+   }
+   else EncodeColorScalar ( Out, Pixels, Job.ScratchPitch, true );
+}
+
+static void EncodeRows ( BlockJob &Job, LONG Thread,
+        LONG First, LONG Last ) {
+
+   LPBYTE Scratch, Out;
+   DWORD *Row;
+   LONG BlockY, BlockX, Rows, X, Y;
+   RECT Rect;
+
+   Scratch = Job.Scratch + Thread * Job.ScratchPitch * 4;
+
+   for ( BlockY = First; BlockY < Last; BlockY++ ) {
+      Rows = Job.Height - BlockY * 4;
+
+      if ( Rows > 4 )
+         Rows = 4;
+
+      Rect.left = 0; Rect.right  = Job.Width;
+      Rect.top  = BlockY * 4; Rect.bottom = Rect.top + Rows;
+
+      ConvertPixels ( Scratch, Job.ScratchPitch, Format8888, 0, 0,
+         Job.Image, Job.ImagePitch, Job.Format, Rect );
+
+      // Blocks over the edge repeat the last column and row:
+      for ( Y = 0; Y < Rows; Y++ ) {
+         Row = ( DWORD * ) ( Scratch + Y * Job.ScratchPitch );
+
+         for ( X = Job.Width; X < Job.BlocksAcross * 4; X++ )
+            Row [ X ] = Row [ Job.Width - 1 ];
+      }
+
+      for ( Y = Rows; Y < 4; Y++ )
+         memcpy ( Scratch + Y * Job.ScratchPitch,
+            Scratch + ( Rows - 1 ) * Job.ScratchPitch,
+            Job.ScratchPitch );
+
+      Out = Job.Blocks + BlockY * Job.BlockPitch;
+
+      for ( BlockX = 0; BlockX < Job.BlocksAcross; BlockX++ )
+         EncodeBlock ( Job, Out + BlockX * Job.BlockBytes,
+            Scratch + BlockX * 16 );
+   }
+}
+
+static void DecodeRows ( BlockJob &Job, LONG Thread,
+        LONG First, LONG Last ) {
+
+   LPBYTE Scratch, In;
+   LONG BlockY, BlockX;
+   RECT Rect;
+
+   Scratch = Job.Scratch + Thread * Job.ScratchPitch * 4;
+
+   for ( BlockY = First; BlockY < Last; BlockY++ ) {
+      In = Job.Blocks + BlockY * Job.BlockPitch;
+
+      for ( BlockX = 0; BlockX < Job.BlocksAcross; BlockX++ ) {
+#ifdef PIXELCONVERT_SSE2
+         if ( Job.UseSIMD ) {
+            DecodeBlockSSE2 ( In + BlockX * Job.BlockBytes,
+               Job.Compression, Scratch + BlockX * 16,
+               Job.ScratchPitch );
+
+            continue;
+         }
+#endif
+
+         DecodeBlockScalar ( In + BlockX * Job.BlockBytes,
+            Job.Compression, Scratch + BlockX * 16,
+            Job.ScratchPitch );
+      }
+
+      Rect.left = 0; Rect.right = Job.Width;
+      Rect.top  = 0; Rect.bottom = Job.Height - BlockY * 4;
+
+      if ( Rect.bottom > 4 )
+         Rect.bottom = 4;
+
+      ConvertPixels ( Job.Image, Job.ImagePitch, Job.Format, 0,
+         BlockY * 4, Scratch, Job.ScratchPitch, Format8888, Rect );
+   }
+}
+
+static void EncodeTask ( LONG Task, LONG Thread,
+        LPVOID Context ) {
+
+   BlockJob &Job = *( BlockJob * ) Context;
+   LONG Last = ( Task + 1 ) * Job.RowsPerTask;
+
+   EncodeRows ( Job, Thread, Task * Job.RowsPerTask,
+      Last < Job.BlocksDown ? Last : Job.BlocksDown );
+}
+
+static void DecodeTask ( LONG Task, LONG Thread,
+        LPVOID Context ) {
+
+   BlockJob &Job = *( BlockJob * ) Context;
+   LONG Last = ( Task + 1 ) * Job.RowsPerTask;
+
+   DecodeRows ( Job, Thread, Task * Job.RowsPerTask,
+      Last < Job.BlocksDown ? Last : Job.BlocksDown );
+}
+
+static bool RunBlockJob ( BlockJob &Job, TaskFunction Task,
+        ThreadPool *Pool ) {
+
+   LONG Threads, Tasks;
+   bool Result = true;
+
+   if ( GetFormatBytesPerPixel ( Job.Format ) == 0 ||
+        Job.Format == Format8 || Job.BlockBytes == 0 ||
+        Job.Width <= 0 || Job.Height <= 0 )
+      return false;
+
+   Job.BlocksAcross = ( Job.Width  + 3 ) / 4;
+   Job.BlocksDown   = ( Job.Height + 3 ) / 4;
+   Job.ScratchPitch = Job.BlocksAcross * 16;
+   Job.UseSIMD      = GetConversionPath () != ScalarPath;
+
+   Job.RowsPerTask = BandBytes / ( Job.ScratchPitch * 4 );
+
+   if ( Job.RowsPerTask < 1 )
+      Job.RowsPerTask = 1;
+
+   Tasks = ( Job.BlocksDown + Job.RowsPerTask - 1 ) /
+      Job.RowsPerTask;
+
+   Threads = Pool != NULL && Tasks > 1 ?
+      Pool->GetThreadCount () : 1;
+
+   Job.Scratch = new BYTE [ Threads * Job.ScratchPitch * 4 ];
+
+   if ( Job.Scratch == NULL )
+      return false;
+
+   if ( Threads == 1 ) {
+      for ( LONG Index = 0; Index < Tasks; Index++ )
+         Task ( Index, 0, &Job );
+   }
+   else Result = Pool->Run ( Task, &Job, Tasks );
+
+   delete [] Job.Scratch;
+
+   return Result;
+}
+
+bool EncodeBlocks ( LPVOID Dest, LONG DestPitch,
+        LPVOID Src, LONG SrcPitch, PixelFormat SrcFormat,
+        LONG Width, LONG Height, BlockCompression Compression,
+        ThreadPool *Pool ) {
+
+   BlockJob Job;
+
+   if ( Dest == NULL || Src == NULL )
+      return false;
+
+   Job.Image       = ( LPBYTE ) Src;
+   Job.ImagePitch  = SrcPitch;
+   Job.Blocks      = ( LPBYTE ) Dest;
+   Job.BlockPitch  = DestPitch;
+   Job.Width       = Width;
+   Job.Height      = Height;
+   Job.Format      = SrcFormat;
+   Job.Compression = Compression;
+   Job.BlockBytes  = GetBlockBytes ( Compression );
+
+   return RunBlockJob ( Job, EncodeTask, Pool );
+}
+
+bool DecodeBlocks ( LPVOID Dest, LONG DestPitch,
+        PixelFormat DestFormat, LPVOID Src, LONG SrcPitch,
+        LONG Width, LONG Height, BlockCompression Compression,
+        ThreadPool *Pool ) {
+
+   BlockJob Job;
+
+   if ( Dest == NULL || Src == NULL )
+      return false;
+
+   Job.Image       = ( LPBYTE ) Dest;
+   Job.ImagePitch  = DestPitch;
+   Job.Blocks      = ( LPBYTE ) Src;
+   Job.BlockPitch  = SrcPitch;
+   Job.Width       = Width;
+   Job.Height      = Height;
+   Job.Format      = DestFormat;
+   Job.Compression = Compression;
+   Job.BlockBytes  = GetBlockBytes ( Compression );
+
+   return RunBlockJob ( Job, DecodeTask, Pool );
+}
+
+DWORD SampleBlocks ( LPVOID Src, LONG SrcPitch,
+        BlockCompression Compression, LONG X, LONG Y ) {
+
+   DWORD Palette [ 8 ], Pixel;
+   LPBYTE Block;
+   LONG Index;
+
+   if ( Src == NULL || X < 0 || Y < 0 ||
+        GetBlockBytes ( Compression ) == 0 )
+      return 0;
+
+   Block = ( LPBYTE ) Src + ( Y / 4 ) * SrcPitch +
+      ( X / 4 ) * GetBlockBytes ( Compression );
+
+   Index = ( Y & 3 ) * 4 + ( X & 3 );
+
+   if ( Compression == BlockBC3 ) {
+      BuildColorPalette ( Block + 8, true, Palette );
+
+      Pixel = Palette [ ( *( DWORD * ) ( Block + 12 ) >>
+         ( Index * 2 ) ) & 3 ] & 0x00FFFFFF;
+
+      BuildAlphaPalette ( Block, Palette );
+
+      return Pixel | Palette [ ( AlphaIndices ( Block ) >>
+         ( Index * 3 ) ) & 7 ];
+   }
+
+   BuildColorPalette ( Block, false, Palette );
+
+   return Palette [ ( *( DWORD * ) ( Block + 4 ) >>
+      ( Index * 2 ) ) & 3 ];
+}
+
+static bool TranscodeSurface ( DirectDrawSurface &Dest,
+        DirectDrawSurface &Src, bool Encode, ThreadPool *Pool ) {
+
+   DirectDrawSurface &Plain = Encode ? Src : Dest,
+      &Compressed = Encode ? Dest : Src;
+
+   DDPIXELFORMAT PF;
+   PixelFormat Format;
+   LPVOID PlainMemory, Blocks;
+   LONG Level, Count, PlainPitch, BlockPitch, Width, Height;
+   bool Result;
+
+   if ( Compressed.GetCompression () == BlockNone ||
+        Plain.GetCompression () != BlockNone )
+      return false;
+
+   if ( Plain.GetWidth ()  != Compressed.GetWidth () ||
+        Plain.GetHeight () != Compressed.GetHeight () )
+      return false;
+
+   if ( !Plain.GetSurfaceFormat ( PF ) )
+      return false;
+
+   Format = GetPixelFormat ( PF );
+
+   // Only the levels both surfaces have:
+   Count = Plain.GetMipLevelCount ();
+
+   if ( Compressed.GetMipLevelCount () < Count )
+      Count = Compressed.GetMipLevelCount ();
+
+   for ( Level = 0; Level < Count; Level++ ) {
+      if ( !Plain.StartMipLevelAccess ( Level, &PlainMemory,
+              &PlainPitch ) )
+         return false;
+
+      if ( !Compressed.StartMipLevelAccess ( Level, &Blocks,
+              &BlockPitch ) ) {
+         Plain.EndMipLevelAccess ( Level );
+
+         return false;
+      }
+
+      Width  = Plain.GetMipLevelWidth  ( Level );
+      Height = Plain.GetMipLevelHeight ( Level );
+
+      if ( Encode )
+         Result = EncodeBlocks ( Blocks, BlockPitch, PlainMemory,
+            PlainPitch, Format, Width, Height,
+            Compressed.GetCompression (), Pool );
+      else
+         Result = DecodeBlocks ( PlainMemory, PlainPitch, Format,
+            Blocks, BlockPitch, Width, Height,
+            Compressed.GetCompression (), Pool );
+
+      Compressed.EndMipLevelAccess ( Level );
+      Plain.EndMipLevelAccess ( Level );
+
+      if ( !Result )
+         return false;
+   }
+
+   return true;
+}
+
+bool CompressSurface ( DirectDrawSurface &Dest,
+        DirectDrawSurface &Src, ThreadPool *Pool ) {
+
+   return TranscodeSurface ( Dest, Src, true, Pool );
+}
+
+bool DecompressSurface ( DirectDrawSurface &Dest,
+        DirectDrawSurface &Src, ThreadPool *Pool ) {
+
+   return TranscodeSurface ( Dest, Src, false, Pool );
+}
+
+double MeasureBlockEncodeThroughput (
+        BlockCompression Compression, LONG Width, LONG Height,
+        LONG Repeats, ThreadPool *Pool ) {
+
+   LPBYTE Image, Blocks;
+   LONG X, Y, Repeat, BlockPitch;
+   LARGE_INTEGER Start, Stop, Frequency;
+   DWORD Seed = 12345, Noise;
+   double Seconds;
+
+   if ( Width <= 0 || Height <= 0 || Repeats <= 0 ||
+        GetBlockBytes ( Compression ) == 0 )
+      return 0.0;
+
+   BlockPitch = ( ( Width + 3 ) / 4 ) * GetBlockBytes ( Compression );
+
+   Image  = new BYTE [ Width * Height * 4 ];
+   Blocks = new BYTE [ BlockPitch * ( ( Height + 3 ) / 4 ) ];
+
+   // Smooth gradients with a little noise, which is closer
+   // to real textures than pure noise:
+   for ( Y = 0; Y < Height; Y++ ) {
+      for ( X = 0; X < Width; X++ ) {
+         Seed  = Seed * 1103515245 + 12345;
+         Noise = ( Seed >> 16 ) & 15;
+
+         ( ( DWORD * ) Image ) [ Y * Width + X ] =
+            ( ( ( X * 255 / Width ) ^ Noise ) << 16 ) |
+            ( ( ( Y * 255 / Height ) ^ Noise ) << 8 ) |
+            ( ( ( X + Y ) & 0xFF ) ) |
+            ( ( ( X * Y ) & 0xFF ) << 24 );
+      }
+   }
+
+   EncodeBlocks ( Blocks, BlockPitch, Image, Width * 4, Format8888,
+      Width, Height, Compression, Pool );
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ )
+      EncodeBlocks ( Blocks, BlockPitch, Image, Width * 4,
+         Format8888, Width, Height, Compression, Pool );
+
+   QueryPerformanceCounter ( &Stop );
+
+   delete [] Image;
+   delete [] Blocks;
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return ( double ) Width * Height * Repeats / Seconds / 1e6;
+}
+
+void MeasureTextureSetSavings ( LONG Count, SIZE *Sizes,
+        LONG BPP, BlockCompression Compression,
+        DWORD *Uncompressed, DWORD *Compressed ) {
+
+   LONG Index;
+
+   ( *Uncompressed ) = ( *Compressed ) = 0;
+
+   for ( Index = 0; Index < Count; Index++ ) {
+      ( *Uncompressed ) += GetImageSize ( Sizes [ Index ].cx,
+         Sizes [ Index ].cy, BPP, BlockNone, true );
+      ( *Compressed )   += GetImageSize ( Sizes [ Index ].cx,
+         Sizes [ Index ].cy, BPP, Compression, true );
+   }
+}
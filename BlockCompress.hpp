@@ -0,0 +1,74 @@
+//
+// File name: BlockCompress.hpp
+//
+// Description: BC1 and BC3 (DXT1 and DXT5) block
+//              compression of textures.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __BLOCKCOMPRESSHPP__
+#define __BLOCKCOMPRESSHPP__
+
+#include "PixelConvert.hpp"
+#include "ThreadPool.hpp"
+
+// Every 4x4 block of pixels is stored in BC1Bytes (colour,
+// with 1-bit alpha) or BC3Bytes (colour plus 8-bit
+// alpha). Rows of blocks are Pitch bytes apart:
+enum { BC1Bytes = 8, BC3Bytes = 16 };
+
+LONG GetBlockBytes ( BlockCompression Compression );
+
+// Bytes of one Width x Height image, or of a whole mip
+// chain below it, when stored with Compression (BlockNone
+// uses BPP, rounded up to whole bytes):
+DWORD GetImageSize ( LONG Width, LONG Height, LONG BPP,
+   BlockCompression Compression, bool Mipmaps = false );
+
+// Encode a Width x Height image in any format except
+// Format8. Blocks that cross the right or bottom edge
+// repeat the last column or row. With BC1, pixels whose
+// alpha is below one half become transparent:
+bool EncodeBlocks ( LPVOID Dest, LONG DestPitch,
+   LPVOID Src, LONG SrcPitch, PixelFormat SrcFormat,
+   LONG Width, LONG Height, BlockCompression Compression,
+   ThreadPool *Pool = NULL );
+
+// Decode blocks back to any format except Format8:
+bool DecodeBlocks ( LPVOID Dest, LONG DestPitch,
+   PixelFormat DestFormat, LPVOID Src, LONG SrcPitch,
+   LONG Width, LONG Height, BlockCompression Compression,
+   ThreadPool *Pool = NULL );
+
+// Fetch a single texel as 8888, for software rasterizers
+// that sample compressed textures in place:
+DWORD SampleBlocks ( LPVOID Src, LONG SrcPitch,
+   BlockCompression Compression, LONG X, LONG Y );
+
+// Encode every mip level of an uncompressed texture into a
+// compressed texture of the same size, or the reverse:
+bool CompressSurface ( DirectDrawSurface &Dest,
+   DirectDrawSurface &Src, ThreadPool *Pool = NULL );
+bool DecompressSurface ( DirectDrawSurface &Dest,
+   DirectDrawSurface &Src, ThreadPool *Pool = NULL );
+
+// Encode a Width x Height image Repeats times and return
+// the throughput in megapixels per second:
+double MeasureBlockEncodeThroughput (
+   BlockCompression Compression, LONG Width, LONG Height,
+   LONG Repeats, ThreadPool *Pool = NULL );
+
+// The memory a set of Count mipmapped textures takes with
+// and without Compression:
+void MeasureTextureSetSavings ( LONG Count, SIZE *Sizes,
+   LONG BPP, BlockCompression Compression,
+   DWORD *Uncompressed, DWORD *Compressed );
+
+#endif
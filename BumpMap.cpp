@@ -0,0 +1,428 @@
+//
+// File name: BumpMap.cpp
+//
+// Description: Conversion of height maps and normal maps
+//              into the layouts produced by
+//              SetBumpMapBitDepth.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "BumpMap.hpp"
+
+#ifdef PIXELCONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+// Each task converts a band of rows that writes about
+// this many bytes:
+const LONG BandBytes = 32768;
+
+// Scale is held as 8.8 fixed point. Both kinds of source
+// are multiplied as ( Value << Shift ) * Scale >> 16, which
+// is what the SIMD path's high multiply gives:
+struct BumpJob {
+   LPBYTE Dest, Src, Luminance;
+   LONG   DestPitch, SrcPitch, LuminancePitch, Width, Height,
+          Depth, BytesPerPixel, Scale, RowsPerTask;
+
+   BumpSource Source;
+   bool       Light, Wrap, UseSIMD;
+};
+
+static inline LONG ClampSigned ( LONG Value ) {
+   return Value < -128 ? -128 : ( Value > 127 ? 127 : Value );
+}
+
+static inline void StoreBump ( BumpJob &Job, LPBYTE Pixel,
+        LONG Du, LONG Dv, LONG Luminance ) {
+
+   switch ( Job.Depth ) {
+      case 16:
+         // 5:5:6 keeps the top bits of each value:
+         if ( Job.Light )
+            *( WORD * ) Pixel = ( WORD ) ( ( ( Du >> 3 ) & 0x1F ) |
+               ( ( ( Dv >> 3 ) & 0x1F ) << 5 ) |
+               ( ( Luminance >> 2 ) << 10 ) );
+         else
+            *( WORD * ) Pixel = ( WORD ) ( ( Du & 0xFF ) |
+               ( ( Dv & 0xFF ) << 8 ) );
+      break;
+      case 24:
+         Pixel [ 0 ] = ( BYTE ) Du;
+         Pixel [ 1 ] = ( BYTE ) Dv;
+         Pixel [ 2 ] = ( BYTE ) ( Job.Light ? Luminance : 0 );
+      break;
+      case 32:
+         *( DWORD * ) Pixel = ( Du & 0xFF ) | ( ( Dv & 0xFF ) << 8 ) |
+            ( Job.Light ? Luminance << 16 : 0 );
+      break;
+   }
+}
+
+static LONG EdgeRow ( BumpJob &Job, LONG Y ) {
+   if ( Y < 0 )
+      return Job.Wrap ? Job.Height - 1 : 0;
+
+   if ( Y >= Job.Height )
+      return Job.Wrap ? 0 : Job.Height - 1;
+
+   return Y;
+}
+
+static void ConvertRowScalar ( BumpJob &Job, LONG Y,
+        LONG First, LONG Last ) {
+
+   LPBYTE Row, Above, Below, Dest, Luminance = NULL;
+   DWORD Pixel;
+   LONG X, Left, Right, Du, Dv;
+
+   Row   = Job.Src + Y * Job.SrcPitch;
+   Above = Job.Src + EdgeRow ( Job, Y - 1 ) * Job.SrcPitch;
+   Below = Job.Src + EdgeRow ( Job, Y + 1 ) * Job.SrcPitch;
+   Dest  = Job.Dest + Y * Job.DestPitch;
+
+   if ( Job.Light && Job.Luminance != NULL )
+      Luminance = Job.Luminance + Y * Job.LuminancePitch;
+
+   for ( X = First; X < Last; X++ ) {
+      if ( Job.Source == HeightSource ) {
+         Left  = X - 1;
+         Right = X + 1;
+
+         if ( Left < 0 )
+            Left = Job.Wrap ? Job.Width - 1 : 0;
+
+         if ( Right >= Job.Width )
+            Right = Job.Wrap ? 0 : Job.Width - 1;
+
+         // Central differences, so each slope is half of
+         // the difference:
+         Du = ( ( ( LONG ) Row [ Left ] - Row [ Right ] ) * 128 *
+            Job.Scale ) >> 16;
+         Dv = ( ( ( LONG ) Above [ X ] - Below [ X ] ) * 128 *
+            Job.Scale ) >> 16;
+      }
+      else {
+         Pixel = ( ( DWORD * ) Row ) [ X ];
+
+         Du = ( ( ( LONG ) ( ( Pixel >> 16 ) & 0xFF ) - 128 ) * 256 *
+            Job.Scale ) >> 16;
+         Dv = ( ( ( LONG ) ( ( Pixel >> 8 ) & 0xFF ) - 128 ) * 256 *
+            Job.Scale ) >> 16;
+      }
+
+      StoreBump ( Job, Dest + X * Job.BytesPerPixel,
+         ClampSigned ( Du ), ClampSigned ( Dv ),
+         Luminance != NULL ? Luminance [ X ] : 255 );
+   }
+}
+
+#ifdef PIXELCONVERT_SSE2
+
+// Convert runs of eight pixels from First until fewer than
+// eight are left before Last; returns where it stopped:
+static LONG ConvertRowSSE2 ( BumpJob &Job, LONG Y,
+        LONG First, LONG Last ) {
+
+   LPBYTE Row, Above, Below, Dest, Luminance = NULL;
+   DWORD Packed [ 8 ], *Out;
+   LONG X, Index;
+   __m128i Du, Dv, Lum, Low, High, Pixels0, Pixels1;
+
+   const __m128i Zero     = _mm_setzero_si128 ();
+   const __m128i Scale    = _mm_set1_epi16 ( ( short ) Job.Scale );
+   const __m128i Bias     = _mm_set1_epi16 ( 128 );
+   const __m128i Min      = _mm_set1_epi16 ( -128 );
+   const __m128i Max      = _mm_set1_epi16 ( 127 );
+   const __m128i ByteMask = _mm_set1_epi16 ( 0xFF );
+   const __m128i Mask5    = _mm_set1_epi16 ( 0x1F );
+   const __m128i Full     = _mm_set1_epi16 ( 255 );
+   const __m128i LowByte  = _mm_set1_epi32 ( 0xFF );
+
+   Row   = Job.Src + Y * Job.SrcPitch;
+   Above = Job.Src + EdgeRow ( Job, Y - 1 ) * Job.SrcPitch;
+   Below = Job.Src + EdgeRow ( Job, Y + 1 ) * Job.SrcPitch;
+   Dest  = Job.Dest + Y * Job.DestPitch;
+
+   if ( Job.Light && Job.Luminance != NULL )
+      Luminance = Job.Luminance + Y * Job.LuminancePitch;
+
+   for ( X = First; X + 8 <= Last; X += 8 ) {
+      if ( Job.Source == HeightSource ) {
+         Du = _mm_sub_epi16 (
+            _mm_unpacklo_epi8 ( _mm_loadl_epi64 ( ( __m128i * )
+               ( Row + X - 1 ) ), Zero ),
+            _mm_unpacklo_epi8 ( _mm_loadl_epi64 ( ( __m128i * )
+               ( Row + X + 1 ) ), Zero ) );
+         Dv = _mm_sub_epi16 (
+            _mm_unpacklo_epi8 ( _mm_loadl_epi64 ( ( __m128i * )
+               ( Above + X ) ), Zero ),
+            _mm_unpacklo_epi8 ( _mm_loadl_epi64 ( ( __m128i * )
+               ( Below + X ) ), Zero ) );
+
+         Du = _mm_mulhi_epi16 ( _mm_slli_epi16 ( Du, 7 ), Scale );
+         Dv = _mm_mulhi_epi16 ( _mm_slli_epi16 ( Dv, 7 ), Scale );
+      }
+      else {
+         // Gather red and green of eight pixels into words:
+         Pixels0 = _mm_loadu_si128 ( ( __m128i * ) ( Row + X * 4 ) );
+         Pixels1 = _mm_loadu_si128 ( ( __m128i * ) ( Row + X * 4 +
+            16 ) );
+
+         Du = _mm_packs_epi32 (
+            _mm_and_si128 ( _mm_srli_epi32 ( Pixels0, 16 ), LowByte ),
+            _mm_and_si128 ( _mm_srli_epi32 ( Pixels1, 16 ), LowByte ) );
+         Dv = _mm_packs_epi32 (
+            _mm_and_si128 ( _mm_srli_epi32 ( Pixels0, 8 ), LowByte ),
+            _mm_and_si128 ( _mm_srli_epi32 ( Pixels1, 8 ), LowByte ) );
+
+         Du = _mm_mulhi_epi16 ( _mm_slli_epi16 (
+            _mm_sub_epi16 ( Du, Bias ), 8 ), Scale );
+         Dv = _mm_mulhi_epi16 ( _mm_slli_epi16 (
+            _mm_sub_epi16 ( Dv, Bias ), 8 ), Scale );
+      }
+
+      Du = _mm_min_epi16 ( _mm_max_epi16 ( Du, Min ), Max );
+      Dv = _mm_min_epi16 ( _mm_max_epi16 ( Dv, Min ), Max );
+
+      Lum = Luminance != NULL ? _mm_unpacklo_epi8 ( _mm_loadl_epi64 (
+         ( __m128i * ) ( Luminance + X ) ), Zero ) : Full;
+
+      if ( Job.Depth == 16 ) {
+         if ( Job.Light )
+            Low = _mm_or_si128 ( _mm_or_si128 (
+               _mm_and_si128 ( _mm_srai_epi16 ( Du, 3 ), Mask5 ),
+               _mm_slli_epi16 ( _mm_and_si128 ( _mm_srai_epi16 (
+                  Dv, 3 ), Mask5 ), 5 ) ),
+               _mm_slli_epi16 ( _mm_srli_epi16 ( Lum, 2 ), 10 ) );
+         else
+            Low = _mm_or_si128 ( _mm_and_si128 ( Du, ByteMask ),
+               _mm_slli_epi16 ( Dv, 8 ) );
+
+         _mm_storeu_si128 ( ( __m128i * ) ( Dest + X * 2 ), Low );
+
+         continue;
+      }
+
+      // Du and Dv in the low word of each pixel, and
+      // luminance (or nothing) in the high word:
+      Low  = _mm_or_si128 ( _mm_and_si128 ( Du, ByteMask ),
+         _mm_slli_epi16 ( Dv, 8 ) );
+      High = Job.Light ? Lum : Zero;
+
+      Pixels0 = _mm_unpacklo_epi16 ( Low, High );
+      Pixels1 = _mm_unpackhi_epi16 ( Low, High );
+
+      if ( Job.Depth == 32 ) {
+         _mm_storeu_si128 ( ( __m128i * ) ( Dest + X * 4 ),
+            Pixels0 );
+         _mm_storeu_si128 ( ( __m128i * ) ( Dest + X * 4 + 16 ),
+            Pixels1 );
+      }
+      else {
+         _mm_storeu_si128 ( ( __m128i * ) Packed, Pixels0 );
+         _mm_storeu_si128 ( ( __m128i * ) ( Packed + 4 ), Pixels1 );
+
+         // Every four 24-bit pixels fill three DWORDs:
+         for ( Index = 0; Index < 8; Index += 4 ) {
+            Out = ( DWORD * ) ( Dest + ( X + Index ) * 3 );
+
+            Out [ 0 ] = Packed [ Index ] | ( Packed [ Index + 1 ] << 24 );
+            Out [ 1 ] = ( Packed [ Index + 1 ] >> 8 ) |
+               ( Packed [ Index + 2 ] << 16 );
+            Out [ 2 ] = ( Packed [ Index + 2 ] >> 16 ) |
+               ( Packed [ Index + 3 ] << 8 );
+         }
+      }
+   }
+
+   return X;
+}
+
+#endif
+
+static void ConvertRows ( BumpJob &Job, LONG First,
+        LONG Last ) {
+
+   LONG Y, X;
+
+#ifdef PIXELCONVERT_SSE2
+   LONG Start, End;
+
+   // Height maps read a pixel either side, so the first
+   // and last columns are left to the scalar code:
+   Start = Job.Source == HeightSource ? 1 : 0;
+   End   = Job.Source == HeightSource ? Job.Width - 1 : Job.Width;
+#endif
+
+   for ( Y = First; Y < Last; Y++ ) {
+      X = 0;
+
+#ifdef PIXELCONVERT_SSE2
+      if ( Job.UseSIMD && Start < End ) {
+         ConvertRowScalar ( Job, Y, 0, Start );
+
+         X = ConvertRowSSE2 ( Job, Y, Start, End );
+      }
+#endif
+
+      ConvertRowScalar ( Job, Y, X, Job.Width );
+   }
+}
+
+static void ConvertTask ( LONG Task, LONG,
+        LPVOID Context ) {
+
+   BumpJob &Job = *( BumpJob * ) Context;
+   LONG Last = ( Task + 1 ) * Job.RowsPerTask;
+
+   ConvertRows ( Job, Task * Job.RowsPerTask,
+      Last < Job.Height ? Last : Job.Height );
+}
+
+bool ConvertToBumpMap ( LPVOID Dest, LONG DestPitch,
+        LONG Depth, bool Light, LPVOID Src, LONG SrcPitch,
+        BumpSource Source, LONG Width, LONG Height, float Scale,
+        DWORD Flags, LPBYTE Luminance, LONG LuminancePitch,
+        ThreadPool *Pool ) {
+
+   BumpJob Job;
+   LONG Tasks;
+   float Fixed;
+
+   if ( Dest == NULL || Src == NULL || Width <= 0 || Height <= 0 )
+      return false;
+
+   // 15 and 8 bpp are not bump map layouts (see
+   // SetBumpMapBitDepth):
+   if ( Depth != 16 && Depth != 24 && Depth != 32 )
+      return false;
+
+   Fixed = Scale * 256.0f;
+
+   if ( Fixed >  32767.0f ) Fixed =  32767.0f;
+   if ( Fixed < -32768.0f ) Fixed = -32768.0f;
+
+   Job.Dest           = ( LPBYTE ) Dest;
+   Job.Src            = ( LPBYTE ) Src;
+   Job.Luminance      = Luminance;
+   Job.DestPitch      = DestPitch;
+   Job.SrcPitch       = SrcPitch;
+   Job.LuminancePitch = LuminancePitch;
+   Job.Width          = Width;
+   Job.Height         = Height;
+   Job.Depth          = Depth;
+   Job.BytesPerPixel  = Depth / 8;
+   Job.Scale          = ( LONG ) ( Fixed < 0.0f ? Fixed - 0.5f :
+      Fixed + 0.5f );
+   Job.Source         = Source;
+   Job.Light          = Light;
+   Job.Wrap           = ( Flags & BumpWrap ) != 0;
+   Job.UseSIMD        = GetConversionPath () != ScalarPath;
+
+   Job.RowsPerTask = BandBytes / ( Width * Job.BytesPerPixel );
+
+   if ( Job.RowsPerTask < 1 )
+      Job.RowsPerTask = 1;
+
+   Tasks = ( Height + Job.RowsPerTask - 1 ) / Job.RowsPerTask;
+
+   if ( Pool == NULL || Tasks == 1 ) {
+      ConvertRows ( Job, 0, Height );
+
+      return true;
+   }
+
+   return Pool->Run ( ConvertTask, &Job, Tasks );
+}
+
+bool FillBumpMap ( DirectDrawSurface &Dest, LPVOID Src,
+        LONG SrcPitch, BumpSource Source, float Scale,
+        DWORD Flags, LPBYTE Luminance, LONG LuminancePitch,
+        ThreadPool *Pool ) {
+
+   DDPIXELFORMAT PF;
+   LPVOID Memory;
+   bool Light, Result;
+
+   if ( !Dest.GetSurfaceFormat ( PF ) ||
+        !( PF.dwFlags & DDPF_BUMPDUDV ) )
+      return false;
+
+   // Only the layouts SetBumpMapBitDepth asks for; a driver
+   // may hand back others:
+   Light = ( PF.dwFlags & DDPF_BUMPLUMINANCE ) != 0;
+
+   if ( PF.dwBumpDuBitMask != ( DWORD ) ( Light &&
+        PF.dwBumpBitCount == 16 ? 0x1F : 0xFF ) )
+      return false;
+
+   if ( !Dest.StartAccess ( &Memory ) )
+      return false;
+
+   Result = ConvertToBumpMap ( Memory, Dest.GetPitch (),
+      PF.dwBumpBitCount, Light, Src, SrcPitch, Source,
+      Dest.GetWidth (), Dest.GetHeight (), Scale, Flags,
+      Luminance, LuminancePitch, Pool );
+
+   Dest.EndAccess ();
+
+   return Result;
+}
+
+double MeasureBumpMapThroughput ( LONG Depth, bool Light,
+        BumpSource Source, LONG Size, LONG Repeats,
+        ThreadPool *Pool ) {
+
+   LPBYTE Src, Dest, Luminance;
+   LONG SrcBytes, Repeat, I;
+   LARGE_INTEGER Start, Stop, Frequency;
+   DWORD Seed = 12345;
+   double Seconds;
+
+   if ( Size <= 0 || Repeats <= 0 )
+      return 0.0;
+
+   SrcBytes = Source == HeightSource ? 1 : 4;
+
+   Src       = new BYTE [ Size * Size * SrcBytes ];
+   Dest      = new BYTE [ Size * Size * 4 ];
+   Luminance = new BYTE [ Size * Size ];
+
+   for ( I = 0; I < Size * Size * SrcBytes; I++ ) {
+      Seed = Seed * 1103515245 + 12345;
+      Src [ I ] = ( BYTE ) ( Seed >> 16 );
+   }
+
+   for ( I = 0; I < Size * Size; I++ )
+      Luminance [ I ] = ( BYTE ) I;
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ )
+      ConvertToBumpMap ( Dest, Size * ( Depth / 8 ), Depth, Light,
+         Src, Size * SrcBytes, Source, Size, Size, 1.0f, BumpWrap,
+         Luminance, Size, Pool );
+
+   QueryPerformanceCounter ( &Stop );
+
+   delete [] Src;
+   delete [] Dest;
+   delete [] Luminance;
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return ( double ) Size * Size * Repeats / Seconds / 1e6;
+}
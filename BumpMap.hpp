@@ -0,0 +1,58 @@
+//
+// File name: BumpMap.hpp
+//
+// Description: Conversion of height maps and normal maps
+//              into the layouts produced by
+//              SetBumpMapBitDepth.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __BUMPMAPHPP__
+#define __BUMPMAPHPP__
+
+#include "PixelConvert.hpp"
+#include "ThreadPool.hpp"
+
+// Heights are one byte per pixel; normals are X888 or 8888
+// pixels holding X in red and Y in green, biased by 128:
+enum BumpSource { HeightSource, NormalSource };
+
+// Flags for ConvertToBumpMap. Without BumpWrap, the slopes
+// at the edges of a height map are clamped rather than
+// taken from the opposite edge:
+const DWORD BumpWrap = 0x1;
+
+// Fill a Width x Height bump map of Depth bits (16, 24 or
+// 32) from a source of the same size. Du and Dv are the
+// negated slopes (or the X and Y of the normal) times
+// Scale, where a Scale of 1 maps a slope of one height step
+// per pixel to 1. With Light, luminance comes from the
+// Luminance map, or is full when there is none. With a
+// Pool, bands of rows are converted in parallel:
+bool ConvertToBumpMap ( LPVOID Dest, LONG DestPitch,
+   LONG Depth, bool Light, LPVOID Src, LONG SrcPitch,
+   BumpSource Source, LONG Width, LONG Height, float Scale,
+   DWORD Flags = 0, LPBYTE Luminance = NULL,
+   LONG LuminancePitch = 0, ThreadPool *Pool = NULL );
+
+// The same for a whole BumpMap surface, using the layout
+// the surface was created with:
+bool FillBumpMap ( DirectDrawSurface &Dest, LPVOID Src,
+   LONG SrcPitch, BumpSource Source, float Scale,
+   DWORD Flags = 0, LPBYTE Luminance = NULL,
+   LONG LuminancePitch = 0, ThreadPool *Pool = NULL );
+
+// Convert a Size x Size source Repeats times and return the
+// throughput in megapixels per second:
+double MeasureBumpMapThroughput ( LONG Depth, bool Light,
+   BumpSource Source, LONG Size, LONG Repeats,
+   ThreadPool *Pool = NULL );
+
+#endif
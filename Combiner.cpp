@@ -0,0 +1,909 @@
+//
+// File name: Combiner.cpp
+//
+// Description: A software texture stage that lights a
+//              texture with a light map, optionally
+//              perturbed by a bump map.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include <Math.H>
+
+#include "Combiner.hpp"
+
+#ifdef PIXELCONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+// Each task combines a band of rows covering about this
+// many bytes of 8888 pixels:
+const LONG BandBytes = 32768;
+
+// Bump offsets are limited to this many light map texels:
+const float MaxOffset = 64.0f;
+
+// The two texels a bilinear lookup blends along one axis,
+// and the weight (0 to 255) of the second:
+struct Sample {
+   LONG First, Second, Fraction;
+};
+
+// Every row is worked on in 8888: the texture row, the
+// light under it, the light map rows filtered to the
+// row's height and the bump luminance, in a scratch
+// buffer per thread. Light map coordinates are 16.16
+// texels:
+struct CombineJob {
+   LPBYTE Dest, Base, Light, Bump, Scratch;
+   LONG   DestPitch, BasePitch, LightPitch, BumpPitch, Width,
+          Height, LightWidth, LightHeight, BumpDepth,
+          ScratchPitch, LightOffset, FilteredOffset,
+          LuminanceOffset, RowsPerTask;
+
+   LONG   OriginU, OriginV, StepU, StepV, Matrix [ 4 ];
+
+   Sample *Columns;
+
+   BYTE   LuminanceTable [ 256 ];
+
+   PixelFormat DestFormat, BaseFormat;
+   CombineMode Mode;
+   bool        BumpLight, UseSIMD;
+};
+
+void SetDefaultCombineParams ( CombineParams &Params ) {
+   Params.Mode = CombineModulate;
+
+   Params.Matrix [ 0 ] = 1.0f; Params.Matrix [ 1 ] = 0.0f;
+   Params.Matrix [ 2 ] = 0.0f; Params.Matrix [ 3 ] = 1.0f;
+
+   Params.LuminanceScale  = 1.0f;
+   Params.LuminanceOffset = 0.0f;
+}
+
+static inline void FindSample ( LONG U, LONG Size,
+        Sample &Result ) {
+
+   // Lookups outside the light map clamp to its edge:
+   if ( U <= 0 ) {
+      Result.First = Result.Second = Result.Fraction = 0;
+      return;
+   }
+
+   Result.First = U >> 16;
+
+   if ( Result.First >= Size - 1 ) {
+      Result.First = Result.Second = Size - 1;
+      Result.Fraction = 0;
+      return;
+   }
+
+   Result.Second   = Result.First + 1;
+   Result.Fraction = ( U >> 8 ) & 0xFF;
+}
+
+//
+// Both kernels blend as ( A * ( 256 - F ) + B * F ) >> 8
+// and scale one channel by another as A * B / 255,
+// rounded. Every step fits in 16 bits, so the scalar and
+// SIMD kernels give the same pixels.
+//
+
+static inline DWORD LerpPixel ( DWORD A, DWORD B,
+        LONG Fraction ) {
+
+   DWORD Result = 0;
+   LONG Shift;
+
+   for ( Shift = 0; Shift < 32; Shift += 8 )
+      Result |= ( ( ( ( A >> Shift ) & 0xFF ) * ( 256 - Fraction ) +
+         ( ( B >> Shift ) & 0xFF ) * Fraction ) >> 8 ) << Shift;
+
+   return Result;
+}
+
+static inline DWORD ScaleChannel ( DWORD A, DWORD B ) {
+   DWORD Product = A * B + 128;
+
+   return ( Product + ( Product >> 8 ) ) >> 8;
+}
+
+static inline DWORD LightTexel ( CombineJob &Job, LONG X,
+        LONG Y ) {
+
+   return *( DWORD * ) ( Job.Light + Y * Job.LightPitch + X * 4 );
+}
+
+static void LoadBump ( CombineJob &Job, LPBYTE Pixel,
+        LONG *Du, LONG *Dv, LONG *Luminance ) {
+
+   DWORD Value;
+
+   ( *Luminance ) = 255;
+
+   switch ( Job.BumpDepth ) {
+      case 16:
+         Value = *( WORD * ) Pixel;
+
+         // 5:5:6 holds the top bits of each value:
+         if ( Job.BumpLight ) {
+            ( *Du ) = ( ( ( LONG ) ( Value & 0x1F ) ^ 0x10 ) - 0x10 ) * 8;
+            ( *Dv ) = ( ( ( LONG ) ( ( Value >> 5 ) & 0x1F ) ^ 0x10 ) - 0x10 ) * 8;
+
+            ( *Luminance ) = ( ( Value >> 10 ) << 2 ) | ( Value >> 14 );
+
+            return;
+         }
+      break;
+      case 24:
+         Value = Pixel [ 0 ] | ( Pixel [ 1 ] << 8 ) |
+            ( Pixel [ 2 ] << 16 );
+      break;
+      default:
+         Value = *( DWORD * ) Pixel;
+      break;
+   }
+
+   ( *Du ) = ( signed char ) ( Value & 0xFF );
+   ( *Dv ) = ( signed char ) ( ( Value >> 8 ) & 0xFF );
+
+   if ( Job.BumpLight )
+      ( *Luminance ) = ( Value >> 16 ) & 0xFF;
+}
+
+// The four texels around the perturbed lookup of pixel
+// ( X, Y ), top left first, and its weights:
+static void FindBumpTexels ( CombineJob &Job, LONG X, LONG Y,
+        DWORD *Texels, LONG *FractionU, LONG *FractionV,
+        BYTE *Luminance ) {
+
+   Sample Across, Down;
+   LONG Du, Dv, Lum, U, V;
+
+   LoadBump ( Job, Job.Bump + Y * Job.BumpPitch +
+      X * ( Job.BumpDepth / 8 ), &Du, &Dv, &Lum );
+
+   U = Job.OriginU + X * Job.StepU +
+      ( ( Job.Matrix [ 0 ] * Du + Job.Matrix [ 2 ] * Dv ) >> 7 );
+   V = Job.OriginV + Y * Job.StepV +
+      ( ( Job.Matrix [ 1 ] * Du + Job.Matrix [ 3 ] * Dv ) >> 7 );
+
+   FindSample ( U, Job.LightWidth,  Across );
+   FindSample ( V, Job.LightHeight, Down );
+
+   Texels [ 0 ] = LightTexel ( Job, Across.First,  Down.First );
+   Texels [ 1 ] = LightTexel ( Job, Across.Second, Down.First );
+   Texels [ 2 ] = LightTexel ( Job, Across.First,  Down.Second );
+   Texels [ 3 ] = LightTexel ( Job, Across.Second, Down.Second );
+
+   ( *FractionU ) = Across.Fraction;
+   ( *FractionV ) = Down.Fraction;
+   ( *Luminance ) = Job.LuminanceTable [ Lum ];
+}
+
+static void FilterRowScalar ( DWORD *Dest, DWORD *Row0,
+        DWORD *Row1, LONG Fraction, LONG First, LONG Count ) {
+
+   LONG X;
+
+   for ( X = First; X < Count; X++ )
+      Dest [ X ] = LerpPixel ( Row0 [ X ], Row1 [ X ], Fraction );
+}
+
+static void ExpandRowScalar ( CombineJob &Job, DWORD *Dest,
+        DWORD *Filtered, LONG First ) {
+
+   Sample *Column;
+   LONG X;
+
+   for ( X = First; X < Job.Width; X++ ) {
+      Column = &Job.Columns [ X ];
+
+      Dest [ X ] = LerpPixel ( Filtered [ Column->First ],
+         Filtered [ Column->Second ], Column->Fraction );
+   }
+}
+
+static void BumpRowScalar ( CombineJob &Job, LONG Y,
+        DWORD *Dest, LPBYTE Luminance, LONG First ) {
+
+   DWORD Texels [ 4 ];
+   LONG X, FractionU, FractionV;
+
+   // The same order as the unperturbed lookup: down, then
+   // across:
+   for ( X = First; X < Job.Width; X++ ) {
+      FindBumpTexels ( Job, X, Y, Texels, &FractionU,
+         &FractionV, &Luminance [ X ] );
+
+      Dest [ X ] = LerpPixel (
+         LerpPixel ( Texels [ 0 ], Texels [ 2 ], FractionV ),
+         LerpPixel ( Texels [ 1 ], Texels [ 3 ], FractionV ),
+         FractionU );
+   }
+}
+
+static void ModulateRowScalar ( CombineJob &Job, DWORD *Base,
+        DWORD *Light, LPBYTE Luminance, LONG First ) {
+
+   DWORD Lit, Channel, Texel;
+   LONG X, Shift;
+
+   for ( X = First; X < Job.Width; X++ ) {
+      Lit = Base [ X ] & 0xFF000000;
+
+      for ( Shift = 0; Shift < 24; Shift += 8 ) {
+         Texel = ( Light [ X ] >> Shift ) & 0xFF;
+
+         if ( Luminance != NULL )
+            Texel = ScaleChannel ( Texel, Luminance [ X ] );
+
+         Channel = ScaleChannel ( ( Base [ X ] >> Shift ) & 0xFF,
+            Texel );
+
+         if ( Job.Mode == CombineModulate2X )
+            Channel = Channel > 127 ? 255 : Channel * 2;
+
+         Lit |= Channel << Shift;
+      }
+
+      Base [ X ] = Lit;
+   }
+}
+
+#ifdef PIXELCONVERT_SSE2
+
+// Blend four pixels of A towards B, by a weight from 0 to
+// 255 in each 32-bit lane of Fraction:
+static inline __m128i LerpPixelsSSE2 ( __m128i A, __m128i B,
+        __m128i Fraction ) {
+
+   const __m128i Zero = _mm_setzero_si128 ();
+   const __m128i Full = _mm_set1_epi16 ( 256 );
+
+   __m128i Weights, WeightsLo, WeightsHi, Lo, Hi;
+
+   // Spread each weight over the four channels of its
+   // pixel:
+   Weights   = _mm_or_si128 ( Fraction, _mm_slli_epi32 ( Fraction, 16 ) );
+   WeightsLo = _mm_unpacklo_epi32 ( Weights, Weights );
+   WeightsHi = _mm_unpackhi_epi32 ( Weights, Weights );
+
+   Lo = _mm_add_epi16 (
+      _mm_mullo_epi16 ( _mm_unpacklo_epi8 ( A, Zero ),
+         _mm_sub_epi16 ( Full, WeightsLo ) ),
+      _mm_mullo_epi16 ( _mm_unpacklo_epi8 ( B, Zero ), WeightsLo ) );
+   Hi = _mm_add_epi16 (
+      _mm_mullo_epi16 ( _mm_unpackhi_epi8 ( A, Zero ),
+         _mm_sub_epi16 ( Full, WeightsHi ) ),
+      _mm_mullo_epi16 ( _mm_unpackhi_epi8 ( B, Zero ), WeightsHi ) );
+
+   return _mm_packus_epi16 ( _mm_srli_epi16 ( Lo, 8 ),
+      _mm_srli_epi16 ( Hi, 8 ) );
+}
+
+// A * B / 255, rounded, for eight 16-bit channels:
+static inline __m128i ScaleChannelsSSE2 ( __m128i A, __m128i B ) {
+   __m128i Product = _mm_add_epi16 ( _mm_mullo_epi16 ( A, B ),
+      _mm_set1_epi16 ( 128 ) );
+
+   return _mm_srli_epi16 ( _mm_add_epi16 ( Product,
+      _mm_srli_epi16 ( Product, 8 ) ), 8 );
+}
+
+static LONG FilterRowSSE2 ( DWORD *Dest, DWORD *Row0,
+        DWORD *Row1, LONG Fraction, LONG Count ) {
+
+   __m128i Weight = _mm_set1_epi32 ( Fraction );
+   LONG X;
+
+   for ( X = 0; X + 4 <= Count; X += 4 )
+      _mm_storeu_si128 ( ( __m128i * ) &Dest [ X ],
+         LerpPixelsSSE2 (
+            _mm_loadu_si128 ( ( __m128i * ) &Row0 [ X ] ),
+            _mm_loadu_si128 ( ( __m128i * ) &Row1 [ X ] ),
+            Weight ) );
+
+   return X;
+}
+
+static LONG ExpandRowSSE2 ( CombineJob &Job, DWORD *Dest,
+        DWORD *Filtered ) {
+
+   Sample *Column;
+   LONG X;
+
+   for ( X = 0; X + 4 <= Job.Width; X += 4 ) {
+      Column = &Job.Columns [ X ];
+
+      _mm_storeu_si128 ( ( __m128i * ) &Dest [ X ],
+         LerpPixelsSSE2 (
+            _mm_set_epi32 ( Filtered [ Column [ 3 ].First ],
+               Filtered [ Column [ 2 ].First ],
+               Filtered [ Column [ 1 ].First ],
+               Filtered [ Column [ 0 ].First ] ),
+            _mm_set_epi32 ( Filtered [ Column [ 3 ].Second ],
+               Filtered [ Column [ 2 ].Second ],
+               Filtered [ Column [ 1 ].Second ],
+               Filtered [ Column [ 0 ].Second ] ),
+            _mm_set_epi32 ( Column [ 3 ].Fraction,
+               Column [ 2 ].Fraction, Column [ 1 ].Fraction,
+               Column [ 0 ].Fraction ) ) );
+   }
+
+   return X;
+}
+
+static LONG BumpRowSSE2 ( CombineJob &Job, LONG Y,
+        DWORD *Dest, LPBYTE Luminance ) {
+
+   // Texels [ Corner ] [ Pixel ], so each corner of four
+   // pixels loads as one vector:
+   DWORD Texels [ 4 ] [ 4 ], Corners [ 4 ];
+   LONG  FractionU [ 4 ], FractionV [ 4 ];
+
+   __m128i Weight;
+   LONG X, Pixel;
+
+   for ( X = 0; X + 4 <= Job.Width; X += 4 ) {
+      // The lookups are gathers, so they stay scalar:
+      for ( Pixel = 0; Pixel < 4; Pixel++ ) {
+         FindBumpTexels ( Job, X + Pixel, Y, Corners,
+            &FractionU [ Pixel ], &FractionV [ Pixel ],
+            &Luminance [ X + Pixel ] );
+
+         Texels [ 0 ] [ Pixel ] = Corners [ 0 ];
+         Texels [ 1 ] [ Pixel ] = Corners [ 1 ];
+         Texels [ 2 ] [ Pixel ] = Corners [ 2 ];
+         Texels [ 3 ] [ Pixel ] = Corners [ 3 ];
+      }
+
+      Weight = _mm_loadu_si128 ( ( __m128i * ) FractionV );
+
+      _mm_storeu_si128 ( ( __m128i * ) &Dest [ X ],
+         LerpPixelsSSE2 (
+            LerpPixelsSSE2 (
+               _mm_loadu_si128 ( ( __m128i * ) Texels [ 0 ] ),
+               _mm_loadu_si128 ( ( __m128i * ) Texels [ 2 ] ), Weight ),
+            LerpPixelsSSE2 (
+               _mm_loadu_si128 ( ( __m128i * ) Texels [ 1 ] ),
+               _mm_loadu_si128 ( ( __m128i * ) Texels [ 3 ] ), Weight ),
+            _mm_loadu_si128 ( ( __m128i * ) FractionU ) ) );
+   }
+
+   return X;
+}
+
+static LONG ModulateRowSSE2 ( CombineJob &Job, DWORD *Base,
+        DWORD *Light, LPBYTE Luminance ) {
+
+   const __m128i Zero      = _mm_setzero_si128 ();
+   const __m128i AlphaMask = _mm_set1_epi32 ( 0xFF000000 );
+
+   __m128i Texture, Lit, Lum, LumLo, LumHi, Lo, Hi;
+   LONG X;
+
+   for ( X = 0; X + 4 <= Job.Width; X += 4 ) {
+      Texture = _mm_loadu_si128 ( ( __m128i * ) &Base  [ X ] );
+      Lit     = _mm_loadu_si128 ( ( __m128i * ) &Light [ X ] );
+
+      Lo = _mm_unpacklo_epi8 ( Lit, Zero );
+      Hi = _mm_unpackhi_epi8 ( Lit, Zero );
+
+      if ( Luminance != NULL ) {
+         // One luminance byte per pixel, spread over its
+         // four channels:
+         Lum = _mm_unpacklo_epi8 ( _mm_cvtsi32_si128 (
+            *( int * ) &Luminance [ X ] ), Zero );
+         Lum = _mm_unpacklo_epi16 ( Lum, Lum );
+
+         LumLo = _mm_unpacklo_epi32 ( Lum, Lum );
+         LumHi = _mm_unpackhi_epi32 ( Lum, Lum );
+
+         Lo = ScaleChannelsSSE2 ( Lo, LumLo );
+         Hi = ScaleChannelsSSE2 ( Hi, LumHi );
+      }
+
+      Lo = ScaleChannelsSSE2 ( Lo, _mm_unpacklo_epi8 ( Texture, Zero ) );
+      Hi = ScaleChannelsSSE2 ( Hi, _mm_unpackhi_epi8 ( Texture, Zero ) );
+
+      Lit = _mm_packus_epi16 ( Lo, Hi );
+
+      if ( Job.Mode == CombineModulate2X )
+         Lit = _mm_adds_epu8 ( Lit, Lit );
+
+      _mm_storeu_si128 ( ( __m128i * ) &Base [ X ],
+         _mm_or_si128 ( _mm_andnot_si128 ( AlphaMask, Lit ),
+            _mm_and_si128 ( AlphaMask, Texture ) ) );
+   }
+
+   return X;
+}
+
+#endif
+
+static void CombineRow ( CombineJob &Job, LONG Thread,
+        LONG Y ) {
+
+   DWORD *Base, *Light, *Filtered, *Row0, *Row1;
+   LPBYTE Scratch, Luminance = NULL;
+   Sample Down;
+   LONG First;
+   RECT Rect;
+
+   Scratch  = Job.Scratch + Thread * Job.ScratchPitch;
+   Base     = ( DWORD * ) Scratch;
+   Light    = ( DWORD * ) ( Scratch + Job.LightOffset );
+   Filtered = ( DWORD * ) ( Scratch + Job.FilteredOffset );
+
+   Rect.left = 0; Rect.right  = Job.Width;
+   Rect.top  = Y; Rect.bottom = Y + 1;
+
+   ConvertPixels ( Base, Job.Width * 4, Format8888, 0, 0,
+      Job.Base, Job.BasePitch, Job.BaseFormat, Rect );
+
+   if ( Job.Bump != NULL ) {
+      // The lookups always store a luminance, but it only
+      // scales the light when the bump map has one:
+      if ( Job.BumpLight )
+         Luminance = Scratch + Job.LuminanceOffset;
+
+      First = 0;
+
+#ifdef PIXELCONVERT_SSE2
+      if ( Job.UseSIMD )
+         First = BumpRowSSE2 ( Job, Y, Light,
+            Scratch + Job.LuminanceOffset );
+#endif
+
+      BumpRowScalar ( Job, Y, Light,
+         Scratch + Job.LuminanceOffset, First );
+   }
+   else {
+      // Filter the two light map rows around this row to
+      // its height, then across to the texture's width:
+      FindSample ( Job.OriginV + Y * Job.StepV, Job.LightHeight,
+         Down );
+
+      Row0 = ( DWORD * ) ( Job.Light + Down.First  * Job.LightPitch );
+      Row1 = ( DWORD * ) ( Job.Light + Down.Second * Job.LightPitch );
+
+      if ( Down.Fraction != 0 ) {
+         First = 0;
+
+#ifdef PIXELCONVERT_SSE2
+         if ( Job.UseSIMD )
+            First = FilterRowSSE2 ( Filtered, Row0, Row1,
+               Down.Fraction, Job.LightWidth );
+#endif
+
+         FilterRowScalar ( Filtered, Row0, Row1, Down.Fraction,
+            First, Job.LightWidth );
+
+         Row0 = Filtered;
+      }
+
+      First = 0;
+
+#ifdef PIXELCONVERT_SSE2
+      if ( Job.UseSIMD )
+         First = ExpandRowSSE2 ( Job, Light, Row0 );
+#endif
+
+      ExpandRowScalar ( Job, Light, Row0, First );
+   }
+
+   First = 0;
+
+#ifdef PIXELCONVERT_SSE2
+   if ( Job.UseSIMD )
+      First = ModulateRowSSE2 ( Job, Base, Light, Luminance );
+#endif
+
+   ModulateRowScalar ( Job, Base, Light, Luminance, First );
+
+   Rect.top = 0; Rect.bottom = 1;
+
+   ConvertPixels ( Job.Dest, Job.DestPitch, Job.DestFormat, 0, Y,
+      Base, Job.Width * 4, Format8888, Rect );
+}
+
+static void CombineTask ( LONG Task, LONG Thread,
+        LPVOID Context ) {
+
+   CombineJob &Job = *( CombineJob * ) Context;
+   LONG Y, Last = ( Task + 1 ) * Job.RowsPerTask;
+
+   if ( Last > Job.Height )
+      Last = Job.Height;
+
+   for ( Y = Task * Job.RowsPerTask; Y < Last; Y++ )
+      CombineRow ( Job, Thread, Y );
+}
+
+static inline LONG AlignScratch ( LONG Bytes ) {
+   return ( Bytes + 15 ) & ~15;
+}
+
+static bool IsCombineFormat ( PixelFormat Format ) {
+   return Format != Format8 &&
+      GetFormatBytesPerPixel ( Format ) != 0;
+}
+
+bool CombineLightMap ( LPVOID Dest, LONG DestPitch,
+        PixelFormat DestFormat, LPVOID Base, LONG BasePitch,
+        PixelFormat BaseFormat, LONG Width, LONG Height,
+        LPVOID Light, LONG LightPitch, PixelFormat LightFormat,
+        LONG LightWidth, LONG LightHeight, CombineParams &Params,
+        LPVOID Bump, LONG BumpPitch, LONG BumpDepth,
+        bool BumpLight, ThreadPool *Pool ) {
+
+   CombineJob Job;
+   LPBYTE Converted = NULL;
+   LONG Index, Threads, Tasks, Value;
+   float Offset;
+   RECT Rect;
+   bool Result = true;
+
+   if ( Dest == NULL || Base == NULL || Light == NULL ||
+        Width <= 0 || Height <= 0 ||
+        LightWidth <= 0 || LightHeight <= 0 ||
+        !IsCombineFormat ( DestFormat ) ||
+        !IsCombineFormat ( BaseFormat ) ||
+        !IsCombineFormat ( LightFormat ) )
+      return false;
+
+   if ( Bump != NULL && BumpDepth != 16 && BumpDepth != 24 &&
+        BumpDepth != 32 )
+      return false;
+
+   Job.Dest        = ( LPBYTE ) Dest;
+   Job.DestPitch   = DestPitch;
+   Job.DestFormat  = DestFormat;
+   Job.Base        = ( LPBYTE ) Base;
+   Job.BasePitch   = BasePitch;
+   Job.BaseFormat  = BaseFormat;
+   Job.Width       = Width;
+   Job.Height      = Height;
+   Job.LightWidth  = LightWidth;
+   Job.LightHeight = LightHeight;
+   Job.Bump        = ( LPBYTE ) Bump;
+   Job.BumpPitch   = BumpPitch;
+   Job.BumpDepth   = BumpDepth;
+   Job.BumpLight   = Bump != NULL && BumpLight;
+   Job.Mode        = Params.Mode;
+   Job.UseSIMD     = GetConversionPath () != ScalarPath;
+
+   // The light map is read as 8888. It is usually much
+   // smaller than the texture, so it is converted whole;
+   // 32-bit maps are used where they are (the fourth byte
+   // is never looked at):
+   if ( LightFormat == FormatX888 || LightFormat == Format8888 ) {
+      Job.Light      = ( LPBYTE ) Light;
+      Job.LightPitch = LightPitch;
+   }
+   else {
+      Converted = new BYTE [ LightWidth * LightHeight * 4 ];
+
+      if ( Converted == NULL )
+         return false;
+
+      Rect.left = 0; Rect.right  = LightWidth;
+      Rect.top  = 0; Rect.bottom = LightHeight;
+
+      ConvertPixels ( Converted, LightWidth * 4, Format8888, 0, 0,
+         Light, LightPitch, LightFormat, Rect );
+
+      Job.Light      = Converted;
+      Job.LightPitch = LightWidth * 4;
+   }
+
+   // Texel centres of the light map are spread evenly over
+   // the texture:
+   Job.StepU   = ( LONG ) ( ( ( LONGLONG ) LightWidth  << 16 ) / Width );
+   Job.StepV   = ( LONG ) ( ( ( LONGLONG ) LightHeight << 16 ) / Height );
+   Job.OriginU = Job.StepU / 2 - 0x8000;
+   Job.OriginV = Job.StepV / 2 - 0x8000;
+
+   for ( Index = 0; Index < 4; Index++ ) {
+      Offset = Params.Matrix [ Index ];
+
+      if ( Offset >  MaxOffset ) Offset =  MaxOffset;
+      if ( Offset < -MaxOffset ) Offset = -MaxOffset;
+
+      Job.Matrix [ Index ] = ( LONG ) floor ( Offset * 65536.0f + 0.5f );
+   }
+
+   for ( Index = 0; Index < 256; Index++ ) {
+      Value = ( LONG ) floor ( ( Index / 255.0f * Params.LuminanceScale +
+         Params.LuminanceOffset ) * 255.0f + 0.5f );
+
+      Job.LuminanceTable [ Index ] = ( BYTE ) ( Value < 0 ? 0 :
+         ( Value > 255 ? 255 : Value ) );
+   }
+
+   // Unperturbed lookups filter the same columns on every
+   // row:
+   Job.Columns = new Sample [ Width ];
+
+   if ( Job.Columns == NULL ) {
+      delete [] Converted;
+      return false;
+   }
+
+   for ( Index = 0; Index < Width; Index++ )
+      FindSample ( Job.OriginU + Index * Job.StepU, LightWidth,
+         Job.Columns [ Index ] );
+
+   Job.LightOffset     = AlignScratch ( Width * 4 );
+   Job.FilteredOffset  = Job.LightOffset + AlignScratch ( Width * 4 );
+   Job.LuminanceOffset = Job.FilteredOffset +
+      AlignScratch ( LightWidth * 4 );
+   Job.ScratchPitch    = Job.LuminanceOffset + AlignScratch ( Width );
+
+   Job.RowsPerTask = BandBytes / ( Width * 4 );
+
+   if ( Job.RowsPerTask < 1 )
+      Job.RowsPerTask = 1;
+
+   Tasks = ( Height + Job.RowsPerTask - 1 ) / Job.RowsPerTask;
+
+   Threads = Pool != NULL && Tasks > 1 ?
+      Pool->GetThreadCount () : 1;
+
+   Job.Scratch = new BYTE [ Threads * Job.ScratchPitch ];
+
+   if ( Job.Scratch != NULL ) {
+      if ( Threads == 1 ) {
+         for ( Index = 0; Index < Tasks; Index++ )
+            CombineTask ( Index, 0, &Job );
+      }
+      else Result = Pool->Run ( CombineTask, &Job, Tasks );
+   }
+   else Result = false;
+
+   delete [] Job.Scratch;
+   delete [] Job.Columns;
+   delete [] Converted;
+
+   return Result;
+}
+
+LightMapCombiner::LightMapCombiner () {
+   Base = Light = Bump = NULL;
+
+   SetDefaultCombineParams ( Params );
+
+   BaseChanges = LightChanges = BumpChanges = ResultChanges = 0;
+
+   Combined = false;
+
+   ZeroMemory ( &Stats, sizeof ( CombineStats ) );
+}
+
+bool LightMapCombiner::SetInputs ( DirectDrawSurface &Base,
+        DirectDrawSurface &Light, DirectDrawSurface *Bump ) {
+
+   this->Base  = &Base;
+   this->Light = &Light;
+   this->Bump  = Bump;
+
+   Combined = false;
+
+   return true;
+}
+
+void LightMapCombiner::SetParams ( CombineParams &Params ) {
+   this->Params = Params;
+
+   Combined = false;
+}
+
+bool LightMapCombiner::CreateResult ( DirectDrawManager &Manager,
+        LONG BPP, bool Alpha ) {
+
+   if ( Base == NULL )
+      return false;
+
+   if ( !Result.SetSurfaceType ( DirectDrawSurface::Texture ) ||
+        !Result.SetGeneralOptions ( Base->GetWidth (),
+           Base->GetHeight (), BPP ) ||
+        !Result.SetTextureOptions ( Alpha ) )
+      return false;
+
+   Combined = false;
+
+   return Manager.CreateSurface ( Result );
+}
+
+bool LightMapCombiner::IsCurrent () {
+   // Always ask, so a loss is only acted on once:
+   bool Lost = Result.NeedsRepainting ();
+
+   if ( Lost || !Combined )
+      return false;
+
+   return Base->GetChangeCount ()  == BaseChanges  &&
+          Light->GetChangeCount () == LightChanges &&
+          ( Bump == NULL || Bump->GetChangeCount () == BumpChanges ) &&
+          Result.GetChangeCount () == ResultChanges;
+}
+
+bool LightMapCombiner::Combine ( ThreadPool *Pool ) {
+   DDPIXELFORMAT DestPF, BasePF, LightPF, BumpPF;
+   LPVOID Dest, BaseMemory, LightMemory, BumpMemory = NULL;
+   LONG BumpDepth = 0;
+   bool BumpLight = false, Succeeded;
+
+   if ( Base == NULL || Light == NULL ||
+        !Result.GetSurfaceFormat ( DestPF ) ||
+        !Base->GetSurfaceFormat ( BasePF ) ||
+        !Light->GetSurfaceFormat ( LightPF ) )
+      return false;
+
+   if ( Base->GetWidth ()  != Result.GetWidth () ||
+        Base->GetHeight () != Result.GetHeight () )
+      return false;
+
+   if ( Bump != NULL ) {
+      if ( !Bump->GetSurfaceFormat ( BumpPF ) ||
+           !( BumpPF.dwFlags & DDPF_BUMPDUDV ) ||
+           Bump->GetWidth ()  != Base->GetWidth () ||
+           Bump->GetHeight () != Base->GetHeight () )
+         return false;
+
+      BumpDepth = BumpPF.dwBumpBitCount;
+      BumpLight = ( BumpPF.dwFlags & DDPF_BUMPLUMINANCE ) != 0;
+
+      // Only the layouts SetBumpMapBitDepth asks for:
+      if ( BumpPF.dwBumpDuBitMask != ( DWORD ) ( BumpLight &&
+           BumpDepth == 16 ? 0x1F : 0xFF ) )
+         return false;
+   }
+
+   if ( !Base->StartReadAccess ( &BaseMemory ) )
+      return false;
+
+   if ( !Light->StartReadAccess ( &LightMemory ) ) {
+      Base->EndAccess ();
+      return false;
+   }
+
+   if ( Bump != NULL && !Bump->StartReadAccess ( &BumpMemory ) ) {
+      Light->EndAccess ();
+      Base->EndAccess ();
+      return false;
+   }
+
+   if ( !Result.StartAccess ( &Dest ) ) {
+      if ( Bump != NULL )
+         Bump->EndAccess ();
+
+      Light->EndAccess ();
+      Base->EndAccess ();
+      return false;
+   }
+
+   Succeeded = CombineLightMap ( Dest, Result.GetPitch (),
+      GetPixelFormat ( DestPF ), BaseMemory, Base->GetPitch (),
+      GetPixelFormat ( BasePF ), Base->GetWidth (),
+      Base->GetHeight (), LightMemory, Light->GetPitch (),
+      GetPixelFormat ( LightPF ), Light->GetWidth (),
+      Light->GetHeight (), Params, BumpMemory, Bump != NULL ?
+      Bump->GetPitch () : 0, BumpDepth, BumpLight, Pool );
+
+   Result.EndAccess ();
+
+   if ( Bump != NULL )
+      Bump->EndAccess ();
+
+   Light->EndAccess ();
+   Base->EndAccess ();
+
+   if ( Succeeded && Result.GetMipLevelCount () > 1 )
+      Succeeded = Result.GenerateMipmaps ( MipBox, Pool );
+
+   if ( !Succeeded )
+      return false;
+
+   // The inputs were only read, so their counts are as
+   // they were when combining started. The result was just
+   // painted, even if a lock restored it:
+   Result.NeedsRepainting ();
+
+   BaseChanges   = Base->GetChangeCount ();
+   LightChanges  = Light->GetChangeCount ();
+   BumpChanges   = Bump != NULL ? Bump->GetChangeCount () : 0;
+   ResultChanges = Result.GetChangeCount ();
+
+   Combined = true;
+
+   return true;
+}
+
+DirectDrawSurface *LightMapCombiner::GetResult ( ThreadPool *Pool ) {
+   if ( Base == NULL || Light == NULL )
+      return NULL;
+
+   if ( IsCurrent () ) {
+      Stats.CacheHits++;
+
+      return &Result;
+   }
+
+   if ( !Combine ( Pool ) )
+      return NULL;
+
+   Stats.Combines++;
+
+   return &Result;
+}
+
+void LightMapCombiner::GetStats ( CombineStats &Statistics ) {
+   Statistics = Stats;
+}
+
+double MeasureCombineThroughput ( bool Bump, LONG Size,
+        LONG Repeats, ThreadPool *Pool ) {
+
+   CombineParams Params;
+   LPBYTE Base, Light, BumpMap, Dest;
+   LONG LightSize, Repeat, I;
+   LARGE_INTEGER Start, Stop, Frequency;
+   DWORD Seed = 12345;
+   double Seconds;
+
+   if ( Size <= 0 || Repeats <= 0 )
+      return 0.0;
+
+   LightSize = Size / 4 > 0 ? Size / 4 : 1;
+
+   Base    = new BYTE [ Size * Size * 4 ];
+   BumpMap = new BYTE [ Size * Size * 4 ];
+   Dest    = new BYTE [ Size * Size * 4 ];
+   Light   = new BYTE [ LightSize * LightSize * 3 ];
+
+   for ( I = 0; I < Size * Size * 4; I++ ) {
+      Seed = Seed * 1103515245 + 12345;
+      Base [ I ]    = ( BYTE ) ( Seed >> 16 );
+      BumpMap [ I ] = ( BYTE ) ( Seed >> 8 );
+   }
+
+   for ( I = 0; I < LightSize * LightSize * 3; I++ )
+      Light [ I ] = ( BYTE ) I;
+
+   SetDefaultCombineParams ( Params );
+
+   Params.Matrix [ 0 ] = Params.Matrix [ 3 ] = 2.0f;
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ )
+      CombineLightMap ( Dest, Size * 4, Format8888, Base, Size * 4,
+         Format8888, Size, Size, Light, LightSize * 3, Format888,
+         LightSize, LightSize, Params, Bump ? BumpMap : NULL,
+         Size * 4, 32, true, Pool );
+
+   QueryPerformanceCounter ( &Stop );
+
+   delete [] Base;
+   delete [] BumpMap;
+   delete [] Dest;
+   delete [] Light;
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return ( double ) Size * Size * Repeats / Seconds / 1e6;
+}
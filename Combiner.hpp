@@ -0,0 +1,116 @@
+//
+// File name: Combiner.hpp
+//
+// Description: A software texture stage that lights a
+//              texture with a light map, optionally
+//              perturbed by a bump map.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __COMBINERHPP__
+#define __COMBINERHPP__
+
+#include "PixelConvert.hpp"
+#include "ThreadPool.hpp"
+
+// How the texture and the light are combined. Alpha always
+// comes from the texture:
+enum CombineMode { CombineModulate, CombineModulate2X };
+
+// The bump map offsets each light map lookup by Matrix
+// times ( Du, Dv ), in light map texels, with Du and Dv
+// running from -1 to 1 (-128 to 127 in the map). Matrix
+// [ 0 ] and [ 1 ] are the offsets across and down for Du,
+// [ 2 ] and [ 3 ] those for Dv. Bump luminance L (0 to 1)
+// scales the light by L * LuminanceScale +
+// LuminanceOffset, clamped to 0 to 1:
+struct CombineParams {
+   CombineMode Mode;
+
+   float Matrix [ 4 ], LuminanceScale, LuminanceOffset;
+};
+
+struct CombineStats {
+   DWORD Combines, CacheHits;
+};
+
+void SetDefaultCombineParams ( CombineParams &Params );
+
+// Light a Width x Height texture into Dest. The light map
+// may be any size and is sampled bilinearly, its texel
+// centres spread evenly over the texture and clamped at
+// the edges. The bump map, when there is one, is the size
+// of the texture and in a layout SetBumpMapBitDepth gives.
+// No format may be Format8. With a Pool, bands of rows are
+// combined in parallel:
+bool CombineLightMap ( LPVOID Dest, LONG DestPitch,
+   PixelFormat DestFormat, LPVOID Base, LONG BasePitch,
+   PixelFormat BaseFormat, LONG Width, LONG Height,
+   LPVOID Light, LONG LightPitch, PixelFormat LightFormat,
+   LONG LightWidth, LONG LightHeight, CombineParams &Params,
+   LPVOID Bump = NULL, LONG BumpPitch = 0, LONG BumpDepth = 0,
+   bool BumpLight = false, ThreadPool *Pool = NULL );
+
+// Keeps the lit texture of an uncompressed Texture, a
+// LightMap and an optional BumpMap, and combines them
+// again only when one of them was drawn to, the
+// parameters changed or the result was lost. The inputs
+// are not owned and must outlive the combiner:
+class LightMapCombiner {
+   protected:
+      DirectDrawSurface *Base, *Light, *Bump;
+      DirectDrawSurface Result;
+
+      CombineParams Params;
+
+      // The change counts when the result was combined:
+      DWORD BaseChanges, LightChanges, BumpChanges,
+            ResultChanges;
+
+      bool Combined;
+
+      CombineStats Stats;
+
+      bool IsCurrent ();
+      bool Combine ( ThreadPool *Pool );
+
+   public:
+      LightMapCombiner ();
+
+      bool SetInputs ( DirectDrawSurface &Base,
+         DirectDrawSurface &Light,
+         DirectDrawSurface *Bump = NULL );
+
+      void SetParams ( CombineParams &Params );
+      void GetParams ( CombineParams &Params ) { Params = this->Params; }
+
+      // Create the Texture the result is kept in, the size
+      // of the base texture; BPP and Alpha are as for
+      // SetColorBitDepth. Can only be done once:
+      bool CreateResult ( DirectDrawManager &Manager,
+         LONG BPP, bool Alpha );
+
+      // The lit texture, combined again (with its mip
+      // levels) first if it is out of date:
+      DirectDrawSurface *GetResult ( ThreadPool *Pool = NULL );
+
+      // Force the next GetResult to combine:
+      void Invalidate () { Combined = false; }
+
+      void GetStats ( CombineStats &Statistics );
+};
+
+// Combine a Size x Size texture with a light map a quarter
+// as wide and high Repeats times and return the throughput
+// in megapixels per second:
+double MeasureCombineThroughput ( bool Bump, LONG Size,
+   LONG Repeats, ThreadPool *Pool = NULL );
+
+#endif
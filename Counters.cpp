@@ -0,0 +1,339 @@
+//
+// File name: Counters.cpp
+//
+// Description: Counts and timings of surface operations,
+//              kept per thread and per surface and merged
+//              into per frame totals by every present.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "Counters.hpp"
+
+static const char *CounterNames [ CounterOperations ] = {
+   "Lock", "Blit", "ClearColor", "ClearDepth", "Flip",
+   "LossCheck", "Restore", "Create", "CreateAttempt"
+};
+
+const char *GetCounterName ( CounterOperation Operation ) {
+   if ( Operation < 0 || Operation >= CounterOperations )
+      return NULL;
+
+   return CounterNames [ Operation ];
+}
+
+void SubtractCounters ( RawCounters &Result, RawCounters &From,
+        RawCounters &Less ) {
+
+   LONG Operation;
+
+   for ( Operation = 0; Operation < CounterOperations; Operation++ ) {
+      Result.Count  [ Operation ] = From.Count  [ Operation ] -
+         Less.Count  [ Operation ];
+      Result.Amount [ Operation ] = From.Amount [ Operation ] -
+         Less.Amount [ Operation ];
+      Result.Ticks  [ Operation ] = From.Ticks  [ Operation ] -
+         Less.Ticks  [ Operation ];
+   }
+}
+
+void ConvertCounters ( RawCounters &Raw,
+        OperationCounters &Counters ) {
+
+   LARGE_INTEGER Frequency;
+   LONG Operation;
+
+   QueryPerformanceFrequency ( &Frequency );
+
+   for ( Operation = 0; Operation < CounterOperations; Operation++ ) {
+      Counters.Count  [ Operation ] = Raw.Count  [ Operation ];
+      Counters.Amount [ Operation ] = Raw.Amount [ Operation ];
+
+      Counters.Milliseconds [ Operation ] =
+         ( double ) Raw.Ticks [ Operation ] * 1000.0 /
+         ( double ) Frequency.QuadPart;
+   }
+}
+
+#ifdef DIRECTDRAW_COUNTERS
+
+// Each thread counts into a block of its own, found
+// through a TLS slot, so counting takes no locks. Blocks
+// are kept after their thread ends, so what it counted
+// stays in the totals. Sequence is odd while the owner is
+// writing, so a reader can tell a copy it took halfway
+// through an update (a 64-bit sum is two writes on x86).
+// The starts of the locks the thread holds are only read
+// by the thread itself:
+enum { MaxTimedLocks = 16 };
+
+struct CounterBlock {
+   RawCounters Counters;
+
+   volatile LONG Sequence;
+
+   LONGLONG LockStarts [ MaxTimedLocks ];
+   LONG     LockDepth;
+
+   CounterBlock *Next;
+};
+
+static volatile LONG TlsSlot = ( LONG ) TLS_OUT_OF_INDEXES;
+
+static CounterBlock *volatile Blocks = NULL;
+
+static volatile LONG BlockCount, Merging;
+
+// The sum of every block when the last frame ended, and
+// what that frame added to it:
+static RawCounters Merged, LastFrame;
+
+static DWORD    Frames;
+static LONGLONG FrameStart, FrameTicks;
+
+static CounterBlock *ThreadBlock () {
+   CounterBlock *Block, *Head;
+   DWORD Slot;
+
+   if ( TlsSlot == ( LONG ) TLS_OUT_OF_INDEXES ) {
+      Slot = TlsAlloc ();
+
+      // Another thread may have got there first:
+      if ( InterlockedCompareExchange ( &TlsSlot, ( LONG ) Slot,
+              ( LONG ) TLS_OUT_OF_INDEXES ) !=
+           ( LONG ) TLS_OUT_OF_INDEXES )
+         TlsFree ( Slot );
+   }
+
+   Block = ( CounterBlock * ) TlsGetValue ( ( DWORD ) TlsSlot );
+
+   if ( Block != NULL )
+      return Block;
+
+   Block = new CounterBlock;
+
+   if ( Block == NULL )
+      return NULL;
+
+   ZeroMemory ( &Block->Counters, sizeof ( RawCounters ) );
+
+   Block->Sequence  = 0;
+   Block->LockDepth = 0;
+
+   do {
+      Head        = Blocks;
+      Block->Next = Head;
+   } while ( InterlockedCompareExchangePointer (
+                ( void *volatile * ) &Blocks, Block, Head ) != Head );
+
+   InterlockedIncrement ( &BlockCount );
+
+   TlsSetValue ( ( DWORD ) TlsSlot, Block );
+
+   return Block;
+}
+
+void CountOperation ( RawCounters *Surface,
+        CounterOperation Operation, DWORD Amount, LONGLONG Ticks ) {
+
+   CounterBlock *Block = ThreadBlock ();
+
+   if ( Block != NULL ) {
+      InterlockedIncrement ( &Block->Sequence );
+
+      Block->Counters.Count  [ Operation ]++;
+      Block->Counters.Amount [ Operation ] += Amount;
+      Block->Counters.Ticks  [ Operation ] += Ticks;
+
+      InterlockedIncrement ( &Block->Sequence );
+   }
+
+   if ( Surface != NULL ) {
+      Surface->Count  [ Operation ]++;
+      Surface->Amount [ Operation ] += Amount;
+      Surface->Ticks  [ Operation ] += Ticks;
+   }
+}
+
+void PushOperationStart () {
+   CounterBlock *Block = ThreadBlock ();
+
+   if ( Block == NULL )
+      return;
+
+   // Locks nested deeper than the stack are counted
+   // without a time:
+   if ( Block->LockDepth < MaxTimedLocks )
+      Block->LockStarts [ Block->LockDepth ] = ReadCounterTicks ();
+
+   Block->LockDepth++;
+}
+
+LONGLONG PopOperationTicks () {
+   CounterBlock *Block = ThreadBlock ();
+
+   if ( Block == NULL || Block->LockDepth == 0 )
+      return 0;
+
+   if ( --Block->LockDepth >= MaxTimedLocks )
+      return 0;
+
+   return ReadCounterTicks () -
+      Block->LockStarts [ Block->LockDepth ];
+}
+
+static void ReadBlock ( CounterBlock *Block, RawCounters &Copy ) {
+   LONG Before;
+
+   // Copy again until no update ran during the copy:
+   for ( ;; ) {
+      Before = InterlockedCompareExchange ( &Block->Sequence,
+         0, 0 );
+
+      if ( ( Before & 1 ) == 0 ) {
+         Copy = Block->Counters;
+
+         if ( InterlockedCompareExchange ( &Block->Sequence,
+                 0, 0 ) == Before )
+            return;
+      }
+
+      Sleep ( 0 );
+   }
+}
+
+static void EnterMerge () {
+   while ( InterlockedExchange ( &Merging, 1 ) != 0 )
+      Sleep ( 0 );
+}
+
+static void LeaveMerge () {
+   InterlockedExchange ( &Merging, 0 );
+}
+
+void EndCounterFrame () {
+   RawCounters Sum, Copy;
+   CounterBlock *Block;
+   LONGLONG Now;
+   LONG Operation;
+
+   ZeroMemory ( &Sum, sizeof ( RawCounters ) );
+
+   // The sum is taken inside the merge, so two presents
+   // ending frames at once commit their sums in order.
+   // Blocks are only ever added at the head, and each is
+   // written by its own thread alone; a count made while
+   // this runs falls in the next frame:
+   EnterMerge ();
+
+   Now = ReadCounterTicks ();
+
+   for ( Block = Blocks; Block != NULL; Block = Block->Next ) {
+      ReadBlock ( Block, Copy );
+
+      for ( Operation = 0; Operation < CounterOperations;
+            Operation++ ) {
+
+         Sum.Count  [ Operation ] += Copy.Count  [ Operation ];
+         Sum.Amount [ Operation ] += Copy.Amount [ Operation ];
+         Sum.Ticks  [ Operation ] += Copy.Ticks  [ Operation ];
+      }
+   }
+
+   SubtractCounters ( LastFrame, Sum, Merged );
+
+   Merged = Sum;
+
+   FrameTicks = FrameStart != 0 ? Now - FrameStart : 0;
+   FrameStart = Now;
+
+   Frames++;
+
+   LeaveMerge ();
+}
+
+bool GetCounterSnapshot ( CounterSnapshot &Snapshot ) {
+   LARGE_INTEGER Frequency;
+   RawCounters Frame, Total;
+   LONGLONG Ticks;
+
+   EnterMerge ();
+
+   Frame = LastFrame;
+   Total = Merged;
+   Ticks = FrameTicks;
+
+   Snapshot.Frame = Frames;
+
+   LeaveMerge ();
+
+   QueryPerformanceFrequency ( &Frequency );
+
+   Snapshot.Threads = BlockCount;
+
+   Snapshot.FrameMilliseconds = ( double ) Ticks * 1000.0 /
+      ( double ) Frequency.QuadPart;
+
+   ConvertCounters ( Frame, Snapshot.LastFrame );
+   ConvertCounters ( Total, Snapshot.Total );
+
+   return true;
+}
+
+double MeasureCounterCost ( LONG Repeats ) {
+   LARGE_INTEGER Start, Stop, Frequency;
+   RawCounters Counters;
+   LONG Repeat;
+
+   if ( Repeats <= 0 )
+      return 0.0;
+
+   ZeroMemory ( &Counters, sizeof ( RawCounters ) );
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   // As a blit counts itself, against a surface:
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ ) {
+      OperationTimer Timer ( &Counters, CounterBlit, 1 );
+   }
+
+   QueryPerformanceCounter ( &Stop );
+
+   return ( double ) ( Stop.QuadPart - Start.QuadPart ) * 1e9 /
+      ( double ) Frequency.QuadPart / ( double ) Repeats;
+}
+
+#else
+
+void CountOperation ( RawCounters *, CounterOperation, DWORD,
+        LONGLONG ) {
+}
+
+void EndCounterFrame () {
+}
+
+bool GetCounterSnapshot ( CounterSnapshot &Snapshot ) {
+   ZeroMemory ( &Snapshot, sizeof ( CounterSnapshot ) );
+
+   return false;
+}
+
+double MeasureCounterCost ( LONG ) {
+   return 0.0;
+}
+
+void PushOperationStart () {
+}
+
+LONGLONG PopOperationTicks () {
+   return 0;
+}
+
+#endif
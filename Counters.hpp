@@ -0,0 +1,159 @@
+//
+// File name: Counters.hpp
+//
+// Description: Counts and timings of surface operations,
+//              kept per thread and per surface and merged
+//              into per frame totals by every present.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __COUNTERSHPP__
+#define __COUNTERSHPP__
+
+#include <Windows.H>
+
+// Counting is compiled in unless DIRECTDRAW_NOCOUNTERS is
+// defined, in which case the surface operations carry no
+// trace of it and the snapshots below come back empty:
+#ifndef DIRECTDRAW_NOCOUNTERS
+   #define DIRECTDRAW_COUNTERS
+#endif
+
+// What is counted. The amount of each is the pixels locked,
+// blitted, cleared or presented; the surfaces found lost by
+// loss checks; and nothing for the rest. Lock time is how
+// long the lock was held, flip time how long the flip (or
+// partial present) waited. A surface counts the blits
+// drawn to it:
+enum CounterOperation { CounterLock, CounterBlit,
+   CounterClearColor, CounterClearDepth, CounterFlip,
+   CounterLossCheck, CounterRestore, CounterCreate,
+   CounterCreateAttempt, CounterOperations };
+
+struct OperationCounters {
+   DWORD     Count        [ CounterOperations ];
+   ULONGLONG Amount       [ CounterOperations ];
+   double    Milliseconds [ CounterOperations ];
+};
+
+// Frame is the number of frames merged so far, LastFrame
+// what was counted (on every thread) during the last of
+// them, and Total everything since the program started:
+struct CounterSnapshot {
+   DWORD Frame;
+   LONG  Threads;
+
+   double FrameMilliseconds;
+
+   OperationCounters LastFrame, Total;
+};
+
+// The counts as they are kept, in timer ticks:
+struct RawCounters {
+   DWORD     Count  [ CounterOperations ];
+   ULONGLONG Amount [ CounterOperations ];
+   LONGLONG  Ticks  [ CounterOperations ];
+};
+
+// Add one operation to the calling thread's counters and,
+// unless it is NULL, to a surface's:
+void CountOperation ( RawCounters *Surface,
+   CounterOperation Operation, DWORD Amount, LONGLONG Ticks );
+
+// Merge every thread's counters into the last frame's;
+// called by every present:
+void EndCounterFrame ();
+
+// Result = From - Less, operation by operation:
+void SubtractCounters ( RawCounters &Result, RawCounters &From,
+   RawCounters &Less );
+
+// Lock times are started and stopped on a stack kept per
+// thread, so nested locks, and locks of one surface held on
+// several threads at once, each time their own. Pop returns
+// the ticks since the matching push (0 without one):
+void     PushOperationStart ();
+LONGLONG PopOperationTicks ();
+
+// Returns false when counting is compiled out:
+bool GetCounterSnapshot ( CounterSnapshot &Snapshot );
+
+void ConvertCounters ( RawCounters &Raw,
+   OperationCounters &Counters );
+
+// "Lock", "Blit", ...:
+const char *GetCounterName ( CounterOperation Operation );
+
+// Time Repeats empty counted operations and return the cost
+// of each in nanoseconds (0 when compiled out):
+double MeasureCounterCost ( LONG Repeats );
+
+#ifdef DIRECTDRAW_COUNTERS
+
+inline LONGLONG ReadCounterTicks () {
+   LARGE_INTEGER Ticks;
+
+   QueryPerformanceCounter ( &Ticks );
+
+   return Ticks.QuadPart;
+}
+
+// Counts the rest of the block it is declared in as one
+// operation:
+class OperationTimer {
+   protected:
+      RawCounters     *Surface;
+      CounterOperation Operation;
+      DWORD            Amount;
+      LONGLONG         Start;
+
+   public:
+      OperationTimer ( RawCounters *Counters,
+            CounterOperation Counted, DWORD Pixels ) {
+
+         Surface   = Counters;
+         Operation = Counted;
+         Amount    = Pixels;
+         Start     = ReadCounterTicks ();
+      }
+
+      ~OperationTimer () {
+         CountOperation ( Surface, Operation, Amount,
+            ReadCounterTicks () - Start );
+      }
+};
+
+// Used inside DirectDrawSurface and DirectDrawManager,
+// where Surface is a surface whose Counters are counted
+// into as well:
+#define COUNT_SCOPE(Surface, Operation, Amount) \
+   OperationTimer CounterTimer ( &( Surface ).Counters, \
+      Operation, Amount )
+
+#define COUNT_EVENT(Surface, Operation, Amount) \
+   CountOperation ( &( Surface ).Counters, Operation, \
+      Amount, 0 )
+
+#define COUNT_START() PushOperationStart ()
+
+#define COUNT_STOP(Surface, Operation, Amount) \
+   CountOperation ( &( Surface ).Counters, Operation, \
+      Amount, PopOperationTicks () )
+
+#else
+
+#define COUNT_SCOPE(Surface, Operation, Amount)
+#define COUNT_EVENT(Surface, Operation, Amount)
+#define COUNT_START()
+#define COUNT_STOP(Surface, Operation, Amount)
+
+#endif
+
+#endif
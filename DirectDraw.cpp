@@ -14,17 +14,54 @@
 //
 
 #include "DirectDraw.hpp"
-
-DirectDrawManager::DirectDrawManager () {
+#include "PixelConvert.hpp"
+#include "Mipmap.hpp"
+#include "BlockCompress.hpp"
+#include "Palette.hpp"
+#include "Blend.hpp"
+#include "Scale.hpp"
+#include "SurfaceBackup.hpp"
+#include "SurfacePool.hpp"
+
+// System memory surfaces are aligned to, and their rows
+// padded to, a multiple of one cache line:
+const LONG SysAlignment = 64;
+
+DirectDrawManager::DirectDrawManager ( BackendType Backend ) {
    DirectDraw7 = NULL;
    FullScreen = false;
 
-   // Establish connection to DirectDraw:
-   ConnectToDirectDraw ();
+   PropWidth = PropHeight = PropBPP = 0;
+   PropBackend = Backend;
+
+   Surfaces = NextProbe = NULL;
+   Plans = NULL;
+   Sweep = 0;
+
+   RestorePool = NULL;
+
+   ZeroMemory ( &Losses, sizeof ( LossStats ) );
+
+   InitializeCriticalSection ( &RegistryLock );
+
+   ClearCapsCache ();
+
+   // Establish connection to DirectDraw (surfaces kept in
+   // system memory do not need one):
+   if ( PropBackend == Hardware )
+      ConnectToDirectDraw ();
 }
 
 DirectDrawManager::~DirectDrawManager () {
-   DirectDraw7->Release ();
+   // Surfaces that outlive the manager restore
+   // themselves:
+   while ( Surfaces != NULL )
+      Unregister ( *Surfaces );
+
+   DeleteCriticalSection ( &RegistryLock );
+
+   if ( DirectDraw7 != NULL )
+      DirectDraw7->Release ();
 }
 
 bool DirectDrawManager::ConnectToDirectDraw () {
@@ -56,6 +93,14 @@ bool DirectDrawManager::SetDisplayMode ( LONG Width,
 
    PropWidth = Width; PropHeight = Height; PropBPP = BPP;
 
+   // What the driver accepts may change with the mode:
+   ClearCapsCache ();
+
+   // Without a display there is no mode to switch to; the
+   // dimensions are only used to size the primary surface:
+   if ( PropBackend == SystemMemory )
+      return true;
+
    SurfaceDesc.dwSize    = sizeof ( DDSURFACEDESC2 );
    SurfaceDesc.dwFlags   = DDSD_WIDTH | DDSD_HEIGHT;
    SurfaceDesc.dwWidth   = Width;
@@ -82,6 +127,9 @@ bool DirectDrawManager::SetDisplayMode ( LONG Width,
 bool DirectDrawManager::Initialize ( HWND Window ) { 
    HRESULT Val;
 
+   if ( PropBackend == SystemMemory )
+      return true;
+
    // Set the cooperative level and display mode (if
    // so requested):
    if ( FullScreen ) {
@@ -278,16 +326,40 @@ void SetZBufferBitDepth ( DDPIXELFORMAT &PF, LONG Depth ) {
    }   
 }
 
+void SetCompressedFormat ( DDPIXELFORMAT &PF,
+        BlockCompression Compression ) {
+
+   // Set the pixel format for a block compressed texture:
+   ZeroMemory ( ( void * ) &PF, sizeof PF );
+   PF.dwSize   = sizeof ( DDPIXELFORMAT );
+   PF.dwFlags  = DDPF_FOURCC;
+   PF.dwFourCC = Compression == BlockBC3 ?
+      MAKEFOURCC ( 'D', 'X', 'T', '5' ) :
+      MAKEFOURCC ( 'D', 'X', 'T', '1' );
+}
+
+LONG SurfaceBytesPerPixel (
+        DirectDrawSurface::SurfaceType Type, LONG BPP ) {
+
+   // 24-bit z-buffers are stored in 32-bit pixels (see the
+   // masks in SetZBufferBitDepth); everything else uses
+   // the smallest whole number of bytes:
+   if ( Type == DirectDrawSurface::ZBuffer && BPP == 24 )
+      return 4;
+
+   return ( BPP + 7 ) / 8;
+}
+
 bool DirectDrawManager::CreateSurface (
         DirectDrawSurface &Surface ) {
 
    HRESULT Val;
    DDSURFACEDESC2 SurfaceDesc;
    DWORD EssentialCaps = 0, DesiredCaps = 0,
-      EssentialCaps2 = 0, DesiredCaps2 = 0;
-
-   if ( DirectDraw7 == NULL )
-      return false;
+      EssentialCaps2 = 0, DesiredCaps2 = 0,
+      Caps [ 4 ], Caps2 [ 4 ];
+   CapsCacheEntry *Entry;
+   LONG Attempt, Cached = -1, Tried = -1;
 
    if ( !Surface.TypeSet )
       return false;
@@ -295,6 +367,16 @@ bool DirectDrawManager::CreateSurface (
    if ( Surface.Created )
       return false;
 
+   COUNT_SCOPE ( Surface, CounterCreate, 0 );
+   TRACE_SCOPE ( Surface, CounterCreate, 0, Surface.PropWidth,
+      Surface.PropHeight );
+
+   if ( PropBackend == SystemMemory )
+      return CreateSystemSurface ( Surface );
+
+   if ( DirectDraw7 == NULL )
+      return false;
+
    ZeroMemory ( &SurfaceDesc, sizeof ( DDSURFACEDESC2 ) );
 
    SurfaceDesc.dwSize  = sizeof ( DDSURFACEDESC2 );
@@ -302,10 +384,12 @@ bool DirectDrawManager::CreateSurface (
 
    switch ( Surface.PropSurfaceType ) {
       case DirectDrawSurface::Primary:
-         // Create a primary surface with one backbuffer:
+         // Create a primary surface with one backbuffer,
+         // unless more were asked for:
 
          SurfaceDesc.dwFlags |= DDSD_BACKBUFFERCOUNT;
-         SurfaceDesc.dwBackBufferCount = 1; 
+         SurfaceDesc.dwBackBufferCount =
+            Surface.GetBackBufferCount (); 
  
          EssentialCaps  |= DDSCAPS_COMPLEX | DDSCAPS_FLIP |
             DDSCAPS_PRIMARYSURFACE | DDSCAPS_3DDEVICE |
@@ -378,8 +462,13 @@ bool DirectDrawManager::CreateSurface (
          SurfaceDesc.dwHeight = Surface.PropHeight;
          
          SurfaceDesc.dwFlags |= DDSD_PIXELFORMAT;
-         SetColorBitDepth ( SurfaceDesc.ddpfPixelFormat,
-            Surface.PropBPP, Surface.PropAlpha );
+
+         if ( Surface.PropCompression != BlockNone )
+            SetCompressedFormat ( SurfaceDesc.ddpfPixelFormat,
+               Surface.PropCompression );
+         else
+            SetColorBitDepth ( SurfaceDesc.ddpfPixelFormat,
+               Surface.PropBPP, Surface.PropAlpha );
 
          SurfaceDesc.dwFlags       |= DDSD_TEXTURESTAGE;
          SurfaceDesc.dwTextureStage = 0;
@@ -503,8 +592,9 @@ bool DirectDrawManager::CreateSurface (
          // at the second stage (this means bump mapping
          // and light mapping are incompatible operations,
          // since the above bump mapping code also uses
-         // the second stage; change one stage number or
-         // the other to fix this).
+         // the second stage). A LightMapCombiner applies
+         // the light map, and any bump map, on the CPU
+         // instead, leaving stage 1 free.
          SurfaceDesc.dwTextureStage = 1;
 
          EssentialCaps  |= DDSCAPS_TEXTURE;
@@ -515,49 +605,84 @@ bool DirectDrawManager::CreateSurface (
       break;
    }
 
-   SurfaceDesc.ddsCaps.dwCaps  = EssentialCaps  |
-      DesiredCaps;
+   // The capability combinations, from most to least
+   // desirable:
+   Caps  [ 0 ] = EssentialCaps  | DesiredCaps;
+   Caps2 [ 0 ] = EssentialCaps2 | DesiredCaps2;
 
-   SurfaceDesc.ddsCaps.dwCaps2 = EssentialCaps2 |
-      DesiredCaps2;
+   Caps  [ 1 ] = EssentialCaps;
+   Caps2 [ 1 ] = EssentialCaps2 | DesiredCaps2;
 
-   // Try to get the most capabilities:
-   if ( DirectDraw7->CreateSurface ( &SurfaceDesc,
-        &Surface.Surface7, NULL ) != DD_OK ) {
+   Caps  [ 2 ] = EssentialCaps  | DesiredCaps;
+   Caps2 [ 2 ] = EssentialCaps2;
 
-      SurfaceDesc.ddsCaps.dwCaps  = EssentialCaps;
-      
-      SurfaceDesc.ddsCaps.dwCaps2 = EssentialCaps2 |
-         DesiredCaps2;
+   Caps  [ 3 ] = EssentialCaps;
+   Caps2 [ 3 ] = EssentialCaps2;
+
+   // Start with the combination that last worked for a
+   // surface like this one, if there was one:
+   Entry = &CapsCache [ CapsCacheSlot ( Surface ) ];
+
+   if ( CapsCacheMatches ( *Entry, Surface ) ) {
+      SurfaceDesc.ddsCaps.dwCaps  = Caps  [ Entry->Attempt ];
+      SurfaceDesc.ddsCaps.dwCaps2 = Caps2 [ Entry->Attempt ];
+
+      CapsDriverCalls++;
+
+      COUNT_EVENT ( Surface, CounterCreateAttempt, 0 );
 
       Val = DirectDraw7->CreateSurface ( &SurfaceDesc,
          &Surface.Surface7, NULL );
 
-      if ( FAILED ( Val ) ) {
-         SurfaceDesc.ddsCaps.dwCaps  = EssentialCaps  |
-            DesiredCaps;
+      if ( Val == DD_OK ) {
+         CapsCacheHits++;
+         Cached = Entry->Attempt;
+      }
+      else Tried = Entry->Attempt;
+   }
+
+   if ( Cached < 0 ) {
+      CapsCacheMisses++;
+
+      // Try to get the most capabilities:
+      for ( Attempt = 0; Attempt < 4; Attempt++ ) {
+         if ( Attempt == Tried )
+            continue;
+
+         SurfaceDesc.ddsCaps.dwCaps  = Caps  [ Attempt ];
+         SurfaceDesc.ddsCaps.dwCaps2 = Caps2 [ Attempt ];
+
+         CapsDriverCalls++;
+
+         COUNT_EVENT ( Surface, CounterCreateAttempt, 0 );
 
-         SurfaceDesc.ddsCaps.dwCaps2 = EssentialCaps2;
-         
          Val = DirectDraw7->CreateSurface ( &SurfaceDesc,
-            &Surface.Surface7, NULL ); 
-         
-         if ( FAILED ( Val ) ) {
-            SurfaceDesc.ddsCaps.dwCaps  = EssentialCaps;
-            SurfaceDesc.ddsCaps.dwCaps2 = EssentialCaps2;
-         
-            Val = DirectDraw7->CreateSurface ( &SurfaceDesc,
-               &Surface.Surface7, NULL );
+            &Surface.Surface7, NULL );
 
-            if ( FAILED ( Val ) ) {
-               return PrintDirectDrawError ( Val );
-            }
-         }
+         if ( Val == DD_OK )
+            break;
       }
+
+      if ( Attempt == 4 )
+         return PrintDirectDrawError ( Val );
+
+      Entry->Used   = true;
+      Entry->Type   = Surface.PropSurfaceType;
+      Entry->Width  = Surface.PropWidth;
+      Entry->Height = Surface.PropHeight;
+      Entry->BPP    = Surface.PropBPP;
+      Entry->Alpha  = Surface.PropAlpha;
+      Entry->Lum    = Surface.PropLum;
+
+      Entry->Compression = Surface.PropCompression;
+
+      Entry->Attempt = Attempt;
    }
 
    Surface.Created = true;
 
+   Register ( Surface );
+
    // Grab the width, height, and pitch of the new surface:
    ZeroMemory ( ( void * ) &SurfaceDesc,
       sizeof ( DDSURFACEDESC2 ) );
@@ -570,421 +695,3117 @@ bool DirectDrawManager::CreateSurface (
    Surface.SurfHeight = SurfaceDesc.dwHeight;
    Surface.SurfPitch  = SurfaceDesc.lPitch;
 
-   return true;
-}
-
-bool DirectDrawManager::GetInterface (
-        LPDIRECTDRAW7 *Interface ) {
-
-   if ( DirectDraw7 == NULL )
-      return false;
+   Surface.SurfBytesPerPixel = SurfaceBytesPerPixel (
+      Surface.PropSurfaceType,
+      SurfaceDesc.ddpfPixelFormat.dwRGBBitCount );
 
-   ( *Interface ) = DirectDraw7;
+   // Drivers report the size of a compressed surface in
+   // lPitch (as a linear size); use the block row pitch:
+   if ( Surface.PropCompression != BlockNone ) {
+      Surface.SurfBytesPerPixel = 0;
+      Surface.SurfPitch = ( ( Surface.SurfWidth + 3 ) / 4 ) *
+         GetBlockBytes ( Surface.PropCompression );
+   }
 
-   ( *Interface )->AddRef ();
+   Surface.Dirty.SetBounds ( Surface.SurfWidth,
+      Surface.SurfHeight );
 
    return true;
 }
 
-bool DirectDrawManager::GetBaseInterface (
-        LPDIRECTDRAW *Base ) {
+static LONG SystemPitch ( LONG Width, LONG BytesPerPixel ) {
+   LONG Pitch;
 
-   // Retrieve the base interface:
-   if ( DirectDraw7 == NULL )
-      return false;
+   // Pad each row to the alignment. A pitch that is a
+   // multiple of 4K maps every row onto the same cache
+   // sets, so such pitches get one extra line:
+   Pitch = ( Width * BytesPerPixel + SysAlignment - 1 ) &
+      ~( SysAlignment - 1 );
 
-   return ( DirectDraw7->QueryInterface ( IID_IDirectDraw,
-      ( void ** ) Base ) == S_OK );
-}
+   if ( ( Pitch & 4095 ) == 0 )
+      Pitch += SysAlignment;
 
-DirectDrawSurface::DirectDrawSurface () {
-   ShouldRepaint = UseSourceColorKey = TypeSet = Created = false;
-   PropChainCount = 0;
-   PropLum = PropAlpha = false;
-   SurfWidth = SurfHeight = SurfPitch = 0;   
+   return Pitch;
 }
 
-DirectDrawSurface::~DirectDrawSurface () {
-   if ( Created )
-      Surface7->Release ();
-}
+bool DirectDrawManager::CreateSystemSurface (
+        DirectDrawSurface &Surface ) {
 
-bool DirectDrawSurface::StartAccess ( LPVOID *Pointer,
-        RECT *Rect ) {
+   LONG Width, Height, BPP, BytesPerPixel, Pitch, Rows,
+      BufferCount, BufferSize, MipWidth, MipHeight,
+      MipCount, MipSize, Level, BlockBytes;
 
-   LPDIRECTDRAWSURFACE7 Backbuffer;
-   DDSURFACEDESC2       SurfaceDesc;
-   DDSCAPS2             SurfaceCaps;
-   HRESULT              Val;
+   // Primary surfaces take their dimensions from the
+   // display mode, if one was set:
+   Width  = Surface.PropWidth;
+   Height = Surface.PropHeight;
+   BPP    = Surface.PropBPP;
 
-   // Obtain a pointer to the surface's memory:
+   if ( Surface.PropSurfaceType == DirectDrawSurface::Primary &&
+        PropWidth > 0 ) {
 
-   ZeroMemory ( &SurfaceDesc, sizeof ( DDSURFACEDESC2 ) );
+      Width = PropWidth; Height = PropHeight; BPP = PropBPP;
+   }
 
-   SurfaceDesc.dwSize = sizeof ( DDSURFACEDESC2 );
+   BytesPerPixel = SurfaceBytesPerPixel (
+      Surface.PropSurfaceType, BPP );
 
-   if ( !Created )
+   if ( Width <= 0 || Height <= 0 )
       return false;
 
-   if ( Surface7->IsLost () != DD_OK ) {
-      if ( FAILED ( Surface7->Restore () ) )
-         return false;
+   // Compressed textures are stored as rows of 4x4 blocks,
+   // so each level has a quarter as many rows:
+   BlockBytes = GetBlockBytes ( Surface.PropCompression );
+
+   if ( BlockBytes != 0 )
+      BytesPerPixel = 0;
+   else if ( BytesPerPixel < 1 || BytesPerPixel > 4 )
+      return false;
 
-      ShouldRepaint = true;
+   if ( BlockBytes != 0 ) {
+      Pitch = SystemPitch ( ( Width + 3 ) / 4, BlockBytes );
+      Rows  = ( Height + 3 ) / 4;
+   }
+   else {
+      Pitch = SystemPitch ( Width, BytesPerPixel );
+      Rows  = Height;
    }
 
-   // If the surface is a primary surface, make sure we
-   // obtain a pointer to the backbuffer, since that is the
-   // surface the application probably wants to write to:
-   if ( PropSurfaceType == Primary ) {
+   // Like the hardware path, flip chains get their
+   // backbuffers after the front buffer; all buffers share
+   // one allocation:
+   BufferCount = 1 + Surface.GetBackBufferCount ();
 
-      SurfaceCaps.dwCaps = DDSCAPS_BACKBUFFER;
+   BufferSize = Pitch * Rows;
 
-      Val = Surface7->GetAttachedSurface ( &SurfaceCaps,
-         &Backbuffer );
+   // Textures get a full mip chain, down to 1x1, after the
+   // top level:
+   MipCount = 1;
+   MipSize  = 0;
 
-      if ( FAILED ( Val ) )
-         return PrintDirectDrawError ( Val );
+   if ( Surface.PropSurfaceType == DirectDrawSurface::Texture ) {
+      MipWidth = Width; MipHeight = Height;
 
-      Val = Backbuffer->Lock ( Rect, &SurfaceDesc,
-         DDLOCK_NOSYSLOCK | DDLOCK_WAIT, NULL );
-   }
-   else {
-      Val = Surface7->Lock ( Rect, &SurfaceDesc,
-         DDLOCK_NOSYSLOCK | DDLOCK_WAIT, NULL );
-   }
+      while ( ( MipWidth > 1 || MipHeight > 1 ) &&
+              MipCount < DirectDrawSurface::MaxMipLevels ) {
 
-   if ( FAILED ( Val ) )
-      return PrintDirectDrawError ( Val );
+         if ( MipWidth  > 1 ) MipWidth  /= 2;
+         if ( MipHeight > 1 ) MipHeight /= 2;
 
-   ( *Pointer ) = SurfaceDesc.lpSurface;
+         if ( BlockBytes != 0 ) {
+            Surface.SysMipPitch [ MipCount ] = SystemPitch (
+               ( MipWidth + 3 ) / 4, BlockBytes );
 
-   return true;
-}
+            MipSize += Surface.SysMipPitch [ MipCount++ ] *
+               ( ( MipHeight + 3 ) / 4 );
+         }
+         else {
+            Surface.SysMipPitch [ MipCount ] = SystemPitch (
+               MipWidth, BytesPerPixel );
 
-bool DirectDrawSurface::EndAccess ( RECT *Rect ) {
-   LPDIRECTDRAWSURFACE7 Backbuffer;
-   DDSCAPS2             SurfaceCaps;
-   HRESULT              Val;
+            MipSize += Surface.SysMipPitch [ MipCount++ ] * MipHeight;
+         }
+      }
+   }
 
-   // End access to the surface:
+   Surface.SysBlock = new BYTE [ BufferSize * BufferCount +
+      MipSize + SysAlignment ];
 
-   if ( !Created )
+   if ( Surface.SysBlock == NULL )
       return false;
 
-   if ( PropSurfaceType == Primary ) {
-      SurfaceCaps.dwCaps = DDSCAPS_BACKBUFFER;
+   Surface.SysMemory = ( LPBYTE ) ( ( ( DWORD_PTR )
+      Surface.SysBlock + SysAlignment - 1 ) &
+      ~( DWORD_PTR ) ( SysAlignment - 1 ) );
 
-      Val = Surface7->GetAttachedSurface ( &SurfaceCaps,
-         &Backbuffer );
+   ZeroMemory ( Surface.SysMemory, BufferSize * BufferCount +
+      MipSize );
 
-      if ( FAILED ( Val ) )
-         return PrintDirectDrawError ( Val );
-
-      Val = Backbuffer->Unlock ( Rect );
-   }
-   else {
-      Val = Surface7->Unlock ( Rect );
-   }
+   Surface.SysMipMemory [ 0 ] = Surface.SysMemory;
+   Surface.SysMipPitch  [ 0 ] = Pitch;
 
-   if ( FAILED ( Val ) )
-      return PrintDirectDrawError ( Val );
+   MipSize   = BufferSize * BufferCount;
+   MipHeight = Height;
 
-   return true;
-}
+   for ( Level = 1; Level < MipCount; Level++ ) {
+      if ( MipHeight > 1 ) MipHeight /= 2;
 
-bool DirectDrawSurface::SetSurfaceType (
-        SurfaceType Type ) {
+      Surface.SysMipMemory [ Level ] = Surface.SysMemory + MipSize;
 
-   if ( Created )
-      return false;
+      MipSize += Surface.SysMipPitch [ Level ] * ( BlockBytes != 0 ?
+         ( MipHeight + 3 ) / 4 : MipHeight );
+   }
 
-   PropSurfaceType = Type;
+   Surface.MipLevelCount = MipCount;
 
-   TypeSet = true;
+   Surface.SysBufferCount    = BufferCount;
+   Surface.SysFront          = 0;
+   Surface.SysLockCount      = 0;
 
-   return true;
-}
+   Surface.SurfWidth         = Width;
+   Surface.SurfHeight        = Height;
+   Surface.SurfPitch         = Pitch;
+   Surface.SurfBytesPerPixel = BytesPerPixel;
 
-bool DirectDrawSurface::SetGeneralOptions ( LONG Width,
-        LONG Height, LONG BPP ) {
+   Surface.Dirty.SetBounds ( Width, Height );
 
-   if ( Created )
-      return false;
+   Surface.Created = true;
 
-   PropWidth         = Width;
-   PropHeight        = Height;
-   PropBPP           = BPP;
+   Register ( Surface );
 
    return true;
 }
 
-bool DirectDrawSurface::SetChainOptions (
-        LONG ChainCount ) {
-
-   if ( Created )
-      return false;
+bool DirectDrawManager::CreateAliasedSurface (
+        DirectDrawSurface &Surface, LPBYTE *Levels,
+        LONG *Pitches, LONG LevelCount ) {
 
-   PropChainCount = ChainCount;
+   LONG Width, Height, BytesPerPixel, BlockBytes, Expected,
+      Level, RowBytes;
 
-   return true;
-}
+   // Flip chains and the other types need memory laid out
+   // by CreateSystemSurface:
+   if ( PropBackend != SystemMemory || !Surface.TypeSet ||
+        Surface.Created )
+      return false;
 
-bool DirectDrawSurface::SetTextureOptions ( bool Alpha ) {
-   if ( Created )
+   if ( Surface.PropSurfaceType != DirectDrawSurface::Plain &&
+        Surface.PropSurfaceType != DirectDrawSurface::Texture )
       return false;
 
-   PropAlpha = Alpha;
+   Width  = Surface.PropWidth;
+   Height = Surface.PropHeight;
 
-   return true;
-}
+   if ( Width <= 0 || Height <= 0 )
+      return false;
 
-bool DirectDrawSurface::SetBumpMapOptions (
-        bool Luminescence ) {
+   BlockBytes    = GetBlockBytes ( Surface.PropCompression );
+   BytesPerPixel = BlockBytes != 0 ? 0 : SurfaceBytesPerPixel (
+      Surface.PropSurfaceType, Surface.PropBPP );
 
-   if ( Created )
+   if ( BlockBytes == 0 && ( BytesPerPixel < 1 || BytesPerPixel > 4 ) )
       return false;
 
-   PropLum = Luminescence;
+   // The same number of levels CreateSystemSurface gives:
+   Expected = 1;
 
-   return true;
-}
+   if ( Surface.PropSurfaceType == DirectDrawSurface::Texture ) {
+      while ( ( Width > 1 || Height > 1 ) &&
+              Expected < DirectDrawSurface::MaxMipLevels ) {
 
-bool DirectDrawSurface::Show () {
-   HRESULT Val;
+         if ( Width  > 1 ) Width  /= 2;
+         if ( Height > 1 ) Height /= 2;
 
-   // Display the backbuffer of a primary surface:
+         Expected++;
+      }
+   }
 
-   if ( !Created )
+   if ( LevelCount != Expected )
       return false;
 
-   if ( PropSurfaceType != Primary )
-      return false;
+   Width = Surface.PropWidth;
+
+   for ( Level = 0; Level < LevelCount; Level++ ) {
+      RowBytes = BlockBytes != 0 ? ( ( Width + 3 ) / 4 ) * BlockBytes :
+         Width * BytesPerPixel;
 
-   if ( Surface7->IsLost () != DD_OK ) {
-      if ( FAILED ( Surface7->Restore () ) )
+      if ( Levels [ Level ] == NULL || Pitches [ Level ] < RowBytes )
          return false;
 
-      ShouldRepaint = true;
+      if ( Width > 1 ) Width /= 2;
    }
 
-   Val = Surface7->Flip ( NULL, DDFLIP_WAIT );
+   for ( Level = 0; Level < LevelCount; Level++ ) {
+      Surface.SysMipMemory [ Level ] = Levels  [ Level ];
+      Surface.SysMipPitch  [ Level ] = Pitches [ Level ];
+   }
 
-   if ( FAILED ( Val ) )
-      return PrintDirectDrawError ( Val );
+   // With no block of its own, the destructor frees
+   // nothing:
+   Surface.SysBlock  = NULL;
+   Surface.SysMemory = Levels [ 0 ];
 
-   return true;
-}
+   Surface.MipLevelCount = LevelCount;
 
-bool DirectDrawSurface::BlitTo ( DirectDrawSurface &Dest,
-        RECT &DestRect ) {
+   Surface.SysBufferCount    = 1;
+   Surface.SysFront          = 0;
+   Surface.SysLockCount      = 0;
 
-   RECT Portion;
+   Surface.SurfWidth         = Surface.PropWidth;
+   Surface.SurfHeight        = Surface.PropHeight;
+   Surface.SurfPitch         = Pitches [ 0 ];
+   Surface.SurfBytesPerPixel = BytesPerPixel;
 
-   if ( !Created )
-      return false;
+   Surface.Dirty.SetBounds ( Surface.SurfWidth, Surface.SurfHeight );
 
-   Portion.left = 0; Portion.top = 0;
-   Portion.right = PropWidth; Portion.bottom = PropHeight;
+   Surface.Created = true;
 
-   return BlitPortionTo ( Portion, Dest, DestRect );
-}
+   Register ( Surface );
 
-bool DirectDrawSurface::BlitPortionTo ( RECT &Portion,
-        DirectDrawSurface &Dest, RECT &DestRect ) {
+   return true;
+}
 
-   DDBLTFX BlitFX;
-   DWORD Flags = DDBLT_WAIT;
-   HRESULT Val;
+LONG DirectDrawManager::CapsCacheSlot (
+        DirectDrawSurface &Surface ) {
 
-   if ( !Created )
-      return false;
+   DWORD Hash;
 
-   if ( Surface7->IsLost () != DD_OK ) {
-      if ( FAILED ( Surface7->Restore () ) )
-         return false;
+   Hash = ( DWORD ) Surface.PropSurfaceType * 0x9E3779B1;
+   Hash = ( Hash ^ ( DWORD ) Surface.PropWidth  ) * 0x85EBCA6B;
+   Hash = ( Hash ^ ( DWORD ) Surface.PropHeight ) * 0xC2B2AE35;
+   Hash = ( Hash ^ ( DWORD ) Surface.PropBPP    ) * 0x27D4EB2F;
+   Hash ^= ( Surface.PropAlpha ? 1 : 0 ) |
+      ( Surface.PropLum ? 2 : 0 ) |
+      ( ( DWORD ) Surface.PropCompression << 2 );
 
-      ShouldRepaint = true;
-   }
+   return ( LONG ) ( ( Hash ^ ( Hash >> 16 ) ) %
+      CapsCacheSize );
+}
 
-   ZeroMemory ( ( void * ) &BlitFX, sizeof ( DDBLTFX ) );
-   BlitFX.dwSize = sizeof ( DDBLTFX );
+bool DirectDrawManager::CapsCacheMatches (
+        CapsCacheEntry &Entry, DirectDrawSurface &Surface ) {
+
+   return Entry.Used &&
+      Entry.Type   == Surface.PropSurfaceType &&
+      Entry.Width  == Surface.PropWidth  &&
+      Entry.Height == Surface.PropHeight &&
+      Entry.BPP    == Surface.PropBPP    &&
+      Entry.Alpha  == Surface.PropAlpha  &&
+      Entry.Lum    == Surface.PropLum    &&
+      Entry.Compression == Surface.PropCompression;
+}
 
-   if ( UseSourceColorKey )
-      Flags |= DDBLT_KEYSRC;
+void DirectDrawManager::ClearCapsCache () {
+   LONG Index;
 
-   Val = Dest.Surface7->Blt ( &DestRect, this->Surface7,
-      &Portion, Flags, &BlitFX );
-   
-   if ( FAILED ( Val ) )
-      return PrintDirectDrawError ( Val );
+   for ( Index = 0; Index < CapsCacheSize; Index++ )
+      CapsCache [ Index ].Used = false;
 
-   return true;
+   CapsCacheHits = CapsCacheMisses = CapsDriverCalls = 0;
 }
 
-bool DirectDrawSurface::BlitTo ( DirectDrawSurface &Dest,
-        LONG DestX, LONG DestY ) {
+void DirectDrawManager::GetCapsCacheStats ( DWORD *Hits,
+        DWORD *Misses, DWORD *DriverCalls ) {
 
-   RECT DestRect;
+   if ( Hits != NULL )
+      ( *Hits ) = CapsCacheHits;
 
-   DestRect.left     = DestX;
-   DestRect.right    = DestX + PropWidth;
-   DestRect.top      = DestY;
-   DestRect.bottom   = DestY + PropHeight;
+   if ( Misses != NULL )
+      ( *Misses ) = CapsCacheMisses;
 
-   return BlitTo ( Dest, DestRect );
+   if ( DriverCalls != NULL )
+      ( *DriverCalls ) = CapsDriverCalls;
 }
 
-bool DirectDrawSurface::BlitPortionTo ( RECT &Portion,
-        DirectDrawSurface &Dest, LONG DestX, LONG DestY ) {
+bool DirectDrawManager::GetInterface (
+        LPDIRECTDRAW7 *Interface ) {
 
-   RECT DestRect;
+   if ( DirectDraw7 == NULL )
+      return false;
 
-   DestRect.left     = DestX;
-   DestRect.right    = DestX + PropWidth;
-   DestRect.top      = DestY;
-   DestRect.bottom   = DestY + PropHeight;
+   ( *Interface ) = DirectDraw7;
 
-   return BlitPortionTo ( Portion, Dest, DestRect );
+   ( *Interface )->AddRef ();
+
+   return true;
 }
 
-bool DirectDrawSurface::ClearToDepth ( DWORD Depth ) {
-   DDBLTFX BlitFX;
-   RECT Portion;
-   DWORD Flags = 0;
-   HRESULT Val;
+bool DirectDrawManager::GetBaseInterface (
+        LPDIRECTDRAW *Base ) {
 
-   if ( !Created )
+   // Retrieve the base interface:
+   if ( DirectDraw7 == NULL )
       return false;
 
-   if ( PropSurfaceType != ZBuffer )
-      return false;
+   return ( DirectDraw7->QueryInterface ( IID_IDirectDraw,
+      ( void ** ) Base ) == S_OK );
+}
 
-   if ( Surface7->IsLost () != DD_OK ) {
-      if ( FAILED ( Surface7->Restore () ) )
-         return false;
+void DirectDrawManager::Register ( DirectDrawSurface &Surface ) {
+   EnterCriticalSection ( &RegistryLock );
 
-      ShouldRepaint = true;
-   }
+   Surface.Owner           = this;
+   Surface.PreviousSurface = NULL;
+   Surface.NextSurface     = Surfaces;
+
+   if ( Surfaces != NULL )
+      Surfaces->PreviousSurface = &Surface;
+
+   Surfaces = &Surface;
+
+   Losses.Surfaces++;
+
+   LeaveCriticalSection ( &RegistryLock );
+}
+
+void DirectDrawManager::DropDependents (
+        DirectDrawSurface &Surface ) {
+
+   DirectDrawSurface *Other;
+   LONG Index;
+
+   // Nothing may still be repainted after Surface; called
+   // with RegistryLock held:
+   for ( Other = Surfaces; Other != NULL;
+         Other = Other->NextSurface ) {
+
+      for ( Index = 0; Index < Other->RepaintAfterCount; ) {
+         if ( Other->RepaintAfter [ Index ] == &Surface )
+            Other->RepaintAfter [ Index ] = Other->RepaintAfter
+               [ --Other->RepaintAfterCount ];
+         else
+            Index++;
+      }
+   }
+}
+
+// What a sweep repaints, worked out while RegistryLock is
+// held so the callbacks can run after it is released. Steps
+// are numbered in the order surfaces are first met; Order
+// lists them with each after the surfaces it depends on:
+struct RepaintStep {
+   DirectDrawSurface *Surface;
+   RepaintCallback    Function;
+   LPVOID             Context;
+
+   // Restored by the sweep, and repainted (or refilled
+   // from a backup) in it:
+   bool Restored, Done;
+
+   LONG After [ DirectDrawSurface::MaxRepaintDependencies ];
+   LONG AfterCount;
+};
+
+// While its callbacks run, a plan is on the manager's
+// Plans list, so Unregister can take a dying surface out of
+// it (and wait for its callback, if one is running on
+// another thread):
+struct RepaintPlan {
+   RepaintStep *Steps;
+   LONG        *Order;
+   LONG         Count, Ordered;
+
+   DWORD Sweep, Thread;
+
+   DirectDrawSurface *Running;
+   RepaintPlan       *Next;
+};
+
+void DirectDrawManager::Unregister ( DirectDrawSurface &Surface ) {
+   DirectDrawSurface *Other;
+   RepaintPlan *Plan;
+   LONG Index;
+   bool Busy;
+
+   EnterCriticalSection ( &RegistryLock );
+
+   // A repaint callback running on another thread finishes
+   // with the surface before it goes; this thread's own
+   // callbacks may destroy it:
+   do {
+      Busy = false;
+
+      for ( Plan = Plans; Plan != NULL; Plan = Plan->Next ) {
+         if ( Plan->Running == &Surface &&
+              Plan->Thread != GetCurrentThreadId () )
+            Busy = true;
+      }
+
+      if ( Busy ) {
+         LeaveCriticalSection ( &RegistryLock );
+         Sleep ( 1 );
+         EnterCriticalSection ( &RegistryLock );
+      }
+   } while ( Busy );
+
+   // Sweeps repainting with the lock released skip it:
+   for ( Plan = Plans; Plan != NULL; Plan = Plan->Next ) {
+      for ( Index = 0; Index < Plan->Count; Index++ ) {
+         if ( Plan->Steps [ Index ].Surface == &Surface )
+            Plan->Steps [ Index ].Surface = NULL;
+      }
+   }
+
+   if ( Surface.PreviousSurface != NULL )
+      Surface.PreviousSurface->NextSurface = Surface.NextSurface;
+   else
+      Surfaces = Surface.NextSurface;
+
+   if ( Surface.NextSurface != NULL )
+      Surface.NextSurface->PreviousSurface = Surface.PreviousSurface;
+
+   if ( NextProbe == &Surface )
+      NextProbe = Surface.NextSurface;
+
+   DropDependents ( Surface );
+
+   // Surfaces it masked blend no more:
+   for ( Other = Surfaces; Other != NULL;
+         Other = Other->NextSurface ) {
+
+      if ( Other->BlendMask == &Surface ) {
+         Other->PropBlendMode = BlendOpaque;
+         Other->BlendMask     = NULL;
+         Other->BlendOpacity  = 255;
+      }
+   }
+
+   Surface.Owner = NULL;
+   Surface.NextSurface = Surface.PreviousSurface = NULL;
+   Surface.RepaintAfterCount = 0;
+
+   Losses.Surfaces--;
+
+   if ( Surface.Backup != NULL ) {
+      Losses.Backups--;
+      Losses.BackupBytes   -= Surface.Backup->GetBytes ();
+      Losses.BackedUpBytes -= Surface.Backup->GetRawBytes ();
+   }
+
+   LeaveCriticalSection ( &RegistryLock );
+}
+
+bool DirectDrawManager::CheckForLoss () {
+   DirectDrawSurface *Probe = NULL;
+   DWORD Tried;
+   bool Lost = false;
+
+   EnterCriticalSection ( &RegistryLock );
+
+   // System memory surfaces are never lost, so they are
+   // passed over:
+   for ( Tried = 0; Tried < Losses.Surfaces; Tried++ ) {
+      if ( NextProbe == NULL )
+         NextProbe = Surfaces;
+
+      Probe     = NextProbe;
+      NextProbe = Probe->NextSurface;
+
+      if ( Probe->Surface7 != NULL )
+         break;
+
+      Probe = NULL;
+   }
+
+   if ( Probe != NULL ) {
+      Losses.Probes++;
+
+      Lost = Probe->Surface7->IsLost () != DD_OK;
+
+      COUNT_EVENT ( *Probe, CounterLossCheck, Lost ? 1 : 0 );
+
+      if ( Lost )
+         TRACE_EVENT ( *Probe, CounterLossCheck, TraceInstant, 0, 0 );
+   }
+
+   LeaveCriticalSection ( &RegistryLock );
+
+   return !Lost || RestoreSurfaces ();
+}
+
+bool DirectDrawManager::RestoreSurfaces () {
+   DirectDrawSurface *Surface;
+   LARGE_INTEGER Start, Stop, Frequency;
+   RepaintPlan Plan, **Link;
+   bool Restored = true, Lost;
+
+   EnterCriticalSection ( &RegistryLock );
+
+   QueryPerformanceCounter ( &Start );
+
+   Sweep++;
+   Losses.Sweeps++;
+
+   for ( Surface = Surfaces; Surface != NULL;
+         Surface = Surface->NextSurface ) {
+
+      if ( Surface->Surface7 == NULL )
+         continue;
+
+      Lost = Surface->Surface7->IsLost () != DD_OK;
+
+      COUNT_EVENT ( *Surface, CounterLossCheck, Lost ? 1 : 0 );
+
+      if ( !Lost )
+         continue;
+
+      if ( !Surface->RestoreSurface () ) {
+         Restored = false;
+
+         continue;
+      }
+
+      Surface->RestoredSweep = Sweep;
+
+      Losses.Restored++;
+   }
+
+   UploadBackups ();
+
+   Plan.Steps = new RepaintStep [ Losses.Surfaces + 1 ];
+   Plan.Order = new LONG [ Losses.Surfaces + 1 ];
+   Plan.Count = Plan.Ordered = 0;
+
+   Plan.Sweep   = Sweep;
+   Plan.Thread  = GetCurrentThreadId ();
+   Plan.Running = NULL;
+
+   // Without a plan, lost surfaces are only flagged for
+   // NeedsRepainting:
+   if ( Plan.Steps != NULL && Plan.Order != NULL ) {
+      for ( Surface = Surfaces; Surface != NULL;
+            Surface = Surface->NextSurface )
+         PlanRepaint ( *Surface, Plan );
+
+      Plan.Next = Plans;
+      Plans     = &Plan;
+   }
+   else Restored = false;
+
+   LeaveCriticalSection ( &RegistryLock );
+
+   // Callbacks may take locks of their own, or call back
+   // into the manager from other threads, so none runs
+   // under RegistryLock:
+   if ( Plan.Steps != NULL && Plan.Order != NULL ) {
+      RunRepaint ( Plan );
+
+      EnterCriticalSection ( &RegistryLock );
+
+      for ( Link = &Plans; *Link != &Plan;
+            Link = &( *Link )->Next );
+
+      *Link = Plan.Next;
+
+      LeaveCriticalSection ( &RegistryLock );
+   }
+
+   delete [] Plan.Steps;
+   delete [] Plan.Order;
+
+   QueryPerformanceCounter ( &Stop );
+   QueryPerformanceFrequency ( &Frequency );
+
+   EnterCriticalSection ( &RegistryLock );
+
+   Losses.LastSweepMilliseconds = ( double ) ( Stop.QuadPart -
+      Start.QuadPart ) * 1000.0 / ( double ) Frequency.QuadPart;
+
+   LeaveCriticalSection ( &RegistryLock );
+
+   return Restored;
+}
+
+LONG DirectDrawManager::PlanRepaint ( DirectDrawSurface &Surface,
+        RepaintPlan &Plan ) {
+
+   RepaintStep *Step;
+   LONG Index, After;
+
+   // A surface met again while its dependencies are being
+   // planned is part of a cycle, which ends there:
+   if ( Surface.VisitedSweep == Sweep )
+      return Surface.RepaintIndex;
+
+   Surface.VisitedSweep = Sweep;
+   Surface.RepaintIndex = Plan.Count;
+
+   Step = &Plan.Steps [ Plan.Count++ ];
+
+   Step->Surface  = &Surface;
+   Step->Function = Surface.RepaintFunction;
+   Step->Context  = Surface.RepaintContext;
+   Step->Restored = Surface.RestoredSweep  == Sweep;
+   Step->Done     = Surface.RepaintedSweep == Sweep;
+
+   Step->AfterCount = 0;
+
+   for ( Index = 0; Index < Surface.RepaintAfterCount; Index++ ) {
+      After = PlanRepaint ( *Surface.RepaintAfter [ Index ],
+         Plan );
+
+      Step->After [ Step->AfterCount++ ] = After;
+   }
+
+   Plan.Order [ Plan.Ordered++ ] = Surface.RepaintIndex;
+
+   return Surface.RepaintIndex;
+}
+
+void DirectDrawManager::RunRepaint ( RepaintPlan &Plan ) {
+   DirectDrawSurface *Surface;
+   RepaintStep *Step;
+   LONG Index, After, Repainted = 0;
+   bool Stale, Painted;
+
+   // A surface is repainted when it was restored, or when
+   // something it is painted from was repainted or
+   // refilled from its backup:
+   for ( Index = 0; Index < Plan.Ordered; Index++ ) {
+      Step = &Plan.Steps [ Plan.Order [ Index ] ];
+
+      if ( Step->Done )
+         continue;
+
+      Stale = Step->Restored;
+
+      for ( After = 0; After < Step->AfterCount; After++ ) {
+         if ( Plan.Steps [ Step->After [ After ] ].Done )
+            Stale = true;
+      }
+
+      if ( !Stale || Step->Function == NULL )
+         continue;
+
+      // Unregister clears Surface for a surface destroyed
+      // since the plan was made, and waits for the one
+      // named Running:
+      EnterCriticalSection ( &RegistryLock );
+
+      Surface = Step->Surface;
+      Plan.Running = Surface;
+
+      LeaveCriticalSection ( &RegistryLock );
+
+      if ( Surface == NULL )
+         continue;
+
+      Painted = Step->Function ( *Surface, Step->Context );
+
+      EnterCriticalSection ( &RegistryLock );
+
+      Plan.Running = NULL;
+
+      // The callback may have destroyed the surface itself:
+      if ( Painted && Step->Surface != NULL ) {
+         Step->Surface->ShouldRepaint  = false;
+         Step->Surface->RepaintedSweep = Plan.Sweep;
+      }
+
+      LeaveCriticalSection ( &RegistryLock );
+
+      if ( !Painted )
+         continue;
+
+      Step->Done = true;
+
+      Repainted++;
+   }
+
+   EnterCriticalSection ( &RegistryLock );
+
+   Losses.Repainted += Repainted;
+
+   LeaveCriticalSection ( &RegistryLock );
+}
+
+bool DirectDrawManager::SetRepaintCallback (
+        DirectDrawSurface &Surface, RepaintCallback Callback,
+        LPVOID Context ) {
+
+   if ( Surface.Owner != this )
+      return false;
+
+   EnterCriticalSection ( &RegistryLock );
+
+   Surface.RepaintFunction = Callback;
+   Surface.RepaintContext  = Context;
+
+   LeaveCriticalSection ( &RegistryLock );
+
+   return true;
+}
+
+bool DirectDrawManager::AddRepaintDependency (
+        DirectDrawSurface &Surface, DirectDrawSurface &DependsOn ) {
+
+   LONG Index;
+
+   if ( Surface.Owner != this || DependsOn.Owner != this ||
+        &Surface == &DependsOn )
+      return false;
+
+   EnterCriticalSection ( &RegistryLock );
+
+   for ( Index = 0; Index < Surface.RepaintAfterCount; Index++ ) {
+      if ( Surface.RepaintAfter [ Index ] == &DependsOn )
+         break;
+   }
+
+   if ( Index == Surface.RepaintAfterCount ) {
+      if ( Index == DirectDrawSurface::MaxRepaintDependencies ) {
+         LeaveCriticalSection ( &RegistryLock );
+
+         return false;
+      }
+
+      Surface.RepaintAfter [ Surface.RepaintAfterCount++ ] =
+         &DependsOn;
+   }
+
+   LeaveCriticalSection ( &RegistryLock );
+
+   return true;
+}
+
+void DirectDrawManager::UploadBackups () {
+   DirectDrawSurface *Surface, **Targets;
+   SurfaceBackup **Backups;
+   LARGE_INTEGER Start, Stop, Frequency;
+   LONG Count = 0, Index;
+   bool *Uploaded;
+
+   // Every surface this sweep restored that has a backup
+   // is decompressed in one parallel pass:
+   for ( Surface = Surfaces; Surface != NULL;
+         Surface = Surface->NextSurface ) {
+
+      if ( Surface->Backup != NULL && Surface->RestoredSweep == Sweep )
+         Count++;
+   }
+
+   if ( Count == 0 )
+      return;
+
+   QueryPerformanceCounter ( &Start );
+
+   Targets  = new DirectDrawSurface * [ Count ];
+   Backups  = new SurfaceBackup * [ Count ];
+   Uploaded = new bool [ Count ];
+
+   if ( Targets != NULL && Backups != NULL && Uploaded != NULL ) {
+      Index = 0;
+
+      for ( Surface = Surfaces; Surface != NULL;
+            Surface = Surface->NextSurface ) {
+
+         if ( Surface->Backup != NULL &&
+              Surface->RestoredSweep == Sweep ) {
+
+            Targets [ Index ] = Surface;
+            Backups [ Index ] = Surface->Backup;
+
+            Index++;
+         }
+      }
+
+      RestoreBackups ( Backups, Targets, Count, Uploaded,
+         RestorePool );
+
+      // Those that could not be refilled are left to their
+      // callbacks:
+      for ( Index = 0; Index < Count; Index++ ) {
+         if ( !Uploaded [ Index ] )
+            continue;
+
+         Targets [ Index ]->ShouldRepaint  = false;
+         Targets [ Index ]->RepaintedSweep = Sweep;
+
+         Losses.Uploaded++;
+      }
+   }
+
+   delete [] Targets;
+   delete [] Backups;
+   delete [] Uploaded;
+
+   QueryPerformanceCounter ( &Stop );
+   QueryPerformanceFrequency ( &Frequency );
+
+   Losses.LastUploadMilliseconds = ( double ) ( Stop.QuadPart -
+      Start.QuadPart ) * 1000.0 / ( double ) Frequency.QuadPart;
+}
+
+bool DirectDrawManager::SetBackup ( DirectDrawSurface &Surface,
+        bool Enable ) {
+
+   SurfaceBackup *Copy = NULL;
+
+   // System memory surfaces are never lost:
+   if ( Surface.Owner != this || Surface.Surface7 == NULL )
+      return false;
+
+   if ( Enable ) {
+      Copy = new SurfaceBackup;
+
+      if ( Copy == NULL || !Copy->Capture ( Surface, RestorePool ) ) {
+         delete Copy;
+         return false;
+      }
+   }
+
+   EnterCriticalSection ( &RegistryLock );
+
+   if ( Surface.Backup != NULL ) {
+      Losses.Backups--;
+      Losses.BackupBytes   -= Surface.Backup->GetBytes ();
+      Losses.BackedUpBytes -= Surface.Backup->GetRawBytes ();
+
+      delete Surface.Backup;
+   }
+
+   Surface.Backup = Copy;
+
+   if ( Copy != NULL ) {
+      Losses.Backups++;
+      Losses.BackupBytes   += Copy->GetBytes ();
+      Losses.BackedUpBytes += Copy->GetRawBytes ();
+   }
+
+   LeaveCriticalSection ( &RegistryLock );
+
+   return true;
+}
+
+void DirectDrawManager::ForgetRepaint (
+        DirectDrawSurface &Surface ) {
+
+   EnterCriticalSection ( &RegistryLock );
+
+   DropDependents ( Surface );
+
+   Surface.RepaintFunction   = NULL;
+   Surface.RepaintContext    = NULL;
+   Surface.RepaintAfterCount = 0;
+   Surface.ShouldRepaint     = false;
+
+   LeaveCriticalSection ( &RegistryLock );
+
+   if ( Surface.Backup != NULL )
+      SetBackup ( Surface, false );
+}
+
+void DirectDrawManager::EndFrameCounters () {
+#ifdef DIRECTDRAW_COUNTERS
+   DirectDrawSurface *Surface;
+
+   EndCounterFrame ();
+
+   // Each surface keeps what the frame did to it as well:
+   EnterCriticalSection ( &RegistryLock );
+
+   for ( Surface = Surfaces; Surface != NULL;
+         Surface = Surface->NextSurface ) {
+
+      SubtractCounters ( Surface->LastFrame, Surface->Counters,
+         Surface->FrameBase );
+
+      Surface->FrameBase = Surface->Counters;
+   }
+
+   LeaveCriticalSection ( &RegistryLock );
+#endif
+}
+
+void DirectDrawManager::GetLossStats ( LossStats &Stats ) {
+   EnterCriticalSection ( &RegistryLock );
+
+   Stats = Losses;
+
+   LeaveCriticalSection ( &RegistryLock );
+}
+
+DirectDrawSurface::DirectDrawSurface () {
+   ShouldRepaint = UseSourceColorKey = TypeSet = Created = false;
+   PropChainCount = 0;
+   PropLum = PropAlpha = false;
+   PropCompression = BlockNone;
+   PropWidth = PropHeight = PropBPP = 0;
+   SurfWidth = SurfHeight = SurfPitch = SurfBytesPerPixel = 0;   
+
+   Surface7 = NULL;
+   Palette  = NULL;
+
+   Owner  = NULL;
+   Lender = NULL;
+   NextLoan = PreviousLoan = NULL;
+   NextSurface = PreviousSurface = NULL;
+
+   RepaintFunction   = NULL;
+   RepaintContext    = NULL;
+   RepaintAfterCount = 0;
+
+   Backup = NULL;
+
+   RestoredSweep = VisitedSweep = RepaintedSweep = 0;
+   RepaintIndex  = 0;
+
+   PropBlendMode = BlendOpaque;
+   BlendMask     = NULL;
+   BlendOpacity  = 255;
+
+   BackBufferCount = 0;
+   MipLevelCount   = 0;
+
+   SysBlock = SysMemory = NULL;
+   SysBufferCount = SysFront = SysLockCount = 0;
+
+   ZeroMemory ( SysMipMemory, sizeof ( SysMipMemory ) );
+   ZeroMemory ( SysMipPitch,  sizeof ( SysMipPitch ) );
+
+   KeyLow = KeyHigh = 0;
+
+   PartialPresent = false;
+
+   ZeroMemory ( &Presents, sizeof ( PresentStats ) );
+
+   FastClear = ClearPending = ClearIsDepth = false;
+   ClearValue = 0;
+   ClearTiles = NULL;
+   ClearTilesAcross = ClearTilesDown = ClearTilesPending = 0;
+
+   ZeroMemory ( &Clears, sizeof ( ClearStats ) );
+
+   LockedCount = 0;
+
+#ifdef DIRECTDRAW_COUNTERS
+   ZeroMemory ( &Counters,   sizeof ( RawCounters ) );
+   ZeroMemory ( &FrameBase,  sizeof ( RawCounters ) );
+   ZeroMemory ( &LastFrame,  sizeof ( RawCounters ) );
+#endif
+
+   TraceId = NewTraceId ();
+}
+
+DirectDrawSurface::~DirectDrawSurface () {
+   if ( Lender != NULL )
+      Lender->Unlend ( *this );
+
+   if ( Owner != NULL )
+      Owner->Unregister ( *this );
+
+   delete Backup;
+
+   InvalidateBackBuffers ();
+   InvalidateMipLevels ();
+
+   if ( Created && Surface7 != NULL )
+      Surface7->Release ();
+
+   if ( SysBlock != NULL )
+      delete [] SysBlock;
+
+   if ( ClearTiles != NULL )
+      delete [] ClearTiles;
+}
+
+LPBYTE DirectDrawSurface::SystemBuffer ( LONG Index ) {
+   // Buffers of a system memory flip chain are stored one
+   // after the other:
+   return SysMemory + ( Index % SysBufferCount ) *
+      SurfPitch * SurfHeight;
+}
+
+LPBYTE DirectDrawSurface::DrawBuffer () {
+   // The system memory buffer blits and clears write to:
+   if ( PropSurfaceType == Primary && PartialPresent )
+      return SystemBuffer ( SysFront + 1 );
+
+   return SystemBuffer ( SysFront );
+}
+
+HRESULT DirectDrawSurface::GetDrawTarget (
+        LPDIRECTDRAWSURFACE7 *Target ) {
+
+   HRESULT Val;
+
+   // The interface blits and clears write to:
+
+   if ( PropSurfaceType == Primary && PartialPresent ) {
+      Val = ResolveBackBuffers ();
+
+      if ( FAILED ( Val ) )
+         return Val;
+
+      ( *Target ) = BackBuffers [ 0 ];
+
+      return DD_OK;
+   }
+
+   ( *Target ) = Surface7;
+
+   return DD_OK;
+}
+
+bool DirectDrawSurface::RestoreLost () {
+   // Restore the surface if it was lost:
+
+   if ( Surface7->IsLost () == DD_OK )
+      return true;
+
+   return RestoreSurface ();
+}
+
+bool DirectDrawSurface::RestoreSurface () {
+   RECT All;
+
+   // The backbuffer and mip level attachments are
+   // resolved again afterwards:
+
+   InvalidateBackBuffers ();
+   InvalidateMipLevels ();
+
+   COUNT_SCOPE ( *this, CounterRestore, 0 );
+   TRACE_SCOPE ( *this, CounterRestore, 0, SurfWidth, SurfHeight );
+
+   if ( FAILED ( Surface7->Restore () ) )
+      return false;
+
+   // Nothing is known about the depths of a restored
+   // z-buffer until it is redrawn:
+   if ( HiZ.IsCreated () ) {
+      All.left = 0; All.top = 0;
+      All.right = SurfWidth; All.bottom = SurfHeight;
+
+      HiZ.Invalidate ( All );
+   }
+
+   ShouldRepaint = true;
+
+   return true;
+}
+
+bool DirectDrawSurface::RetryAfterLoss ( HRESULT Val,
+        LONG &Attempts ) {
+
+   // Loss is found by the call that fails rather than
+   // checked for before every call. The call is made once
+   // more after a sweep:
+
+   if ( Val != DDERR_SURFACELOST || Attempts++ > 0 )
+      return false;
+
+   if ( Owner != NULL )
+      return Owner->RestoreSurfaces ();
+
+   return RestoreLost ();
+}
+
+HRESULT DirectDrawSurface::ResolveBackBuffers () {
+   LPDIRECTDRAWSURFACE7 Previous;
+   DDSCAPS2 SurfaceCaps;
+   LONG Count;
+   HRESULT Val;
+
+   if ( BackBufferCount > 0 )
+      return DD_OK;
+
+   // Walk the flip chain once: the front buffer's
+   // backbuffer first, then each buffer's successor:
+
+   Count = GetBackBufferCount ();
+
+   ZeroMemory ( &SurfaceCaps, sizeof ( DDSCAPS2 ) );
+   SurfaceCaps.dwCaps = DDSCAPS_BACKBUFFER;
+
+   Previous = Surface7;
+
+   while ( BackBufferCount < Count ) {
+      Val = Previous->GetAttachedSurface ( &SurfaceCaps,
+         &BackBuffers [ BackBufferCount ] );
+
+      if ( FAILED ( Val ) ) {
+         InvalidateBackBuffers ();
+
+         return Val;
+      }
+
+      Previous = BackBuffers [ BackBufferCount++ ];
+
+      SurfaceCaps.dwCaps = DDSCAPS_FLIP;
+   }
+
+   return DD_OK;
+}
+
+void DirectDrawSurface::InvalidateBackBuffers () {
+   while ( BackBufferCount > 0 )
+      BackBuffers [ --BackBufferCount ]->Release ();
+}
+
+inline DWORD ReadPixel ( LPBYTE Pixel, LONG BytesPerPixel ) {
+   switch ( BytesPerPixel ) {
+      case 1:
+         return *Pixel;
+      case 2:
+         return *( WORD * ) Pixel;
+      case 3:
+         return Pixel [ 0 ] | ( Pixel [ 1 ] << 8 ) |
+            ( Pixel [ 2 ] << 16 );
+   }
+
+   return *( DWORD * ) Pixel;
+}
+
+inline void WritePixel ( LPBYTE Pixel, LONG BytesPerPixel,
+        DWORD Value ) {
+
+   switch ( BytesPerPixel ) {
+      case 1:
+         *Pixel = ( BYTE ) Value;
+      break;
+      case 2:
+         *( WORD * ) Pixel = ( WORD ) Value;
+      break;
+      case 3:
+         Pixel [ 0 ] = ( BYTE ) ( Value );
+         Pixel [ 1 ] = ( BYTE ) ( Value >> 8 );
+         Pixel [ 2 ] = ( BYTE ) ( Value >> 16 );
+      break;
+      default:
+         *( DWORD * ) Pixel = Value;
+      break;
+   }
+}
+
+bool RectInside ( RECT &Rect, LONG Width, LONG Height ) {
+   // DirectDraw rejects empty rects and rects that cross
+   // the surface edge; system memory surfaces do the same:
+   return Rect.left >= 0 && Rect.top >= 0 &&
+      Rect.right <= Width && Rect.bottom <= Height &&
+      Rect.left < Rect.right && Rect.top < Rect.bottom;
+}
+
+static bool SameRect ( RECT &A, RECT &B ) {
+   return A.left == B.left && A.top == B.top &&
+      A.right == B.right && A.bottom == B.bottom;
+}
+
+static LONG RectWidth ( RECT *Rect, LONG Width ) {
+   return Rect != NULL ? Rect->right - Rect->left : Width;
+}
+
+static LONG RectHeight ( RECT *Rect, LONG Height ) {
+   return Rect != NULL ? Rect->bottom - Rect->top : Height;
+}
+
+#ifdef DIRECTDRAW_COUNTERS
+static DWORD RectPixels ( RECT *Rect, LONG Width, LONG Height ) {
+   if ( Rect == NULL )
+      return ( DWORD ) ( Width * Height );
+
+   return ( DWORD ) ( ( Rect->right - Rect->left ) *
+      ( Rect->bottom - Rect->top ) );
+}
+#endif
+
+bool DirectDrawSurface::SystemBlit ( RECT &Portion,
+        DirectDrawSurface &Dest, RECT &DestRect ) {
+
+   LONG SrcWidth, SrcHeight, DestWidth, DestHeight,
+      BytesPerPixel, X, Y;
+   LPBYTE Src, Dst, SrcRow, DstRow;
+   DWORD Pixel;
+
+   // Blit between two system memory surfaces:
+
+   if ( SysMemory == NULL || Dest.SysMemory == NULL )
+      return false;
+
+   // Blocks cannot be copied pixel by pixel:
+   if ( PropCompression != BlockNone ||
+        Dest.PropCompression != BlockNone )
+      return false;
+
+   if ( SurfBytesPerPixel != Dest.SurfBytesPerPixel )
+      return false;
+
+   if ( !RectInside ( Portion, SurfWidth, SurfHeight ) ||
+        !RectInside ( DestRect, Dest.SurfWidth,
+           Dest.SurfHeight ) )
+      return false;
+
+   BytesPerPixel = SurfBytesPerPixel;
+
+   SrcWidth   = Portion.right   - Portion.left;
+   SrcHeight  = Portion.bottom  - Portion.top;
+   DestWidth  = DestRect.right  - DestRect.left;
+   DestHeight = DestRect.bottom - DestRect.top;
+
+   Src = SystemBuffer ( SysFront ) + Portion.top * SurfPitch +
+      Portion.left * BytesPerPixel;
+
+   Dst = Dest.DrawBuffer () +
+      DestRect.top * Dest.SurfPitch +
+      DestRect.left * BytesPerPixel;
+
+   if ( SrcWidth == DestWidth && SrcHeight == DestHeight &&
+        !UseSourceColorKey ) {
+
+      // Opaque, unscaled copies move whole rows. When both
+      // rects are on the same surface and the destination
+      // lies below the source, copy from the bottom up:
+      if ( Dst > Src ) {
+         for ( Y = SrcHeight - 1; Y >= 0; Y-- )
+            memmove ( Dst + Y * Dest.SurfPitch,
+               Src + Y * SurfPitch,
+               SrcWidth * BytesPerPixel );
+      }
+      else {
+         for ( Y = 0; Y < SrcHeight; Y++ )
+            memmove ( Dst + Y * Dest.SurfPitch,
+               Src + Y * SurfPitch,
+               SrcWidth * BytesPerPixel );
+      }
+
+      return true;
+   }
+
+   // Stretched or color keyed blits go pixel by pixel,
+   // sampling the nearest source pixel:
+   for ( Y = 0; Y < DestHeight; Y++ ) {
+      SrcRow = Src + ( Y * SrcHeight / DestHeight ) * SurfPitch;
+      DstRow = Dst + Y * Dest.SurfPitch;
+
+      for ( X = 0; X < DestWidth; X++ ) {
+         Pixel = ReadPixel ( SrcRow + ( X * SrcWidth /
+            DestWidth ) * BytesPerPixel, BytesPerPixel );
+
+         if ( UseSourceColorKey && Pixel >= KeyLow &&
+              Pixel <= KeyHigh )
+            continue;
+
+         WritePixel ( DstRow + X * BytesPerPixel,
+            BytesPerPixel, Pixel );
+      }
+   }
+
+   return true;
+}
+
+bool DirectDrawSurface::ExpandBlit ( RECT &Portion,
+        DirectDrawSurface &Dest, RECT &DestRect ) {
+
+   DDPIXELFORMAT PF;
+   LPBYTE Src, Dst, SrcRow, Row = NULL;
+   DWORD *Lookup;
+   LONG SrcWidth, SrcHeight, DestWidth, DestHeight,
+      DestBuffer, X, Y;
+
+   // Blit palette indices to a true colour surface. Both
+   // surfaces are locked, so this works on either backend:
+
+   if ( Dest.PropCompression != BlockNone ||
+        !Dest.GetSurfaceFormat ( PF ) )
+      return false;
+
+   Lookup = Palette->GetLookup ( GetPixelFormat ( PF ) );
+
+   if ( Lookup == NULL )
+      return false;
+
+   if ( !RectInside ( Portion, SurfWidth, SurfHeight ) ||
+        !RectInside ( DestRect, Dest.SurfWidth,
+           Dest.SurfHeight ) )
+      return false;
+
+   SrcWidth   = Portion.right   - Portion.left;
+   SrcHeight  = Portion.bottom  - Portion.top;
+   DestWidth  = DestRect.right  - DestRect.left;
+   DestHeight = DestRect.bottom - DestRect.top;
+
+   // Stretched blits sample the nearest source index of
+   // each row first:
+   if ( SrcWidth != DestWidth ) {
+      Row = new BYTE [ DestWidth ];
+
+      if ( Row == NULL )
+         return false;
+   }
+
+   // Write where other blits would:
+   DestBuffer = Dest.PropSurfaceType == Primary &&
+      Dest.PartialPresent ? 0 : -1;
+
+   if ( !LockBuffer ( -1, ( LPVOID * ) &Src, &Portion,
+           true ) ) {
+      delete [] Row;
+      return false;
+   }
+
+   if ( !Dest.LockBuffer ( DestBuffer, ( LPVOID * ) &Dst,
+           &DestRect, false, !UseSourceColorKey ) ) {
+      UnlockBuffer ( -1, &Portion );
+      delete [] Row;
+      return false;
+   }
+
+   for ( Y = 0; Y < DestHeight; Y++ ) {
+      SrcRow = Src + ( Y * SrcHeight / DestHeight ) * SurfPitch;
+
+      if ( Row != NULL ) {
+         for ( X = 0; X < DestWidth; X++ )
+            Row [ X ] = SrcRow [ X * SrcWidth / DestWidth ];
+
+         SrcRow = Row;
+      }
+
+      ExpandPixels ( Dst + Y * Dest.SurfPitch, Dest.SurfPitch,
+         Dest.SurfBytesPerPixel, SrcRow, 0, DestWidth, 1, Lookup,
+         UseSourceColorKey, ( BYTE ) KeyLow, ( BYTE ) KeyHigh );
+   }
+
+   Dest.UnlockBuffer ( DestBuffer, &DestRect );
+   UnlockBuffer ( -1, &Portion );
+
+   delete [] Row;
+
+   return true;
+}
+
+bool DirectDrawSurface::BlendBlit ( RECT &Portion,
+        DirectDrawSurface &Dest, RECT &DestRect ) {
+
+   DDPIXELFORMAT PF;
+   PixelFormat SrcFormat, DestFormat;
+   LPBYTE Src, Dst, Alpha = NULL, SrcRow, MaskRow = NULL,
+      Row = NULL, MaskSamples = NULL;
+   DWORD *Lookup = NULL;
+   LONG SrcWidth, SrcHeight, DestWidth, DestHeight,
+      DestBuffer, SrcX, SrcY, X, Y;
+
+   // Blend the portion into the destination. All three
+   // surfaces are locked, so this works on either backend:
+
+   if ( PropCompression != BlockNone ||
+        Dest.PropCompression != BlockNone ||
+        !GetSurfaceFormat ( PF ) )
+      return false;
+
+   SrcFormat = GetPixelFormat ( PF );
+
+   if ( !Dest.GetSurfaceFormat ( PF ) )
+      return false;
+
+   DestFormat = GetPixelFormat ( PF );
+
+   if ( SrcFormat == FormatUnknown || DestFormat == FormatUnknown ||
+        DestFormat == Format8 )
+      return false;
+
+   if ( SrcFormat == Format8 ) {
+      if ( Palette == NULL )
+         return false;
+
+      Lookup = Palette->GetLookup ( Format8888 );
+
+      if ( Lookup == NULL )
+         return false;
+   }
+
+   if ( !RectInside ( Portion, SurfWidth, SurfHeight ) ||
+        !RectInside ( DestRect, Dest.SurfWidth,
+           Dest.SurfHeight ) )
+      return false;
+
+   SrcWidth   = Portion.right   - Portion.left;
+   SrcHeight  = Portion.bottom  - Portion.top;
+   DestWidth  = DestRect.right  - DestRect.left;
+   DestHeight = DestRect.bottom - DestRect.top;
+
+   // Stretched blits sample the nearest source pixel (and
+   // mask value) of each row first:
+   if ( SrcWidth != DestWidth ) {
+      Row = new BYTE [ DestWidth * ( SurfBytesPerPixel + 1 ) ];
+
+      if ( Row == NULL )
+         return false;
+
+      MaskSamples = Row + DestWidth * SurfBytesPerPixel;
+   }
+
+   // Write where other blits would:
+   DestBuffer = Dest.PropSurfaceType == Primary &&
+      Dest.PartialPresent ? 0 : -1;
+
+   if ( !LockBuffer ( -1, ( LPVOID * ) &Src, &Portion,
+           true ) ) {
+      delete [] Row;
+      return false;
+   }
+
+   if ( BlendMask != NULL &&
+        !BlendMask->LockBuffer ( -1, ( LPVOID * ) &Alpha,
+           &Portion, true ) ) {
+      UnlockBuffer ( -1, &Portion );
+      delete [] Row;
+      return false;
+   }
+
+   if ( !Dest.LockBuffer ( DestBuffer, ( LPVOID * ) &Dst,
+           &DestRect ) ) {
+      if ( BlendMask != NULL )
+         BlendMask->UnlockBuffer ( -1, &Portion );
+
+      UnlockBuffer ( -1, &Portion );
+      delete [] Row;
+      return false;
+   }
+
+   for ( Y = 0; Y < DestHeight; Y++ ) {
+      SrcY   = Y * SrcHeight / DestHeight;
+      SrcRow = Src + SrcY * SurfPitch;
+
+      if ( Alpha != NULL )
+         MaskRow = Alpha + SrcY * BlendMask->SurfPitch;
+
+      if ( Row != NULL ) {
+         for ( X = 0; X < DestWidth; X++ ) {
+            SrcX = X * SrcWidth / DestWidth;
+
+            memcpy ( Row + X * SurfBytesPerPixel,
+               SrcRow + SrcX * SurfBytesPerPixel,
+               SurfBytesPerPixel );
+
+            if ( MaskRow != NULL )
+               MaskSamples [ X ] = MaskRow [ SrcX ];
+         }
+
+         SrcRow = Row;
+
+         if ( MaskRow != NULL )
+            MaskRow = MaskSamples;
+      }
+
+      BlendPixels ( Dst + Y * Dest.SurfPitch, Dest.SurfPitch,
+         DestFormat, SrcRow, 0, SrcFormat, DestWidth, 1,
+         PropBlendMode, BlendOpacity, MaskRow, 0, Lookup,
+         UseSourceColorKey, KeyLow, KeyHigh );
+   }
+
+   Dest.UnlockBuffer ( DestBuffer, &DestRect );
+
+   if ( BlendMask != NULL )
+      BlendMask->UnlockBuffer ( -1, &Portion );
+
+   UnlockBuffer ( -1, &Portion );
+
+   delete [] Row;
+
+   return true;
+}
+
+bool DirectDrawSurface::SystemFill ( DWORD Value,
+        RECT *Rect ) {
+
+   LONG Left = 0, Top = 0, Right, Bottom;
+
+   // Fill the (front) buffer of a system memory surface,
+   // or a rect of it, with a raw pixel value:
+
+   if ( SysMemory == NULL || PropCompression != BlockNone )
+      return false;
+
+   Right = SurfWidth; Bottom = SurfHeight;
+
+   if ( Rect != NULL ) {
+      if ( !RectInside ( *Rect, SurfWidth, SurfHeight ) )
+         return false;
+
+      Left  = Rect->left;  Top    = Rect->top;
+      Right = Rect->right; Bottom = Rect->bottom;
+   }
+
+   FillPixels ( DrawBuffer () + Top * SurfPitch +
+      Left * SurfBytesPerPixel, SurfPitch, SurfBytesPerPixel,
+      Right - Left, Bottom - Top, Value );
+
+   return true;
+}
+
+bool DirectDrawSurface::BeginLazyClear ( DWORD Value,
+        bool Depth ) {
+
+   LONG Tiles;
+
+   if ( ClearTiles == NULL ) {
+      ClearTilesAcross = ( SurfWidth  + ClearTileSize - 1 ) /
+         ClearTileSize;
+      ClearTilesDown   = ( SurfHeight + ClearTileSize - 1 ) /
+         ClearTileSize;
+
+      ClearTiles = new BYTE [ ClearTilesAcross *
+         ClearTilesDown ];
+
+      if ( ClearTiles == NULL )
+         return false;
+   }
+
+   Tiles = ClearTilesAcross * ClearTilesDown;
+
+   // Tiles still waiting for the last clear never needed
+   // it:
+   Clears.TilesDiscarded += ClearTilesPending;
+   Clears.LazyClears++;
+
+   memset ( ClearTiles, 1, Tiles );
+
+   ClearTilesPending = Tiles;
+   ClearPending = true;
+   ClearValue   = Value;
+   ClearIsDepth = Depth;
+
+   return true;
+}
+
+void DirectDrawSurface::DiscardClear () {
+   if ( !ClearPending )
+      return;
+
+   Clears.TilesDiscarded += ClearTilesPending;
+
+   ClearTilesPending = 0;
+   ClearPending = false;
+}
+
+bool DirectDrawSurface::FillClearRun ( RECT &Rect ) {
+   DDBLTFX BlitFX;
+   HRESULT Val;
+
+   // Write the pending clear value to a run of tiles:
+
+   if ( SysMemory != NULL )
+      return SystemFill ( ClearValue, &Rect );
+
+   ZeroMemory ( ( void * ) &BlitFX, sizeof ( DDBLTFX ) );
+   BlitFX.dwSize = sizeof ( DDBLTFX );
+
+   if ( ClearIsDepth ) {
+      BlitFX.dwFillDepth = ClearValue;
+
+      Val = Surface7->Blt ( &Rect, NULL, NULL,
+         DDBLT_DEPTHFILL | DDBLT_WAIT, &BlitFX );
+   }
+   else {
+      if ( !PropAlpha )
+         BlitFX.dwFillColor = ClearValue;
+      else BlitFX.dwFillPixel = ClearValue;
+
+      Val = Surface7->Blt ( &Rect, NULL, NULL,
+         DDBLT_COLORFILL | DDBLT_WAIT, &BlitFX );
+   }
+
+   if ( FAILED ( Val ) )
+      return PrintDirectDrawError ( Val );
+
+   return true;
+}
+
+bool DirectDrawSurface::ResolveClear ( RECT *Rect,
+        RECT *Covered ) {
+
+   RECT Area, Tile, Run;
+   LONG TileX, TileY, Left, Top, Right, Bottom, RunFirst = 0;
+   bool InRun = false;
+   LPBYTE Pending;
+
+   // Fill the pending tiles that overlap Rect (all of them
+   // for NULL). Tiles entirely inside Covered are about to
+   // be overwritten, so they are left pending, for
+   // CoverClear to drop once the write has succeeded:
+
+   if ( !ClearPending )
+      return true;
+
+   if ( Rect != NULL )
+      Area = *Rect;
+   else {
+      Area.left = 0; Area.top = 0;
+      Area.right = SurfWidth; Area.bottom = SurfHeight;
+   }
+
+   Left   = Area.left < 0 ? 0 : Area.left / ClearTileSize;
+   Top    = Area.top  < 0 ? 0 : Area.top  / ClearTileSize;
+   Right  = ( Area.right  + ClearTileSize - 1 ) / ClearTileSize;
+   Bottom = ( Area.bottom + ClearTileSize - 1 ) / ClearTileSize;
+
+   if ( Right  > ClearTilesAcross ) Right  = ClearTilesAcross;
+   if ( Bottom > ClearTilesDown   ) Bottom = ClearTilesDown;
+
+   for ( TileY = Top; TileY < Bottom; TileY++ ) {
+      for ( TileX = Left; TileX <= Right; TileX++ ) {
+         Pending = &ClearTiles [ TileY * ClearTilesAcross +
+            TileX ];
+
+         if ( TileX < Right && *Pending ) {
+            Tile.left   = TileX * ClearTileSize;
+            Tile.top    = TileY * ClearTileSize;
+            Tile.right  = Tile.left + ClearTileSize;
+            Tile.bottom = Tile.top  + ClearTileSize;
+
+            if ( Tile.right  > SurfWidth  ) Tile.right  = SurfWidth;
+            if ( Tile.bottom > SurfHeight ) Tile.bottom = SurfHeight;
+
+            if ( Covered == NULL ||
+                 Tile.left   < Covered->left  ||
+                 Tile.top    < Covered->top   ||
+                 Tile.right  > Covered->right ||
+                 Tile.bottom > Covered->bottom ) {
+
+               // Neighbouring tiles in a row are filled
+               // together:
+               if ( InRun )
+                  Run.right = Tile.right;
+               else {
+                  Run      = Tile;
+                  RunFirst = TileX;
+               }
+
+               InRun = true;
+
+               continue;
+            }
+         }
+
+         // The run's tiles stay pending until it is filled:
+         if ( InRun ) {
+            InRun = false;
+
+            if ( !FillClearRun ( Run ) )
+               return false;
+
+            memset ( &ClearTiles [ TileY * ClearTilesAcross +
+               RunFirst ], 0, TileX - RunFirst );
+
+            ClearTilesPending  -= TileX - RunFirst;
+            Clears.TilesFilled  += TileX - RunFirst;
+         }
+      }
+   }
+
+   if ( ClearTilesPending == 0 )
+      ClearPending = false;
+
+   return true;
+}
+
+void DirectDrawSurface::CoverClear ( RECT &Covered ) {
+   LONG TileX, TileY, Left, Top, Right, Bottom;
+   LONG TileRight, TileBottom;
+   LPBYTE Pending;
+
+   // Covered has been written over, so the pending tiles
+   // entirely inside it need no clear any more:
+
+   if ( !ClearPending )
+      return;
+
+   Left   = Covered.left < 0 ? 0 :
+      ( Covered.left + ClearTileSize - 1 ) / ClearTileSize;
+   Top    = Covered.top  < 0 ? 0 :
+      ( Covered.top  + ClearTileSize - 1 ) / ClearTileSize;
+   Right  = ( Covered.right  + ClearTileSize - 1 ) / ClearTileSize;
+   Bottom = ( Covered.bottom + ClearTileSize - 1 ) / ClearTileSize;
+
+   if ( Right  > ClearTilesAcross ) Right  = ClearTilesAcross;
+   if ( Bottom > ClearTilesDown   ) Bottom = ClearTilesDown;
+
+   for ( TileY = Top; TileY < Bottom; TileY++ ) {
+      TileBottom = ( TileY + 1 ) * ClearTileSize;
+
+      if ( TileBottom > SurfHeight ) TileBottom = SurfHeight;
+
+      if ( TileBottom > Covered.bottom )
+         break;
+
+      for ( TileX = Left; TileX < Right; TileX++ ) {
+         TileRight = ( TileX + 1 ) * ClearTileSize;
+
+         if ( TileRight > SurfWidth ) TileRight = SurfWidth;
+
+         if ( TileRight > Covered.right )
+            break;
+
+         Pending = &ClearTiles [ TileY * ClearTilesAcross +
+            TileX ];
+
+         if ( *Pending ) {
+            *Pending = 0;
+            ClearTilesPending--;
+
+            Clears.TilesOverwritten++;
+         }
+      }
+   }
+
+   if ( ClearTilesPending == 0 )
+      ClearPending = false;
+}
+
+bool DirectDrawSurface::SetFastClear ( bool Enable ) {
+   if ( Enable && ( PropSurfaceType == Primary ||
+        PropCompression != BlockNone ) )
+      return false;
+
+   if ( !Enable && Created && !ResolveClear ( NULL ) )
+      return false;
+
+   FastClear = Enable;
+
+   return true;
+}
+
+void DirectDrawSurface::GetClearStats ( ClearStats &Stats ) {
+   Stats = Clears;
+}
+
+bool DirectDrawSurface::LockBuffer ( LONG Buffer,
+        LPVOID *Pointer, RECT *Rect, bool ReadOnly,
+        bool Overwrite ) {
+
+   LPDIRECTDRAWSURFACE7 Target;
+   DDSURFACEDESC2       SurfaceDesc;
+   HRESULT              Val;
+   LPBYTE               SurfaceMemory;
+   LONG                 Attempts = 0;
+
+   // Obtain a pointer to the memory of backbuffer Buffer,
+   // or of the surface itself if Buffer is negative:
+
+   if ( Buffer < 0 && !ResolveClear ( Rect,
+           Overwrite ? Rect : NULL ) )
+      return false;
+
+   ZeroMemory ( &SurfaceDesc, sizeof ( DDSURFACEDESC2 ) );
+
+   SurfaceDesc.dwSize = sizeof ( DDSURFACEDESC2 );
+
+   if ( SysMemory != NULL ) {
+      // The backbuffers of a system memory chain follow the
+      // front buffer, as with a hardware flip chain:
+      SurfaceMemory = SystemBuffer ( SysFront + 1 + Buffer );
+
+      if ( Rect != NULL ) {
+         if ( !RectInside ( *Rect, SurfWidth, SurfHeight ) )
+            return false;
+
+         if ( PropCompression != BlockNone ) {
+            // Rects of a compressed surface start on a
+            // block:
+            if ( ( Rect->left & 3 ) != 0 || ( Rect->top & 3 ) != 0 )
+               return false;
+
+            SurfaceMemory += ( Rect->top / 4 ) * SurfPitch +
+               ( Rect->left / 4 ) * GetBlockBytes ( PropCompression );
+         }
+         else
+            SurfaceMemory += Rect->top * SurfPitch +
+               Rect->left * SurfBytesPerPixel;
+      }
+
+      SysLockCount++;
+
+      if ( Buffer <= 0 && !ReadOnly )
+         Dirty.Add ( Rect );
+
+      if ( Buffer < 0 )
+         RecordLock ( SurfaceMemory, SurfPitch, Rect, ReadOnly );
+
+      COUNT_START ();
+      TRACE_EVENT ( *this, CounterLock, TraceBegin,
+         RectWidth ( Rect, SurfWidth ),
+         RectHeight ( Rect, SurfHeight ) );
+
+      ( *Pointer ) = SurfaceMemory;
+
+      return true;
+   }
+
+   do {
+      Target = Surface7;
+
+      if ( Buffer >= 0 ) {
+         Val = ResolveBackBuffers ();
+
+         if ( FAILED ( Val ) )
+            return PrintDirectDrawError ( Val );
+
+         Target = BackBuffers [ Buffer ];
+      }
+
+      Val = Target->Lock ( Rect, &SurfaceDesc,
+         DDLOCK_NOSYSLOCK | DDLOCK_WAIT |
+         ( ReadOnly ? DDLOCK_READONLY : 0 ), NULL );
+   } while ( RetryAfterLoss ( Val, Attempts ) );
+
+   if ( FAILED ( Val ) )
+      return PrintDirectDrawError ( Val );
+
+   if ( Buffer <= 0 && !ReadOnly )
+      Dirty.Add ( Rect );
+
+   if ( Buffer < 0 )
+      RecordLock ( ( LPBYTE ) SurfaceDesc.lpSurface,
+         SurfaceDesc.lPitch, Rect, ReadOnly );
+
+   COUNT_START ();
+   TRACE_EVENT ( *this, CounterLock, TraceBegin,
+      RectWidth ( Rect, SurfWidth ), RectHeight ( Rect, SurfHeight ) );
+
+   ( *Pointer ) = SurfaceDesc.lpSurface;
+
+   return true;
+}
+
+bool DirectDrawSurface::UnlockBuffer ( LONG Buffer,
+        RECT *Rect ) {
+
+   LPDIRECTDRAWSURFACE7 Target;
+   HRESULT              Val;
+
+   // Pick up the depths written under the lock:
+   if ( Buffer < 0 )
+      EndLock ( Rect );
+
+   if ( SysMemory != NULL ) {
+      if ( SysLockCount == 0 )
+         return false;
+
+      SysLockCount--;
+
+      COUNT_STOP ( *this, CounterLock,
+         RectPixels ( Rect, SurfWidth, SurfHeight ) );
+      TRACE_EVENT ( *this, CounterLock, TraceEnd,
+         RectWidth ( Rect, SurfWidth ),
+         RectHeight ( Rect, SurfHeight ) );
+
+      return true;
+   }
+
+   Target = Surface7;
+
+   if ( Buffer >= 0 ) {
+      // Unlocking never resolves the chain again, since the
+      // lock must have done so:
+      if ( Buffer >= BackBufferCount )
+         return false;
+
+      Target = BackBuffers [ Buffer ];
+   }
+
+   Val = Target->Unlock ( Rect );
+
+   // A failed unlock still ends the lock's timing and its
+   // slice in the trace:
+   COUNT_STOP ( *this, CounterLock,
+      RectPixels ( Rect, SurfWidth, SurfHeight ) );
+   TRACE_EVENT ( *this, CounterLock, TraceEnd,
+      RectWidth ( Rect, SurfWidth ), RectHeight ( Rect, SurfHeight ) );
+
+   if ( FAILED ( Val ) )
+      return PrintDirectDrawError ( Val );
+
+   return true;
+}
+
+void DirectDrawSurface::RecordLock ( LPBYTE Memory,
+        LONG Pitch, RECT *Rect, bool ReadOnly ) {
+
+   LockedArea *Area;
+
+   if ( !HiZ.IsCreated () || LockedCount == MaxLockedAreas )
+      return;
+
+   Area = &LockedAreas [ LockedCount++ ];
+
+   Area->Memory   = Memory;
+   Area->Pitch    = Pitch;
+   Area->ReadOnly = ReadOnly;
+
+   if ( Rect != NULL )
+      Area->Rect = *Rect;
+   else {
+      Area->Rect.left = 0; Area->Rect.top = 0;
+      Area->Rect.right = SurfWidth; Area->Rect.bottom = SurfHeight;
+   }
+}
+
+void DirectDrawSurface::EndLock ( RECT *Rect ) {
+   RECT Ended;
+   LONG Index;
+
+   if ( Rect != NULL )
+      Ended = *Rect;
+   else {
+      Ended.left = 0; Ended.top = 0;
+      Ended.right = SurfWidth; Ended.bottom = SurfHeight;
+   }
+
+   // Locks usually end innermost first, but the one ended
+   // is found by its rect:
+   for ( Index = LockedCount - 1; Index >= 0; Index-- ) {
+      if ( SameRect ( LockedAreas [ Index ].Rect, Ended ) )
+         break;
+   }
+
+   if ( Index < 0 ) {
+      // A lock that was not recorded, taken before the
+      // pyramid was created or nested too deeply:
+      HiZ.Invalidate ( Ended );
+
+      return;
+   }
+
+   // Depths read through a ReadOnly lock are unchanged, so
+   // the pyramid is left as it is:
+   if ( !LockedAreas [ Index ].ReadOnly )
+      HiZ.Update ( LockedAreas [ Index ].Memory,
+         LockedAreas [ Index ].Pitch, LockedAreas [ Index ].Rect );
+
+   for ( LockedCount--; Index < LockedCount; Index++ )
+      LockedAreas [ Index ] = LockedAreas [ Index + 1 ];
+}
+
+bool DirectDrawSurface::EnableHiZ ( bool Enable ) {
+   LPVOID Memory;
+
+   if ( !Created || PropSurfaceType != ZBuffer )
+      return false;
+
+   if ( !Enable ) {
+      HiZ.Destroy ();
+
+      return true;
+   }
+
+   if ( HiZ.IsCreated () )
+      return true;
+
+   if ( !HiZ.Create ( SurfWidth, SurfHeight,
+           SurfBytesPerPixel, PropBPP ) )
+      return false;
+
+   // Read the current depths once:
+   if ( !StartAccess ( &Memory ) ) {
+      HiZ.Destroy ();
+
+      return false;
+   }
+
+   return EndAccess ();
+}
+
+bool DirectDrawSurface::StartAccess ( LPVOID *Pointer,
+        RECT *Rect ) {
+
+   if ( !Created )
+      return false;
+
+   // If the surface is a primary surface, make sure we
+   // obtain a pointer to the backbuffer, since that is the
+   // surface the application probably wants to write to:
+   if ( PropSurfaceType == Primary )
+      return LockBuffer ( 0, Pointer, Rect );
+
+   return LockBuffer ( -1, Pointer, Rect );
+}
+
+bool DirectDrawSurface::StartReadAccess ( LPVOID *Pointer,
+        RECT *Rect ) {
+
+   if ( !Created )
+      return false;
+
+   if ( PropSurfaceType == Primary )
+      return LockBuffer ( 0, Pointer, Rect, true );
+
+   return LockBuffer ( -1, Pointer, Rect, true );
+}
+
+bool DirectDrawSurface::EndAccess ( RECT *Rect ) {
+   // End access to the surface:
+
+   if ( !Created )
+      return false;
+
+   if ( PropSurfaceType == Primary )
+      return UnlockBuffer ( 0, Rect );
+
+   return UnlockBuffer ( -1, Rect );
+}
+
+bool DirectDrawSurface::StartBackBufferAccess ( LONG Index,
+        LPVOID *Pointer, RECT *Rect ) {
+
+   if ( !Created )
+      return false;
+
+   if ( Index < 0 || Index >= GetBackBufferCount () )
+      return false;
+
+   return LockBuffer ( Index, Pointer, Rect );
+}
+
+bool DirectDrawSurface::EndBackBufferAccess ( LONG Index,
+        RECT *Rect ) {
+
+   if ( !Created )
+      return false;
+
+   if ( Index < 0 || Index >= GetBackBufferCount () )
+      return false;
+
+   return UnlockBuffer ( Index, Rect );
+}
+
+bool DirectDrawSurface::SetSurfaceType (
+        SurfaceType Type ) {
+
+   if ( Created )
+      return false;
+
+   PropSurfaceType = Type;
+
+   TypeSet = true;
+
+   return true;
+}
+
+bool DirectDrawSurface::SetGeneralOptions ( LONG Width,
+        LONG Height, LONG BPP ) {
+
+   if ( Created )
+      return false;
+
+   PropWidth         = Width;
+   PropHeight        = Height;
+   PropBPP           = BPP;
+
+   return true;
+}
+
+bool DirectDrawSurface::SetChainOptions (
+        LONG ChainCount ) {
+
+   if ( Created )
+      return false;
+
+   if ( ChainCount < 1 || ChainCount > MaxBackBuffers )
+      return false;
+
+   PropChainCount = ChainCount;
+
+   return true;
+}
+
+bool DirectDrawSurface::SetTextureOptions ( bool Alpha,
+        BlockCompression Compression ) {
+
+   if ( Created )
+      return false;
+
+   PropAlpha       = Alpha;
+   PropCompression = Compression;
+
+   return true;
+}
+
+bool DirectDrawSurface::SetBumpMapOptions (
+        bool Luminescence ) {
+
+   if ( Created )
+      return false;
+
+   PropLum = Luminescence;
+
+   return true;
+}
+
+bool DirectDrawSurface::Show ( bool EndFrame ) {
+   LONG Attempts = 0;
+   HRESULT Val;
+
+   // Display the backbuffer of a primary surface:
+
+   if ( !Created )
+      return false;
+
+   if ( PropSurfaceType != Primary )
+      return false;
+
+   if ( PartialPresent )
+      return PresentDirty ( EndFrame );
+
+   if ( SysMemory != NULL ) {
+      SysFront = ( SysFront + 1 ) % SysBufferCount;
+
+      COUNT_EVENT ( *this, CounterFlip, SurfWidth * SurfHeight );
+      TRACE_EVENT ( *this, CounterFlip, TraceInstant, SurfWidth,
+         SurfHeight );
+
+      RecordPresent ( SurfWidth * SurfHeight, EndFrame );
+
+      return true;
+   }
+
+   // The wait is counted in the frame it ends:
+   {
+      COUNT_SCOPE ( *this, CounterFlip, SurfWidth * SurfHeight );
+      TRACE_SCOPE ( *this, CounterFlip, 0, SurfWidth, SurfHeight );
+
+      do {
+         Val = Surface7->Flip ( NULL, DDFLIP_WAIT );
+      } while ( EndFrame && RetryAfterLoss ( Val, Attempts ) );
+   }
+
+   if ( FAILED ( Val ) )
+      return PrintDirectDrawError ( Val );
+
+   RecordPresent ( SurfWidth * SurfHeight, EndFrame );
+
+   // A loss found here is restored now; if that fails,
+   // the next frame finds it again:
+   if ( Owner != NULL && EndFrame )
+      Owner->CheckForLoss ();
+
+   return true;
+}
+
+bool DirectDrawSurface::PresentDirty ( bool EndFrame ) {
+   LPDIRECTDRAWSURFACE7 Backbuffer;
+   DDBLTFX BlitFX;
+   LPBYTE Front, Back;
+   RECT *Rect;
+   LONG Index, Y, Offset, Attempts = 0;
+   HRESULT Val;
+
+   // Copy the dirty rects of the backbuffer to the front
+   // buffer; the backbuffer keeps the complete frame:
+
+   if ( SysMemory != NULL ) {
+      Front = SystemBuffer ( SysFront );
+      Back  = SystemBuffer ( SysFront + 1 );
+
+      for ( Index = 0; Index < Dirty.GetCount (); Index++ ) {
+         Rect = &Dirty.GetRect ( Index );
+
+         for ( Y = Rect->top; Y < Rect->bottom; Y++ ) {
+            Offset = Y * SurfPitch +
+               Rect->left * SurfBytesPerPixel;
+
+            memcpy ( Front + Offset, Back + Offset,
+               ( Rect->right - Rect->left ) *
+               SurfBytesPerPixel );
+         }
+      }
+
+      COUNT_EVENT ( *this, CounterFlip, Dirty.GetArea () );
+      TRACE_EVENT ( *this, CounterFlip, TraceInstant, SurfWidth,
+         SurfHeight );
+
+      RecordPresent ( Dirty.GetArea (), EndFrame );
+
+      return true;
+   }
+
+   ZeroMemory ( ( void * ) &BlitFX, sizeof ( DDBLTFX ) );
+   BlitFX.dwSize = sizeof ( DDBLTFX );
+
+   {
+      COUNT_SCOPE ( *this, CounterFlip, Dirty.GetArea () );
+      TRACE_SCOPE ( *this, CounterFlip, 0, SurfWidth, SurfHeight );
+
+      do {
+         Val = GetDrawTarget ( &Backbuffer );
+
+         if ( FAILED ( Val ) )
+            return PrintDirectDrawError ( Val );
+
+         for ( Index = 0; Index < Dirty.GetCount (); Index++ ) {
+            Rect = &Dirty.GetRect ( Index );
+
+            Val = Surface7->Blt ( Rect, Backbuffer, Rect,
+               DDBLT_WAIT, &BlitFX );
+
+            if ( FAILED ( Val ) )
+               break;
+         }
+      } while ( EndFrame && RetryAfterLoss ( Val, Attempts ) );
+   }
+
+   if ( FAILED ( Val ) )
+      return PrintDirectDrawError ( Val );
+
+   RecordPresent ( Dirty.GetArea (), EndFrame );
+
+   if ( Owner != NULL && EndFrame )
+      Owner->CheckForLoss ();
+
+   return true;
+}
+
+void DirectDrawSurface::RecordPresent ( DWORD Pixels,
+        bool EndFrame ) {
+
+   DWORD Total = SurfWidth * SurfHeight;
+
+   Presents.Frames++;
+   Presents.DirtyRects      = Dirty.GetCount ();
+   Presents.PresentedPixels = Pixels;
+   Presents.SavedPixels     = Total - Pixels;
+
+   Presents.TotalSavedPixels += Total - Pixels;
+
+   Dirty.Clear ();
+
+   if ( !EndFrame )
+      return;
+
+   AdvanceErrorFrame ();
+
+   if ( Owner != NULL )
+      Owner->EndFrameCounters ();
+}
+
+bool DirectDrawSurface::SetPartialPresent ( bool Enable,
+        LONG MaxRects ) {
+
+   if ( !Dirty.SetLimit ( MaxRects ) )
+      return false;
+
+   PartialPresent = Enable;
+
+   // Present everything once when switching modes:
+   Dirty.Add ( NULL );
+
+   return true;
+}
+
+void DirectDrawSurface::GetPresentStats (
+        PresentStats &Stats ) {
+
+   Stats = Presents;
+}
+
+bool DirectDrawSurface::GetOperationCounters (
+        OperationCounters &Stats ) {
+
+#ifdef DIRECTDRAW_COUNTERS
+   ConvertCounters ( Counters, Stats );
+
+   return true;
+#else
+   ZeroMemory ( &Stats, sizeof ( OperationCounters ) );
+
+   return false;
+#endif
+}
+
+bool DirectDrawSurface::GetFrameCounters (
+        OperationCounters &Stats ) {
+
+#ifdef DIRECTDRAW_COUNTERS
+   ConvertCounters ( LastFrame, Stats );
+
+   return true;
+#else
+   ZeroMemory ( &Stats, sizeof ( OperationCounters ) );
+
+   return false;
+#endif
+}
+
+void DirectDrawSurface::ResetOperationCounters () {
+#ifdef DIRECTDRAW_COUNTERS
+   ZeroMemory ( &Counters,  sizeof ( RawCounters ) );
+   ZeroMemory ( &FrameBase, sizeof ( RawCounters ) );
+   ZeroMemory ( &LastFrame, sizeof ( RawCounters ) );
+#endif
+}
+
+bool DirectDrawSurface::BlitTo ( DirectDrawSurface &Dest,
+        RECT &DestRect ) {
+
+   RECT Portion;
+
+   if ( !Created )
+      return false;
+
+   Portion.left = 0; Portion.top = 0;
+   Portion.right = PropWidth; Portion.bottom = PropHeight;
+
+   return BlitPortionTo ( Portion, Dest, DestRect );
+}
+
+bool DirectDrawSurface::BlitPortionTo ( RECT &Portion,
+        DirectDrawSurface &Dest, RECT &DestRect ) {
+
+   LPDIRECTDRAWSURFACE7 Target;
+   DDBLTFX BlitFX;
+   DWORD Flags = DDBLT_WAIT;
+   LONG Attempts = 0;
+   HRESULT Val;
+   bool Opaque;
+
+   if ( !Created )
+      return false;
+
+   COUNT_SCOPE ( Dest, CounterBlit,
+      RectPixels ( &DestRect, 0, 0 ) );
+   TRACE_SCOPE ( Dest, CounterBlit, TraceId,
+      DestRect.right - DestRect.left, DestRect.bottom - DestRect.top );
+
+   Opaque = !UseSourceColorKey && PropBlendMode == BlendOpaque;
+
+   // An opaque blit overwrites whatever a pending clear
+   // would have put under DestRect, though the clear is
+   // only dropped there once the blit has succeeded:
+   if ( !ResolveClear ( &Portion ) ||
+        !Dest.ResolveClear ( &DestRect,
+           Opaque ? &DestRect : NULL ) )
+      return false;
+
+   Dest.HiZ.Invalidate ( DestRect );
+
+   // Neither backend blends blits either:
+   if ( PropBlendMode != BlendOpaque )
+      return BlendBlit ( Portion, Dest, DestRect );
+
+   // Neither backend converts formats, so indices drawn to
+   // a true colour surface are expanded on the CPU:
+   if ( Palette != NULL && Dest.SurfBytesPerPixel > 1 ) {
+      if ( !ExpandBlit ( Portion, Dest, DestRect ) )
+         return false;
+
+      if ( Opaque )
+         Dest.CoverClear ( DestRect );
+
+      return true;
+   }
+
+   if ( SysMemory != NULL || Dest.SysMemory != NULL ) {
+      if ( !SystemBlit ( Portion, Dest, DestRect ) )
+         return false;
+
+      Dest.Dirty.Add ( &DestRect );
+
+      if ( Opaque )
+         Dest.CoverClear ( DestRect );
+
+      return true;
+   }
+
+   ZeroMemory ( ( void * ) &BlitFX, sizeof ( DDBLTFX ) );
+   BlitFX.dwSize = sizeof ( DDBLTFX );
+
+   if ( UseSourceColorKey )
+      Flags |= DDBLT_KEYSRC;
+
+   do {
+      Val = Dest.GetDrawTarget ( &Target );
+
+      if ( FAILED ( Val ) )
+         return PrintDirectDrawError ( Val );
+
+      Val = Target->Blt ( &DestRect, this->Surface7,
+         &Portion, Flags, &BlitFX );
+   } while ( RetryAfterLoss ( Val, Attempts ) );
+   
+   if ( FAILED ( Val ) )
+      return PrintDirectDrawError ( Val );
+
+   Dest.Dirty.Add ( &DestRect );
+
+   if ( Opaque )
+      Dest.CoverClear ( DestRect );
+
+   return true;
+}
+
+bool DirectDrawSurface::BlitTo ( DirectDrawSurface &Dest,
+        LONG DestX, LONG DestY ) {
+
+   RECT DestRect;
+
+   DestRect.left     = DestX;
+   DestRect.right    = DestX + PropWidth;
+   DestRect.top      = DestY;
+   DestRect.bottom   = DestY + PropHeight;
+
+   return BlitTo ( Dest, DestRect );
+}
+
+bool DirectDrawSurface::BlitPortionTo ( RECT &Portion,
+        DirectDrawSurface &Dest, LONG DestX, LONG DestY ) {
+
+   RECT DestRect;
+
+   DestRect.left     = DestX;
+   DestRect.right    = DestX + PropWidth;
+   DestRect.top      = DestY;
+   DestRect.bottom   = DestY + PropHeight;
+
+   return BlitPortionTo ( Portion, Dest, DestRect );
+}
+
+bool DirectDrawSurface::ScaleTo ( DirectDrawSurface &Dest,
+        RECT &DestRect, ScaleFilter Filter, ThreadPool *Pool ) {
+
+   RECT Portion;
+
+   if ( !Created )
+      return false;
+
+   Portion.left = 0; Portion.top = 0;
+   Portion.right = PropWidth; Portion.bottom = PropHeight;
+
+   return ScalePortionTo ( Portion, Dest, DestRect, Filter,
+      Pool );
+}
+
+bool DirectDrawSurface::ScalePortionTo ( RECT &Portion,
+        DirectDrawSurface &Dest, RECT &DestRect,
+        ScaleFilter Filter, ThreadPool *Pool ) {
+
+   DDPIXELFORMAT PF;
+   PixelFormat SrcFormat, DestFormat;
+   PALETTEENTRY *Entries = NULL;
+   LPBYTE Src, Dst;
+   LONG DestBuffer;
+   bool Result;
+
+   // Both surfaces are locked, so this works on either
+   // backend:
+
+   if ( !Created || &Dest == this ||
+        PropCompression != BlockNone ||
+        Dest.PropCompression != BlockNone )
+      return false;
+
+   if ( !RectInside ( Portion, SurfWidth, SurfHeight ) ||
+        !RectInside ( DestRect, Dest.SurfWidth,
+           Dest.SurfHeight ) )
+      return false;
+
+   if ( !GetSurfaceFormat ( PF ) )
+      return false;
+
+   SrcFormat = GetPixelFormat ( PF );
+
+   if ( !Dest.GetSurfaceFormat ( PF ) )
+      return false;
+
+   DestFormat = GetPixelFormat ( PF );
+
+   if ( SrcFormat == FormatUnknown || DestFormat == FormatUnknown )
+      return false;
+
+   if ( Palette != NULL )
+      Entries = Palette->GetEntries ();
+
+   // Keyed pixels leave the destination showing through,
+   // so only unkeyed scales cover DestRect, and only once
+   // they have succeeded:
+   if ( !ResolveClear ( &Portion ) ||
+        !Dest.ResolveClear ( &DestRect,
+           UseSourceColorKey ? NULL : &DestRect ) )
+      return false;
+
+   Dest.HiZ.Invalidate ( DestRect );
+
+   // Write where other blits would:
+   DestBuffer = Dest.PropSurfaceType == Primary &&
+      Dest.PartialPresent ? 0 : -1;
+
+   if ( !LockBuffer ( -1, ( LPVOID * ) &Src, &Portion,
+           true ) )
+      return false;
+
+   if ( !Dest.LockBuffer ( DestBuffer, ( LPVOID * ) &Dst,
+           &DestRect, false, !UseSourceColorKey ) ) {
+      UnlockBuffer ( -1, &Portion );
+      return false;
+   }
+
+   Result = ScalePixels ( Dst, Dest.SurfPitch, DestFormat,
+      DestRect.right - DestRect.left,
+      DestRect.bottom - DestRect.top, Src, SurfPitch, SrcFormat,
+      Portion.right - Portion.left, Portion.bottom - Portion.top,
+      Filter, Entries, UseSourceColorKey, KeyLow, KeyHigh, Pool );
+
+   Dest.UnlockBuffer ( DestBuffer, &DestRect );
+   UnlockBuffer ( -1, &Portion );
+
+   if ( Result && !UseSourceColorKey )
+      Dest.CoverClear ( DestRect );
+
+   return Result;
+}
+
+bool DirectDrawSurface::ClearToDepth ( DWORD Depth ) {
+   DDBLTFX BlitFX;
+   RECT Portion;
+   DWORD Flags = 0;
+   LONG Attempts = 0;
+   HRESULT Val;
+
+   if ( !Created )
+      return false;
+
+   if ( PropSurfaceType != ZBuffer )
+      return false;
+
+   COUNT_SCOPE ( *this, CounterClearDepth, SurfWidth * SurfHeight );
+   TRACE_SCOPE ( *this, CounterClearDepth, 0, SurfWidth, SurfHeight );
+
+   HiZ.Clear ( Depth );
+
+   // Without memory for the tiles, the surface is cleared
+   // at once:
+   if ( FastClear && BeginLazyClear ( Depth, true ) )
+      return true;
+
+   DiscardClear ();
+
+   if ( SysMemory != NULL )
+      return SystemFill ( Depth );
 
    // Clear z-buffer to a specific depth:
 
-   Portion.left = 0; Portion.top = 0;
-   Portion.right = PropWidth; Portion.bottom = PropHeight;
+   Portion.left = 0; Portion.top = 0;
+   Portion.right = PropWidth; Portion.bottom = PropHeight;
+
+   ZeroMemory ( ( void * ) &BlitFX, sizeof ( DDBLTFX ) );
+   BlitFX.dwSize = sizeof ( DDBLTFX );
+
+   Flags |= DDBLT_DEPTHFILL;
+
+   BlitFX.dwFillDepth = Depth;
+
+   do {
+      Val = Surface7->Blt ( NULL, NULL, &Portion, Flags,
+         &BlitFX );
+   } while ( RetryAfterLoss ( Val, Attempts ) );
+
+   if ( FAILED ( Val ) )
+      return PrintDirectDrawError ( Val );
+
+   return true;
+}
+
+bool DirectDrawSurface::ClearToColor ( DWORD Color ) {
+   LPDIRECTDRAWSURFACE7 Target;
+   DDBLTFX BlitFX;
+   RECT Portion;
+   DWORD Flags = 0;
+   LONG Attempts = 0;
+   HRESULT Val;
+
+   if ( !Created )
+      return false;
+
+   COUNT_SCOPE ( *this, CounterClearColor, SurfWidth * SurfHeight );
+   TRACE_SCOPE ( *this, CounterClearColor, 0, SurfWidth, SurfHeight );
+
+   if ( FastClear && BeginLazyClear ( Color, false ) ) {
+      Dirty.Add ( NULL );
+
+      return true;
+   }
+
+   DiscardClear ();
+
+   if ( SysMemory != NULL ) {
+      if ( !SystemFill ( Color ) )
+         return false;
+
+      Dirty.Add ( NULL );
+
+      return true;
+   }
+
+   // Clear surface to a specific color:
+
+   Portion.left = 0; Portion.top = 0;
+   Portion.right = PropWidth; Portion.bottom = PropHeight;
+
+   ZeroMemory ( ( void * ) &BlitFX, sizeof ( DDBLTFX ) );
+   BlitFX.dwSize = sizeof ( DDBLTFX );
+
+   Flags |= DDBLT_COLORFILL;
+
+   if ( !PropAlpha ) {
+      BlitFX.dwFillColor = Color;
+   }
+   else {
+      BlitFX.dwFillPixel = Color;
+   }
+
+   do {
+      Val = GetDrawTarget ( &Target );
+
+      if ( FAILED ( Val ) )
+         return PrintDirectDrawError ( Val );
+
+      Val = Target->Blt ( NULL, NULL, &Portion, Flags,
+         &BlitFX );
+   } while ( RetryAfterLoss ( Val, Attempts ) );
+
+   if ( FAILED ( Val ) )
+      return PrintDirectDrawError ( Val );
+
+   Dirty.Add ( NULL );
+
+   return true;
+}
+      
+bool DirectDrawSurface::SetTransparentColorRange (
+        DWORD Color1, DWORD Color2 ) {
+
+   DWORD Flags = DDCKEY_COLORSPACE;
+   DDCOLORKEY ColorKey;
+   HRESULT Val;
+
+   // Set the source color key range for the surface:
+
+   if ( !Created )
+      return false;
+
+   KeyLow  = Color1;
+   KeyHigh = Color2;
+
+   // System memory blits test the raw pixel value against
+   // the range themselves:
+   if ( SysMemory != NULL ) {
+      UseSourceColorKey = true;
+
+      return true;
+   }
+
+   if ( PropSurfaceType == Overlay ) {
+      Flags |= DDCKEY_SRCOVERLAY;
+   }
+   else Flags |= DDCKEY_SRCBLT;
+
+   ColorKey.dwColorSpaceLowValue  = Color1; 
+   ColorKey.dwColorSpaceHighValue = Color2; 
+
+   Val = Surface7->SetColorKey ( Flags, &ColorKey );
+
+   if ( FAILED ( Val ) )
+      PrintDirectDrawError ( Val );
+
+   UseSourceColorKey = true;
+
+   return true;
+}
+
+bool DirectDrawSurface::SetPalette ( DirectDrawPalette *Palette ) {
+   LPDIRECTDRAWPALETTE Interface = NULL;
+   DDPIXELFORMAT PF;
+   HRESULT Val;
+
+   if ( !GetSurfaceFormat ( PF ) ||
+        !( PF.dwFlags & DDPF_PALETTEINDEXED8 ) )
+      return false;
+
+   if ( SysMemory == NULL ) {
+      if ( Palette != NULL && !Palette->GetInterface ( &Interface ) )
+         return false;
+
+      Val = Surface7->SetPalette ( Interface );
+
+      if ( FAILED ( Val ) )
+         return PrintDirectDrawError ( Val );
+   }
+
+   this->Palette = Palette;
+
+   return true;
+}
+
+bool DirectDrawSurface::SetBlendMode ( BlendMode Mode,
+        DirectDrawSurface *Mask, BYTE Opacity ) {
+
+   // Masks are 8-bit Alpha surfaces of the same manager
+   // covering the source:
+   if ( Mask != NULL && ( !Mask->Created ||
+        Mask->Owner == NULL || Mask->Owner != Owner ||
+        Mask->PropSurfaceType != Alpha ||
+        Mask->SurfBytesPerPixel != 1 ||
+        Mask->SurfWidth  < SurfWidth ||
+        Mask->SurfHeight < SurfHeight ) )
+      return false;
+
+   PropBlendMode = Mode;
+   BlendMask     = Mask;
+   BlendOpacity  = Opacity;
+
+   return true;
+}
+
+void DirectDrawSurface::ResetState () {
+   // Forget everything a user of the surface set up, as
+   // if it had just been created; its contents are left
+   // as they are:
+
+   UseSourceColorKey = false;
+   KeyLow = KeyHigh = 0;
+
+   if ( Palette != NULL && !SetPalette ( NULL ) )
+      Palette = NULL;
+
+   PropBlendMode = BlendOpaque;
+   BlendMask     = NULL;
+   BlendOpacity  = 255;
+
+   if ( Owner != NULL )
+      Owner->ForgetRepaint ( *this );
+
+   DiscardClear ();
+   FastClear = false;
+
+   HiZ.Destroy ();
+
+   PartialPresent = false;
+   Dirty.Clear ();
+   Dirty.SetLimit ( 16 );
+
+   ZeroMemory ( &Presents, sizeof ( PresentStats ) );
+   ZeroMemory ( &Clears,   sizeof ( ClearStats ) );
+
+   ResetOperationCounters ();
+}
+
+bool DirectDrawSurface::NeedsRepainting () {
+   if ( ShouldRepaint ) {
+      ShouldRepaint = false;
+      return true;
+   }
+
+   return false;
+}
+
+bool DirectDrawSurface::GetInterface (
+        LPDIRECTDRAWSURFACE7 *Interface ) {
+
+   if ( Surface7 == NULL )
+      return false;
+
+   // The caller may read the surface in ways this class
+   // cannot see, so a pending clear is finished first:
+   if ( !ResolveClear ( NULL ) )
+      return false;
+   
+   ( *Interface ) = Surface7;
+
+   ( *Interface )->AddRef ();
+
+   return true;
+}
+
+LONG DirectDrawSurface::GetBackBufferCount () {
+   // Primary surfaces always have at least one backbuffer:
+   if ( PropSurfaceType == Primary )
+      return PropChainCount > 0 ? PropChainCount : 1;
+
+   if ( PropSurfaceType == Chain )
+      return PropChainCount;
+
+   return 0;
+}
+
+bool DirectDrawSurface::GetBackBuffer ( LONG Index,
+        LPDIRECTDRAWSURFACE7 *Interface ) {
+
+   if ( !Created || SysMemory != NULL )
+      return false;
+
+   if ( Index < 0 || Index >= GetBackBufferCount () )
+      return false;
+
+   if ( FAILED ( ResolveBackBuffers () ) )
+      return false;
+
+   ( *Interface ) = BackBuffers [ Index ];
+
+   ( *Interface )->AddRef ();
+
+   return true;
+}
+
+HRESULT DirectDrawSurface::ResolveMipLevels () {
+   LPDIRECTDRAWSURFACE7 Previous;
+   DDSCAPS2 SurfaceCaps;
+   HRESULT Val;
+
+   if ( MipLevelCount > 0 )
+      return DD_OK;
+
+   MipLevelCount = 1;
+
+   if ( PropSurfaceType != Texture )
+      return DD_OK;
+
+   // Walk down the mipmap chain; the smallest level has
+   // nothing attached:
+
+   ZeroMemory ( &SurfaceCaps, sizeof ( DDSCAPS2 ) );
+   SurfaceCaps.dwCaps = DDSCAPS_TEXTURE | DDSCAPS_MIPMAP;
+
+   Previous = Surface7;
+
+   while ( MipLevelCount < MaxMipLevels ) {
+      Val = Previous->GetAttachedSurface ( &SurfaceCaps,
+         &MipLevels [ MipLevelCount - 1 ] );
+
+      if ( Val == DDERR_NOTFOUND )
+         break;
+
+      if ( FAILED ( Val ) ) {
+         InvalidateMipLevels ();
+
+         return Val;
+      }
+
+      Previous = MipLevels [ MipLevelCount - 1 ];
 
-   ZeroMemory ( ( void * ) &BlitFX, sizeof ( DDBLTFX ) );
-   BlitFX.dwSize = sizeof ( DDBLTFX );
+      MipLevelCount++;
+   }
 
-   Flags |= DDBLT_DEPTHFILL;
+   return DD_OK;
+}
 
-   BlitFX.dwFillDepth = Depth;
+void DirectDrawSurface::InvalidateMipLevels () {
+   // System memory levels are part of the allocation:
+   if ( SysMemory != NULL )
+      return;
+
+   while ( MipLevelCount > 1 )
+      MipLevels [ --MipLevelCount - 1 ]->Release ();
+
+   MipLevelCount = 0;
+}
+
+bool DirectDrawSurface::GetSurfaceFormat ( DDPIXELFORMAT &PF ) {
+   DDSURFACEDESC2 SurfaceDesc;
+   HRESULT Val;
+
+   if ( !Created )
+      return false;
+
+   // System memory surfaces are laid out as the hardware
+   // path would have asked for them:
+   if ( SysMemory != NULL ) {
+      switch ( PropSurfaceType ) {
+         case ZBuffer:
+            SetZBufferBitDepth ( PF, PropBPP );
+         break;
+         case Alpha:
+            SetAlphaBitDepth ( PF, PropBPP );
+         break;
+         case BumpMap:
+            SetBumpMapBitDepth ( PF, PropBPP, PropLum );
+         break;
+         case LightMap:
+            SetColorBitDepth ( PF, PropBPP, false );
+         break;
+         default:
+            if ( PropCompression != BlockNone )
+               SetCompressedFormat ( PF, PropCompression );
+            else
+               SetColorBitDepth ( PF, PropBPP > 0 ? PropBPP :
+                  SurfBytesPerPixel * 8, PropAlpha );
+         break;
+      }
+
+      return true;
+   }
+
+   ZeroMemory ( &SurfaceDesc, sizeof ( DDSURFACEDESC2 ) );
+
+   SurfaceDesc.dwSize = sizeof ( DDSURFACEDESC2 );
 
-   Val = Surface7->Blt ( NULL, NULL, &Portion, Flags,
-      &BlitFX );
+   Val = Surface7->GetSurfaceDesc ( &SurfaceDesc );
 
    if ( FAILED ( Val ) )
       return PrintDirectDrawError ( Val );
 
+   PF = SurfaceDesc.ddpfPixelFormat;
+
    return true;
 }
 
-bool DirectDrawSurface::ClearToColor ( DWORD Color ) {
-   DDBLTFX BlitFX;
-   RECT Portion;
-   DWORD Flags = 0;
+LONG DirectDrawSurface::GetMipLevelCount () {
+   if ( !Created )
+      return 0;
+
+   if ( FAILED ( ResolveMipLevels () ) )
+      return 1;
+
+   return MipLevelCount;
+}
+
+LONG DirectDrawSurface::GetMipLevelWidth ( LONG Level ) {
+   LONG Width = SurfWidth >> Level;
+
+   return Width > 0 ? Width : 1;
+}
+
+LONG DirectDrawSurface::GetMipLevelHeight ( LONG Level ) {
+   LONG Height = SurfHeight >> Level;
+
+   return Height > 0 ? Height : 1;
+}
+
+bool DirectDrawSurface::StartMipLevelAccess ( LONG Level,
+        LPVOID *Pointer, LONG *Pitch ) {
+
+   DDSURFACEDESC2 SurfaceDesc;
+   LONG Attempts = 0;
    HRESULT Val;
 
-   if ( !Created )
+   if ( !Created || Level < 0 )
       return false;
 
-   if ( Surface7->IsLost () != DD_OK ) {
-      if ( FAILED ( Surface7->Restore () ) )
+   // Level 0 is locked as by StartAccess, so a pending
+   // clear is resolved first:
+   if ( Level == 0 ) {
+      ( *Pitch ) = SurfPitch;
+
+      return LockBuffer ( -1, Pointer, NULL );
+   }
+
+   if ( SysMemory != NULL ) {
+      if ( Level >= MipLevelCount )
          return false;
 
-      ShouldRepaint = true;
+      SysLockCount++;
+
+      ( *Pointer ) = SysMipMemory [ Level ];
+      ( *Pitch )   = SysMipPitch  [ Level ];
+
+      return true;
    }
 
-   // Clear surface to a specific color:
+   ZeroMemory ( &SurfaceDesc, sizeof ( DDSURFACEDESC2 ) );
 
-   Portion.left = 0; Portion.top = 0;
-   Portion.right = PropWidth; Portion.bottom = PropHeight;
+   SurfaceDesc.dwSize = sizeof ( DDSURFACEDESC2 );
 
-   ZeroMemory ( ( void * ) &BlitFX, sizeof ( DDBLTFX ) );
-   BlitFX.dwSize = sizeof ( DDBLTFX );
+   do {
+      Val = ResolveMipLevels ();
 
-   Flags |= DDBLT_COLORFILL;
+      if ( FAILED ( Val ) )
+         return PrintDirectDrawError ( Val );
 
-   if ( !PropAlpha ) {
-      BlitFX.dwFillColor = Color;
-   }
-   else {
-      BlitFX.dwFillPixel = Color;
-   }
+      if ( Level >= MipLevelCount )
+         return false;
 
-   Val = Surface7->Blt ( NULL, NULL, &Portion, Flags,
-      &BlitFX );
+      Val = MipLevels [ Level - 1 ]->Lock ( NULL, &SurfaceDesc,
+         DDLOCK_NOSYSLOCK | DDLOCK_WAIT, NULL );
+   } while ( RetryAfterLoss ( Val, Attempts ) );
 
    if ( FAILED ( Val ) )
       return PrintDirectDrawError ( Val );
 
+   ( *Pointer ) = SurfaceDesc.lpSurface;
+   ( *Pitch )   = SurfaceDesc.lPitch;
+
+   // As with level 0, use the block row pitch rather than
+   // the linear size a driver reports:
+   if ( PropCompression != BlockNone )
+      ( *Pitch ) = ( ( GetMipLevelWidth ( Level ) + 3 ) / 4 ) *
+         GetBlockBytes ( PropCompression );
+
    return true;
 }
-      
-bool DirectDrawSurface::SetTransparentColorRange (
-        DWORD Color1, DWORD Color2 ) {
 
-   DWORD Flags = DDCKEY_COLORSPACE;
-   DDCOLORKEY ColorKey;
+bool DirectDrawSurface::EndMipLevelAccess ( LONG Level ) {
    HRESULT Val;
 
-   // Set the source color key range for the surface:
-
-   if ( !Created )
+   if ( !Created || Level < 0 )
       return false;
 
-   if ( PropSurfaceType == Overlay ) {
-      Flags |= DDCKEY_SRCOVERLAY;
+   if ( Level == 0 )
+      return UnlockBuffer ( -1, NULL );
+
+   if ( SysMemory != NULL ) {
+      if ( Level >= MipLevelCount || SysLockCount == 0 )
+         return false;
+
+      SysLockCount--;
+
+      return true;
    }
-   else Flags |= DDCKEY_SRCBLT;
 
-   ColorKey.dwColorSpaceLowValue  = Color1; 
-   ColorKey.dwColorSpaceHighValue = Color2; 
+   if ( Level >= MipLevelCount )
+      return false;
 
-   Val = Surface7->SetColorKey ( Flags, &ColorKey );
+   Val = MipLevels [ Level - 1 ]->Unlock ( NULL );
 
    if ( FAILED ( Val ) )
-      PrintDirectDrawError ( Val );
-
-   UseSourceColorKey = true;
+      return PrintDirectDrawError ( Val );
 
    return true;
 }
 
-bool DirectDrawSurface::NeedsRepainting () {
-   if ( ShouldRepaint ) {
-      ShouldRepaint = false;
-      return true;
-   }
+bool DirectDrawSurface::GenerateMipmaps ( MipFilter Filter,
+        ThreadPool *Pool ) {
 
-   return false;
-}
+   DDPIXELFORMAT PF;
+   PixelFormat Format;
+   LPVOID Src, Dest;
+   LONG Level, Count, SrcPitch, DestPitch;
+   bool Result;
 
-bool DirectDrawSurface::GetInterface (
-        LPDIRECTDRAWSURFACE7 *Interface ) {
+   // Compressed textures are filled by compressing an
+   // uncompressed texture whose levels were generated:
+   if ( !Created || PropSurfaceType != Texture ||
+        PropCompression != BlockNone )
+      return false;
 
-   if ( Surface7 == NULL )
+   if ( !GetSurfaceFormat ( PF ) )
       return false;
-   
-   ( *Interface ) = Surface7;
 
-   ( *Interface )->AddRef ();
+   Format = GetPixelFormat ( PF );
 
-   return true;
+   if ( Format == FormatUnknown )
+      return false;
+
+   Count = GetMipLevelCount ();
+
+   if ( Count < 2 )
+      return true;
+
+   // Each level is filtered out of the one above it, so
+   // the levels run in order and only two are locked at
+   // any time:
+
+   if ( !StartMipLevelAccess ( 0, &Src, &SrcPitch ) )
+      return false;
+
+   for ( Level = 1; Level < Count; Level++ ) {
+      if ( !StartMipLevelAccess ( Level, &Dest, &DestPitch ) ) {
+         EndMipLevelAccess ( Level - 1 );
+
+         return false;
+      }
+
+      Result = DownsampleMipLevel ( Dest, DestPitch, Src,
+         SrcPitch, GetMipLevelWidth ( Level - 1 ),
+         GetMipLevelHeight ( Level - 1 ), Format, Filter, Pool );
+
+      EndMipLevelAccess ( Level - 1 );
+
+      if ( !Result ) {
+         EndMipLevelAccess ( Level );
+
+         return false;
+      }
+
+      Src      = Dest;
+      SrcPitch = DestPitch;
+   }
+
+   return EndMipLevelAccess ( Count - 1 );
 }
 
 bool DirectDrawSurface::GetBaseInterface (
         LPDIRECTDRAWSURFACE *Base ) {
 
+   if ( Surface7 == NULL )
+      return false;
+
    return ( Surface7->QueryInterface (
                IID_IDirectDrawSurface,
                ( void ** ) Base ) == S_OK );
@@ -1002,354 +3823,3 @@ HRESULT WINAPI EnumModesCallback (
 
    return DDENUMRET_CANCEL;
 }
-
-bool FatalError ( TCHAR *Message ) {
-   TCHAR ErrorMessage [ 200 ];
-   
-   sprintf ( ErrorMessage, "DirectDraw Error: %s",
-      Message );
-
-   MessageBox ( GetActiveWindow (), ErrorMessage,
-      "DirectDraw Fatal Error", MB_OK | MB_ICONERROR );
-
-   return false;
-}
-
-bool PrintDirectDrawError ( HRESULT Error ) {
-   switch ( Error ) {
-      case DD_OK:
-         FatalError ( "DD_OK" );
-      break;
-      case DDERR_ALREADYINITIALIZED:
-         FatalError ( "DDERR_ALREADYINITIALIZED" );
-      break;
-      case DDERR_BLTFASTCANTCLIP:
-         FatalError ( "DDERR_BLTFASTCANTCLIP" );
-      break;
-      case DDERR_CANNOTATTACHSURFACE:
-         FatalError ( "DDERR_CANNOTATTACHSURFACE" );
-      break;
-      case DDERR_CANNOTDETACHSURFACE:
-         FatalError ( "DDERR_CANNOTDETACHSURFACE" );
-      break;
-      case DDERR_CANTCREATEDC:
-         FatalError ( "DDERR_CANTCREATEDC" );
-      break;
-      case DDERR_CANTDUPLICATE:
-         FatalError ( "DDERR_CANTDUPLICATE" );
-      break;
-      case DDERR_CANTLOCKSURFACE:
-         FatalError ( "DDERR_CANTLOCKSURFACE" );
-      break;
-      case DDERR_CANTPAGELOCK:
-         FatalError ( "DDERR_CANTPAGELOCK" );
-      break;
-      case DDERR_CANTPAGEUNLOCK:
-         FatalError ( "DDERR_CANTPAGEUNLOCK" );
-      break;
-      case DDERR_CLIPPERISUSINGHWND:
-         FatalError ( "DDERR_CLIPPERISUSINGHWND" );
-      break;
-      case DDERR_COLORKEYNOTSET:
-         FatalError ( "DDERR_COLORKEYNOTSET" );
-      break;
-      case DDERR_CURRENTLYNOTAVAIL:
-         FatalError ( "DDERR_CURRENTLYNOTAVAIL" );
-      break;
-      case DDERR_DCALREADYCREATED:
-         FatalError ( "DDERR_DCALREADYCREATED" );
-      break;
-      case DDERR_DEVICEDOESNTOWNSURFACE:
-         FatalError ( "DDERR_DEVICEDOESNTOWNSURFACE" );
-      break;
-      case DDERR_DIRECTDRAWALREADYCREATED:
-         FatalError ( "DDERR_DIRECTDRAWALREADYCREATED" );
-      break;
-      case DDERR_EXCEPTION:
-         FatalError ( "DDERR_EXCEPTION" );
-      break;
-      case DDERR_EXCLUSIVEMODEALREADYSET:
-         FatalError ( "DDERR_EXCLUSIVEMODEALREADYSET" );
-      break;
-      case DDERR_EXPIRED:
-         FatalError ( "DDERR_EXPIRED" );
-      break;
-      case DDERR_GENERIC:
-         FatalError ( "DDERR_GENERIC" );
-      break;
-      case DDERR_HEIGHTALIGN:
-         FatalError ( "DDERR_HEIGHTALIGN" );
-      break;
-      case DDERR_HWNDALREADYSET:
-         FatalError ( "DDERR_HWNDALREADYSET" );
-      break;
-      case DDERR_HWNDSUBCLASSED:
-         FatalError ( "DDERR_HWNDSUBCLASSED" );
-      break;
-      case DDERR_IMPLICITLYCREATED:
-         FatalError ( "DDERR_IMPLICITLYCREATED" );
-      break;
-      case DDERR_INCOMPATIBLEPRIMARY:
-         FatalError ( "DDERR_INCOMPATIBLEPRIMARY" );
-      break;
-      case DDERR_INVALIDCAPS:
-         FatalError ( "DDERR_INVALIDCAPS" );
-      break;
-      case DDERR_INVALIDCLIPLIST:
-         FatalError ( "DDERR_INVALIDCLIPLIST" );
-      break;
-      case DDERR_INVALIDDIRECTDRAWGUID:
-         FatalError ( "DDERR_INVALIDDIRECTDRAWGUID" );
-      break;
-      case DDERR_INVALIDMODE:
-         FatalError ( "DDERR_INVALIDMODE" );
-      break;
-      case DDERR_INVALIDOBJECT:
-         FatalError ( "DDERR_INVALIDOBJECT" );
-      break;
-      case DDERR_INVALIDPARAMS:
-         FatalError ( "DDERR_INVALIDPARAMS" );
-      break;
-      case DDERR_INVALIDPIXELFORMAT:
-         FatalError ( "DDERR_INVALIDPIXELFORMAT" );
-      break;
-      case DDERR_INVALIDPOSITION:
-         FatalError ( "DDERR_INVALIDPOSITION" );
-      break;
-      case DDERR_INVALIDRECT:
-         FatalError ( "DDERR_INVALIDRECT" );
-      break;
-      case DDERR_INVALIDSTREAM:
-         FatalError ( "DDERR_INVALIDSTREAM" );
-      break;
-      case DDERR_INVALIDSURFACETYPE:
-         FatalError ( "DDERR_INVALIDSURFACETYPE" );
-      break;
-      case DDERR_LOCKEDSURFACES:
-         FatalError ( "DDERR_LOCKEDSURFACES" );
-      break;
-      case DDERR_MOREDATA:
-         FatalError ( "DDERR_MOREDATA" );
-      break;
-      case DDERR_NO3D:
-         FatalError ( "DDERR_NO3D" );
-      break;
-      case DDERR_NOALPHAHW:
-         FatalError ( "DDERR_NOALPHAHW" );
-      break;
-      case DDERR_NOBLTHW:
-         FatalError ( "DDERR_NOBLTHW" );
-      break;
-      case DDERR_NOCLIPLIST:
-         FatalError ( "DDERR_NOCLIPLIST" );
-      break;
-      case DDERR_NOCLIPPERATTACHED:
-         FatalError ( "DDERR_NOCLIPPERATTACHED" );
-      break;
-      case DDERR_NOCOLORCONVHW:
-         FatalError ( "DDERR_NOCOLORCONVHW" );
-      break;
-      case DDERR_NOCOLORKEY:
-         FatalError ( "DDERR_NOCOLORKEY" );
-      break;
-      case DDERR_NOCOLORKEYHW:
-         FatalError ( "DDERR_NOCOLORKEYHW" );
-      break;
-      case DDERR_NOCOOPERATIVELEVELSET:
-         FatalError ( "DDERR_NOCOOPERATIVELEVELSET" );
-      break;
-      case DDERR_NODC:
-         FatalError ( "DDERR_NODC" );
-      break;
-      case DDERR_NODDROPSHW:
-         FatalError ( "DDERR_NODDROPSHW" );
-      break;
-      case DDERR_NODIRECTDRAWHW:
-         FatalError ( "DDERR_NODIRECTDRAWHW" );
-      break;
-      case DDERR_NODIRECTDRAWSUPPORT:
-         FatalError ( "DDERR_NODIRECTDRAWSUPPORT" );
-      break;
-      case DDERR_NOEMULATION:
-         FatalError ( "DDERR_NOEMULATION" );
-      break;
-      case DDERR_NOEXCLUSIVEMODE:
-         FatalError ( "DDERR_NOEXCLUSIVEMODE" );
-      break;
-      case DDERR_NOFLIPHW:
-         FatalError ( "DDERR_NOFLIPHW" );
-      break;
-      case DDERR_NOFOCUSWINDOW:
-         FatalError ( "DDERR_NOFOCUSWINDOW" );
-      break;
-      case DDERR_NOGDI:
-         FatalError ( "DDERR_NOGDI" );
-      break;
-      case DDERR_NOHWND:
-         FatalError ( "DDERR_NOHWND" );
-      break;
-      case DDERR_NOMIPMAPHW:
-         FatalError ( "DDERR_NOMIPMAPHW" );
-      break;
-      case DDERR_NOMIRRORHW:         
-         FatalError ( "DDERR_NOMIRRORHW" );
-      break;
-      case DDERR_NONONLOCALVIDMEM:         
-         FatalError ( "DDERR_NONONLOCALVIDMEM" );
-      break;
-      case DDERR_NOOPTIMIZEHW:
-         FatalError ( "DDERR_NOOPTIMIZEHW" );
-      break;
-      case DDERR_NOOVERLAYDEST:
-         FatalError ( "DDERR_NOOVERLAYDEST" );
-      break;
-      case DDERR_NOOVERLAYHW:
-         FatalError ( "DDERR_NOOVERLAYHW" );
-      break;
-      case DDERR_NOPALETTEATTACHED:
-         FatalError ( "DDERR_NOPALETTEATTACHED" );
-      break;
-      case DDERR_NOPALETTEHW:
-         FatalError ( "DDERR_NOPALETTEHW" );
-      break;
-      case DDERR_NORASTEROPHW:
-         FatalError ( "DDERR_NORASTEROPHW" );
-      break;
-      case DDERR_NOROTATIONHW:
-         FatalError ( "DDERR_NOROTATIONHW" );
-      break;
-      case DDERR_NOSTRETCHHW:
-         FatalError ( "DDERR_NOSTRETCHHW" );
-      break;
-      case DDERR_NOT4BITCOLOR:
-         FatalError ( "DDERR_NOT4BITCOLOR" );
-      break;
-      case DDERR_NOT4BITCOLORINDEX:
-         FatalError ( "DDERR_NOT4BITCOLORINDEX" );
-      break;
-      case DDERR_NOT8BITCOLOR:
-         FatalError ( "DDERR_NOT8BITCOLOR" );
-      break;
-      case DDERR_NOTAOVERLAYSURFACE:
-         FatalError ( "DDERR_NOTAOVERLAYSURFACE" );
-      break;
-      case DDERR_NOTEXTUREHW:
-         FatalError ( "DDERR_NOTEXTUREHW" );
-      break;
-      case DDERR_NOTFLIPPABLE:
-         FatalError ( "DDERR_NOTFLIPPABLE" );
-      break;
-      case DDERR_NOTFOUND:
-         FatalError ( "DDERR_NOTFOUND" );
-      break;
-      case DDERR_NOTINITIALIZED:
-         FatalError ( "DDERR_NOTINITIALIZED" );
-      break;
-      case DDERR_NOTLOADED:
-         FatalError ( "DDERR_NOTLOADED" );
-      break;
-      case DDERR_NOTLOCKED:
-         FatalError ( "DDERR_NOTLOCKED" );
-      break;
-      case DDERR_NOTPAGELOCKED:
-         FatalError ( "DDERR_NOTPAGELOCKED" );
-      break;
-      case DDERR_NOTPALETTIZED:
-         FatalError ( "DDERR_NOTPALETTIZED" );
-      break;
-      case DDERR_NOVSYNCHW:
-         FatalError ( "DDERR_NOVSYNCHW" );
-      break;
-      case DDERR_NOZBUFFERHW:
-         FatalError ( "DDERR_NOZBUFFERHW" );
-      break;
-      case DDERR_NOZOVERLAYHW:
-         FatalError ( "DDERR_NOZOVERLAYHW" );
-      break;
-      case DDERR_OUTOFCAPS:
-         FatalError ( "DDERR_OUTOFCAPS" );
-      break;
-      case DDERR_OUTOFMEMORY:
-         FatalError ( "DDERR_OUTOFMEMORY" );
-      break;
-      case DDERR_OUTOFVIDEOMEMORY:
-         FatalError ( "DDERR_OUTOFVIDEOMEMORY" );
-      break;
-      case DDERR_OVERLAPPINGRECTS:
-         FatalError ( "DDERR_OVERLAPPINGRECTS" );
-      break;
-      case DDERR_OVERLAYCANTCLIP:
-         FatalError ( "DDERR_OVERLAYCANTCLIP" );
-      break;
-      case DDERR_OVERLAYCOLORKEYONLYONEACTIVE:
-         FatalError ("DDERR_OVERLAYCOLORKEYONLYONEACTIVE");
-      break;
-      case DDERR_OVERLAYNOTVISIBLE:
-         FatalError ( "DDERR_OVERLAYNOTVISIBLE" );
-      break;
-      case DDERR_PALETTEBUSY:
-         FatalError ( "DDERR_PALETTEBUSY" );
-      break;
-      case DDERR_PRIMARYSURFACEALREADYEXISTS:
-         FatalError ("DDERR_PRIMARYSURFACEALREADYEXISTS");
-      break;
-      case DDERR_REGIONTOOSMALL:
-         FatalError ( "DDERR_REGIONTOOSMALL" );
-      break;
-      case DDERR_SURFACEALREADYATTACHED:
-         FatalError ( "DDERR_SURFACEALREADYATTACHED" );
-      break;
-      case DDERR_SURFACEALREADYDEPENDENT:
-         FatalError ( "DDERR_SURFACEALREADYDEPENDENT" );
-      break;
-      case DDERR_SURFACEBUSY:
-         FatalError ( "DDERR_SURFACEBUSY" );
-      break;
-      case DDERR_SURFACEISOBSCURED:
-         FatalError ( "DDERR_SURFACEISOBSCURED" );
-      break;
-      case DDERR_SURFACELOST:
-         FatalError ( "DDERR_SURFACELOST" );
-      break;
-      case DDERR_SURFACENOTATTACHED:
-         FatalError ( "DDERR_SURFACENOTATTACHED" );
-      break;
-      case DDERR_TOOBIGHEIGHT:
-         FatalError ( "DDERR_TOOBIGHEIGHT" );
-      break;
-      case DDERR_TOOBIGSIZE:
-         FatalError ( "DDERR_TOOBIGSIZE" );
-      break;
-      case DDERR_TOOBIGWIDTH:
-         FatalError ( "DDERR_TOOBIGWIDTH" );
-      break;
-      case DDERR_UNSUPPORTED:
-         FatalError ( "DDERR_UNSUPPORTED" );
-      break;
-      case DDERR_UNSUPPORTEDFORMAT:
-         FatalError ( "DDERR_UNSUPPORTEDFORMAT" );
-      break;
-      case DDERR_UNSUPPORTEDMASK:
-         FatalError ( "DDERR_UNSUPPORTEDMASK" );
-      break;
-      case DDERR_UNSUPPORTEDMODE:
-         FatalError ( "DDERR_UNSUPPORTEDMODE" );
-      break;
-      case DDERR_VERTICALBLANKINPROGRESS:
-         FatalError ( "DDERR_VERTICALBLANKINPROGRESS" );
-      break;
-      case DDERR_VIDEONOTACTIVE:
-         FatalError ( "DDERR_VIDEONOTACTIVE" );
-      break;
-      case DDERR_WASSTILLDRAWING:
-         FatalError ( "DDERR_WASSTILLDRAWING" );
-      break;
-      case DDERR_WRONGMODE:
-         FatalError ( "DDERR_WRONGMODE" );
-      break;
-      case DDERR_XALIGN:
-         FatalError ( "DDERR_XALIGN" );
-      break;
-   }
-   return false;
-}
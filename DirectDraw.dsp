@@ -86,5 +86,93 @@ LINK32=link.exe
 
 SOURCE=.\DirectDraw.cpp
 # End Source File
+# Begin Source File
+
+SOURCE=.\PixelConvert.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\SurfacePool.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\BlitBatch.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\DirtyRegion.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\PresentQueue.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\ThreadPool.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\ParallelSurfaceAccess.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\HiZBuffer.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Mipmap.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\BlockCompress.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\AssetPack.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\BumpMap.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Combiner.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Palette.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Blend.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Scale.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\RLESprite.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\ErrorLog.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\LZCodec.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\SurfaceBackup.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Counters.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\Trace.cpp
+# End Source File
 # End Target
 # End Project
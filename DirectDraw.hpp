@@ -19,33 +19,222 @@
 #include <Windows.H>
 #include <DDraw.H>
 
+#include "DirtyRegion.hpp"
+#include "HiZBuffer.hpp"
+#include "ErrorLog.hpp"
+#include "Counters.hpp"
+#include "Trace.hpp"
+
 
-bool PrintDirectDrawError ( HRESULT Error );
 HRESULT WINAPI EnumModesCallback ( DDSURFACEDESC2 *SurfaceDesc, LPVOID AppData );
 
+void SetColorBitDepth   ( DDPIXELFORMAT &PF, LONG Depth,
+   bool Alpha );
+void SetBumpMapBitDepth ( DDPIXELFORMAT &PF, LONG Depth,
+   bool Light );
+void SetAlphaBitDepth   ( DDPIXELFORMAT &PF, LONG Depth );
+void SetZBufferBitDepth ( DDPIXELFORMAT &PF, LONG Depth );
+
 class DirectDrawSurface;
+class DirectDrawPalette;
+class SurfaceBackup;
+class SurfacePool;
+struct RepaintPlan;
+class ThreadPool;
+
+// What the last Show presented, and what partial presents
+// saved over presenting whole frames:
+struct PresentStats {
+   DWORD Frames, DirtyRects, PresentedPixels, SavedPixels;
+
+   ULONGLONG TotalSavedPixels;
+};
+
+// How much clearing fast clears avoided. Tiles are
+// Overwritten when a blit or fill covered them before they
+// were touched, and Discarded when the next clear came
+// first:
+struct ClearStats {
+   DWORD LazyClears, TilesFilled, TilesOverwritten,
+         TilesDiscarded;
+};
+
+// How GenerateMipmaps filters each 2x2 block. MipGamma
+// averages colour in linear light; alpha is always box
+// filtered:
+enum MipFilter { MipBox, MipGamma };
+
+// Textures can be stored in 4x4 blocks of BC1 (DXT1) or
+// BC3 (DXT5) instead of pixels:
+enum BlockCompression { BlockNone, BlockBC1, BlockBC3 };
+
+// How a blit mixes with what it is drawn over. Opaque
+// blits copy; the others blend per pixel on the CPU (see
+// Blend.hpp):
+enum BlendMode { BlendOpaque, BlendSourceOver,
+   BlendPremultiplied, BlendAdditive, BlendMultiply };
+
+// How ScalePortionTo filters (see Scale.hpp):
+enum ScaleFilter { ScaleNearest, ScaleBilinear, ScaleBox };
+
+void SetCompressedFormat ( DDPIXELFORMAT &PF,
+   BlockCompression Compression );
+
+// Refills a surface after it was lost and restored, and
+// returns whether it did (see SetRepaintCallback):
+typedef bool ( *RepaintCallback ) ( DirectDrawSurface &Surface,
+   LPVOID Context );
+
+// How surface loss was looked for and recovered from.
+// Probes are the one loss check Show makes per frame;
+// sweeps restore every lost surface at once. Backups are
+// the compressed copies kept by SetBackup, which take
+// BackupBytes for BackedUpBytes of pixels; Uploaded counts
+// the surfaces refilled from them:
+struct LossStats {
+   DWORD Surfaces, Probes, Sweeps, Restored, Repainted;
+   DWORD Backups, BackupBytes, BackedUpBytes, Uploaded;
+
+   double LastSweepMilliseconds, LastUploadMilliseconds;
+};
 
 class DirectDrawManager {
+   public:
+      // Hardware surfaces live in DirectDraw; SystemMemory
+      // surfaces are plain aligned buffers serviced on the
+      // CPU, so no display or DirectDraw object is needed:
+      enum BackendType { Hardware, SystemMemory };
+
    protected:
+      // Which of the four capability combinations tried by
+      // CreateSurface last worked for a surface description:
+      struct CapsCacheEntry {
+         bool Used, Alpha, Lum;
+         int  Type;
+         BlockCompression Compression;
+         LONG Width, Height, BPP, Attempt;
+      };
+
+      enum { CapsCacheSize = 256 };
+
 		LPDIRECTDRAW7 DirectDraw7;
 
 		LONG PropWidth, PropHeight, PropBPP;
       bool FullScreen;
 
+      BackendType PropBackend;
+
+      CapsCacheEntry CapsCache [ CapsCacheSize ];
+      DWORD CapsCacheHits, CapsCacheMisses, CapsDriverCalls;
+
+      // Every created surface, linked through the
+      // surfaces, and the next one Show probes for loss:
+      DirectDrawSurface *Surfaces, *NextProbe;
+
+      CRITICAL_SECTION RegistryLock;
+
+      DWORD Sweep;
+
+      // The sweeps whose repaint callbacks are running:
+      RepaintPlan *Plans;
+
+      LossStats Losses;
+
+      ThreadPool *RestorePool;
+
       bool ConnectToDirectDraw ();
+      bool CreateSystemSurface ( DirectDrawSurface &Surface );
+
+      void Register   ( DirectDrawSurface &Surface );
+      void Unregister ( DirectDrawSurface &Surface );
+
+      void DropDependents ( DirectDrawSurface &Surface );
+
+      // Drop a surface's callback, dependencies and backup:
+      void ForgetRepaint ( DirectDrawSurface &Surface );
+
+      // Work out under RegistryLock which surfaces a sweep
+      // repaints and in what order, then repaint them with
+      // the lock released:
+      LONG PlanRepaint ( DirectDrawSurface &Surface,
+         RepaintPlan &Plan );
+      void RunRepaint ( RepaintPlan &Plan );
+      void UploadBackups ();
+
+      LONG CapsCacheSlot ( DirectDrawSurface &Surface );
+      bool CapsCacheMatches ( CapsCacheEntry &Entry,
+         DirectDrawSurface &Surface );
 	public:
-		DirectDrawManager ();
+		DirectDrawManager ( BackendType Backend = Hardware );
 		~DirectDrawManager ();
 
 		bool CreateSurface ( DirectDrawSurface &Surface );
 
+      // Create a SystemMemory Plain or Texture surface over
+      // memory owned by the caller, one pointer and pitch
+      // per mip level, instead of allocating its own:
+      bool CreateAliasedSurface ( DirectDrawSurface &Surface,
+         LPBYTE *Levels, LONG *Pitches, LONG LevelCount );
+
 		bool SetDisplayMode ( LONG Width, LONG Height, LONG BPP );
 
 		bool Initialize ( HWND Window );
 		bool Uninitialize ();
 
+      BackendType GetBackend () { return PropBackend; }
+
+      void ClearCapsCache ();
+      void GetCapsCacheStats ( DWORD *Hits, DWORD *Misses,
+         DWORD *DriverCalls );
+
       bool GetInterface ( LPDIRECTDRAW7 *Interface );
       bool GetBaseInterface ( LPDIRECTDRAW *Base );
+
+      // Ask one hardware surface, a different one each
+      // call, whether it was lost, and restore them all if
+      // it was. Show calls this once per frame; calls that
+      // fail with DDERR_SURFACELOST restore at once:
+      bool CheckForLoss ();
+
+      // Restore every lost surface, then repaint those that
+      // have a callback, each after the surfaces it depends
+      // on (and again whenever one of those is repainted).
+      // Lost surfaces without one report NeedsRepainting:
+      bool RestoreSurfaces ();
+
+      // The callback runs on the thread that found the
+      // loss, with no manager lock held; destroying its
+      // surface on another thread waits for it to return.
+      // Callback NULL removes it:
+      bool SetRepaintCallback ( DirectDrawSurface &Surface,
+         RepaintCallback Callback, LPVOID Context = NULL );
+
+      // Surface is painted from DependsOn, so it is
+      // repainted after it. Both must be surfaces of this
+      // manager:
+      bool AddRepaintDependency ( DirectDrawSurface &Surface,
+         DirectDrawSurface &DependsOn );
+
+      // Keep a compressed copy of a hardware surface in
+      // system memory, taken now (and again by each call),
+      // so a sweep that restores the surface refills it
+      // before any repaint callback runs. Meant for surfaces
+      // that rarely change; Enable false drops the copy:
+      bool SetBackup ( DirectDrawSurface &Surface,
+         bool Enable = true );
+
+      // Copies are taken and written back over Pool's
+      // threads (NULL for the calling thread only):
+      void SetRestorePool ( ThreadPool *Pool ) { RestorePool = Pool; }
+
+      void GetLossStats ( LossStats &Stats );
+
+      // End a frame of the operation counters (see
+      // Counters.hpp) for every thread and for each of this
+      // manager's surfaces; every Show calls it:
+      void EndFrameCounters ();
+
+      friend class DirectDrawSurface;
 };
 
 class DirectDrawSurface {
@@ -53,19 +242,203 @@ class DirectDrawSurface {
       enum SurfaceType { Primary, Plain, Chain, Texture,
          ZBuffer, Alpha, Overlay, BumpMap, LightMap };
 
+      enum { MaxBackBuffers = 8, MaxMipLevels = 16,
+             MaxRepaintDependencies = 8 };
+
    protected:
       LPDIRECTDRAWSURFACE7 Surface7;
 
+      // The manager that created the surface, which
+      // restores it, and its neighbours in the manager's
+      // list:
+      DirectDrawManager *Owner;
+
+      DirectDrawSurface *NextSurface, *PreviousSurface;
+
+      // The pool the surface was acquired from and has not
+      // yet gone back to, if any, and its neighbours in
+      // that pool's list of loans:
+      SurfacePool *Lender;
+
+      DirectDrawSurface *NextLoan, *PreviousLoan;
+
+      RepaintCallback RepaintFunction;
+      LPVOID          RepaintContext;
+
+      // The copy written back when the surface is restored,
+      // owned:
+      SurfaceBackup *Backup;
+
+      DirectDrawSurface *RepaintAfter [ MaxRepaintDependencies ];
+
+      LONG RepaintAfterCount;
+
+      // The manager's sweeps that last restored, visited
+      // and repainted the surface, and its step in the
+      // repaint plan of the sweep that last visited it:
+      DWORD RestoredSweep, VisitedSweep, RepaintedSweep;
+
+      LONG RepaintIndex;
+
+      // The attached backbuffers of a flip chain, resolved
+      // once and released when the surface is lost:
+      LPDIRECTDRAWSURFACE7 BackBuffers [ MaxBackBuffers ];
+
+      LONG BackBufferCount;
+
+      // The attached levels below a texture, resolved the
+      // same way; MipLevels [ 0 ] is level 1:
+      LPDIRECTDRAWSURFACE7 MipLevels [ MaxMipLevels ];
+
+      LONG MipLevelCount;
+
       bool TypeSet, Created, PropLum, PropAlpha,
            UseSourceColorKey, ShouldRepaint;
 
       LONG PropWidth,      PropHeight,       PropBPP,
            SurfWidth,      SurfHeight,       SurfPitch,
-           PropChainCount;
+           SurfBytesPerPixel,                PropChainCount;
 
       SurfaceType PropSurfaceType;
 
+      BlockCompression PropCompression;
+
+      // System memory backing (only used when the surface
+      // was created by a SystemMemory manager):
+      LPBYTE SysBlock,     SysMemory;
+
+      LONG SysBufferCount, SysFront, SysLockCount;
+
+      // A system memory texture keeps its mip levels after
+      // level 0 in the same allocation:
+      LPBYTE SysMipMemory [ MaxMipLevels ];
+      LONG   SysMipPitch  [ MaxMipLevels ];
+
+      DWORD KeyLow, KeyHigh;
+
+      // The palette of an 8-bit surface, not owned:
+      DirectDrawPalette *Palette;
+
+      // How blits from this surface are blended, and the
+      // Alpha surface (not owned) that masks them. The
+      // manager clears all three when the mask is
+      // destroyed:
+      BlendMode PropBlendMode;
+
+      DirectDrawSurface *BlendMask;
+
+      BYTE BlendOpacity;
+
+      // Changed areas, fed by blits, clears and StartAccess:
+      DirtyRegion Dirty;
+
+      bool PartialPresent;
+
+      PresentStats Presents;
+
+      // Fast clears only record the clear value; each tile
+      // of the surface is filled when it is first touched:
+      enum { ClearTileSize = 64 };
+
+      bool FastClear, ClearPending, ClearIsDepth;
+
+      DWORD ClearValue;
+
+      LPBYTE ClearTiles;
+
+      LONG ClearTilesAcross, ClearTilesDown,
+           ClearTilesPending;
+
+      ClearStats Clears;
+
+      // Optional depth pyramid of a z-buffer, refreshed
+      // from the memory of the last lock when it ends:
+      HiZBuffer HiZ;
+
+      // The locks of level 0 still held, innermost last.
+      // Locks nested deeper are only invalidated in the
+      // pyramid when they end:
+      enum { MaxLockedAreas = 8 };
+
+      struct LockedArea {
+         LPBYTE Memory;
+         LONG   Pitch;
+         RECT   Rect;
+         bool   ReadOnly;
+      };
+
+      LockedArea LockedAreas [ MaxLockedAreas ];
+
+      LONG LockedCount;
+
+#ifdef DIRECTDRAW_COUNTERS
+      // What was done to this surface, what that was when
+      // the last frame ended, and what the frame added:
+      RawCounters Counters, FrameBase, LastFrame;
+#endif
+
+      // Names the surface in traces (see Trace.hpp):
+      DWORD TraceId;
+
+      bool BeginLazyClear ( DWORD Value, bool Depth );
+      void DiscardClear ();
+      bool ResolveClear ( RECT *Rect, RECT *Covered = NULL );
+      void CoverClear ( RECT &Covered );
+      bool FillClearRun ( RECT &Rect );
+
+      void RecordLock ( LPBYTE Memory, LONG Pitch,
+         RECT *Rect, bool ReadOnly );
+      void EndLock ( RECT *Rect );
+
+      LPBYTE SystemBuffer ( LONG Index );
+      LPBYTE DrawBuffer ();
+
+      HRESULT GetDrawTarget ( LPDIRECTDRAWSURFACE7 *Target );
+
+      bool RestoreLost ();
+      bool RestoreSurface ();
+
+      // Whether a call that failed with Val should be made
+      // again, after the surfaces it lost were restored:
+      bool RetryAfterLoss ( HRESULT Val, LONG &Attempts );
+
+      // A ReadOnly lock leaves the surface's dirty region
+      // and change count alone. The caller of an Overwrite
+      // lock writes every pixel of Rect, so pending clear
+      // tiles inside it are left for CoverClear:
+      bool LockBuffer ( LONG Buffer, LPVOID *Pointer,
+         RECT *Rect, bool ReadOnly = false,
+         bool Overwrite = false );
+      bool UnlockBuffer ( LONG Buffer, RECT *Rect );
+
+      HRESULT ResolveBackBuffers ();
+      void InvalidateBackBuffers ();
+
+      HRESULT ResolveMipLevels ();
+      void InvalidateMipLevels ();
+
+      bool PresentDirty ( bool EndFrame );
+      void RecordPresent ( DWORD Pixels, bool EndFrame );
+
+      bool SystemBlit ( RECT &Portion,
+         DirectDrawSurface &Dest, RECT &DestRect );
+      bool SystemFill ( DWORD Value, RECT *Rect = NULL );
+
+      // Undo what a user set on the surface, before a pool
+      // hands it to the next one:
+      void ResetState ();
+
+      bool ExpandBlit ( RECT &Portion,
+         DirectDrawSurface &Dest, RECT &DestRect );
+      bool BlendBlit ( RECT &Portion,
+         DirectDrawSurface &Dest, RECT &DestRect );
+
       friend class DirectDrawManager;
+      friend class SurfacePool;
+      friend class BlitBatch;
+      friend class AssetPack;
+      friend class RLESprite;
+      friend class SurfaceBackup;
 
    public:
       DirectDrawSurface ();
@@ -75,19 +448,86 @@ class DirectDrawSurface {
          RECT *Rect = NULL );
       bool EndAccess   ( RECT *Rect = NULL );
 
+      // Lock for reading only: the surface is not marked
+      // dirty and its change count stays as it was. Ended
+      // with EndAccess:
+      bool StartReadAccess ( LPVOID *Pointer,
+         RECT *Rect = NULL );
+
+      // Backbuffer 0 is shown by the next Show, backbuffer 1
+      // by the one after that, and so on:
+      bool StartBackBufferAccess ( LONG Index,
+         LPVOID *Pointer, RECT *Rect = NULL );
+      bool EndBackBufferAccess ( LONG Index,
+         RECT *Rect = NULL );
+
       bool SetSurfaceType ( SurfaceType Type );
       
       bool SetGeneralOptions ( LONG Width, LONG Height,
          LONG BPP );
+      // The number of backbuffers of a Primary (default 1)
+      // or Chain surface, up to MaxBackBuffers:
       bool SetChainOptions ( LONG ChainCount );
-      bool SetTextureOptions ( bool Alpha );
+      bool SetTextureOptions ( bool Alpha,
+         BlockCompression Compression = BlockNone );
       bool SetBumpMapOptions ( bool Luminescence );
 
       LONG GetWidth  () { return SurfWidth;  }
       LONG GetHeight () { return SurfHeight; }
       LONG GetPitch  () { return SurfPitch;  }
 
-      bool Show ();
+      // The options the surface was created with:
+      bool        IsCreated      () const { return Created; }
+      SurfaceType GetSurfaceType () const { return PropSurfaceType; }
+      LONG        GetBPP         () const { return PropBPP; }
+      bool        HasAlpha       () const { return PropAlpha; }
+
+      bool IsSystemMemory () { return SysMemory != NULL; }
+      LONG GetBytesPerPixel () { return SurfBytesPerPixel; }
+
+      // Compressed surfaces have no bytes per pixel; their
+      // pitch is the distance between rows of blocks, and
+      // rectangles passed to StartAccess must be 4-aligned:
+      BlockCompression GetCompression () { return PropCompression; }
+
+      // The layout of the surface's memory:
+      bool GetSurfaceFormat ( DDPIXELFORMAT &PF );
+
+      // Show ( false ) only presents: a loss is reported
+      // rather than restored, and the loss check and the
+      // end of the frame (counters, error frame) are left
+      // to the caller, for a present thread whose surfaces
+      // another thread draws to (see PresentQueue):
+      bool Show ( bool EndFrame = true );
+
+      // In partial present mode a primary surface's Show
+      // copies only the dirty parts of the backbuffer to the
+      // front buffer, and blits and clears aimed at the
+      // primary surface draw to the backbuffer:
+      bool SetPartialPresent ( bool Enable,
+         LONG MaxRects = 16 );
+
+      void MarkDirty ( RECT *Rect = NULL ) { Dirty.Add ( Rect ); }
+      DirtyRegion &GetDirtyRegion () { return Dirty; }
+
+      // Grows whenever level 0 is drawn to (any lock but a
+      // read-only one counts) or the surface is created:
+      DWORD GetChangeCount () { return Dirty.GetChangeCount (); }
+
+      void GetPresentStats ( PresentStats &Stats );
+
+      // What was done to this surface since it was created
+      // or the counters were reset, on any thread (see
+      // Counters.hpp); false when counting is compiled out:
+      bool GetOperationCounters ( OperationCounters &Stats );
+      void ResetOperationCounters ();
+
+      // What was done to it during the last frame, as of
+      // the last Show of any primary surface of its
+      // manager:
+      bool GetFrameCounters ( OperationCounters &Stats );
+
+      DWORD GetTraceId () { return TraceId; }
 
       bool NeedsRepainting ();
 
@@ -103,15 +543,80 @@ class DirectDrawSurface {
       bool BlitPortionTo ( RECT &Portion,
          DirectDrawSurface &Dest, LONG DestX, LONG DestY );
 
+      // Stretch Portion over DestRect on the CPU with
+      // Filter, whatever the backend would do, with bands of
+      // rows spread over Pool when there is one. The colour
+      // key applies; blend modes do not:
+      bool ScaleTo ( DirectDrawSurface &Dest, RECT &DestRect,
+         ScaleFilter Filter, ThreadPool *Pool = NULL );
+
+      bool ScalePortionTo ( RECT &Portion,
+         DirectDrawSurface &Dest, RECT &DestRect,
+         ScaleFilter Filter, ThreadPool *Pool = NULL );
+
       bool ClearToDepth ( DWORD Depth );
       bool ClearToColor ( DWORD Color );
+
+      // Primary surfaces cannot clear lazily, since a flip
+      // would show tiles that were never filled:
+      bool SetFastClear ( bool Enable );
+      bool IsClearPending () { return ClearPending; }
+
+      void GetClearStats ( ClearStats &Stats );
+
+      // Only z-buffers can have a depth pyramid. Depths
+      // written through StartAccess are picked up by
+      // EndAccess, so lock only what was written:
+      bool EnableHiZ ( bool Enable );
+      HiZBuffer *GetHiZ () { return HiZ.IsCreated () ? &HiZ : NULL; }
       
       bool SetTransparentColorRange ( DWORD Color1,
          DWORD Color2 );
 
+      // Only 8-bit surfaces take a palette, which must
+      // outlive them (NULL detaches it). Blits from a
+      // surface with a palette to a true colour surface
+      // expand through it, with the colour key range
+      // taken as palette indices:
+      bool SetPalette ( DirectDrawPalette *Palette );
+      DirectDrawPalette *GetPalette () { return Palette; }
+
+      // Blits from a surface with a mode other than
+      // BlendOpaque blend into the destination on the CPU,
+      // by the source's alpha times Opacity and, with a
+      // Mask, times the 8-bit Alpha surface's pixels under
+      // the blitted portion. The mask must be at least as
+      // large as this surface and created by the same
+      // manager; it is not owned, and destroying it sets the
+      // mode back to BlendOpaque. Colour keys still apply,
+      // and stretched blits sample the nearest pixel:
+      bool SetBlendMode ( BlendMode Mode,
+         DirectDrawSurface *Mask = NULL, BYTE Opacity = 255 );
+      BlendMode GetBlendMode () { return PropBlendMode; }
+
       bool GetInterface ( LPDIRECTDRAWSURFACE7 *Interface );
 
+      LONG GetBackBufferCount ();
+      bool GetBackBuffer ( LONG Index,
+         LPDIRECTDRAWSURFACE7 *Interface );
+
       bool GetBaseInterface ( LPDIRECTDRAWSURFACE *Base );
+
+      // Level 0 is the texture itself; each level below is
+      // half the size of the one above, down to 1x1:
+      LONG GetMipLevelCount ();
+      LONG GetMipLevelWidth  ( LONG Level );
+      LONG GetMipLevelHeight ( LONG Level );
+
+      bool StartMipLevelAccess ( LONG Level, LPVOID *Pointer,
+         LONG *Pitch );
+      bool EndMipLevelAccess ( LONG Level );
+
+      // Fill every level below level 0 of a texture from
+      // the one above it. With a Pool, the rows of each
+      // level are filtered in parallel:
+      bool GenerateMipmaps ( MipFilter Filter = MipBox,
+         ThreadPool *Pool = NULL );
 };
 
 #endif
\ No newline at end of file
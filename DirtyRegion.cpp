@@ -0,0 +1,157 @@
+//
+// File name: DirtyRegion.cpp
+//
+// Description: A small set of rectangles describing the
+//              parts of a surface that changed.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries:
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "DirtyRegion.hpp"
+
+DirtyRegion::DirtyRegion () {
+   Count = 0;
+   Limit = 16;
+   Width = Height = 0;
+
+   Changes = 0;
+}
+
+void DirtyRegion::SetBounds ( LONG Width, LONG Height ) {
+   this->Width  = Width;
+   this->Height = Height;
+
+   Count = 0;
+
+   Changes++;
+}
+
+bool DirtyRegion::SetLimit ( LONG Limit ) {
+   RECT Old [ MaxRects ];
+   LONG Index, OldCount;
+
+   if ( Limit < 1 || Limit > MaxRects )
+      return false;
+
+   this->Limit = Limit;
+
+   // Add the current rects again under the new limit:
+   OldCount = Count;
+
+   for ( Index = 0; Index < OldCount; Index++ )
+      Old [ Index ] = Rects [ Index ];
+
+   Count = 0;
+
+   for ( Index = 0; Index < OldCount; Index++ )
+      Add ( &Old [ Index ] );
+
+   return true;
+}
+
+void DirtyRegion::Remove ( LONG Index ) {
+   Rects [ Index ] = Rects [ --Count ];
+}
+
+inline DWORD RectArea ( RECT &Rect ) {
+   return ( DWORD ) ( Rect.right - Rect.left ) *
+      ( DWORD ) ( Rect.bottom - Rect.top );
+}
+
+inline void GrowRect ( RECT &Dest, RECT &Rect ) {
+   if ( Rect.left   < Dest.left   ) Dest.left   = Rect.left;
+   if ( Rect.top    < Dest.top    ) Dest.top    = Rect.top;
+   if ( Rect.right  > Dest.right  ) Dest.right  = Rect.right;
+   if ( Rect.bottom > Dest.bottom ) Dest.bottom = Rect.bottom;
+}
+
+void DirtyRegion::Add ( RECT *Rect ) {
+   RECT New, Merged;
+   LONG Index, Best;
+   DWORD Growth, BestGrowth;
+   bool Absorbed;
+
+   if ( Rect == NULL ) {
+      New.left = 0; New.top = 0;
+      New.right = Width; New.bottom = Height;
+   }
+   else {
+      New = *Rect;
+
+      // Clip to the surface:
+      if ( New.left   < 0      ) New.left   = 0;
+      if ( New.top    < 0      ) New.top    = 0;
+      if ( New.right  > Width  ) New.right  = Width;
+      if ( New.bottom > Height ) New.bottom = Height;
+   }
+
+   if ( New.left >= New.right || New.top >= New.bottom )
+      return;
+
+   Changes++;
+
+   for ( ;; ) {
+      // Absorb every rect the new one overlaps or touches,
+      // so the stored rects never overlap:
+      do {
+         Absorbed = false;
+
+         for ( Index = 0; Index < Count; Index++ ) {
+            if ( Rects [ Index ].left   <= New.right  &&
+                 Rects [ Index ].right  >= New.left   &&
+                 Rects [ Index ].top    <= New.bottom &&
+                 Rects [ Index ].bottom >= New.top ) {
+
+               GrowRect ( New, Rects [ Index ] );
+               Remove ( Index );
+
+               Absorbed = true;
+               break;
+            }
+         }
+      } while ( Absorbed );
+
+      if ( Count < Limit ) {
+         Rects [ Count++ ] = New;
+
+         return;
+      }
+
+      // Out of rects: merge with whichever one grows the
+      // region least, then check for overlaps again:
+      Best = 0; BestGrowth = 0xFFFFFFFF;
+
+      for ( Index = 0; Index < Count; Index++ ) {
+         Merged = New;
+         GrowRect ( Merged, Rects [ Index ] );
+
+         Growth = RectArea ( Merged ) - RectArea ( New ) -
+            RectArea ( Rects [ Index ] );
+
+         if ( Growth < BestGrowth ) {
+            BestGrowth = Growth;
+            Best = Index;
+         }
+      }
+
+      GrowRect ( New, Rects [ Best ] );
+      Remove ( Best );
+   }
+}
+
+DWORD DirtyRegion::GetArea () {
+   DWORD Area = 0;
+   LONG Index;
+
+   // The rects never overlap, so their areas add up:
+   for ( Index = 0; Index < Count; Index++ )
+      Area += RectArea ( Rects [ Index ] );
+
+   return Area;
+}
@@ -0,0 +1,61 @@
+//
+// File name: DirtyRegion.hpp
+//
+// Description: A small set of rectangles describing the
+//              parts of a surface that changed.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries:
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __DIRTYREGIONHPP__
+#define __DIRTYREGIONHPP__
+
+#include <Windows.H>
+
+class DirtyRegion {
+   public:
+      enum { MaxRects = 32 };
+
+   protected:
+      RECT Rects [ MaxRects ];
+
+      LONG Count, Limit, Width, Height;
+
+      DWORD Changes;
+
+      void Remove ( LONG Index );
+
+   public:
+      DirtyRegion ();
+
+      void SetBounds ( LONG Width, LONG Height );
+
+      // Rects are merged once more than Limit would be
+      // needed (at most MaxRects):
+      bool SetLimit ( LONG Limit );
+
+      // A NULL Rect marks the whole surface:
+      void Add ( RECT *Rect = NULL );
+      void Clear () { Count = 0; }
+
+      bool IsEmpty () { return Count == 0; }
+
+      LONG  GetCount () { return Count; }
+      RECT &GetRect  ( LONG Index ) { return Rects [ Index ]; }
+
+      DWORD GetArea ();
+
+      // Counts every non-empty Add and every SetBounds.
+      // Unlike the rects it is never cleared, so a reader
+      // can tell whether the surface changed since it last
+      // looked:
+      DWORD GetChangeCount () { return Changes; }
+};
+
+#endif
@@ -0,0 +1,432 @@
+//
+// File name: ErrorLog.cpp
+//
+// Description: Table driven names for DirectDraw errors and
+//              a lock free log of where they happened.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include <Stdio.H>
+#include <String.H>
+
+#include "ErrorLog.hpp"
+
+struct ErrorName {
+   HRESULT Code;
+
+   const char *Name;
+};
+
+static const ErrorName Names [] = {
+   { DD_OK,                              "DD_OK" },
+   { DDERR_ALREADYINITIALIZED,           "DDERR_ALREADYINITIALIZED" },
+   { DDERR_BLTFASTCANTCLIP,              "DDERR_BLTFASTCANTCLIP" },
+   { DDERR_CANNOTATTACHSURFACE,          "DDERR_CANNOTATTACHSURFACE" },
+   { DDERR_CANNOTDETACHSURFACE,          "DDERR_CANNOTDETACHSURFACE" },
+   { DDERR_CANTCREATEDC,                 "DDERR_CANTCREATEDC" },
+   { DDERR_CANTDUPLICATE,                "DDERR_CANTDUPLICATE" },
+   { DDERR_CANTLOCKSURFACE,              "DDERR_CANTLOCKSURFACE" },
+   { DDERR_CANTPAGELOCK,                 "DDERR_CANTPAGELOCK" },
+   { DDERR_CANTPAGEUNLOCK,               "DDERR_CANTPAGEUNLOCK" },
+   { DDERR_CLIPPERISUSINGHWND,           "DDERR_CLIPPERISUSINGHWND" },
+   { DDERR_COLORKEYNOTSET,               "DDERR_COLORKEYNOTSET" },
+   { DDERR_CURRENTLYNOTAVAIL,            "DDERR_CURRENTLYNOTAVAIL" },
+   { DDERR_DCALREADYCREATED,             "DDERR_DCALREADYCREATED" },
+   { DDERR_DEVICEDOESNTOWNSURFACE,       "DDERR_DEVICEDOESNTOWNSURFACE" },
+   { DDERR_DIRECTDRAWALREADYCREATED,     "DDERR_DIRECTDRAWALREADYCREATED" },
+   { DDERR_EXCEPTION,                    "DDERR_EXCEPTION" },
+   { DDERR_EXCLUSIVEMODEALREADYSET,      "DDERR_EXCLUSIVEMODEALREADYSET" },
+   { DDERR_EXPIRED,                      "DDERR_EXPIRED" },
+   { DDERR_GENERIC,                      "DDERR_GENERIC" },
+   { DDERR_HEIGHTALIGN,                  "DDERR_HEIGHTALIGN" },
+   { DDERR_HWNDALREADYSET,               "DDERR_HWNDALREADYSET" },
+   { DDERR_HWNDSUBCLASSED,               "DDERR_HWNDSUBCLASSED" },
+   { DDERR_IMPLICITLYCREATED,            "DDERR_IMPLICITLYCREATED" },
+   { DDERR_INCOMPATIBLEPRIMARY,          "DDERR_INCOMPATIBLEPRIMARY" },
+   { DDERR_INVALIDCAPS,                  "DDERR_INVALIDCAPS" },
+   { DDERR_INVALIDCLIPLIST,              "DDERR_INVALIDCLIPLIST" },
+   { DDERR_INVALIDDIRECTDRAWGUID,        "DDERR_INVALIDDIRECTDRAWGUID" },
+   { DDERR_INVALIDMODE,                  "DDERR_INVALIDMODE" },
+   { DDERR_INVALIDOBJECT,                "DDERR_INVALIDOBJECT" },
+   { DDERR_INVALIDPARAMS,                "DDERR_INVALIDPARAMS" },
+   { DDERR_INVALIDPIXELFORMAT,           "DDERR_INVALIDPIXELFORMAT" },
+   { DDERR_INVALIDPOSITION,              "DDERR_INVALIDPOSITION" },
+   { DDERR_INVALIDRECT,                  "DDERR_INVALIDRECT" },
+   { DDERR_INVALIDSTREAM,                "DDERR_INVALIDSTREAM" },
+   { DDERR_INVALIDSURFACETYPE,           "DDERR_INVALIDSURFACETYPE" },
+   { DDERR_LOCKEDSURFACES,               "DDERR_LOCKEDSURFACES" },
+   { DDERR_MOREDATA,                     "DDERR_MOREDATA" },
+   { DDERR_NO3D,                         "DDERR_NO3D" },
+   { DDERR_NOALPHAHW,                    "DDERR_NOALPHAHW" },
+   { DDERR_NOBLTHW,                      "DDERR_NOBLTHW" },
+   { DDERR_NOCLIPLIST,                   "DDERR_NOCLIPLIST" },
+   { DDERR_NOCLIPPERATTACHED,            "DDERR_NOCLIPPERATTACHED" },
+   { DDERR_NOCOLORCONVHW,                "DDERR_NOCOLORCONVHW" },
+   { DDERR_NOCOLORKEY,                   "DDERR_NOCOLORKEY" },
+   { DDERR_NOCOLORKEYHW,                 "DDERR_NOCOLORKEYHW" },
+   { DDERR_NOCOOPERATIVELEVELSET,        "DDERR_NOCOOPERATIVELEVELSET" },
+   { DDERR_NODC,                         "DDERR_NODC" },
+   { DDERR_NODDROPSHW,                   "DDERR_NODDROPSHW" },
+   { DDERR_NODIRECTDRAWHW,               "DDERR_NODIRECTDRAWHW" },
+   { DDERR_NODIRECTDRAWSUPPORT,          "DDERR_NODIRECTDRAWSUPPORT" },
+   { DDERR_NOEMULATION,                  "DDERR_NOEMULATION" },
+   { DDERR_NOEXCLUSIVEMODE,              "DDERR_NOEXCLUSIVEMODE" },
+   { DDERR_NOFLIPHW,                     "DDERR_NOFLIPHW" },
+   { DDERR_NOFOCUSWINDOW,                "DDERR_NOFOCUSWINDOW" },
+   { DDERR_NOGDI,                        "DDERR_NOGDI" },
+   { DDERR_NOHWND,                       "DDERR_NOHWND" },
+   { DDERR_NOMIPMAPHW,                   "DDERR_NOMIPMAPHW" },
+   { DDERR_NOMIRRORHW,                   "DDERR_NOMIRRORHW" },
+   { DDERR_NONONLOCALVIDMEM,             "DDERR_NONONLOCALVIDMEM" },
+   { DDERR_NOOPTIMIZEHW,                 "DDERR_NOOPTIMIZEHW" },
+   { DDERR_NOOVERLAYDEST,                "DDERR_NOOVERLAYDEST" },
+   { DDERR_NOOVERLAYHW,                  "DDERR_NOOVERLAYHW" },
+   { DDERR_NOPALETTEATTACHED,            "DDERR_NOPALETTEATTACHED" },
+   { DDERR_NOPALETTEHW,                  "DDERR_NOPALETTEHW" },
+   { DDERR_NORASTEROPHW,                 "DDERR_NORASTEROPHW" },
+   { DDERR_NOROTATIONHW,                 "DDERR_NOROTATIONHW" },
+   { DDERR_NOSTRETCHHW,                  "DDERR_NOSTRETCHHW" },
+   { DDERR_NOT4BITCOLOR,                 "DDERR_NOT4BITCOLOR" },
+   { DDERR_NOT4BITCOLORINDEX,            "DDERR_NOT4BITCOLORINDEX" },
+   { DDERR_NOT8BITCOLOR,                 "DDERR_NOT8BITCOLOR" },
+   { DDERR_NOTAOVERLAYSURFACE,           "DDERR_NOTAOVERLAYSURFACE" },
+   { DDERR_NOTEXTUREHW,                  "DDERR_NOTEXTUREHW" },
+   { DDERR_NOTFLIPPABLE,                 "DDERR_NOTFLIPPABLE" },
+   { DDERR_NOTFOUND,                     "DDERR_NOTFOUND" },
+   { DDERR_NOTINITIALIZED,               "DDERR_NOTINITIALIZED" },
+   { DDERR_NOTLOADED,                    "DDERR_NOTLOADED" },
+   { DDERR_NOTLOCKED,                    "DDERR_NOTLOCKED" },
+   { DDERR_NOTPAGELOCKED,                "DDERR_NOTPAGELOCKED" },
+   { DDERR_NOTPALETTIZED,                "DDERR_NOTPALETTIZED" },
+   { DDERR_NOVSYNCHW,                    "DDERR_NOVSYNCHW" },
+   { DDERR_NOZBUFFERHW,                  "DDERR_NOZBUFFERHW" },
+   { DDERR_NOZOVERLAYHW,                 "DDERR_NOZOVERLAYHW" },
+   { DDERR_OUTOFCAPS,                    "DDERR_OUTOFCAPS" },
+   { DDERR_OUTOFMEMORY,                  "DDERR_OUTOFMEMORY" },
+   { DDERR_OUTOFVIDEOMEMORY,             "DDERR_OUTOFVIDEOMEMORY" },
+   { DDERR_OVERLAPPINGRECTS,             "DDERR_OVERLAPPINGRECTS" },
+   { DDERR_OVERLAYCANTCLIP,              "DDERR_OVERLAYCANTCLIP" },
+   { DDERR_OVERLAYCOLORKEYONLYONEACTIVE, "DDERR_OVERLAYCOLORKEYONLYONEACTIVE" },
+   { DDERR_OVERLAYNOTVISIBLE,            "DDERR_OVERLAYNOTVISIBLE" },
+   { DDERR_PALETTEBUSY,                  "DDERR_PALETTEBUSY" },
+   { DDERR_PRIMARYSURFACEALREADYEXISTS,  "DDERR_PRIMARYSURFACEALREADYEXISTS" },
+   { DDERR_REGIONTOOSMALL,               "DDERR_REGIONTOOSMALL" },
+   { DDERR_SURFACEALREADYATTACHED,       "DDERR_SURFACEALREADYATTACHED" },
+   { DDERR_SURFACEALREADYDEPENDENT,      "DDERR_SURFACEALREADYDEPENDENT" },
+   { DDERR_SURFACEBUSY,                  "DDERR_SURFACEBUSY" },
+   { DDERR_SURFACEISOBSCURED,            "DDERR_SURFACEISOBSCURED" },
+   { DDERR_SURFACELOST,                  "DDERR_SURFACELOST" },
+   { DDERR_SURFACENOTATTACHED,           "DDERR_SURFACENOTATTACHED" },
+   { DDERR_TOOBIGHEIGHT,                 "DDERR_TOOBIGHEIGHT" },
+   { DDERR_TOOBIGSIZE,                   "DDERR_TOOBIGSIZE" },
+   { DDERR_TOOBIGWIDTH,                  "DDERR_TOOBIGWIDTH" },
+   { DDERR_UNSUPPORTED,                  "DDERR_UNSUPPORTED" },
+   { DDERR_UNSUPPORTEDFORMAT,            "DDERR_UNSUPPORTEDFORMAT" },
+   { DDERR_UNSUPPORTEDMASK,              "DDERR_UNSUPPORTEDMASK" },
+   { DDERR_UNSUPPORTEDMODE,              "DDERR_UNSUPPORTEDMODE" },
+   { DDERR_VERTICALBLANKINPROGRESS,      "DDERR_VERTICALBLANKINPROGRESS" },
+   { DDERR_VIDEONOTACTIVE,               "DDERR_VIDEONOTACTIVE" },
+   { DDERR_WASSTILLDRAWING,              "DDERR_WASSTILLDRAWING" },
+   { DDERR_WRONGMODE,                    "DDERR_WRONGMODE" },
+   { DDERR_XALIGN,                       "DDERR_XALIGN" },
+};
+
+#define NameCount ( ( LONG ) ( sizeof ( Names ) / sizeof ( ErrorName ) ) )
+
+// DirectDraw's own codes are looked up by their low word;
+// the few it shares with COM are kept to one side:
+#define FacilityCodes 1024
+
+static WORD FacilityNames [ FacilityCodes ];
+static WORD OtherNames [ NameCount ];
+static LONG OtherCount;
+
+// A slot's sequence is the ticket of the record in it, or 0
+// while it is being written:
+struct ErrorSlot {
+   ErrorRecord Record;
+
+   volatile LONG Sequence;
+};
+
+static ErrorSlot Ring [ ErrorLogSize ];
+
+static volatile LONG Written, Logged, Suppressed, Frame;
+
+// When each code (and, in the last slot, every unnamed
+// one) last reached the sink, and how many were held back
+// since:
+static volatile LONG LastLogged [ NameCount + 1 ];
+static volatile LONG Pending    [ NameCount + 1 ];
+
+static ErrorSink SinkFunction = DebugStringErrorSink;
+static LPVOID    SinkContext  = NULL;
+static DWORD     LogInterval  = 1000;
+
+static bool BuildErrorTables () {
+   DWORD Code;
+   LONG Index;
+
+   for ( Index = 0; Index < NameCount; Index++ ) {
+      Code = ( DWORD ) Names [ Index ].Code;
+
+      if ( ( Code & 0xFFFF0000 ) ==
+           ( ( DWORD ) MAKE_DDHRESULT ( 0 ) & 0xFFFF0000 ) &&
+           ( Code & 0xFFFF ) < FacilityCodes )
+         FacilityNames [ Code & 0xFFFF ] = ( WORD ) ( Index + 1 );
+      else
+         OtherNames [ OtherCount++ ] = ( WORD ) Index;
+   }
+
+   return true;
+}
+
+static bool TablesBuilt = BuildErrorTables ();
+
+// The index of Error in Names, or -1:
+static LONG FindName ( HRESULT Error ) {
+   DWORD Code = ( DWORD ) Error;
+   LONG Index;
+
+   if ( ( Code & 0xFFFF0000 ) ==
+        ( ( DWORD ) MAKE_DDHRESULT ( 0 ) & 0xFFFF0000 ) )
+      return ( Code & 0xFFFF ) < FacilityCodes ?
+         FacilityNames [ Code & 0xFFFF ] - 1 : -1;
+
+   for ( Index = 0; Index < OtherCount; Index++ ) {
+      if ( Names [ OtherNames [ Index ] ].Code == Error )
+         return OtherNames [ Index ];
+   }
+
+   return -1;
+}
+
+const char *GetDirectDrawErrorName ( HRESULT Error ) {
+   LONG Index = FindName ( Error );
+
+   return Index >= 0 ? Names [ Index ].Name : NULL;
+}
+
+// Whether this report of code slot Rate may go to the sink.
+// Of reports racing for the same turn only one wins:
+static bool TakeLogTurn ( LONG Rate ) {
+   LONG Now, Last;
+
+   if ( LogInterval == 0 )
+      return true;
+
+   // 0 marks a code that has never been logged:
+   Now  = ( LONG ) GetTickCount ();
+   Now  = Now != 0 ? Now : 1;
+   Last = LastLogged [ Rate ];
+
+   if ( Last != 0 && ( DWORD ) ( Now - Last ) < LogInterval )
+      return false;
+
+   return InterlockedCompareExchange ( &LastLogged [ Rate ],
+      Now, Last ) == Last;
+}
+
+bool ReportDirectDrawError ( HRESULT Error, const char *File,
+        LONG Line ) {
+
+   ErrorRecord Record;
+   ErrorSlot *Slot;
+   ErrorSink Sink;
+   LONG Ticket, Index, Rate, Skipped;
+
+   Record.Code   = Error;
+   Record.File   = File;
+   Record.Line   = Line;
+   Record.Frame  = ( DWORD ) Frame;
+   Record.Thread = GetCurrentThreadId ();
+
+   // Each report takes the next slot; readers skip a slot
+   // until its sequence shows the record is complete:
+   Ticket = InterlockedIncrement ( &Written );
+   Slot   = &Ring [ ( Ticket - 1 ) & ( ErrorLogSize - 1 ) ];
+
+   InterlockedExchange ( &Slot->Sequence, 0 );
+
+   Slot->Record = Record;
+
+   InterlockedExchange ( &Slot->Sequence, Ticket );
+
+   Sink = SinkFunction;
+
+   if ( Sink == NULL )
+      return false;
+
+   Index = FindName ( Error );
+   Rate  = Index >= 0 ? Index : NameCount;
+
+   if ( !TakeLogTurn ( Rate ) ) {
+      InterlockedIncrement ( &Pending [ Rate ] );
+      InterlockedIncrement ( &Suppressed );
+
+      return false;
+   }
+
+   Skipped = InterlockedExchange ( &Pending [ Rate ], 0 );
+
+   InterlockedIncrement ( &Logged );
+
+   Sink ( Record, Index >= 0 ? Names [ Index ].Name : NULL,
+      Skipped, SinkContext );
+
+   return false;
+}
+
+void SetErrorSink ( ErrorSink Sink, LPVOID Context ) {
+   SinkFunction = Sink;
+   SinkContext  = Context;
+}
+
+void SetErrorLogInterval ( DWORD Milliseconds ) {
+   LONG Rate;
+
+   LogInterval = Milliseconds;
+
+   // The next report of every code is logged:
+   for ( Rate = 0; Rate <= NameCount; Rate++ )
+      InterlockedExchange ( &LastLogged [ Rate ], 0 );
+}
+
+void AdvanceErrorFrame () {
+   InterlockedIncrement ( &Frame );
+}
+
+DWORD GetErrorFrame () {
+   return ( DWORD ) Frame;
+}
+
+LONG ReadErrors ( ErrorRecord *Records, LONG Count,
+        LONG &Cursor, DWORD *Lost ) {
+
+   ErrorSlot *Slot;
+   LONG Read = 0, Newest, Sequence, Missed;
+
+   while ( Read < Count ) {
+      Newest = InterlockedCompareExchange ( &Written, 0, 0 );
+
+      if ( Cursor >= Newest )
+         break;
+
+      // Anything more than a ring behind has been
+      // overwritten:
+      Missed = Newest - ErrorLogSize - Cursor;
+
+      if ( Missed > 0 ) {
+         if ( Lost != NULL )
+            ( *Lost ) += Missed;
+
+         Cursor += Missed;
+      }
+
+      Slot = &Ring [ Cursor & ( ErrorLogSize - 1 ) ];
+
+      Sequence = InterlockedCompareExchange ( &Slot->Sequence,
+         0, 0 );
+
+      // A record still being written is read next time:
+      if ( Sequence < Cursor + 1 )
+         break;
+
+      if ( Sequence == Cursor + 1 ) {
+         Records [ Read ] = Slot->Record;
+
+         // The copy only counts if no writer came by
+         // during it:
+         if ( InterlockedCompareExchange ( &Slot->Sequence,
+                 0, 0 ) == Sequence ) {
+            Read++;
+            Cursor++;
+
+            continue;
+         }
+      }
+
+      if ( Lost != NULL )
+         ( *Lost )++;
+
+      Cursor++;
+   }
+
+   return Read;
+}
+
+void GetErrorLogStats ( ErrorLogStats &Stats ) {
+   Stats.Reported   = ( DWORD ) Written;
+   Stats.Logged     = ( DWORD ) Logged;
+   Stats.Suppressed = ( DWORD ) Suppressed;
+}
+
+static void FormatError ( char *Message, const ErrorRecord &Record,
+        const char *Name, LONG Suppressed ) {
+
+   if ( Name != NULL )
+      sprintf ( Message, "DirectDraw Error: %s", Name );
+   else
+      sprintf ( Message, "DirectDraw Error: 0x%08lX",
+         ( DWORD ) Record.Code );
+
+   sprintf ( Message + strlen ( Message ),
+      " at %.160s(%ld), frame %lu", Record.File, Record.Line,
+      Record.Frame );
+
+   if ( Suppressed > 0 )
+      sprintf ( Message + strlen ( Message ),
+         " (%ld more since the last)", Suppressed );
+}
+
+void DebugStringErrorSink ( const ErrorRecord &Record,
+        const char *Name, LONG Suppressed, LPVOID ) {
+
+   char Message [ 320 ];
+
+   FormatError ( Message, Record, Name, Suppressed );
+
+   strcat ( Message, "\n" );
+
+   OutputDebugString ( Message );
+}
+
+void MessageBoxErrorSink ( const ErrorRecord &Record,
+        const char *Name, LONG Suppressed, LPVOID ) {
+
+   char Message [ 320 ];
+
+   FormatError ( Message, Record, Name, Suppressed );
+
+   MessageBox ( GetActiveWindow (), Message,
+      "DirectDraw Fatal Error", MB_OK | MB_ICONERROR );
+}
+
+double MeasureErrorReportCost ( HRESULT Error, LONG Repeats ) {
+   LARGE_INTEGER Start, Stop, Frequency;
+   LONG Repeat;
+   double Seconds;
+
+   if ( Repeats <= 0 )
+      return 0.0;
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ )
+      PrintDirectDrawError ( Error );
+
+   QueryPerformanceCounter ( &Stop );
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   return Seconds * 1e9 / Repeats;
+}
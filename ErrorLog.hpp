@@ -0,0 +1,98 @@
+//
+// File name: ErrorLog.hpp
+//
+// Description: Table driven names for DirectDraw errors and
+//              a lock free log of where they happened.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __ERRORLOGHPP__
+#define __ERRORLOGHPP__
+
+#include <Windows.H>
+#include <DDraw.H>
+
+// The number of records the log keeps; older ones are
+// overwritten:
+#define ErrorLogSize 256
+
+// One reported error, from the file and line of the call
+// that failed, during frame Frame (see AdvanceErrorFrame):
+struct ErrorRecord {
+   HRESULT Code;
+
+   const char *File;
+   LONG Line;
+
+   DWORD Frame, Thread;
+};
+
+// How many errors were reported, how many reached the sink
+// and how many it was spared by the rate limit:
+struct ErrorLogStats {
+   DWORD Reported, Logged, Suppressed;
+};
+
+// Receives reported errors, at most once per code per log
+// interval. Suppressed is how many of the code were left
+// out since the last one the sink saw. Sinks are called on
+// the thread that reported the error:
+typedef void ( *ErrorSink ) ( const ErrorRecord &Record,
+   const char *Name, LONG Suppressed, LPVOID Context );
+
+// Record Error in the log, pass it to the sink if the rate
+// limit allows, and return false. Failed calls are
+// reported through PrintDirectDrawError, which adds the
+// call site:
+bool ReportDirectDrawError ( HRESULT Error, const char *File,
+   LONG Line );
+
+#define PrintDirectDrawError(Error) \
+   ReportDirectDrawError ( Error, __FILE__, __LINE__ )
+
+// The name of a DirectDraw error ("DDERR_SURFACELOST"), or
+// NULL if it is not one, found without searching:
+const char *GetDirectDrawErrorName ( HRESULT Error );
+
+// Replace the sink (DebugStringErrorSink by default); a
+// NULL sink only keeps the log. Set it before errors can
+// be reported from other threads:
+void SetErrorSink ( ErrorSink Sink, LPVOID Context = NULL );
+
+// Pass each code to the sink at most once per Milliseconds
+// (1000 by default); 0 passes every error:
+void SetErrorLogInterval ( DWORD Milliseconds );
+
+// Move on to the next frame; called by every present:
+void  AdvanceErrorFrame ();
+DWORD GetErrorFrame ();
+
+// Copy up to Count records written since Cursor, which
+// starts at 0 and is moved past what was read, and return
+// how many were copied. Records overwritten before they
+// could be read are skipped and added to Lost:
+LONG ReadErrors ( ErrorRecord *Records, LONG Count,
+   LONG &Cursor, DWORD *Lost = NULL );
+
+void GetErrorLogStats ( ErrorLogStats &Stats );
+
+// Sinks: the debugger's output window, and the modal
+// message box errors used to stop the program with:
+void DebugStringErrorSink ( const ErrorRecord &Record,
+   const char *Name, LONG Suppressed, LPVOID Context );
+void MessageBoxErrorSink  ( const ErrorRecord &Record,
+   const char *Name, LONG Suppressed, LPVOID Context );
+
+// Report Error Repeats times, as a failing call on the
+// render path would, and return the cost of each report
+// in nanoseconds. The reports are left in the log:
+double MeasureErrorReportCost ( HRESULT Error, LONG Repeats );
+
+#endif
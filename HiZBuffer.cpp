@@ -0,0 +1,618 @@
+//
+// File name: HiZBuffer.cpp
+//
+// Description: A pyramid of minimum and maximum depths
+//              over a z-buffer, for rejecting hidden
+//              geometry without reading every pixel.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries:
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "HiZBuffer.hpp"
+
+HiZBuffer::HiZBuffer () {
+   LONG Level;
+
+   for ( Level = 0; Level < MaxLevels; Level++ ) {
+      Levels [ Level ] = NULL;
+      LevelWidth [ Level ] = LevelHeight [ Level ] = 0;
+   }
+
+   LevelCount = Width = Height = BytesPerPixel = 0;
+   DepthMask = 0;
+
+   ZeroMemory ( &Stats, sizeof ( HiZStats ) );
+}
+
+HiZBuffer::~HiZBuffer () {
+   Destroy ();
+}
+
+bool HiZBuffer::Create ( LONG Width, LONG Height,
+        LONG BytesPerPixel, LONG DepthBits ) {
+
+   LONG LevelW, LevelH, Level, Index;
+
+   Destroy ();
+
+   if ( Width <= 0 || Height <= 0 )
+      return false;
+
+   if ( BytesPerPixel != 1 && BytesPerPixel != 2 &&
+        BytesPerPixel != 4 )
+      return false;
+
+   if ( DepthBits < 1 || DepthBits > 32 ||
+        DepthBits > BytesPerPixel * 8 )
+      return false;
+
+   this->Width  = Width;
+   this->Height = Height;
+   this->BytesPerPixel = BytesPerPixel;
+
+   DepthMask = DepthBits == 32 ? 0xFFFFFFFF :
+      ( ( DWORD ) 1 << DepthBits ) - 1;
+
+   LevelW = ( Width  + TileSize - 1 ) / TileSize;
+   LevelH = ( Height + TileSize - 1 ) / TileSize;
+
+   // Halve the tile grid until one tile covers the
+   // surface:
+   while ( LevelCount < MaxLevels ) {
+      Levels [ LevelCount ] = new Bounds [ LevelW * LevelH ];
+
+      if ( Levels [ LevelCount ] == NULL ) {
+         Destroy ();
+
+         return false;
+      }
+
+      LevelWidth  [ LevelCount ] = LevelW;
+      LevelHeight [ LevelCount ] = LevelH;
+
+      LevelCount++;
+
+      if ( LevelW == 1 && LevelH == 1 )
+         break;
+
+      LevelW = ( LevelW + 1 ) / 2;
+      LevelH = ( LevelH + 1 ) / 2;
+   }
+
+   // Until the first update nothing is known:
+   for ( Level = 0; Level < LevelCount; Level++ ) {
+      for ( Index = 0; Index < LevelWidth [ Level ] *
+            LevelHeight [ Level ]; Index++ ) {
+
+         Levels [ Level ] [ Index ].Min = 0;
+         Levels [ Level ] [ Index ].Max = DepthMask;
+      }
+   }
+
+   return true;
+}
+
+void HiZBuffer::Destroy () {
+   while ( LevelCount > 0 ) {
+      LevelCount--;
+
+      delete [] Levels [ LevelCount ];
+      Levels [ LevelCount ] = NULL;
+   }
+}
+
+void HiZBuffer::Clear ( DWORD Depth ) {
+   LONG Level, Index;
+
+   Depth &= DepthMask;
+
+   for ( Level = 0; Level < LevelCount; Level++ ) {
+      for ( Index = 0; Index < LevelWidth [ Level ] *
+            LevelHeight [ Level ]; Index++ ) {
+
+         Levels [ Level ] [ Index ].Min = Depth;
+         Levels [ Level ] [ Index ].Max = Depth;
+      }
+   }
+}
+
+void HiZBuffer::SetBounds ( RECT &Rect, DWORD Min,
+        DWORD Max ) {
+
+   RECT Area;
+   LONG TileX, TileY, Left, Top, Right, Bottom;
+   Bounds *Tile;
+
+   // Tiles inside Rect take the new bounds; tiles it only
+   // overlaps widen theirs to include them:
+
+   Area = Rect;
+
+   if ( Area.left   < 0      ) Area.left   = 0;
+   if ( Area.top    < 0      ) Area.top    = 0;
+   if ( Area.right  > Width  ) Area.right  = Width;
+   if ( Area.bottom > Height ) Area.bottom = Height;
+
+   if ( Area.left >= Area.right || Area.top >= Area.bottom )
+      return;
+
+   Left   = Area.left / TileSize;
+   Top    = Area.top  / TileSize;
+   Right  = ( Area.right  + TileSize - 1 ) / TileSize;
+   Bottom = ( Area.bottom + TileSize - 1 ) / TileSize;
+
+   for ( TileY = Top; TileY < Bottom; TileY++ ) {
+      for ( TileX = Left; TileX < Right; TileX++ ) {
+         Tile = &Levels [ 0 ] [ TileY * LevelWidth [ 0 ] + TileX ];
+
+         if ( TileX * TileSize >= Area.left &&
+              TileY * TileSize >= Area.top &&
+              ( ( TileX + 1 ) * TileSize <= Area.right ||
+                Area.right == Width ) &&
+              ( ( TileY + 1 ) * TileSize <= Area.bottom ||
+                Area.bottom == Height ) ) {
+
+            Tile->Min = Min;
+            Tile->Max = Max;
+         }
+         else {
+            if ( Min < Tile->Min ) Tile->Min = Min;
+            if ( Max > Tile->Max ) Tile->Max = Max;
+         }
+      }
+   }
+
+   Propagate ( Area );
+}
+
+void HiZBuffer::Propagate ( RECT &Rect ) {
+   LONG Level, X, Y, ChildX, ChildY, Left, Top, Right,
+      Bottom, Size;
+   Bounds *Parent, *Child;
+
+   // Recompute the parents of every changed tile from
+   // their children:
+
+   for ( Level = 1; Level < LevelCount; Level++ ) {
+      Size = TileSize << Level;
+
+      Left   = Rect.left / Size;
+      Top    = Rect.top  / Size;
+      Right  = ( Rect.right  + Size - 1 ) / Size;
+      Bottom = ( Rect.bottom + Size - 1 ) / Size;
+
+      for ( Y = Top; Y < Bottom; Y++ ) {
+         for ( X = Left; X < Right; X++ ) {
+            Parent = &Levels [ Level ] [ Y * LevelWidth [ Level ] + X ];
+
+            Parent->Min = 0xFFFFFFFF;
+            Parent->Max = 0;
+
+            for ( ChildY = Y * 2; ChildY < Y * 2 + 2 &&
+                  ChildY < LevelHeight [ Level - 1 ]; ChildY++ ) {
+
+               for ( ChildX = X * 2; ChildX < X * 2 + 2 &&
+                     ChildX < LevelWidth [ Level - 1 ]; ChildX++ ) {
+
+                  Child = &Levels [ Level - 1 ] [ ChildY *
+                     LevelWidth [ Level - 1 ] + ChildX ];
+
+                  if ( Child->Min < Parent->Min )
+                     Parent->Min = Child->Min;
+
+                  if ( Child->Max > Parent->Max )
+                     Parent->Max = Child->Max;
+               }
+            }
+         }
+      }
+   }
+}
+
+void HiZBuffer::Fill ( RECT &Rect, DWORD Depth ) {
+   if ( LevelCount == 0 )
+      return;
+
+   Depth &= DepthMask;
+
+   SetBounds ( Rect, Depth, Depth );
+}
+
+void HiZBuffer::Invalidate ( RECT &Rect ) {
+   if ( LevelCount == 0 )
+      return;
+
+   SetBounds ( Rect, 0, DepthMask );
+}
+
+void HiZBuffer::Update ( LPBYTE Memory, LONG Pitch,
+        RECT &Rect ) {
+
+   RECT Area, Part;
+   LONG TileX, TileY, X, Y, Left, Top, Right, Bottom, Count;
+   DWORD Min, Max, Depth;
+   LPBYTE Row;
+   Bounds *Tile;
+
+   // Read the depths of every tile Rect overlaps (only
+   // the part inside Rect) and refresh the pyramid:
+
+   if ( LevelCount == 0 )
+      return;
+
+   Area = Rect;
+
+   if ( Area.left < 0 || Area.top < 0 || Area.right > Width ||
+        Area.bottom > Height || Area.left >= Area.right ||
+        Area.top >= Area.bottom )
+      return;
+
+   Left   = Area.left / TileSize;
+   Top    = Area.top  / TileSize;
+   Right  = ( Area.right  + TileSize - 1 ) / TileSize;
+   Bottom = ( Area.bottom + TileSize - 1 ) / TileSize;
+
+   for ( TileY = Top; TileY < Bottom; TileY++ ) {
+      for ( TileX = Left; TileX < Right; TileX++ ) {
+         Part.left   = TileX * TileSize;
+         Part.top    = TileY * TileSize;
+         Part.right  = Part.left + TileSize;
+         Part.bottom = Part.top  + TileSize;
+
+         if ( Part.right  > Width  ) Part.right  = Width;
+         if ( Part.bottom > Height ) Part.bottom = Height;
+
+         Tile = &Levels [ 0 ] [ TileY * LevelWidth [ 0 ] + TileX ];
+
+         // A tile only partly inside Rect keeps the depths
+         // outside it in its old bounds:
+         if ( Part.left < Area.left || Part.top < Area.top ||
+              Part.right > Area.right ||
+              Part.bottom > Area.bottom ) {
+
+            Min = Tile->Min; Max = Tile->Max;
+
+            if ( Part.left   < Area.left   ) Part.left   = Area.left;
+            if ( Part.top    < Area.top    ) Part.top    = Area.top;
+            if ( Part.right  > Area.right  ) Part.right  = Area.right;
+            if ( Part.bottom > Area.bottom ) Part.bottom = Area.bottom;
+         }
+         else {
+            Min = 0xFFFFFFFF; Max = 0;
+         }
+
+         for ( Y = Part.top; Y < Part.bottom; Y++ ) {
+            Row = Memory + ( Y - Area.top ) * Pitch +
+               ( Part.left - Area.left ) * BytesPerPixel;
+
+            Count = Part.right - Part.left;
+
+            switch ( BytesPerPixel ) {
+               case 1:
+                  for ( X = 0; X < Count; X++ ) {
+                     Depth = Row [ X ] & DepthMask;
+
+                     if ( Depth < Min ) Min = Depth;
+                     if ( Depth > Max ) Max = Depth;
+                  }
+               break;
+               case 2:
+                  for ( X = 0; X < Count; X++ ) {
+                     Depth = ( ( WORD * ) Row ) [ X ] & DepthMask;
+
+                     if ( Depth < Min ) Min = Depth;
+                     if ( Depth > Max ) Max = Depth;
+                  }
+               break;
+               default:
+                  for ( X = 0; X < Count; X++ ) {
+                     Depth = ( ( DWORD * ) Row ) [ X ] & DepthMask;
+
+                     if ( Depth < Min ) Min = Depth;
+                     if ( Depth > Max ) Max = Depth;
+                  }
+               break;
+            }
+         }
+
+         Tile->Min = Min;
+         Tile->Max = Max;
+      }
+   }
+
+   Propagate ( Area );
+}
+
+HiZResult HiZBuffer::TestTile ( LONG Level, LONG TileX,
+        LONG TileY, RECT &Rect, DWORD MinDepth,
+        DWORD MaxDepth ) {
+
+   LONG X, Y, Size;
+   Bounds *Tile;
+   HiZResult Result, Child;
+   bool First = true;
+
+   Stats.TilesVisited++;
+
+   Tile = &Levels [ Level ] [ TileY * LevelWidth [ Level ] +
+      TileX ];
+
+   if ( MinDepth >= Tile->Max )
+      return HiZRejected;
+
+   if ( MaxDepth < Tile->Min )
+      return HiZAccepted;
+
+   if ( Level == 0 )
+      return HiZAmbiguous;
+
+   // Refine with the children that overlap Rect:
+   Size = TileSize << ( Level - 1 );
+   Result = HiZAmbiguous;
+
+   for ( Y = TileY * 2; Y < TileY * 2 + 2 &&
+         Y < LevelHeight [ Level - 1 ]; Y++ ) {
+
+      if ( ( Y + 1 ) * Size <= Rect.top || Y * Size >= Rect.bottom )
+         continue;
+
+      for ( X = TileX * 2; X < TileX * 2 + 2 &&
+            X < LevelWidth [ Level - 1 ]; X++ ) {
+
+         if ( ( X + 1 ) * Size <= Rect.left ||
+              X * Size >= Rect.right )
+            continue;
+
+         Child = TestTile ( Level - 1, X, Y, Rect, MinDepth,
+            MaxDepth );
+
+         if ( Child == HiZAmbiguous )
+            return HiZAmbiguous;
+
+         if ( First )
+            Result = Child;
+         else if ( Child != Result )
+            return HiZAmbiguous;
+
+         First = false;
+      }
+   }
+
+   return Result;
+}
+
+HiZResult HiZBuffer::Test ( RECT &Rect, DWORD MinDepth,
+        DWORD MaxDepth ) {
+
+   RECT Area;
+   LONG Level, Size, X, Y, Left, Top, Right, Bottom;
+   HiZResult Result = HiZRejected, Tile;
+   bool First = true;
+
+   if ( LevelCount == 0 )
+      return HiZAmbiguous;
+
+   Stats.Queries++;
+
+   Area = Rect;
+
+   if ( Area.left   < 0      ) Area.left   = 0;
+   if ( Area.top    < 0      ) Area.top    = 0;
+   if ( Area.right  > Width  ) Area.right  = Width;
+   if ( Area.bottom > Height ) Area.bottom = Height;
+
+   // Nothing of the rect is on the surface:
+   if ( Area.left >= Area.right || Area.top >= Area.bottom ) {
+      Stats.Rejected++;
+
+      return HiZRejected;
+   }
+
+   // Start from the finest level on which the rect spans
+   // at most two tiles each way:
+   for ( Level = LevelCount - 1; Level > 0; Level-- ) {
+      Size = TileSize << ( Level - 1 );
+
+      if ( ( Area.right - 1 ) / Size - Area.left / Size >= 2 ||
+           ( Area.bottom - 1 ) / Size - Area.top / Size >= 2 )
+         break;
+   }
+
+   Size   = TileSize << Level;
+   Left   = Area.left / Size;
+   Top    = Area.top  / Size;
+   Right  = ( Area.right  - 1 ) / Size;
+   Bottom = ( Area.bottom - 1 ) / Size;
+
+   for ( Y = Top; Y <= Bottom && Result != HiZAmbiguous; Y++ ) {
+      for ( X = Left; X <= Right; X++ ) {
+         Tile = TestTile ( Level, X, Y, Area, MinDepth,
+            MaxDepth );
+
+         if ( First )
+            Result = Tile;
+         else if ( Tile != Result )
+            Result = HiZAmbiguous;
+
+         First = false;
+
+         if ( Result == HiZAmbiguous )
+            break;
+      }
+   }
+
+   switch ( Result ) {
+      case HiZRejected:
+         Stats.Rejected++;
+      break;
+      case HiZAccepted:
+         Stats.Accepted++;
+      break;
+      default:
+         Stats.Ambiguous++;
+      break;
+   }
+
+   return Result;
+}
+
+HiZResult HiZBuffer::TestSpan ( LONG Y, LONG Left, LONG Right,
+        DWORD MinDepth, DWORD MaxDepth ) {
+
+   RECT Span;
+
+   Span.left = Left;  Span.top    = Y;
+   Span.right = Right; Span.bottom = Y + 1;
+
+   return Test ( Span, MinDepth, MaxDepth );
+}
+
+void HiZBuffer::GetStats ( HiZStats &Statistics ) {
+   Statistics = Stats;
+}
+
+void HiZBuffer::ResetStats () {
+   ZeroMemory ( &Stats, sizeof ( HiZStats ) );
+}
+
+static void DrawQuad ( WORD *Buffer, LONG Pitch, RECT &Rect,
+        WORD Depth, bool Test ) {
+
+   LONG X, Y;
+   WORD *Row;
+
+   for ( Y = Rect.top; Y < Rect.bottom; Y++ ) {
+      Row = Buffer + Y * Pitch;
+
+      if ( Test ) {
+         for ( X = Rect.left; X < Rect.right; X++ )
+            if ( Depth < Row [ X ] )
+               Row [ X ] = Depth;
+      }
+      else {
+         for ( X = Rect.left; X < Rect.right; X++ )
+            Row [ X ] = Depth;
+      }
+   }
+}
+
+double MeasureHiZSpeedup ( LONG Width, LONG Height,
+        LONG Quads, LONG Overdraw, HiZStats *Statistics ) {
+
+   LARGE_INTEGER Start, Middle, Stop;
+   HiZBuffer HiZ;
+   WORD *Plain, *Tested, Depth;
+   RECT *Rects;
+   LONG Index, Side;
+   DWORD Seed = 12345;
+   double PlainTime, TestedTime;
+
+   if ( Width <= 0 || Height <= 0 || Quads <= 0 ||
+        Overdraw <= 0 )
+      return 0.0;
+
+   Plain  = new WORD [ Width * Height ];
+   Tested = new WORD [ Width * Height ];
+   Rects  = new RECT [ Quads ];
+
+   if ( Plain == NULL || Tested == NULL || Rects == NULL ||
+        !HiZ.Create ( Width, Height, 2, 16 ) ) {
+      delete [] Plain;
+      delete [] Tested;
+      delete [] Rects;
+
+      return 0.0;
+   }
+
+   // Square quads sized so they cover the surface
+   // Overdraw times:
+   Side = 1;
+
+   while ( ( LONGLONG ) ( Side + 1 ) * ( Side + 1 ) * Quads <=
+           ( LONGLONG ) Width * Height * Overdraw )
+      Side++;
+
+   for ( Index = 0; Index < Quads; Index++ ) {
+      Seed = Seed * 1103515245 + 12345;
+      Rects [ Index ].left = ( LONG ) ( ( Seed >> 8 ) %
+         ( DWORD ) Width ) - Side / 2;
+
+      Seed = Seed * 1103515245 + 12345;
+      Rects [ Index ].top  = ( LONG ) ( ( Seed >> 8 ) %
+         ( DWORD ) Height ) - Side / 2;
+
+      Rects [ Index ].right  = Rects [ Index ].left + Side;
+      Rects [ Index ].bottom = Rects [ Index ].top  + Side;
+
+      if ( Rects [ Index ].left   < 0      ) Rects [ Index ].left   = 0;
+      if ( Rects [ Index ].top    < 0      ) Rects [ Index ].top    = 0;
+      if ( Rects [ Index ].right  > Width  ) Rects [ Index ].right  = Width;
+      if ( Rects [ Index ].bottom > Height ) Rects [ Index ].bottom = Height;
+   }
+
+   for ( Index = 0; Index < Width * Height; Index++ )
+      Plain [ Index ] = Tested [ Index ] = 0xFFFF;
+
+   HiZ.Clear ( 0xFFFF );
+
+   // Quads arrive front to back, as a renderer sorting
+   // its opaque geometry would submit them:
+
+   QueryPerformanceCounter ( &Start );
+
+   for ( Index = 0; Index < Quads; Index++ ) {
+      Depth = ( WORD ) ( 1 + ( LONGLONG ) Index * 0xFFFE / Quads );
+
+      DrawQuad ( Plain, Width, Rects [ Index ], Depth, true );
+   }
+
+   QueryPerformanceCounter ( &Middle );
+
+   for ( Index = 0; Index < Quads; Index++ ) {
+      Depth = ( WORD ) ( 1 + ( LONGLONG ) Index * 0xFFFE / Quads );
+
+      switch ( HiZ.Test ( Rects [ Index ], Depth, Depth ) ) {
+         case HiZRejected:
+            continue;
+         case HiZAccepted:
+            // Every pixel now holds Depth, so the bounds are
+            // known without reading them back:
+            DrawQuad ( Tested, Width, Rects [ Index ], Depth,
+               false );
+
+            HiZ.Fill ( Rects [ Index ], Depth );
+         break;
+         default:
+            DrawQuad ( Tested, Width, Rects [ Index ], Depth,
+               true );
+
+            HiZ.Update ( ( LPBYTE ) ( Tested + Rects [ Index ].top *
+               Width + Rects [ Index ].left ), Width * 2,
+               Rects [ Index ] );
+         break;
+      }
+   }
+
+   QueryPerformanceCounter ( &Stop );
+
+   if ( Statistics != NULL )
+      HiZ.GetStats ( *Statistics );
+
+   delete [] Plain;
+   delete [] Tested;
+   delete [] Rects;
+
+   PlainTime  = ( double ) ( Middle.QuadPart - Start.QuadPart );
+   TestedTime = ( double ) ( Stop.QuadPart - Middle.QuadPart );
+
+   if ( TestedTime <= 0.0 )
+      return 0.0;
+
+   return PlainTime / TestedTime;
+}
@@ -0,0 +1,96 @@
+//
+// File name: HiZBuffer.hpp
+//
+// Description: A pyramid of minimum and maximum depths
+//              over a z-buffer, for rejecting hidden
+//              geometry without reading every pixel.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries:
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __HIZBUFFERHPP__
+#define __HIZBUFFERHPP__
+
+#include <Windows.H>
+
+// Smaller depths are nearer. Rejected means no pixel of
+// the rect can pass a less-than depth test, Accepted that
+// every pixel will:
+enum HiZResult { HiZRejected, HiZAccepted, HiZAmbiguous };
+
+struct HiZStats {
+   DWORD Queries, Rejected, Accepted, Ambiguous,
+         TilesVisited;
+};
+
+class HiZBuffer {
+   public:
+      enum { TileSize = 8, MaxLevels = 16 };
+
+   protected:
+      struct Bounds {
+         DWORD Min, Max;
+      };
+
+      // Level zero has one entry per TileSize square of
+      // pixels; each level above halves both dimensions:
+      Bounds *Levels [ MaxLevels ];
+      LONG    LevelWidth [ MaxLevels ],
+              LevelHeight [ MaxLevels ];
+
+      LONG    LevelCount, Width, Height, BytesPerPixel;
+      DWORD   DepthMask;
+
+      HiZStats Stats;
+
+      void SetBounds ( RECT &Rect, DWORD Min, DWORD Max );
+      void Propagate ( RECT &Rect );
+
+      HiZResult TestTile ( LONG Level, LONG TileX, LONG TileY,
+         RECT &Rect, DWORD MinDepth, DWORD MaxDepth );
+
+   public:
+      HiZBuffer ();
+      ~HiZBuffer ();
+
+      // DepthBits selects the depth mask, as in
+      // SetZBufferBitDepth:
+      bool Create ( LONG Width, LONG Height,
+         LONG BytesPerPixel, LONG DepthBits );
+      void Destroy ();
+
+      bool IsCreated () { return LevelCount > 0; }
+
+      // Keep the pyramid in step with the z-buffer. Memory
+      // points at the top left pixel of Rect:
+      void Clear ( DWORD Depth );
+      void Fill ( RECT &Rect, DWORD Depth );
+      void Update ( LPBYTE Memory, LONG Pitch, RECT &Rect );
+      void Invalidate ( RECT &Rect );
+
+      // MinDepth and MaxDepth bound the depths of whatever
+      // is about to be drawn over Rect:
+      HiZResult Test ( RECT &Rect, DWORD MinDepth,
+         DWORD MaxDepth );
+      HiZResult TestSpan ( LONG Y, LONG Left, LONG Right,
+         DWORD MinDepth, DWORD MaxDepth );
+
+      void GetStats ( HiZStats &Statistics );
+      void ResetStats ();
+};
+
+// Draw Quads random quads over a Width x Height z-buffer,
+// each at a constant depth, with Overdraw layers on
+// average, once with a plain per-pixel depth test and once
+// testing each quad against the pyramid first. Returns how
+// many times faster the second pass was:
+double MeasureHiZSpeedup ( LONG Width, LONG Height,
+   LONG Quads, LONG Overdraw, HiZStats *Statistics = NULL );
+
+#endif
@@ -0,0 +1,207 @@
+//
+// File name: LZCodec.cpp
+//
+// Description: A fast byte oriented LZ77 codec, in the
+//              manner of LZ4, for data kept in memory.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "LZCodec.hpp"
+
+// Positions are found through a table of the last place
+// each hash of four bytes was seen:
+enum { HashBits = 12, HashSize = 1 << HashBits };
+
+static inline DWORD Read32 ( LPBYTE Data ) {
+   DWORD Value;
+
+   memcpy ( &Value, Data, sizeof ( DWORD ) );
+
+   return Value;
+}
+
+static inline DWORD HashOf ( DWORD Value ) {
+   return ( Value * 2654435761U ) >> ( 32 - HashBits );
+}
+
+static inline LPBYTE WriteLength ( LPBYTE Out, DWORD Length ) {
+   while ( Length >= 255 ) {
+      *Out++ = 255;
+      Length -= 255;
+   }
+
+   *Out++ = ( BYTE ) Length;
+
+   return Out;
+}
+
+static LPBYTE WriteSequence ( LPBYTE Out, LPBYTE Literals,
+        DWORD LiteralCount, DWORD Offset, DWORD MatchLength ) {
+
+   DWORD MatchCode = MatchLength - LZMinMatch;
+
+   *Out++ = ( BYTE ) ( ( LiteralCount < 15 ? LiteralCount : 15 ) << 4 |
+      ( Offset == 0 ? 0 : MatchCode < 15 ? MatchCode : 15 ) );
+
+   if ( LiteralCount >= 15 )
+      Out = WriteLength ( Out, LiteralCount - 15 );
+
+   memcpy ( Out, Literals, LiteralCount );
+   Out += LiteralCount;
+
+   // The last sequence has no match:
+   if ( Offset == 0 )
+      return Out;
+
+   *Out++ = ( BYTE ) Offset;
+   *Out++ = ( BYTE ) ( Offset >> 8 );
+
+   if ( MatchCode >= 15 )
+      Out = WriteLength ( Out, MatchCode - 15 );
+
+   return Out;
+}
+
+DWORD LZCompressBound ( DWORD Size ) {
+   return Size + Size / 255 + 16;
+}
+
+DWORD LZCompress ( LPBYTE Src, DWORD Size, LPBYTE Dest ) {
+   LONG Table [ HashSize ];
+   LPBYTE Out = Dest;
+   DWORD Position = 1, Anchor = 0, Candidate, Length,
+      Misses = 0, Hash;
+
+   for ( Hash = 0; Hash < HashSize; Hash++ )
+      Table [ Hash ] = -1;
+
+   if ( Size >= LZMinMatch )
+      Table [ HashOf ( Read32 ( Src ) ) ] = 0;
+
+   while ( Position + LZMinMatch <= Size ) {
+      Hash      = HashOf ( Read32 ( Src + Position ) );
+      Candidate = ( DWORD ) Table [ Hash ];
+
+      Table [ Hash ] = ( LONG ) Position;
+
+      if ( Candidate == ( DWORD ) -1 ||
+           Position - Candidate > LZMaxOffset ||
+           Read32 ( Src + Candidate ) != Read32 ( Src + Position ) ) {
+
+         // Data that does not compress is skipped faster
+         // the longer it goes on:
+         Position += 1 + ( Misses++ >> 6 );
+
+         continue;
+      }
+
+      Misses = 0;
+
+      Length = LZMinMatch;
+
+      while ( Position + Length < Size &&
+              Src [ Candidate + Length ] == Src [ Position + Length ] )
+         Length++;
+
+      Out = WriteSequence ( Out, Src + Anchor, Position - Anchor,
+         Position - Candidate, Length );
+
+      Position += Length;
+      Anchor    = Position;
+
+      // Seed the table inside the match, so the next one
+      // can start right after it:
+      if ( Position + LZMinMatch <= Size )
+         Table [ HashOf ( Read32 ( Src + Position - 2 ) ) ] =
+            ( LONG ) ( Position - 2 );
+   }
+
+   Out = WriteSequence ( Out, Src + Anchor, Size - Anchor, 0, 0 );
+
+   return ( DWORD ) ( Out - Dest );
+}
+
+static inline bool ReadLength ( LPBYTE &In, LPBYTE End,
+        DWORD &Length ) {
+
+   BYTE Byte;
+
+   do {
+      if ( In >= End )
+         return false;
+
+      Byte    = *In++;
+      Length += Byte;
+   } while ( Byte == 255 );
+
+   return true;
+}
+
+bool LZDecompress ( LPBYTE Src, DWORD SrcSize, LPBYTE Dest,
+        DWORD DestSize ) {
+
+   LPBYTE In = Src, InEnd = Src + SrcSize, Out = Dest,
+      OutEnd = Dest + DestSize, Match;
+   DWORD Token, Literals, Length, Offset, Chunk;
+
+   while ( In < InEnd ) {
+      Token    = *In++;
+      Literals = Token >> 4;
+
+      if ( Literals == 15 && !ReadLength ( In, InEnd, Literals ) )
+         return false;
+
+      if ( Literals > ( DWORD ) ( InEnd - In ) ||
+           Literals > ( DWORD ) ( OutEnd - Out ) )
+         return false;
+
+      memcpy ( Out, In, Literals );
+
+      In  += Literals;
+      Out += Literals;
+
+      // Only the last sequence ends after its literals:
+      if ( In == InEnd )
+         break;
+
+      if ( InEnd - In < 2 )
+         return false;
+
+      Offset = In [ 0 ] | ( In [ 1 ] << 8 );
+      In    += 2;
+
+      Length = Token & 15;
+
+      if ( Length == 15 && !ReadLength ( In, InEnd, Length ) )
+         return false;
+
+      Length += LZMinMatch;
+
+      if ( Offset == 0 || Offset > ( DWORD ) ( Out - Dest ) ||
+           Length > ( DWORD ) ( OutEnd - Out ) )
+         return false;
+
+      // A match closer than its length repeats itself; each
+      // copy doubles what can be copied without overlap:
+      Match = Out - Offset;
+
+      while ( Length > 0 ) {
+         Chunk = ( DWORD ) ( Out - Match );
+         Chunk = Chunk < Length ? Chunk : Length;
+
+         memcpy ( Out, Match, Chunk );
+
+         Out    += Chunk;
+         Length -= Chunk;
+      }
+   }
+
+   return Out == OutEnd;
+}
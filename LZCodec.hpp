@@ -0,0 +1,42 @@
+//
+// File name: LZCodec.hpp
+//
+// Description: A fast byte oriented LZ77 codec, in the
+//              manner of LZ4, for data kept in memory.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __LZCODECHPP__
+#define __LZCODECHPP__
+
+#include <Windows.H>
+
+// Data is stored as sequences of a token, literal bytes
+// and a match: the token's high nibble is the literal
+// count and its low nibble the match length less
+// LZMinMatch, each continued in bytes of 255 when it is
+// 15. A match is a 16-bit little endian offset back into
+// the output, then the rest of its length. The last
+// sequence has literals only:
+enum { LZMinMatch = 4, LZMaxOffset = 65535 };
+
+// The most LZCompress can write for Size bytes:
+DWORD LZCompressBound ( DWORD Size );
+
+// Compress Size bytes to Dest, which must hold
+// LZCompressBound ( Size ), and return the compressed size:
+DWORD LZCompress ( LPBYTE Src, DWORD Size, LPBYTE Dest );
+
+// Decompress exactly DestSize bytes. Damaged data is
+// rejected rather than read or written out of bounds:
+bool LZDecompress ( LPBYTE Src, DWORD SrcSize, LPBYTE Dest,
+   DWORD DestSize );
+
+#endif
@@ -0,0 +1,439 @@
+//
+// File name: Mipmap.cpp
+//
+// Description: Downsampling of one mip level into the next,
+//              for the layouts produced by SetColorBitDepth.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include <Math.H>
+
+#include "Mipmap.hpp"
+
+#ifdef PIXELCONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+// Each task filters a band of destination rows that reads
+// about this many source bytes:
+const LONG BandBytes = 32768;
+
+// Where each channel of a pixel lives. The first
+// ColorChannels are colour; the rest (alpha, or the unused
+// byte of X888) are always box filtered:
+struct ChannelLayout {
+   LONG  Channels, ColorChannels;
+   LONG  Shift [ 4 ];
+   DWORD Mask  [ 4 ];
+};
+
+struct MipJob {
+   LPBYTE Dest, Src;
+   LONG   DestPitch, SrcPitch, DestWidth, DestHeight,
+          SrcWidth, SrcHeight, BytesPerPixel, RowsPerTask;
+
+   PixelFormat   Format;
+   MipFilter     Filter;
+   ChannelLayout Layout;
+   bool          UseSIMD;
+};
+
+static bool GetChannelLayout ( PixelFormat Format,
+        ChannelLayout &Layout ) {
+
+   static const LONG Shift555 [ 4 ] = { 10, 5, 0, 15 },
+                     Shift565 [ 4 ] = { 11, 5, 0,  0 },
+                     Shift888 [ 4 ] = { 16, 8, 0, 24 };
+
+   static const DWORD Mask555 [ 4 ] = { 0x1F, 0x1F, 0x1F, 0x01 },
+                      Mask565 [ 4 ] = { 0x1F, 0x3F, 0x1F, 0x00 },
+                      Mask888 [ 4 ] = { 0xFF, 0xFF, 0xFF, 0xFF };
+
+   const LONG  *Shift;
+   const DWORD *Mask;
+   LONG Channel;
+
+   Layout.ColorChannels = 3;
+
+   switch ( Format ) {
+      case Format555:
+         Layout.Channels = 3;
+         Shift = Shift555; Mask = Mask555;
+      break;
+      case Format1555:
+         Layout.Channels = 4;
+         Shift = Shift555; Mask = Mask555;
+      break;
+      case Format565:
+         Layout.Channels = 3;
+         Shift = Shift565; Mask = Mask565;
+      break;
+      case Format888:
+         Layout.Channels = 3;
+         Shift = Shift888; Mask = Mask888;
+      break;
+      case FormatX888:
+      case Format8888:
+         Layout.Channels = 4;
+         Shift = Shift888; Mask = Mask888;
+      break;
+      default:
+         return false;
+   }
+
+   for ( Channel = 0; Channel < 4; Channel++ ) {
+      Layout.Shift [ Channel ] = Shift [ Channel ];
+      Layout.Mask  [ Channel ] = Mask  [ Channel ];
+   }
+
+   return true;
+}
+
+static inline DWORD LoadPixel ( LPBYTE Pixel,
+        LONG BytesPerPixel ) {
+
+   switch ( BytesPerPixel ) {
+      case 2:
+         return *( WORD * ) Pixel;
+      case 3:
+         return Pixel [ 0 ] | ( Pixel [ 1 ] << 8 ) |
+            ( Pixel [ 2 ] << 16 );
+   }
+
+   return *( DWORD * ) Pixel;
+}
+
+static inline void StorePixel ( LPBYTE Pixel,
+        LONG BytesPerPixel, DWORD Value ) {
+
+   switch ( BytesPerPixel ) {
+      case 2:
+         *( WORD * ) Pixel = ( WORD ) Value;
+      break;
+      case 3:
+         Pixel [ 0 ] = ( BYTE ) ( Value );
+         Pixel [ 1 ] = ( BYTE ) ( Value >> 8 );
+         Pixel [ 2 ] = ( BYTE ) ( Value >> 16 );
+      break;
+      default:
+         *( DWORD * ) Pixel = Value;
+      break;
+   }
+}
+
+//
+// The gamma filter averages in linear light, taking the
+// display gamma to be 2: each colour channel is the root of
+// the mean of the squared inputs. The sums of squares are
+// exact in a float, so the scalar and SIMD kernels give
+// the same pixels.
+//
+
+static void DownsampleRowScalar ( MipJob &Job, LPBYTE Dest,
+        LPBYTE Row0, LPBYTE Row1, LONG First ) {
+
+   ChannelLayout &Layout = Job.Layout;
+   LONG X, X0, X1, Channel, Index, Bytes = Job.BytesPerPixel;
+   DWORD Pixels [ 4 ], Value, Out, Sum, C;
+
+   for ( X = First; X < Job.DestWidth; X++ ) {
+      X0 = X * 2;
+      X1 = X0 + 1 < Job.SrcWidth ? X0 + 1 : X0;
+
+      Pixels [ 0 ] = LoadPixel ( Row0 + X0 * Bytes, Bytes );
+      Pixels [ 1 ] = LoadPixel ( Row0 + X1 * Bytes, Bytes );
+      Pixels [ 2 ] = LoadPixel ( Row1 + X0 * Bytes, Bytes );
+      Pixels [ 3 ] = LoadPixel ( Row1 + X1 * Bytes, Bytes );
+
+      Out = 0;
+
+      for ( Channel = 0; Channel < Layout.Channels; Channel++ ) {
+         Sum = 0;
+
+         if ( Job.Filter == MipGamma &&
+              Channel < Layout.ColorChannels ) {
+
+            for ( Index = 0; Index < 4; Index++ ) {
+               C = ( Pixels [ Index ] >> Layout.Shift [ Channel ] ) &
+                  Layout.Mask [ Channel ];
+
+               Sum += C * C;
+            }
+
+            Value = ( DWORD ) ( sqrtf ( ( float ) Sum * 0.25f ) +
+               0.5f );
+         }
+         else {
+            for ( Index = 0; Index < 4; Index++ )
+               Sum += ( Pixels [ Index ] >> Layout.Shift [ Channel ] ) &
+                  Layout.Mask [ Channel ];
+
+            Value = ( Sum + 2 ) >> 2;
+         }
+
+         Out |= Value << Layout.Shift [ Channel ];
+      }
+
+      StorePixel ( Dest + X * Bytes, Bytes, Out );
+   }
+}
+
+#ifdef PIXELCONVERT_SSE2
+
+//
+// The SSE2 kernel makes four destination pixels from eight
+// source pixels of each row. Every channel is moved to its
+// own 16-bit lanes, so pmaddwd both sums (or squares and
+// sums) each horizontal pair and widens it to 32 bits.
+// 24-bit pixels are left to the scalar kernel.
+//
+
+static LONG DownsampleRowSSE2 ( MipJob &Job, LPBYTE Dest,
+        LPBYTE Row0, LPBYTE Row1 ) {
+
+   ChannelLayout &Layout = Job.Layout;
+   LONG X, Count, Channel;
+   __m128i A0, A1, B0, B1, CA, CB, Mask, Shift, Sum, Value,
+      Out;
+   __m128 Root;
+
+   const __m128i One     = _mm_set1_epi16 ( 1 );
+   const __m128i Two     = _mm_set1_epi32 ( 2 );
+   const __m128  Quarter = _mm_set1_ps ( 0.25f );
+   const __m128  Half    = _mm_set1_ps ( 0.5f );
+
+   if ( Job.BytesPerPixel != 2 && Job.BytesPerPixel != 4 )
+      return 0;
+
+   // Only destination pixels with two source columns:
+   Count = Job.SrcWidth / 2;
+
+   for ( X = 0; X + 4 <= Count; X += 4 ) {
+      if ( Job.BytesPerPixel == 2 ) {
+         A0 = _mm_loadu_si128 ( ( __m128i * ) ( Row0 + X * 4 ) );
+         B0 = _mm_loadu_si128 ( ( __m128i * ) ( Row1 + X * 4 ) );
+      }
+      else {
+         A0 = _mm_loadu_si128 ( ( __m128i * ) ( Row0 + X * 8 ) );
+         A1 = _mm_loadu_si128 ( ( __m128i * ) ( Row0 + X * 8 + 16 ) );
+         B0 = _mm_loadu_si128 ( ( __m128i * ) ( Row1 + X * 8 ) );
+         B1 = _mm_loadu_si128 ( ( __m128i * ) ( Row1 + X * 8 + 16 ) );
+      }
+
+      Out = _mm_setzero_si128 ();
+
+      for ( Channel = 0; Channel < Layout.Channels; Channel++ ) {
+         Shift = _mm_cvtsi32_si128 ( Layout.Shift [ Channel ] );
+
+         if ( Job.BytesPerPixel == 2 ) {
+            Mask = _mm_set1_epi16 ( ( short ) Layout.Mask [ Channel ] );
+
+            CA = _mm_and_si128 ( _mm_srl_epi16 ( A0, Shift ), Mask );
+            CB = _mm_and_si128 ( _mm_srl_epi16 ( B0, Shift ), Mask );
+         }
+         else {
+            Mask = _mm_set1_epi32 ( Layout.Mask [ Channel ] );
+
+            CA = _mm_packs_epi32 (
+               _mm_and_si128 ( _mm_srl_epi32 ( A0, Shift ), Mask ),
+               _mm_and_si128 ( _mm_srl_epi32 ( A1, Shift ), Mask ) );
+            CB = _mm_packs_epi32 (
+               _mm_and_si128 ( _mm_srl_epi32 ( B0, Shift ), Mask ),
+               _mm_and_si128 ( _mm_srl_epi32 ( B1, Shift ), Mask ) );
+         }
+
+         if ( Job.Filter == MipGamma &&
+              Channel < Layout.ColorChannels ) {
+
+            Sum = _mm_add_epi32 ( _mm_madd_epi16 ( CA, CA ),
+               _mm_madd_epi16 ( CB, CB ) );
+
+            Root = _mm_sqrt_ps ( _mm_mul_ps (
+               _mm_cvtepi32_ps ( Sum ), Quarter ) );
+
+            Value = _mm_cvttps_epi32 ( _mm_add_ps ( Root, Half ) );
+         }
+         else {
+            Sum = _mm_add_epi32 ( _mm_madd_epi16 ( CA, One ),
+               _mm_madd_epi16 ( CB, One ) );
+
+            Value = _mm_srli_epi32 ( _mm_add_epi32 ( Sum, Two ), 2 );
+         }
+
+         if ( Job.BytesPerPixel == 2 )
+            Out = _mm_or_si128 ( Out, _mm_sll_epi16 (
+               _mm_packs_epi32 ( Value, Value ), Shift ) );
+         else
+            Out = _mm_or_si128 ( Out, _mm_sll_epi32 ( Value, Shift ) );
+      }
+
+      if ( Job.BytesPerPixel == 2 )
+         _mm_storel_epi64 ( ( __m128i * ) ( Dest + X * 2 ), Out );
+      else
+         _mm_storeu_si128 ( ( __m128i * ) ( Dest + X * 4 ), Out );
+   }
+
+   return X;
+}
+
+#endif
+
+static void DownsampleRows ( MipJob &Job, LONG First,
+        LONG Last ) {
+
+   LPBYTE Dest, Row0, Row1;
+   LONG Y, X, Done;
+
+   for ( Y = First; Y < Last; Y++ ) {
+      Dest = Job.Dest + Y * Job.DestPitch;
+      Row0 = Job.Src  + Y * 2 * Job.SrcPitch;
+      Row1 = Y * 2 + 1 < Job.SrcHeight ? Row0 + Job.SrcPitch : Row0;
+
+      if ( Job.Format == Format8 ) {
+         for ( X = 0; X < Job.DestWidth; X++ )
+            Dest [ X ] = Row0 [ X * 2 ];
+
+         continue;
+      }
+
+      Done = 0;
+
+#ifdef PIXELCONVERT_SSE2
+      if ( Job.UseSIMD )
+         Done = DownsampleRowSSE2 ( Job, Dest, Row0, Row1 );
+#endif
+
+      DownsampleRowScalar ( Job, Dest, Row0, Row1, Done );
+   }
+}
+
+static void DownsampleTask ( LONG Task, LONG,
+        LPVOID Context ) {
+
+   MipJob &Job = *( MipJob * ) Context;
+   LONG First, Last;
+
+   First = Task * Job.RowsPerTask;
+   Last  = First + Job.RowsPerTask;
+
+   if ( Last > Job.DestHeight )
+      Last = Job.DestHeight;
+
+   DownsampleRows ( Job, First, Last );
+}
+
+bool DownsampleMipLevel ( LPVOID Dest, LONG DestPitch,
+        LPVOID Src, LONG SrcPitch, LONG SrcWidth, LONG SrcHeight,
+        PixelFormat Format, MipFilter Filter, ThreadPool *Pool ) {
+
+   MipJob Job;
+   LONG Tasks;
+
+   if ( Dest == NULL || Src == NULL || SrcWidth <= 0 ||
+        SrcHeight <= 0 )
+      return false;
+
+   Job.BytesPerPixel = GetFormatBytesPerPixel ( Format );
+
+   if ( Job.BytesPerPixel == 0 )
+      return false;
+
+   if ( Format != Format8 &&
+        !GetChannelLayout ( Format, Job.Layout ) )
+      return false;
+
+   Job.Dest       = ( LPBYTE ) Dest;
+   Job.Src        = ( LPBYTE ) Src;
+   Job.DestPitch  = DestPitch;
+   Job.SrcPitch   = SrcPitch;
+   Job.SrcWidth   = SrcWidth;
+   Job.SrcHeight  = SrcHeight;
+   Job.DestWidth  = SrcWidth  > 1 ? SrcWidth  / 2 : 1;
+   Job.DestHeight = SrcHeight > 1 ? SrcHeight / 2 : 1;
+   Job.Format     = Format;
+   Job.Filter     = Filter;
+   Job.UseSIMD    = GetConversionPath () != ScalarPath;
+
+   Job.RowsPerTask = BandBytes / ( SrcWidth * 2 *
+      Job.BytesPerPixel );
+
+   if ( Job.RowsPerTask < 1 )
+      Job.RowsPerTask = 1;
+
+   Tasks = ( Job.DestHeight + Job.RowsPerTask - 1 ) /
+      Job.RowsPerTask;
+
+   // Small levels are not worth waking the pool for:
+   if ( Pool == NULL || Tasks == 1 ) {
+      DownsampleRows ( Job, 0, Job.DestHeight );
+
+      return true;
+   }
+
+   return Pool->Run ( DownsampleTask, &Job, Tasks );
+}
+
+double MeasureMipmapThroughput ( PixelFormat Format,
+        MipFilter Filter, LONG Size, LONG Repeats,
+        ThreadPool *Pool ) {
+
+   LONG BytesPerPixel, Width, Height, Repeat, I;
+   LPBYTE Levels [ 2 ];
+   LARGE_INTEGER Start, Stop, Frequency;
+   DWORD Seed = 12345;
+   double Seconds, Bytes = 0.0;
+
+   BytesPerPixel = GetFormatBytesPerPixel ( Format );
+
+   if ( BytesPerPixel == 0 || Size <= 1 || Repeats <= 0 )
+      return 0.0;
+
+   // Every level is filtered out of the one before it, so
+   // two buffers are swapped down the chain:
+   Levels [ 0 ] = new BYTE [ Size * Size * BytesPerPixel ];
+   Levels [ 1 ] = new BYTE [ Size * Size * BytesPerPixel ];
+
+   for ( I = 0; I < Size * Size * BytesPerPixel; I++ ) {
+      Seed = Seed * 1103515245 + 12345;
+      Levels [ 0 ] [ I ] = ( BYTE ) ( Seed >> 16 );
+   }
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ ) {
+      Width = Height = Size;
+
+      for ( I = 0; Width > 1 || Height > 1; I ^= 1 ) {
+         DownsampleMipLevel ( Levels [ I ^ 1 ],
+            BytesPerPixel * ( Width > 1 ? Width / 2 : 1 ),
+            Levels [ I ], BytesPerPixel * Width, Width, Height,
+            Format, Filter, Pool );
+
+         Bytes += ( double ) Width * Height * BytesPerPixel;
+
+         if ( Width  > 1 ) Width  /= 2;
+         if ( Height > 1 ) Height /= 2;
+      }
+   }
+
+   QueryPerformanceCounter ( &Stop );
+
+   delete [] Levels [ 0 ];
+   delete [] Levels [ 1 ];
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return Bytes / Seconds / 1e9;
+}
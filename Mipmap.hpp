@@ -0,0 +1,41 @@
+//
+// File name: Mipmap.hpp
+//
+// Description: Downsampling of one mip level into the next,
+//              for the layouts produced by SetColorBitDepth.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __MIPMAPHPP__
+#define __MIPMAPHPP__
+
+#include "PixelConvert.hpp"
+#include "ThreadPool.hpp"
+
+// Halve a SrcWidth x SrcHeight image into Dest, which is
+// half as wide and high (rounded down, but at least one
+// pixel). Each destination pixel filters a 2x2 block; the
+// last row or column of an odd-sized source is dropped.
+// Format8 levels are point sampled, since palette indices
+// cannot be averaged. With a Pool, bands of destination
+// rows are filtered in parallel:
+bool DownsampleMipLevel ( LPVOID Dest, LONG DestPitch,
+   LPVOID Src, LONG SrcPitch, LONG SrcWidth, LONG SrcHeight,
+   PixelFormat Format, MipFilter Filter,
+   ThreadPool *Pool = NULL );
+
+// Build a whole mip chain below a Size x Size image Repeats
+// times and return the throughput in GB/s of source bytes
+// read:
+double MeasureMipmapThroughput ( PixelFormat Format,
+   MipFilter Filter, LONG Size, LONG Repeats,
+   ThreadPool *Pool = NULL );
+
+#endif
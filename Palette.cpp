@@ -0,0 +1,751 @@
+//
+// File name: Palette.cpp
+//
+// Description: Palettes for 8-bit surfaces, expansion of
+//              palette indices to true colour, and a
+//              median cut quantizer.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "Palette.hpp"
+
+#ifdef PIXELCONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef PIXELCONVERT_AVX2
+#include <immintrin.h>
+#endif
+
+// A box of 15-bit colours, inclusive on every side, in
+// red, green, blue order:
+struct ColorBox {
+   LONG  Min [ 3 ], Max [ 3 ];
+   DWORD Count;
+};
+
+static void FillColorCube ( PALETTEENTRY *Entries ) {
+   LONG Index;
+
+   for ( Index = 0; Index < 256; Index++ ) {
+      Entries [ Index ].peRed   = ( BYTE ) ( ( ( Index >> 5 ) & 7 ) * 255 / 7 );
+      Entries [ Index ].peGreen = ( BYTE ) ( ( ( Index >> 2 ) & 7 ) * 255 / 7 );
+      Entries [ Index ].peBlue  = ( BYTE ) ( ( Index & 3 ) * 255 / 3 );
+      Entries [ Index ].peFlags = 0;
+   }
+}
+
+static bool BuildLookup ( PALETTEENTRY *Entries,
+        PixelFormat Format, DWORD *Lookup ) {
+
+   BYTE Indices [ 256 ], Packed [ 256 * 4 ];
+   LONG Index, Size;
+   LPBYTE Pixel;
+   RECT Rect;
+
+   Size = GetFormatBytesPerPixel ( Format );
+
+   if ( Format == Format8 || Size == 0 )
+      return false;
+
+   for ( Index = 0; Index < 256; Index++ )
+      Indices [ Index ] = ( BYTE ) Index;
+
+   Rect.left = 0; Rect.right  = 256;
+   Rect.top  = 0; Rect.bottom = 1;
+
+   if ( !ConvertPixels ( Packed, sizeof Packed, Format, 0, 0,
+           Indices, 256, Format8, Rect, 0, Entries ) )
+      return false;
+
+   for ( Index = 0; Index < 256; Index++ ) {
+      Pixel = Packed + Index * Size;
+
+      switch ( Size ) {
+         case 2:
+            Lookup [ Index ] = *( WORD * ) Pixel;
+         break;
+         case 3:
+            Lookup [ Index ] = Pixel [ 0 ] | ( Pixel [ 1 ] << 8 ) |
+               ( Pixel [ 2 ] << 16 );
+         break;
+         default:
+            Lookup [ Index ] = *( DWORD * ) Pixel;
+         break;
+      }
+   }
+
+   return true;
+}
+
+DirectDrawPalette::DirectDrawPalette () {
+   Palette = NULL;
+
+   ZeroMemory ( Entries, sizeof Entries );
+
+   Created = false;
+
+   Changes = LookupChanges = 0;
+
+   LookupFormat = FormatUnknown;
+
+   Inverse = NULL;
+   InverseChanges = 0;
+}
+
+DirectDrawPalette::~DirectDrawPalette () {
+   if ( Palette != NULL )
+      Palette->Release ();
+
+   if ( Inverse != NULL )
+      delete [] Inverse;
+}
+
+bool DirectDrawPalette::Create ( DirectDrawManager &Manager,
+        PALETTEENTRY *Entries ) {
+
+   LPDIRECTDRAW7 DirectDraw7;
+   HRESULT Val;
+
+   if ( Created )
+      return false;
+
+   if ( Entries != NULL )
+      CopyMemory ( this->Entries, Entries, sizeof this->Entries );
+   else FillColorCube ( this->Entries );
+
+   if ( Manager.GetBackend () == DirectDrawManager::Hardware ) {
+      if ( !Manager.GetInterface ( &DirectDraw7 ) )
+         return false;
+
+      Val = DirectDraw7->CreatePalette ( DDPCAPS_8BIT |
+         DDPCAPS_ALLOW256, this->Entries, &Palette, NULL );
+
+      DirectDraw7->Release ();
+
+      if ( FAILED ( Val ) ) {
+         Palette = NULL;
+
+         return PrintDirectDrawError ( Val );
+      }
+   }
+
+   Created = true;
+
+   Changes++;
+
+   return true;
+}
+
+bool DirectDrawPalette::SetEntries ( LONG First, LONG Count,
+        PALETTEENTRY *Entries ) {
+
+   HRESULT Val;
+
+   if ( !Created || First < 0 || Count <= 0 ||
+        First + Count > 256 || Entries == NULL )
+      return false;
+
+   CopyMemory ( &this->Entries [ First ], Entries,
+      Count * sizeof ( PALETTEENTRY ) );
+
+   Changes++;
+
+   if ( Palette != NULL ) {
+      Val = Palette->SetEntries ( 0, First, Count, Entries );
+
+      if ( FAILED ( Val ) )
+         return PrintDirectDrawError ( Val );
+   }
+
+   return true;
+}
+
+bool DirectDrawPalette::GetEntries ( LONG First, LONG Count,
+        PALETTEENTRY *Entries ) {
+
+   if ( !Created || First < 0 || Count <= 0 ||
+        First + Count > 256 || Entries == NULL )
+      return false;
+
+   CopyMemory ( Entries, &this->Entries [ First ],
+      Count * sizeof ( PALETTEENTRY ) );
+
+   return true;
+}
+
+DWORD *DirectDrawPalette::GetLookup ( PixelFormat Format ) {
+   if ( !Created )
+      return NULL;
+
+   if ( Format == LookupFormat && LookupChanges == Changes )
+      return Lookup;
+
+   if ( !BuildLookup ( Entries, Format, Lookup ) ) {
+      LookupFormat = FormatUnknown;
+
+      return NULL;
+   }
+
+   LookupFormat  = Format;
+   LookupChanges = Changes;
+
+   return Lookup;
+}
+
+LPBYTE DirectDrawPalette::GetInverse () {
+   if ( !Created )
+      return NULL;
+
+   if ( Inverse != NULL && InverseChanges == Changes )
+      return Inverse;
+
+   if ( Inverse == NULL ) {
+      Inverse = new BYTE [ 32768 ];
+
+      if ( Inverse == NULL )
+         return NULL;
+   }
+
+   BuildInverseTable ( Entries, Inverse );
+
+   InverseChanges = Changes;
+
+   return Inverse;
+}
+
+bool DirectDrawPalette::GetInterface (
+        LPDIRECTDRAWPALETTE *Interface ) {
+
+   if ( Palette == NULL )
+      return false;
+
+   ( *Interface ) = Palette;
+
+   return true;
+}
+
+static void ExpandRowScalar ( LPBYTE Dest, LONG BytesPerPixel,
+        LPBYTE Src, LONG First, LONG Count, DWORD *Lookup,
+        bool Keyed, BYTE KeyLow, BYTE KeyHigh ) {
+
+   LPBYTE Pixel;
+   DWORD Value;
+   LONG X;
+
+   for ( X = First; X < Count; X++ ) {
+      if ( Keyed && Src [ X ] >= KeyLow && Src [ X ] <= KeyHigh )
+         continue;
+
+      Pixel = Dest + X * BytesPerPixel;
+      Value = Lookup [ Src [ X ] ];
+
+      switch ( BytesPerPixel ) {
+         case 2:
+            *( WORD * ) Pixel = ( WORD ) Value;
+         break;
+         case 3:
+            Pixel [ 0 ] = ( BYTE ) Value;
+            Pixel [ 1 ] = ( BYTE ) ( Value >> 8 );
+            Pixel [ 2 ] = ( BYTE ) ( Value >> 16 );
+         break;
+         default:
+            *( DWORD * ) Pixel = Value;
+         break;
+      }
+   }
+}
+
+#ifdef PIXELCONVERT_SSE2
+
+// SSE2 has no gather, so sixteen lookups are assembled in
+// registers and stored whole. Keyed pixels are merged with
+// the destination under a mask, without branches:
+
+static inline __m128i KeyMaskSSE2 ( __m128i Indices,
+        __m128i Low, __m128i High ) {
+
+   // All ones where Low <= Index <= High (unsigned):
+   return _mm_and_si128 (
+      _mm_cmpeq_epi8 ( _mm_max_epu8 ( Indices, Low ), Indices ),
+      _mm_cmpeq_epi8 ( _mm_min_epu8 ( Indices, High ), Indices ) );
+}
+
+static inline void StoreMaskedSSE2 ( LPBYTE Dest,
+        __m128i Pixels, __m128i Mask ) {
+
+   __m128i Old = _mm_loadu_si128 ( ( __m128i * ) Dest );
+
+   _mm_storeu_si128 ( ( __m128i * ) Dest, _mm_or_si128 (
+      _mm_and_si128 ( Mask, Old ),
+      _mm_andnot_si128 ( Mask, Pixels ) ) );
+}
+
+static LONG ExpandRowSSE2 ( LPBYTE Dest, LONG BytesPerPixel,
+        LPBYTE Src, LONG Count, DWORD *Lookup, bool Keyed,
+        BYTE KeyLow, BYTE KeyHigh ) {
+
+   const __m128i Low  = _mm_set1_epi8 ( ( char ) KeyLow );
+   const __m128i High = _mm_set1_epi8 ( ( char ) KeyHigh );
+
+   __m128i Pixels [ 4 ], Mask, Mask16 [ 2 ], Mask32 [ 4 ];
+   LPBYTE In;
+   LONG X, Part;
+
+   // 24-bit pixels do not tile a 16-byte store:
+   if ( BytesPerPixel == 3 )
+      return 0;
+
+   for ( X = 0; X + 16 <= Count; X += 16 ) {
+      In = Src + X;
+
+      if ( BytesPerPixel == 2 ) {
+         for ( Part = 0; Part < 2; Part++, In += 8 )
+            Pixels [ Part ] = _mm_set_epi16 (
+               ( short ) Lookup [ In [ 7 ] ], ( short ) Lookup [ In [ 6 ] ],
+               ( short ) Lookup [ In [ 5 ] ], ( short ) Lookup [ In [ 4 ] ],
+               ( short ) Lookup [ In [ 3 ] ], ( short ) Lookup [ In [ 2 ] ],
+               ( short ) Lookup [ In [ 1 ] ], ( short ) Lookup [ In [ 0 ] ] );
+      }
+      else {
+         for ( Part = 0; Part < 4; Part++, In += 4 )
+            Pixels [ Part ] = _mm_set_epi32 (
+               ( int ) Lookup [ In [ 3 ] ], ( int ) Lookup [ In [ 2 ] ],
+               ( int ) Lookup [ In [ 1 ] ], ( int ) Lookup [ In [ 0 ] ] );
+      }
+
+      if ( !Keyed ) {
+         for ( Part = 0; Part < BytesPerPixel; Part++ )
+            _mm_storeu_si128 ( ( __m128i * ) ( Dest +
+               ( X + Part * 16 / BytesPerPixel ) * BytesPerPixel ),
+               Pixels [ Part ] );
+
+         continue;
+      }
+
+      // Widen the byte mask to one lane per pixel:
+      Mask = KeyMaskSSE2 ( _mm_loadu_si128 ( ( __m128i * ) ( Src + X ) ),
+         Low, High );
+
+      Mask16 [ 0 ] = _mm_unpacklo_epi8 ( Mask, Mask );
+      Mask16 [ 1 ] = _mm_unpackhi_epi8 ( Mask, Mask );
+
+      if ( BytesPerPixel == 2 ) {
+         StoreMaskedSSE2 ( Dest + X * 2, Pixels [ 0 ], Mask16 [ 0 ] );
+         StoreMaskedSSE2 ( Dest + X * 2 + 16, Pixels [ 1 ], Mask16 [ 1 ] );
+
+         continue;
+      }
+
+      Mask32 [ 0 ] = _mm_unpacklo_epi16 ( Mask16 [ 0 ], Mask16 [ 0 ] );
+      Mask32 [ 1 ] = _mm_unpackhi_epi16 ( Mask16 [ 0 ], Mask16 [ 0 ] );
+      Mask32 [ 2 ] = _mm_unpacklo_epi16 ( Mask16 [ 1 ], Mask16 [ 1 ] );
+      Mask32 [ 3 ] = _mm_unpackhi_epi16 ( Mask16 [ 1 ], Mask16 [ 1 ] );
+
+      for ( Part = 0; Part < 4; Part++ )
+         StoreMaskedSSE2 ( Dest + ( X + Part * 4 ) * 4,
+            Pixels [ Part ], Mask32 [ Part ] );
+   }
+
+   return X;
+}
+
+#endif
+
+#ifdef PIXELCONVERT_AVX2
+
+// 32-bit lookups are gathered eight at a time:
+static LONG ExpandRowAVX2 ( LPBYTE Dest, LPBYTE Src,
+        LONG Count, DWORD *Lookup, bool Keyed, BYTE KeyLow,
+        BYTE KeyHigh ) {
+
+   const __m256i Low  = _mm256_set1_epi32 ( KeyLow - 1 );
+   const __m256i High = _mm256_set1_epi32 ( KeyHigh + 1 );
+
+   __m256i Indices, Pixels, Mask;
+   LONG X;
+
+   for ( X = 0; X + 8 <= Count; X += 8 ) {
+      Indices = _mm256_cvtepu8_epi32 ( _mm_loadl_epi64 (
+         ( __m128i * ) ( Src + X ) ) );
+
+      Pixels = _mm256_i32gather_epi32 ( ( const int * ) Lookup,
+         Indices, 4 );
+
+      if ( Keyed ) {
+         Mask = _mm256_and_si256 ( _mm256_cmpgt_epi32 ( Indices, Low ),
+            _mm256_cmpgt_epi32 ( High, Indices ) );
+
+         Pixels = _mm256_blendv_epi8 ( Pixels, _mm256_loadu_si256 (
+            ( __m256i * ) ( Dest + X * 4 ) ), Mask );
+      }
+
+      _mm256_storeu_si256 ( ( __m256i * ) ( Dest + X * 4 ), Pixels );
+   }
+
+   return X;
+}
+
+#endif
+
+bool ExpandPixels ( LPVOID Dest, LONG DestPitch,
+        LONG DestBytesPerPixel, LPBYTE Src, LONG SrcPitch,
+        LONG Width, LONG Height, DWORD *Lookup, bool Keyed,
+        BYTE KeyLow, BYTE KeyHigh ) {
+
+   LPBYTE DestRow;
+   LONG Y, Done;
+
+#ifdef PIXELCONVERT_SSE2
+   ConversionPath Path = GetConversionPath ();
+#endif
+
+   if ( Dest == NULL || Src == NULL || Lookup == NULL ||
+        Width <= 0 || Height <= 0 ||
+        DestBytesPerPixel < 2 || DestBytesPerPixel > 4 )
+      return false;
+
+   for ( Y = 0; Y < Height; Y++ ) {
+      DestRow = ( LPBYTE ) Dest + Y * DestPitch;
+      Done    = 0;
+
+#ifdef PIXELCONVERT_AVX2
+      if ( Path == AVX2Path && DestBytesPerPixel == 4 )
+         Done = ExpandRowAVX2 ( DestRow, Src, Width, Lookup, Keyed,
+            KeyLow, KeyHigh );
+#endif
+
+#ifdef PIXELCONVERT_SSE2
+      if ( Path != ScalarPath && Done == 0 )
+         Done = ExpandRowSSE2 ( DestRow, DestBytesPerPixel, Src,
+            Width, Lookup, Keyed, KeyLow, KeyHigh );
+#endif
+
+      ExpandRowScalar ( DestRow, DestBytesPerPixel, Src, Done,
+         Width, Lookup, Keyed, KeyLow, KeyHigh );
+
+      Src += SrcPitch;
+   }
+
+   return true;
+}
+
+//
+// Median cut works on a histogram of 15-bit colours. Rows
+// are reduced to 555 with ConvertPixels, so the SIMD
+// packers do the per-pixel work, then counted. The box
+// with the most pixels is split at the median of its
+// longest side until there are enough boxes; each entry is
+// the mean of its box.
+//
+
+inline LONG ColorKey ( LONG R, LONG G, LONG B ) {
+   return ( R << 10 ) | ( G << 5 ) | B;
+}
+
+inline LONG ExpandBin ( LONG Value ) {
+   return ( Value << 3 ) | ( Value >> 2 );
+}
+
+static void ShrinkBox ( ColorBox &Box, DWORD *Histogram ) {
+   LONG Min [ 3 ] = { 31, 31, 31 }, Max [ 3 ] = { 0, 0, 0 },
+      R, G, B, Channel;
+   DWORD Count;
+
+   Box.Count = 0;
+
+   for ( R = Box.Min [ 0 ]; R <= Box.Max [ 0 ]; R++ )
+      for ( G = Box.Min [ 1 ]; G <= Box.Max [ 1 ]; G++ )
+         for ( B = Box.Min [ 2 ]; B <= Box.Max [ 2 ]; B++ ) {
+            Count = Histogram [ ColorKey ( R, G, B ) ];
+
+            if ( Count == 0 )
+               continue;
+
+            Box.Count += Count;
+
+            if ( R < Min [ 0 ] ) Min [ 0 ] = R;
+            if ( R > Max [ 0 ] ) Max [ 0 ] = R;
+            if ( G < Min [ 1 ] ) Min [ 1 ] = G;
+            if ( G > Max [ 1 ] ) Max [ 1 ] = G;
+            if ( B < Min [ 2 ] ) Min [ 2 ] = B;
+            if ( B > Max [ 2 ] ) Max [ 2 ] = B;
+         }
+
+   if ( Box.Count == 0 )
+      return;
+
+   for ( Channel = 0; Channel < 3; Channel++ ) {
+      Box.Min [ Channel ] = Min [ Channel ];
+      Box.Max [ Channel ] = Max [ Channel ];
+   }
+}
+
+static bool SplitBox ( ColorBox &Box, ColorBox &Upper,
+        DWORD *Histogram ) {
+
+   DWORD Slices [ 32 ], Sum;
+   LONG Channel, Axis, Cut, Value [ 3 ];
+
+   // Split the longest side; a box of one colour cannot
+   // be split:
+   Axis = 0;
+
+   for ( Channel = 1; Channel < 3; Channel++ )
+      if ( Box.Max [ Channel ] - Box.Min [ Channel ] >
+           Box.Max [ Axis ] - Box.Min [ Axis ] )
+         Axis = Channel;
+
+   if ( Box.Max [ Axis ] == Box.Min [ Axis ] )
+      return false;
+
+   ZeroMemory ( Slices, sizeof Slices );
+
+   for ( Value [ 0 ] = Box.Min [ 0 ]; Value [ 0 ] <= Box.Max [ 0 ]; Value [ 0 ]++ )
+      for ( Value [ 1 ] = Box.Min [ 1 ]; Value [ 1 ] <= Box.Max [ 1 ]; Value [ 1 ]++ )
+         for ( Value [ 2 ] = Box.Min [ 2 ]; Value [ 2 ] <= Box.Max [ 2 ]; Value [ 2 ]++ )
+            Slices [ Value [ Axis ] ] += Histogram [
+               ColorKey ( Value [ 0 ], Value [ 1 ], Value [ 2 ] ) ];
+
+   // The lower box takes slices until it holds half the
+   // pixels, but always leaves the upper box one:
+   Sum = 0;
+
+   for ( Cut = Box.Min [ Axis ]; Cut < Box.Max [ Axis ] - 1; Cut++ ) {
+      Sum += Slices [ Cut ];
+
+      if ( Sum * 2 >= Box.Count )
+         break;
+   }
+
+   Upper = Box;
+
+   Box.Max   [ Axis ] = Cut;
+   Upper.Min [ Axis ] = Cut + 1;
+
+   ShrinkBox ( Box, Histogram );
+   ShrinkBox ( Upper, Histogram );
+
+   return true;
+}
+
+static void AverageBox ( ColorBox &Box, DWORD *Histogram,
+        PALETTEENTRY &Entry ) {
+
+   LONGLONG Sum [ 3 ] = { 0, 0, 0 };
+   LONG R, G, B;
+   DWORD Count;
+
+   for ( R = Box.Min [ 0 ]; R <= Box.Max [ 0 ]; R++ )
+      for ( G = Box.Min [ 1 ]; G <= Box.Max [ 1 ]; G++ )
+         for ( B = Box.Min [ 2 ]; B <= Box.Max [ 2 ]; B++ ) {
+            Count = Histogram [ ColorKey ( R, G, B ) ];
+
+            Sum [ 0 ] += ( LONGLONG ) ExpandBin ( R ) * Count;
+            Sum [ 1 ] += ( LONGLONG ) ExpandBin ( G ) * Count;
+            Sum [ 2 ] += ( LONGLONG ) ExpandBin ( B ) * Count;
+         }
+
+   Entry.peRed   = ( BYTE ) ( ( Sum [ 0 ] + Box.Count / 2 ) / Box.Count );
+   Entry.peGreen = ( BYTE ) ( ( Sum [ 1 ] + Box.Count / 2 ) / Box.Count );
+   Entry.peBlue  = ( BYTE ) ( ( Sum [ 2 ] + Box.Count / 2 ) / Box.Count );
+   Entry.peFlags = 0;
+}
+
+bool QuantizePixels ( LPBYTE Dest, LONG DestPitch, LPVOID Src,
+        LONG SrcPitch, PixelFormat SrcFormat, LONG Width,
+        LONG Height, PALETTEENTRY *Palette, LONG Colors ) {
+
+   ColorBox Boxes [ 256 ];
+   DWORD *Histogram;
+   LPBYTE Inverse;
+   WORD *Row;
+   LONG BoxCount, Best, Index, X, Y, R, G, B;
+   RECT Rect;
+
+   if ( Src == NULL || Palette == NULL || Width <= 0 ||
+        Height <= 0 || Colors < 1 || Colors > 256 ||
+        SrcFormat == Format8 ||
+        GetFormatBytesPerPixel ( SrcFormat ) == 0 )
+      return false;
+
+   Histogram = new DWORD [ 32768 ];
+   Inverse   = new BYTE  [ 32768 ];
+   Row       = new WORD  [ Width ];
+
+   if ( Histogram == NULL || Inverse == NULL || Row == NULL ) {
+      delete [] Histogram;
+      delete [] Inverse;
+      delete [] Row;
+
+      return false;
+   }
+
+   ZeroMemory ( Histogram, 32768 * sizeof ( DWORD ) );
+
+   Rect.left = 0; Rect.right = Width;
+
+   for ( Y = 0; Y < Height; Y++ ) {
+      Rect.top = Y; Rect.bottom = Y + 1;
+
+      ConvertPixels ( Row, Width * 2, Format555, 0, 0, Src,
+         SrcPitch, SrcFormat, Rect );
+
+      for ( X = 0; X < Width; X++ )
+         Histogram [ Row [ X ] ]++;
+   }
+
+   for ( Index = 0; Index < 3; Index++ ) {
+      Boxes [ 0 ].Min [ Index ] = 0;
+      Boxes [ 0 ].Max [ Index ] = 31;
+   }
+
+   ShrinkBox ( Boxes [ 0 ], Histogram );
+
+   BoxCount = 1;
+
+   while ( BoxCount < Colors ) {
+      // The fullest box that has more than one colour:
+      Best = -1;
+
+      for ( Index = 0; Index < BoxCount; Index++ ) {
+         if ( Boxes [ Index ].Min [ 0 ] == Boxes [ Index ].Max [ 0 ] &&
+              Boxes [ Index ].Min [ 1 ] == Boxes [ Index ].Max [ 1 ] &&
+              Boxes [ Index ].Min [ 2 ] == Boxes [ Index ].Max [ 2 ] )
+            continue;
+
+         if ( Best < 0 || Boxes [ Index ].Count > Boxes [ Best ].Count )
+            Best = Index;
+      }
+
+      if ( Best < 0 )
+         break;
+
+      if ( !SplitBox ( Boxes [ Best ], Boxes [ BoxCount ], Histogram ) )
+         break;
+
+      BoxCount++;
+   }
+
+   ZeroMemory ( Palette, Colors * sizeof ( PALETTEENTRY ) );
+
+   for ( Index = 0; Index < BoxCount; Index++ ) {
+      AverageBox ( Boxes [ Index ], Histogram, Palette [ Index ] );
+
+      for ( R = Boxes [ Index ].Min [ 0 ]; R <= Boxes [ Index ].Max [ 0 ]; R++ )
+         for ( G = Boxes [ Index ].Min [ 1 ]; G <= Boxes [ Index ].Max [ 1 ]; G++ )
+            for ( B = Boxes [ Index ].Min [ 2 ]; B <= Boxes [ Index ].Max [ 2 ]; B++ )
+               Inverse [ ColorKey ( R, G, B ) ] = ( BYTE ) Index;
+   }
+
+   if ( Dest != NULL ) {
+      for ( Y = 0; Y < Height; Y++ ) {
+         Rect.top = Y; Rect.bottom = Y + 1;
+
+         ConvertPixels ( Row, Width * 2, Format555, 0, 0, Src,
+            SrcPitch, SrcFormat, Rect );
+
+         for ( X = 0; X < Width; X++ )
+            Dest [ Y * DestPitch + X ] = Inverse [ Row [ X ] ];
+      }
+   }
+
+   delete [] Histogram;
+   delete [] Inverse;
+   delete [] Row;
+
+   return true;
+}
+
+bool QuantizeSurface ( DirectDrawSurface &Dest,
+        DirectDrawPalette &Palette, DirectDrawSurface &Src ) {
+
+   DDPIXELFORMAT DestPF, SrcPF;
+   PALETTEENTRY Entries [ 256 ];
+   LPVOID DestMemory, SrcMemory;
+   bool Result;
+
+   if ( !Dest.GetSurfaceFormat ( DestPF ) ||
+        !Src.GetSurfaceFormat ( SrcPF ) ||
+        GetPixelFormat ( DestPF ) != Format8 ||
+        Dest.GetWidth ()  != Src.GetWidth () ||
+        Dest.GetHeight () != Src.GetHeight () )
+      return false;
+
+   if ( !Src.StartAccess ( &SrcMemory ) )
+      return false;
+
+   if ( !Dest.StartAccess ( &DestMemory ) ) {
+      Src.EndAccess ();
+      return false;
+   }
+
+   Result = QuantizePixels ( ( LPBYTE ) DestMemory, Dest.GetPitch (),
+      SrcMemory, Src.GetPitch (), GetPixelFormat ( SrcPF ),
+      Src.GetWidth (), Src.GetHeight (), Entries );
+
+   Dest.EndAccess ();
+   Src.EndAccess ();
+
+   if ( !Result || !Palette.SetEntries ( 0, 256, Entries ) )
+      return false;
+
+   return Dest.SetPalette ( &Palette );
+}
+
+double MeasureExpandThroughput ( PixelFormat DestFormat,
+        LONG Size, LONG Repeats, bool Keyed ) {
+
+   PALETTEENTRY Entries [ 256 ];
+   DWORD Lookup [ 256 ];
+   LPBYTE Src, Dest;
+   LONG BytesPerPixel, Repeat, I;
+   LARGE_INTEGER Start, Stop, Frequency;
+   DWORD Seed = 12345;
+   double Seconds;
+
+   BytesPerPixel = GetFormatBytesPerPixel ( DestFormat );
+
+   if ( Size <= 0 || Repeats <= 0 || BytesPerPixel < 2 )
+      return 0.0;
+
+   FillColorCube ( Entries );
+
+   if ( !BuildLookup ( Entries, DestFormat, Lookup ) )
+      return 0.0;
+
+   Src  = new BYTE [ Size * Size ];
+   Dest = new BYTE [ Size * Size * BytesPerPixel ];
+
+   for ( I = 0; I < Size * Size; I++ ) {
+      Seed = Seed * 1103515245 + 12345;
+      Src [ I ] = ( BYTE ) ( Seed >> 16 );
+   }
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ )
+      ExpandPixels ( Dest, Size * BytesPerPixel, BytesPerPixel,
+         Src, Size, Size, Size, Lookup, Keyed, 0, 15 );
+
+   QueryPerformanceCounter ( &Stop );
+
+   delete [] Src;
+   delete [] Dest;
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return ( double ) Size * Size * Repeats / Seconds / 1e6;
+}
@@ -0,0 +1,105 @@
+//
+// File name: Palette.hpp
+//
+// Description: Palettes for 8-bit surfaces, expansion of
+//              palette indices to true colour, and a
+//              median cut quantizer.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __PALETTEHPP__
+#define __PALETTEHPP__
+
+#include "PixelConvert.hpp"
+
+// 256 entries, attached to 8-bit surfaces with SetPalette.
+// On a Hardware manager the entries are mirrored in a
+// DirectDraw palette:
+class DirectDrawPalette {
+   protected:
+      LPDIRECTDRAWPALETTE Palette;
+
+      PALETTEENTRY Entries [ 256 ];
+
+      bool Created;
+
+      // Grows whenever the entries change:
+      DWORD Changes;
+
+      // The entries as pixels of LookupFormat, rebuilt when
+      // a different format is asked for or the entries
+      // changed since:
+      DWORD       Lookup [ 256 ];
+      PixelFormat LookupFormat;
+      DWORD       LookupChanges;
+
+      // The nearest entry to each 15-bit colour, allocated
+      // on first use and rebuilt the same way:
+      LPBYTE Inverse;
+      DWORD  InverseChanges;
+
+   public:
+      DirectDrawPalette ();
+      ~DirectDrawPalette ();
+
+      // Without Entries, the palette starts as a 3:3:2
+      // colour cube:
+      bool Create ( DirectDrawManager &Manager,
+         PALETTEENTRY *Entries = NULL );
+
+      bool SetEntries ( LONG First, LONG Count,
+         PALETTEENTRY *Entries );
+      bool GetEntries ( LONG First, LONG Count,
+         PALETTEENTRY *Entries );
+
+      PALETTEENTRY *GetEntries () { return Entries; }
+
+      DWORD GetChangeCount () { return Changes; }
+
+      // Every entry as a raw pixel of Format (not Format8),
+      // for ExpandPixels:
+      DWORD *GetLookup ( PixelFormat Format );
+
+      // The table ConvertPixels converts to Format8 through
+      // (see BuildInverseTable):
+      LPBYTE GetInverse ();
+
+      bool GetInterface ( LPDIRECTDRAWPALETTE *Interface );
+};
+
+// Expand Width x Height palette indices into Dest, whose
+// format has two, three or four bytes per pixel, through a
+// table of raw pixels such as GetLookup returns. With
+// Keyed, indices from KeyLow to KeyHigh leave the
+// destination as it was:
+bool ExpandPixels ( LPVOID Dest, LONG DestPitch,
+   LONG DestBytesPerPixel, LPBYTE Src, LONG SrcPitch,
+   LONG Width, LONG Height, DWORD *Lookup, bool Keyed = false,
+   BYTE KeyLow = 0, BYTE KeyHigh = 0 );
+
+// Choose up to Colors palette entries for a Width x Height
+// true colour image by median cut over its 15-bit colours
+// and, when Dest is not NULL, write the image as indices.
+// Entries beyond those needed are black:
+bool QuantizePixels ( LPBYTE Dest, LONG DestPitch, LPVOID Src,
+   LONG SrcPitch, PixelFormat SrcFormat, LONG Width,
+   LONG Height, PALETTEENTRY *Palette, LONG Colors = 256 );
+
+// Fill an 8-bit surface and its palette from a true
+// colour surface of the same size, and attach the palette:
+bool QuantizeSurface ( DirectDrawSurface &Dest,
+   DirectDrawPalette &Palette, DirectDrawSurface &Src );
+
+// Expand a Size x Size image to DestFormat Repeats times
+// and return the throughput in megapixels per second:
+double MeasureExpandThroughput ( PixelFormat DestFormat,
+   LONG Size, LONG Repeats, bool Keyed = false );
+
+#endif
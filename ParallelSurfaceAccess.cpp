@@ -0,0 +1,129 @@
+//
+// File name: ParallelSurfaceAccess.cpp
+//
+// Description: Locks a surface once and runs a kernel over
+//              its tiles on a thread pool.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "ParallelSurfaceAccess.hpp"
+
+ParallelSurfaceAccess::ParallelSurfaceAccess (
+        ThreadPool &Pool ) {
+
+   this->Pool = &Pool;
+
+   PropTileWidth = PropTileHeight = 0;
+   TileWidth = TileHeight = 0;
+   TilesAcross = TileCount = Pitch = BytesPerPixel = 0;
+
+   Memory  = NULL;
+   Kernel  = NULL;
+   Context = NULL;
+}
+
+bool ParallelSurfaceAccess::SetTileSize ( LONG Width,
+        LONG Height ) {
+
+   if ( Width < 0 || Height < 0 )
+      return false;
+
+   PropTileWidth  = Width;
+   PropTileHeight = Height;
+
+   return true;
+}
+
+void ParallelSurfaceAccess::RunTile ( LONG Task, LONG Thread,
+        LPVOID Access ) {
+
+   ParallelSurfaceAccess *Self =
+      ( ParallelSurfaceAccess * ) Access;
+
+   RECT Tile;
+
+   Tile.left   = Self->Area.left + ( Task % Self->TilesAcross ) *
+      Self->TileWidth;
+   Tile.top    = Self->Area.top  + ( Task / Self->TilesAcross ) *
+      Self->TileHeight;
+   Tile.right  = Tile.left + Self->TileWidth;
+   Tile.bottom = Tile.top  + Self->TileHeight;
+
+   if ( Tile.right  > Self->Area.right  )
+      Tile.right  = Self->Area.right;
+
+   if ( Tile.bottom > Self->Area.bottom )
+      Tile.bottom = Self->Area.bottom;
+
+   Self->Kernel ( Self->Memory +
+      ( Tile.top - Self->Area.top ) * Self->Pitch +
+      ( Tile.left - Self->Area.left ) * Self->BytesPerPixel,
+      Self->Pitch, Tile, Thread, Self->Context );
+}
+
+bool ParallelSurfaceAccess::Run ( DirectDrawSurface &Surface,
+        TileKernel Kernel, LPVOID Context, RECT *Rect ) {
+
+   LONG Width, Height, TilesDown;
+   bool Result;
+
+   if ( Kernel == NULL )
+      return false;
+
+   if ( Rect != NULL )
+      Area = *Rect;
+   else {
+      Area.left = 0; Area.top = 0;
+      Area.right = Surface.GetWidth ();
+      Area.bottom = Surface.GetHeight ();
+   }
+
+   Width  = Area.right  - Area.left;
+   Height = Area.bottom - Area.top;
+
+   if ( Width <= 0 || Height <= 0 )
+      return false;
+
+   BytesPerPixel = Surface.GetBytesPerPixel ();
+   Pitch         = Surface.GetPitch ();
+
+   // Default tiles are at most 128 pixels wide, with as
+   // many rows as fit in DefaultTileBytes:
+   TileWidth  = PropTileWidth;
+   TileHeight = PropTileHeight;
+
+   if ( TileWidth == 0 )
+      TileWidth = Width < 128 ? Width : 128;
+
+   if ( TileHeight == 0 ) {
+      TileHeight = DefaultTileBytes /
+         ( TileWidth * BytesPerPixel );
+
+      if ( TileHeight < 1 )
+         TileHeight = 1;
+   }
+
+   if ( !Surface.StartAccess ( ( LPVOID * ) &Memory, Rect ) )
+      return false;
+
+   TilesAcross = ( Width  + TileWidth  - 1 ) / TileWidth;
+   TilesDown   = ( Height + TileHeight - 1 ) / TileHeight;
+   TileCount   = TilesAcross * TilesDown;
+
+   this->Kernel  = Kernel;
+   this->Context = Context;
+
+   Result = Pool->Run ( RunTile, this, TileCount );
+
+   if ( !Surface.EndAccess ( Rect ) )
+      return false;
+
+   return Result;
+}
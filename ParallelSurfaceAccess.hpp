@@ -0,0 +1,62 @@
+//
+// File name: ParallelSurfaceAccess.hpp
+//
+// Description: Locks a surface once and runs a kernel over
+//              its tiles on a thread pool.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __PARALLELSURFACEACCESSHPP__
+#define __PARALLELSURFACEACCESSHPP__
+
+#include "DirectDraw.hpp"
+#include "ThreadPool.hpp"
+
+// Tile points at the tile's top left pixel; Rect is the
+// tile in surface coordinates. Kernels run concurrently,
+// so they must only write inside their own tile:
+typedef void ( *TileKernel ) ( LPBYTE Tile, LONG Pitch,
+   RECT &Rect, LONG Thread, LPVOID Context );
+
+class ParallelSurfaceAccess {
+   public:
+      // Tiles are sized to stay in a core's cache:
+      enum { DefaultTileBytes = 32768 };
+
+   protected:
+      ThreadPool *Pool;
+
+      LONG PropTileWidth, PropTileHeight, TileWidth,
+           TileHeight, TilesAcross, TileCount, Pitch,
+           BytesPerPixel;
+
+      LPBYTE     Memory;
+      RECT       Area;
+      TileKernel Kernel;
+      LPVOID     Context;
+
+      static void RunTile ( LONG Task, LONG Thread,
+         LPVOID Access );
+
+   public:
+      ParallelSurfaceAccess ( ThreadPool &Pool );
+
+      // A zero size picks tiles of about DefaultTileBytes:
+      bool SetTileSize ( LONG Width, LONG Height );
+
+      // Locks Rect (or the whole surface), runs Kernel on
+      // every tile and unlocks once all of them are done:
+      bool Run ( DirectDrawSurface &Surface, TileKernel Kernel,
+         LPVOID Context, RECT *Rect = NULL );
+
+      LONG GetTileCount () { return TileCount; }
+};
+
+#endif
@@ -0,0 +1,998 @@
+//
+// File name: PixelConvert.cpp
+//
+// Description: Conversion between the pixel layouts
+//              produced by SetColorBitDepth.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "PixelConvert.hpp"
+
+#ifdef PIXELCONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef PIXELCONVERT_AVX2
+#include <immintrin.h>
+#endif
+
+// Every conversion unpacks a chunk of a row to 32-bit
+// ARGB (the 8888 layout), then packs it to the destination
+// format. The chunk buffer stays in the L1 cache:
+const LONG ChunkPixels = 256;
+
+#if defined ( PIXELCONVERT_AVX2 )
+static ConversionPath CurrentPath = AVX2Path;
+#elif defined ( PIXELCONVERT_SSE2 )
+static ConversionPath CurrentPath = SSE2Path;
+#else
+static ConversionPath CurrentPath = ScalarPath;
+#endif
+
+// 4x4 ordered dither matrix:
+static const BYTE Bayer [ 4 ] [ 4 ] = {
+   {  0,  8,  2, 10 },
+   { 12,  4, 14,  6 },
+   {  3, 11,  1,  9 },
+   { 15,  7, 13,  5 }
+};
+
+PixelFormat GetPixelFormat ( DDPIXELFORMAT &PF ) {
+   if ( PF.dwFlags & DDPF_PALETTEINDEXED8 )
+      return Format8;
+
+   if ( !( PF.dwFlags & DDPF_RGB ) )
+      return FormatUnknown;
+
+   switch ( PF.dwRGBBitCount ) {
+      case 16:
+         if ( PF.dwFlags & DDPF_ALPHAPIXELS )
+            return Format1555;
+
+         if ( PF.dwGBitMask == ( 0x1F << 5 ) )
+            return Format555;
+
+         return Format565;
+      case 24:
+         return Format888;
+      case 32:
+         if ( PF.dwFlags & DDPF_ALPHAPIXELS )
+            return Format8888;
+
+         return FormatX888;
+   }
+
+   return FormatUnknown;
+}
+
+PixelFormat GetPixelFormat ( LONG Depth, bool Alpha ) {
+   DDPIXELFORMAT PF;
+
+   SetColorBitDepth ( PF, Depth, Alpha );
+
+   return GetPixelFormat ( PF );
+}
+
+LONG GetFormatBytesPerPixel ( PixelFormat Format ) {
+   switch ( Format ) {
+      case Format8:
+         return 1;
+      case Format555:
+      case Format565:
+      case Format1555:
+         return 2;
+      case Format888:
+         return 3;
+      case FormatX888:
+      case Format8888:
+         return 4;
+      default:
+         break;
+   }
+
+   return 0;
+}
+
+bool SetConversionPath ( ConversionPath Path ) {
+#ifndef PIXELCONVERT_AVX2
+   if ( Path == AVX2Path )
+      return false;
+#endif
+
+#ifndef PIXELCONVERT_SSE2
+   if ( Path == SSE2Path )
+      return false;
+#endif
+
+   CurrentPath = Path;
+
+   return true;
+}
+
+ConversionPath GetConversionPath () {
+   return CurrentPath;
+}
+
+//
+// Scalar kernels (these also finish the tail of every row
+// the SIMD kernels leave behind):
+//
+
+inline DWORD Expand5 ( DWORD Value ) {
+   return ( Value << 3 ) | ( Value >> 2 );
+}
+
+inline DWORD Expand6 ( DWORD Value ) {
+   return ( Value << 2 ) | ( Value >> 4 );
+}
+
+static void UnpackScalar ( LPBYTE Src, PixelFormat Format,
+        LONG Count, DWORD *Out, DWORD *Lookup ) {
+
+   LONG X;
+   DWORD P;
+
+   switch ( Format ) {
+      case Format8:
+         for ( X = 0; X < Count; X++ )
+            Out [ X ] = Lookup [ Src [ X ] ];
+      break;
+      case Format555:
+      case Format1555:
+         for ( X = 0; X < Count; X++ ) {
+            P = ( ( WORD * ) Src ) [ X ];
+
+            Out [ X ] = ( Expand5 ( ( P >> 10 ) & 0x1F ) << 16 ) |
+               ( Expand5 ( ( P >> 5 ) & 0x1F ) << 8 ) |
+               Expand5 ( P & 0x1F );
+
+            if ( Format == Format555 || ( P & 0x8000 ) )
+               Out [ X ] |= 0xFF000000;
+         }
+      break;
+      case Format565:
+         for ( X = 0; X < Count; X++ ) {
+            P = ( ( WORD * ) Src ) [ X ];
+
+            Out [ X ] = 0xFF000000 |
+               ( Expand5 ( P >> 11 ) << 16 ) |
+               ( Expand6 ( ( P >> 5 ) & 0x3F ) << 8 ) |
+               Expand5 ( P & 0x1F );
+         }
+      break;
+      case Format888:
+         for ( X = 0; X < Count; X++, Src += 3 )
+            Out [ X ] = 0xFF000000 | Src [ 0 ] |
+               ( Src [ 1 ] << 8 ) | ( Src [ 2 ] << 16 );
+      break;
+      case FormatX888:
+         for ( X = 0; X < Count; X++ )
+            Out [ X ] = ( ( DWORD * ) Src ) [ X ] | 0xFF000000;
+      break;
+      case Format8888:
+         memcpy ( Out, Src, Count * 4 );
+      break;
+      default:
+      break;
+   }
+}
+
+static void PackScalar ( DWORD *In, PixelFormat Format,
+        LONG Count, LPBYTE Dest, LPBYTE Inverse ) {
+
+   LONG X;
+   DWORD P;
+
+   switch ( Format ) {
+      case Format8:
+         for ( X = 0; X < Count; X++ ) {
+            P = In [ X ];
+
+            Dest [ X ] = Inverse [ ( ( P >> 9 ) & 0x7C00 ) |
+               ( ( P >> 6 ) & 0x03E0 ) | ( ( P >> 3 ) & 0x1F ) ];
+         }
+      break;
+      case Format555:
+      case Format1555:
+         for ( X = 0; X < Count; X++ ) {
+            P = In [ X ];
+
+            ( ( WORD * ) Dest ) [ X ] = ( WORD ) (
+               ( ( P >> 9 ) & 0x7C00 ) | ( ( P >> 6 ) & 0x03E0 ) |
+               ( ( P >> 3 ) & 0x001F ) );
+
+            if ( Format == Format1555 )
+               ( ( WORD * ) Dest ) [ X ] |=
+                  ( WORD ) ( ( P >> 16 ) & 0x8000 );
+         }
+      break;
+      case Format565:
+         for ( X = 0; X < Count; X++ ) {
+            P = In [ X ];
+
+            ( ( WORD * ) Dest ) [ X ] = ( WORD ) (
+               ( ( P >> 8 ) & 0xF800 ) | ( ( P >> 5 ) & 0x07E0 ) |
+               ( ( P >> 3 ) & 0x001F ) );
+         }
+      break;
+      case Format888:
+         for ( X = 0; X < Count; X++, Dest += 3 ) {
+            P = In [ X ];
+
+            Dest [ 0 ] = ( BYTE ) ( P );
+            Dest [ 1 ] = ( BYTE ) ( P >> 8 );
+            Dest [ 2 ] = ( BYTE ) ( P >> 16 );
+         }
+      break;
+      case FormatX888:
+      case Format8888:
+         memcpy ( Dest, In, Count * 4 );
+      break;
+      default:
+      break;
+   }
+}
+
+static void DitherPattern ( PixelFormat Format, LONG X,
+        LONG Y, BYTE Pattern [ 16 ] ) {
+
+   LONG I;
+   BYTE Threshold;
+
+   // Per-byte offsets for four consecutive pixels starting
+   // at X: the matrix is scaled to the bits each channel
+   // loses (3 for 5-bit channels, 2 for 6-bit green):
+   for ( I = 0; I < 4; I++ ) {
+      Threshold = Bayer [ Y & 3 ] [ ( X + I ) & 3 ];
+
+      Pattern [ I * 4 + 0 ] = Threshold >> 1;
+      Pattern [ I * 4 + 1 ] = ( Format == Format565 ) ?
+         Threshold >> 2 : Threshold >> 1;
+      Pattern [ I * 4 + 2 ] = Threshold >> 1;
+      Pattern [ I * 4 + 3 ] = 0;
+   }
+}
+
+static void DitherScalar ( DWORD *Pixels, LONG Count,
+        BYTE Pattern [ 16 ] ) {
+
+   LONG X, C;
+   LPBYTE P;
+   DWORD Sum;
+
+   for ( X = 0; X < Count; X++ ) {
+      P = ( LPBYTE ) &Pixels [ X ];
+
+      for ( C = 0; C < 3; C++ ) {
+         Sum = P [ C ] + Pattern [ ( X & 3 ) * 4 + C ];
+         P [ C ] = ( BYTE ) ( Sum > 255 ? 255 : Sum );
+      }
+   }
+}
+
+//
+// SSE2 kernels. Each returns the number of pixels it
+// handled; the scalar kernels finish the rest:
+//
+
+#ifdef PIXELCONVERT_SSE2
+
+static LONG UnpackSSE2 ( LPBYTE Src, PixelFormat Format,
+        LONG Count, DWORD *Out ) {
+
+   LONG X = 0;
+   __m128i P, R, G, B, A;
+
+   const __m128i Mask5  = _mm_set1_epi16 ( 0x1F );
+   const __m128i Mask6  = _mm_set1_epi16 ( 0x3F );
+   const __m128i Opaque = _mm_set1_epi16 ( ( short ) 0xFF00 );
+   const __m128i Alpha  = _mm_set1_epi32 ( 0xFF000000 );
+
+   switch ( Format ) {
+      case Format555:
+      case Format1555:
+      case Format565:
+         for ( ; X + 8 <= Count; X += 8 ) {
+            P = _mm_loadu_si128 ( ( __m128i * ) ( Src + X * 2 ) );
+
+            if ( Format == Format565 ) {
+               R = _mm_srli_epi16 ( P, 11 );
+               G = _mm_and_si128 ( _mm_srli_epi16 ( P, 5 ), Mask6 );
+               G = _mm_or_si128 ( _mm_slli_epi16 ( G, 2 ),
+                  _mm_srli_epi16 ( G, 4 ) );
+               A = Opaque;
+            }
+            else {
+               R = _mm_and_si128 ( _mm_srli_epi16 ( P, 10 ), Mask5 );
+               G = _mm_and_si128 ( _mm_srli_epi16 ( P, 5 ), Mask5 );
+               G = _mm_or_si128 ( _mm_slli_epi16 ( G, 3 ),
+                  _mm_srli_epi16 ( G, 2 ) );
+
+               if ( Format == Format1555 )
+                  A = _mm_and_si128 ( _mm_srai_epi16 ( P, 15 ),
+                     Opaque );
+               else A = Opaque;
+            }
+
+            B = _mm_and_si128 ( P, Mask5 );
+
+            R = _mm_or_si128 ( _mm_slli_epi16 ( R, 3 ),
+               _mm_srli_epi16 ( R, 2 ) );
+            B = _mm_or_si128 ( _mm_slli_epi16 ( B, 3 ),
+               _mm_srli_epi16 ( B, 2 ) );
+
+            // Low words hold G:B, high words A:R:
+            G = _mm_or_si128 ( _mm_slli_epi16 ( G, 8 ), B );
+            R = _mm_or_si128 ( A, R );
+
+            _mm_storeu_si128 ( ( __m128i * ) ( Out + X ),
+               _mm_unpacklo_epi16 ( G, R ) );
+            _mm_storeu_si128 ( ( __m128i * ) ( Out + X + 4 ),
+               _mm_unpackhi_epi16 ( G, R ) );
+         }
+      break;
+      case FormatX888:
+         for ( ; X + 4 <= Count; X += 4 ) {
+            P = _mm_loadu_si128 ( ( __m128i * ) ( Src + X * 4 ) );
+
+            _mm_storeu_si128 ( ( __m128i * ) ( Out + X ),
+               _mm_or_si128 ( P, Alpha ) );
+         }
+      break;
+      default:
+         // Left to the scalar kernels:
+      break;
+   }
+
+   return X;
+}
+
+static inline __m128i Pack16SSE2 ( __m128i P,
+        PixelFormat Format ) {
+
+   __m128i V;
+
+   if ( Format == Format565 ) {
+      V = _mm_or_si128 (
+         _mm_and_si128 ( _mm_srli_epi32 ( P, 8 ),
+            _mm_set1_epi32 ( 0xF800 ) ),
+         _mm_and_si128 ( _mm_srli_epi32 ( P, 5 ),
+            _mm_set1_epi32 ( 0x07E0 ) ) );
+   }
+   else {
+      V = _mm_or_si128 (
+         _mm_and_si128 ( _mm_srli_epi32 ( P, 9 ),
+            _mm_set1_epi32 ( 0x7C00 ) ),
+         _mm_and_si128 ( _mm_srli_epi32 ( P, 6 ),
+            _mm_set1_epi32 ( 0x03E0 ) ) );
+
+      if ( Format == Format1555 )
+         V = _mm_or_si128 ( V, _mm_and_si128 (
+            _mm_srli_epi32 ( P, 16 ),
+            _mm_set1_epi32 ( 0x8000 ) ) );
+   }
+
+   V = _mm_or_si128 ( V, _mm_and_si128 (
+      _mm_srli_epi32 ( P, 3 ), _mm_set1_epi32 ( 0x1F ) ) );
+
+   // Sign extend so the signed saturating pack leaves the
+   // 16-bit values intact:
+   return _mm_srai_epi32 ( _mm_slli_epi32 ( V, 16 ), 16 );
+}
+
+static LONG PackSSE2 ( DWORD *In, PixelFormat Format,
+        LONG Count, LPBYTE Dest ) {
+
+   LONG X = 0;
+   __m128i Lo, Hi;
+
+   switch ( Format ) {
+      case Format555:
+      case Format1555:
+      case Format565:
+         for ( ; X + 8 <= Count; X += 8 ) {
+            Lo = Pack16SSE2 ( _mm_loadu_si128 (
+               ( __m128i * ) ( In + X ) ), Format );
+            Hi = Pack16SSE2 ( _mm_loadu_si128 (
+               ( __m128i * ) ( In + X + 4 ) ), Format );
+
+            _mm_storeu_si128 ( ( __m128i * ) ( Dest + X * 2 ),
+               _mm_packs_epi32 ( Lo, Hi ) );
+         }
+      break;
+      default:
+         // Left to the scalar kernels:
+      break;
+   }
+
+   return X;
+}
+
+static LONG DitherSSE2 ( DWORD *Pixels, LONG Count,
+        BYTE Pattern [ 16 ] ) {
+
+   LONG X = 0;
+   __m128i Offsets;
+
+   Offsets = _mm_loadu_si128 ( ( __m128i * ) Pattern );
+
+   for ( ; X + 4 <= Count; X += 4 )
+      _mm_storeu_si128 ( ( __m128i * ) ( Pixels + X ),
+         _mm_adds_epu8 ( _mm_loadu_si128 (
+            ( __m128i * ) ( Pixels + X ) ), Offsets ) );
+
+   return X;
+}
+
+#endif
+
+//
+// AVX2 kernels, sixteen 16-bit or eight 32-bit pixels
+// per step:
+//
+
+#ifdef PIXELCONVERT_AVX2
+
+static LONG UnpackAVX2 ( LPBYTE Src, PixelFormat Format,
+        LONG Count, DWORD *Out, DWORD *Lookup ) {
+
+   LONG X = 0;
+   __m256i P, R, G, B, A, Lo, Hi;
+
+   const __m256i Mask5  = _mm256_set1_epi16 ( 0x1F );
+   const __m256i Mask6  = _mm256_set1_epi16 ( 0x3F );
+   const __m256i Opaque = _mm256_set1_epi16 ( ( short ) 0xFF00 );
+
+   switch ( Format ) {
+      case Format8:
+         // Palette lookups are gathered eight at a time:
+         for ( ; X + 8 <= Count; X += 8 ) {
+            P = _mm256_cvtepu8_epi32 ( _mm_loadl_epi64 (
+               ( __m128i * ) ( Src + X ) ) );
+
+            _mm256_storeu_si256 ( ( __m256i * ) ( Out + X ),
+               _mm256_i32gather_epi32 ( ( const int * ) Lookup,
+                  P, 4 ) );
+         }
+      break;
+      case Format555:
+      case Format1555:
+      case Format565:
+         for ( ; X + 16 <= Count; X += 16 ) {
+            P = _mm256_loadu_si256 (
+               ( __m256i * ) ( Src + X * 2 ) );
+
+            if ( Format == Format565 ) {
+               R = _mm256_srli_epi16 ( P, 11 );
+               G = _mm256_and_si256 ( _mm256_srli_epi16 ( P, 5 ),
+                  Mask6 );
+               G = _mm256_or_si256 ( _mm256_slli_epi16 ( G, 2 ),
+                  _mm256_srli_epi16 ( G, 4 ) );
+               A = Opaque;
+            }
+            else {
+               R = _mm256_and_si256 ( _mm256_srli_epi16 ( P, 10 ),
+                  Mask5 );
+               G = _mm256_and_si256 ( _mm256_srli_epi16 ( P, 5 ),
+                  Mask5 );
+               G = _mm256_or_si256 ( _mm256_slli_epi16 ( G, 3 ),
+                  _mm256_srli_epi16 ( G, 2 ) );
+
+               if ( Format == Format1555 )
+                  A = _mm256_and_si256 (
+                     _mm256_srai_epi16 ( P, 15 ), Opaque );
+               else A = Opaque;
+            }
+
+            B = _mm256_and_si256 ( P, Mask5 );
+
+            R = _mm256_or_si256 ( _mm256_slli_epi16 ( R, 3 ),
+               _mm256_srli_epi16 ( R, 2 ) );
+            B = _mm256_or_si256 ( _mm256_slli_epi16 ( B, 3 ),
+               _mm256_srli_epi16 ( B, 2 ) );
+
+            G = _mm256_or_si256 ( _mm256_slli_epi16 ( G, 8 ), B );
+            R = _mm256_or_si256 ( A, R );
+
+            // The unpacks work within 128-bit lanes, so put
+            // the halves back in pixel order:
+            Lo = _mm256_unpacklo_epi16 ( G, R );
+            Hi = _mm256_unpackhi_epi16 ( G, R );
+
+            _mm256_storeu_si256 ( ( __m256i * ) ( Out + X ),
+               _mm256_permute2x128_si256 ( Lo, Hi, 0x20 ) );
+            _mm256_storeu_si256 ( ( __m256i * ) ( Out + X + 8 ),
+               _mm256_permute2x128_si256 ( Lo, Hi, 0x31 ) );
+         }
+      break;
+      default:
+         // Left to the scalar kernels:
+      break;
+   }
+
+   return X;
+}
+
+static inline __m256i Pack16AVX2 ( __m256i P,
+        PixelFormat Format ) {
+
+   __m256i V;
+
+   if ( Format == Format565 ) {
+      V = _mm256_or_si256 (
+         _mm256_and_si256 ( _mm256_srli_epi32 ( P, 8 ),
+            _mm256_set1_epi32 ( 0xF800 ) ),
+         _mm256_and_si256 ( _mm256_srli_epi32 ( P, 5 ),
+            _mm256_set1_epi32 ( 0x07E0 ) ) );
+   }
+   else {
+      V = _mm256_or_si256 (
+         _mm256_and_si256 ( _mm256_srli_epi32 ( P, 9 ),
+            _mm256_set1_epi32 ( 0x7C00 ) ),
+         _mm256_and_si256 ( _mm256_srli_epi32 ( P, 6 ),
+            _mm256_set1_epi32 ( 0x03E0 ) ) );
+
+      if ( Format == Format1555 )
+         V = _mm256_or_si256 ( V, _mm256_and_si256 (
+            _mm256_srli_epi32 ( P, 16 ),
+            _mm256_set1_epi32 ( 0x8000 ) ) );
+   }
+
+   V = _mm256_or_si256 ( V, _mm256_and_si256 (
+      _mm256_srli_epi32 ( P, 3 ), _mm256_set1_epi32 ( 0x1F ) ) );
+
+   // Sign extend for the signed saturating pack:
+   return _mm256_srai_epi32 ( _mm256_slli_epi32 ( V, 16 ), 16 );
+}
+
+static LONG PackAVX2 ( DWORD *In, PixelFormat Format,
+        LONG Count, LPBYTE Dest ) {
+
+   LONG X = 0;
+   __m256i Lo, Hi;
+
+   switch ( Format ) {
+      case Format555:
+      case Format1555:
+      case Format565:
+         for ( ; X + 16 <= Count; X += 16 ) {
+            Lo = Pack16AVX2 ( _mm256_loadu_si256 (
+               ( __m256i * ) ( In + X ) ), Format );
+            Hi = Pack16AVX2 ( _mm256_loadu_si256 (
+               ( __m256i * ) ( In + X + 8 ) ), Format );
+
+            _mm256_storeu_si256 ( ( __m256i * ) ( Dest + X * 2 ),
+               _mm256_permute4x64_epi64 (
+                  _mm256_packs_epi32 ( Lo, Hi ),
+                  _MM_SHUFFLE ( 3, 1, 2, 0 ) ) );
+         }
+      break;
+      default:
+         // Left to the scalar kernels:
+      break;
+   }
+
+   return X;
+}
+
+#endif
+
+//
+// Dispatch:
+//
+
+static void UnpackChunk ( LPBYTE Src, PixelFormat Format,
+        LONG Count, DWORD *Out, DWORD *Lookup ) {
+
+   LONG Done = 0, Size = GetFormatBytesPerPixel ( Format );
+
+#ifdef PIXELCONVERT_AVX2
+   if ( CurrentPath == AVX2Path )
+      Done = UnpackAVX2 ( Src, Format, Count, Out, Lookup );
+#endif
+
+#ifdef PIXELCONVERT_SSE2
+   if ( CurrentPath != ScalarPath )
+      Done += UnpackSSE2 ( Src + Done * Size, Format,
+         Count - Done, Out + Done );
+#endif
+
+   UnpackScalar ( Src + Done * Size, Format, Count - Done,
+      Out + Done, Lookup );
+}
+
+static void PackChunk ( DWORD *In, PixelFormat Format,
+        LONG Count, LPBYTE Dest, LPBYTE Inverse ) {
+
+   LONG Done = 0, Size = GetFormatBytesPerPixel ( Format );
+
+#ifdef PIXELCONVERT_AVX2
+   if ( CurrentPath == AVX2Path )
+      Done = PackAVX2 ( In, Format, Count, Dest );
+#endif
+
+#ifdef PIXELCONVERT_SSE2
+   if ( CurrentPath != ScalarPath )
+      Done += PackSSE2 ( In + Done, Format, Count - Done,
+         Dest + Done * Size );
+#endif
+
+   PackScalar ( In + Done, Format, Count - Done,
+      Dest + Done * Size, Inverse );
+}
+
+static void DitherChunk ( DWORD *Pixels, LONG Count,
+        BYTE Pattern [ 16 ] ) {
+
+   LONG Done = 0;
+
+#ifdef PIXELCONVERT_SSE2
+   if ( CurrentPath != ScalarPath )
+      Done = DitherSSE2 ( Pixels, Count, Pattern );
+#endif
+
+   // Done is a multiple of four, so the pattern phase is
+   // unchanged for the tail:
+   DitherScalar ( Pixels + Done, Count - Done, Pattern );
+}
+
+void BuildInverseTable ( PALETTEENTRY *Palette,
+        LPBYTE Inverse ) {
+
+   LONG Index, Entry, Best, Distance, BestDistance,
+      R, G, B, DR, DG, DB;
+
+   // Map every 15-bit color to its nearest palette entry:
+   for ( Index = 0; Index < 32768; Index++ ) {
+      R = Expand5 ( ( Index >> 10 ) & 0x1F );
+      G = Expand5 ( ( Index >> 5 ) & 0x1F );
+      B = Expand5 ( Index & 0x1F );
+
+      Best = 0; BestDistance = 0x7FFFFFFF;
+
+      for ( Entry = 0; Entry < 256; Entry++ ) {
+         DR = R - Palette [ Entry ].peRed;
+         DG = G - Palette [ Entry ].peGreen;
+         DB = B - Palette [ Entry ].peBlue;
+
+         Distance = DR * DR + DG * DG + DB * DB;
+
+         if ( Distance < BestDistance ) {
+            BestDistance = Distance;
+            Best = Entry;
+         }
+      }
+
+      Inverse [ Index ] = ( BYTE ) Best;
+   }
+}
+
+// Each thread keeps the inverse table of the last palette
+// it converted to without one, found through a TLS slot as
+// the counters' blocks are, so converting row by row with
+// one palette builds the table once. Tables are kept after
+// their thread ends:
+struct InverseCache {
+   PALETTEENTRY Palette [ 256 ];
+   BYTE         Inverse [ 32768 ];
+};
+
+static volatile LONG InverseSlot = ( LONG ) TLS_OUT_OF_INDEXES;
+
+static LPBYTE GetThreadInverse ( PALETTEENTRY *Palette ) {
+   InverseCache *Cache;
+   DWORD Slot;
+
+   if ( InverseSlot == ( LONG ) TLS_OUT_OF_INDEXES ) {
+      Slot = TlsAlloc ();
+
+      // Another thread may have got there first:
+      if ( InterlockedCompareExchange ( &InverseSlot,
+              ( LONG ) Slot, ( LONG ) TLS_OUT_OF_INDEXES ) !=
+           ( LONG ) TLS_OUT_OF_INDEXES )
+         TlsFree ( Slot );
+   }
+
+   Cache = ( InverseCache * ) TlsGetValue ( ( DWORD ) InverseSlot );
+
+   if ( Cache == NULL ) {
+      Cache = new InverseCache;
+
+      if ( Cache == NULL )
+         return NULL;
+
+      TlsSetValue ( ( DWORD ) InverseSlot, Cache );
+   }
+   else if ( memcmp ( Cache->Palette, Palette,
+                sizeof ( Cache->Palette ) ) == 0 )
+      return Cache->Inverse;
+
+   memcpy ( Cache->Palette, Palette, sizeof ( Cache->Palette ) );
+
+   BuildInverseTable ( Palette, Cache->Inverse );
+
+   return Cache->Inverse;
+}
+
+bool ConvertPixels ( LPVOID Dest, LONG DestPitch,
+        PixelFormat DestFormat, LONG DestX, LONG DestY,
+        LPVOID Src, LONG SrcPitch, PixelFormat SrcFormat,
+        RECT &SrcRect, DWORD Flags, PALETTEENTRY *Palette,
+        LPBYTE Inverse ) {
+
+   LONG Width, Height, X, Y, Count, SrcSize, DestSize;
+   LPBYTE SrcRow, DestRow;
+   DWORD Lookup [ 256 ], Chunk [ ChunkPixels ];
+   BYTE Pattern [ 16 ];
+   bool Dither;
+
+   SrcSize  = GetFormatBytesPerPixel ( SrcFormat );
+   DestSize = GetFormatBytesPerPixel ( DestFormat );
+
+   if ( SrcSize == 0 || DestSize == 0 )
+      return false;
+
+   Width  = SrcRect.right  - SrcRect.left;
+   Height = SrcRect.bottom - SrcRect.top;
+
+   if ( Width <= 0 || Height <= 0 || DestX < 0 || DestY < 0 )
+      return false;
+
+   if ( ( SrcFormat == Format8 || DestFormat == Format8 ) &&
+        Palette == NULL )
+      return false;
+
+   // Only down-conversions to 15/16-bit are dithered:
+   Dither = ( Flags & ConvertDither ) &&
+      ( DestFormat == Format555 || DestFormat == Format565 ||
+        DestFormat == Format1555 ) &&
+      ( SrcFormat == Format8 || SrcFormat == Format888 ||
+        SrcFormat == FormatX888 || SrcFormat == Format8888 );
+
+   SrcRow  = ( LPBYTE ) Src + SrcRect.top * SrcPitch +
+      SrcRect.left * SrcSize;
+   DestRow = ( LPBYTE ) Dest + DestY * DestPitch +
+      DestX * DestSize;
+
+   // Identical layouts are plain row copies:
+   if ( SrcFormat == DestFormat ) {
+      for ( Y = 0; Y < Height; Y++ )
+         memcpy ( DestRow + Y * DestPitch,
+            SrcRow + Y * SrcPitch, Width * SrcSize );
+
+      return true;
+   }
+
+   if ( SrcFormat == Format8 ) {
+      for ( X = 0; X < 256; X++ )
+         Lookup [ X ] = 0xFF000000 |
+            ( Palette [ X ].peRed << 16 ) |
+            ( Palette [ X ].peGreen << 8 ) |
+            Palette [ X ].peBlue;
+   }
+
+   if ( DestFormat == Format8 && Inverse == NULL ) {
+      Inverse = GetThreadInverse ( Palette );
+
+      if ( Inverse == NULL )
+         return false;
+   }
+
+   for ( Y = 0; Y < Height; Y++ ) {
+      for ( X = 0; X < Width; X += ChunkPixels ) {
+         Count = Width - X;
+
+         if ( Count > ChunkPixels )
+            Count = ChunkPixels;
+
+         UnpackChunk ( SrcRow + X * SrcSize, SrcFormat, Count,
+            Chunk, Lookup );
+
+         // ChunkPixels is a multiple of four, so every chunk
+         // starts at the same pattern phase:
+         if ( Dither ) {
+            DitherPattern ( DestFormat, DestX + X, DestY + Y,
+               Pattern );
+            DitherChunk ( Chunk, Count, Pattern );
+         }
+
+         PackChunk ( Chunk, DestFormat, Count,
+            DestRow + X * DestSize, Inverse );
+      }
+
+      SrcRow  += SrcPitch;
+      DestRow += DestPitch;
+   }
+
+
+   return true;
+}
+
+// Fills of at least this many bytes bypass the caches:
+const LONG StreamingFillBytes = 256 * 1024;
+
+static inline void StorePixel ( LPBYTE Pixel,
+        LONG BytesPerPixel, DWORD Value ) {
+
+   switch ( BytesPerPixel ) {
+      case 1:
+         *Pixel = ( BYTE ) Value;
+      break;
+      case 2:
+         *( WORD * ) Pixel = ( WORD ) Value;
+      break;
+      case 3:
+         Pixel [ 0 ] = ( BYTE ) Value;
+         Pixel [ 1 ] = ( BYTE ) ( Value >> 8 );
+         Pixel [ 2 ] = ( BYTE ) ( Value >> 16 );
+      break;
+      default:
+         *( DWORD * ) Pixel = Value;
+      break;
+   }
+}
+
+#ifdef PIXELCONVERT_SSE2
+
+// Returns the number of pixels filled; the rest are left
+// to FillRowScalar:
+static LONG FillRowSSE2 ( LPBYTE Row, LONG BytesPerPixel,
+        LONG Width, DWORD Value, bool Streaming ) {
+
+   __m128i Wide;
+   DWORD Pattern;
+   LONG X = 0, Step;
+
+   // 24-bit pixels do not tile a 16-byte store:
+   if ( BytesPerPixel == 3 )
+      return 0;
+
+   if ( BytesPerPixel == 1 )
+      Pattern = ( Value & 0xFF ) * 0x01010101;
+   else if ( BytesPerPixel == 2 )
+      Pattern = ( Value & 0xFFFF ) * 0x00010001;
+   else Pattern = Value;
+
+   Wide = _mm_set1_epi32 ( ( int ) Pattern );
+   Step = 16 / BytesPerPixel;
+
+   // Single pixels up to the first 16-byte boundary:
+   while ( X < Width &&
+           ( ( DWORD_PTR ) ( Row + X * BytesPerPixel ) & 15 ) )
+      StorePixel ( Row + X++ * BytesPerPixel,
+         BytesPerPixel, Value );
+
+   if ( ( ( DWORD_PTR ) ( Row + X * BytesPerPixel ) & 15 ) == 0 ) {
+      if ( Streaming ) {
+         for ( ; X + Step <= Width; X += Step )
+            _mm_stream_si128 ( ( __m128i * ) ( Row +
+               X * BytesPerPixel ), Wide );
+      }
+      else {
+         for ( ; X + Step <= Width; X += Step )
+            _mm_store_si128 ( ( __m128i * ) ( Row +
+               X * BytesPerPixel ), Wide );
+      }
+   }
+
+   return X;
+}
+
+#endif
+
+static void FillRowScalar ( LPBYTE Row, LONG BytesPerPixel,
+        LONG X, LONG Width, DWORD Value ) {
+
+   for ( ; X < Width; X++ )
+      StorePixel ( Row + X * BytesPerPixel, BytesPerPixel,
+         Value );
+}
+
+void FillPixels ( LPVOID Dest, LONG Pitch, LONG BytesPerPixel,
+        LONG Width, LONG Height, DWORD Value ) {
+
+   LPBYTE Row = ( LPBYTE ) Dest;
+   LONG X, Y;
+
+#ifdef PIXELCONVERT_SSE2
+   bool Streaming;
+#endif
+
+   if ( BytesPerPixel < 1 || BytesPerPixel > 4 )
+      return;
+
+#ifdef PIXELCONVERT_SSE2
+   Streaming = Width * BytesPerPixel * Height >=
+      StreamingFillBytes;
+#endif
+
+   for ( Y = 0; Y < Height; Y++, Row += Pitch ) {
+      X = 0;
+
+#ifdef PIXELCONVERT_SSE2
+      X = FillRowSSE2 ( Row, BytesPerPixel, Width, Value,
+         Streaming );
+#endif
+
+      FillRowScalar ( Row, BytesPerPixel, X, Width, Value );
+   }
+
+#ifdef PIXELCONVERT_SSE2
+   // Order the streaming stores before whatever follows:
+   if ( Streaming )
+      _mm_sfence ();
+#endif
+}
+
+double MeasureConversionThroughput ( PixelFormat DestFormat,
+        PixelFormat SrcFormat, LONG Width, LONG Height,
+        LONG Repeats, DWORD Flags ) {
+
+   LONG SrcPitch, DestPitch, I, Repeat;
+   LPBYTE SrcMemory, DestMemory;
+   PALETTEENTRY Palette [ 256 ];
+   LARGE_INTEGER Start, Stop, Frequency;
+   RECT Rect;
+   DWORD Seed = 12345;
+   double Seconds, Bytes;
+
+   SrcPitch  = Width * GetFormatBytesPerPixel ( SrcFormat );
+   DestPitch = Width * GetFormatBytesPerPixel ( DestFormat );
+
+   if ( SrcPitch == 0 || DestPitch == 0 || Height <= 0 ||
+        Repeats <= 0 )
+      return 0.0;
+
+   SrcMemory  = new BYTE [ SrcPitch  * Height ];
+   DestMemory = new BYTE [ DestPitch * Height ];
+
+   // Pseudo-random source pixels and a grey ramp palette:
+   for ( I = 0; I < SrcPitch * Height; I++ ) {
+      Seed = Seed * 1103515245 + 12345;
+      SrcMemory [ I ] = ( BYTE ) ( Seed >> 16 );
+   }
+
+   for ( I = 0; I < 256; I++ ) {
+      Palette [ I ].peRed = Palette [ I ].peGreen =
+         Palette [ I ].peBlue = ( BYTE ) I;
+      Palette [ I ].peFlags = 0;
+   }
+
+   Rect.left = 0; Rect.top = 0;
+   Rect.right = Width; Rect.bottom = Height;
+
+   // Warm the caches (8-bit destinations rebuild their
+   // inverse table on every call, which is included):
+   ConvertPixels ( DestMemory, DestPitch, DestFormat, 0, 0,
+      SrcMemory, SrcPitch, SrcFormat, Rect, Flags, Palette );
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ )
+      ConvertPixels ( DestMemory, DestPitch, DestFormat, 0, 0,
+         SrcMemory, SrcPitch, SrcFormat, Rect, Flags, Palette );
+
+   QueryPerformanceCounter ( &Stop );
+
+   delete [] SrcMemory;
+   delete [] DestMemory;
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   Bytes = ( double ) ( SrcPitch + DestPitch ) * Height *
+      Repeats;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return Bytes / Seconds / 1e9;
+}
@@ -0,0 +1,93 @@
+//
+// File name: PixelConvert.hpp
+//
+// Description: Conversion between the pixel layouts
+//              produced by SetColorBitDepth.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __PIXELCONVERTHPP__
+#define __PIXELCONVERTHPP__
+
+#include "DirectDraw.hpp"
+
+// SIMD kernels are compiled in whenever the target
+// guarantees the instruction set; define PIXELCONVERT_NOSIMD
+// to build the scalar kernels only. Visual C++ 6 cannot
+// target SSE2, so its x86 builds always use the scalar
+// kernels:
+#ifndef PIXELCONVERT_NOSIMD
+   #if defined ( _M_X64 ) || defined ( __SSE2__ ) || \
+       ( defined ( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+      #define PIXELCONVERT_SSE2
+   #endif
+
+   #if defined ( __AVX2__ )
+      #define PIXELCONVERT_AVX2
+   #endif
+#endif
+
+// The layouts SetColorBitDepth describes. Format8 is
+// paletted; FormatX888 is 32-bit without alpha:
+enum PixelFormat { FormatUnknown, Format8, Format555,
+   Format565, Format1555, Format888, FormatX888,
+   Format8888 };
+
+enum ConversionPath { ScalarPath, SSE2Path, AVX2Path };
+
+// Flags for ConvertPixels:
+const DWORD ConvertDither = 0x1;
+
+PixelFormat GetPixelFormat ( DDPIXELFORMAT &PF );
+PixelFormat GetPixelFormat ( LONG Depth, bool Alpha );
+
+LONG GetFormatBytesPerPixel ( PixelFormat Format );
+
+// Select the kernels used by ConvertPixels; fails if the
+// path was not compiled in:
+bool SetConversionPath ( ConversionPath Path );
+ConversionPath GetConversionPath ();
+
+// Convert SrcRect of the source surface memory to the
+// destination, whose top left corner is (DestX, DestY).
+// Both pointers are the start of the surface memory as
+// returned by StartAccess. Palette (256 entries) is only
+// needed when either side is Format8. Conversions to
+// Format8 look colours up in Inverse, the table
+// BuildInverseTable fills for Palette (a DirectDrawPalette
+// keeps one, see GetInverse). Without it the calling
+// thread's table for the last palette it converted to is
+// used, and built again only when the palette differs:
+bool ConvertPixels ( LPVOID Dest, LONG DestPitch,
+   PixelFormat DestFormat, LONG DestX, LONG DestY,
+   LPVOID Src, LONG SrcPitch, PixelFormat SrcFormat,
+   RECT &SrcRect, DWORD Flags = 0,
+   PALETTEENTRY *Palette = NULL, LPBYTE Inverse = NULL );
+
+// Map every 15-bit colour, ( R << 10 ) | ( G << 5 ) | B,
+// to the nearest of 256 palette entries. Inverse holds
+// 32768 bytes:
+void BuildInverseTable ( PALETTEENTRY *Palette,
+   LPBYTE Inverse );
+
+// Fill a Width x Height block with a raw pixel value of
+// 1 to 4 bytes. Large fills use non-temporal stores so
+// they do not evict the caller's working set:
+void FillPixels ( LPVOID Dest, LONG Pitch, LONG BytesPerPixel,
+   LONG Width, LONG Height, DWORD Value );
+
+// Convert a Width x Height image Repeats times with the
+// current path and return the throughput in GB/s of
+// source plus destination bytes:
+double MeasureConversionThroughput ( PixelFormat DestFormat,
+   PixelFormat SrcFormat, LONG Width, LONG Height,
+   LONG Repeats, DWORD Flags = 0 );
+
+#endif
@@ -0,0 +1,488 @@
+//
+// File name: PresentQueue.cpp
+//
+// Description: Presents finished frames on a separate
+//              thread, paced to a target frame time.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "PresentQueue.hpp"
+
+PresentQueue::PresentQueue () {
+   LARGE_INTEGER Frequency;
+
+   Primary = Frames = NULL;
+   Manager = NULL;
+
+   FrameCount = WriteIndex = ReadIndex = Queued = 0;
+   Writing = Stopping = ResetPacing = LossFound = false;
+
+   TargetFrameTime = TotalLatency = 0.0;
+   Deadline.QuadPart = 0;
+
+   Thread = FreeFrames = QueuedFrames = Drained = NULL;
+
+   ZeroMemory ( &Stats, sizeof ( PresentQueueStats ) );
+   ZeroMemory ( History, sizeof ( History ) );
+
+   QueryPerformanceFrequency ( &Frequency );
+
+   TicksPerMillisecond = ( double ) Frequency.QuadPart / 1000.0;
+
+   InitializeCriticalSection ( &Lock );
+}
+
+PresentQueue::~PresentQueue () {
+   Destroy ();
+
+   DeleteCriticalSection ( &Lock );
+}
+
+bool PresentQueue::Create ( DirectDrawManager &Manager,
+        DirectDrawSurface &Primary, LONG BPP, LONG Count ) {
+
+   DWORD ThreadID;
+   LONG Index;
+
+   if ( Frames != NULL )
+      return false;
+
+   if ( Count < 1 || Count > MaxFrames )
+      return false;
+
+   if ( Primary.GetWidth () <= 0 )
+      return false;
+
+   // Frames are rendered off screen and copied to the
+   // backbuffer just before the flip, so the application
+   // never waits for the flip chain:
+
+   Frames = new DirectDrawSurface [ Count ];
+
+   if ( Frames == NULL )
+      return false;
+
+   for ( Index = 0; Index < Count; Index++ ) {
+      Frames [ Index ].SetSurfaceType (
+         DirectDrawSurface::Plain );
+      Frames [ Index ].SetGeneralOptions ( Primary.GetWidth (),
+         Primary.GetHeight (), BPP );
+
+      // Frames are copied as they are, so they must have
+      // the primary surface's pixel size:
+      if ( !Manager.CreateSurface ( Frames [ Index ] ) ||
+           Frames [ Index ].GetBytesPerPixel () !=
+           Primary.GetBytesPerPixel () ) {
+         delete [] Frames;
+         Frames = NULL;
+
+         return false;
+      }
+   }
+
+   this->Primary = &Primary;
+   this->Manager = &Manager;
+
+   FrameCount = Count;
+   WriteIndex = ReadIndex = Queued = 0;
+   Writing = Stopping = ResetPacing = LossFound = false;
+
+   Deadline.QuadPart = 0;
+
+   FreeFrames   = CreateSemaphore ( NULL, Count, Count, NULL );
+   QueuedFrames = CreateSemaphore ( NULL, 0, Count + 1, NULL );
+   Drained      = CreateEvent ( NULL, FALSE, FALSE, NULL );
+
+   // The present thread waits on these, so it is only
+   // started once they all exist:
+   if ( FreeFrames == NULL || QueuedFrames == NULL ||
+        Drained == NULL ) {
+
+      Destroy ();
+
+      return false;
+   }
+
+   Thread = CreateThread ( NULL, 0, PresentThread, this, 0,
+      &ThreadID );
+
+   if ( Thread == NULL ) {
+      Destroy ();
+
+      return false;
+   }
+
+   return true;
+}
+
+void PresentQueue::Destroy () {
+   // Present whatever was queued, then stop the thread:
+
+   if ( Thread != NULL ) {
+      EnterCriticalSection ( &Lock );
+      Stopping = true;
+      LeaveCriticalSection ( &Lock );
+
+      ReleaseSemaphore ( QueuedFrames, 1, NULL );
+
+      WaitForSingleObject ( Thread, INFINITE );
+
+      CloseHandle ( Thread );
+      Thread = NULL;
+   }
+
+   if ( FreeFrames != NULL )
+      CloseHandle ( FreeFrames );
+
+   if ( QueuedFrames != NULL )
+      CloseHandle ( QueuedFrames );
+
+   if ( Drained != NULL )
+      CloseHandle ( Drained );
+
+   FreeFrames = QueuedFrames = Drained = NULL;
+
+   if ( Frames != NULL )
+      delete [] Frames;
+
+   Frames  = NULL;
+   Primary = NULL;
+   Manager = NULL;
+
+   FrameCount = 0;
+}
+
+void PresentQueue::SetTargetFrameTime ( double Milliseconds ) {
+   EnterCriticalSection ( &Lock );
+
+   TargetFrameTime = Milliseconds > 0.0 ? Milliseconds : 0.0;
+
+   // Start pacing again from the next frame:
+   ResetPacing = true;
+
+   LeaveCriticalSection ( &Lock );
+}
+
+DirectDrawSurface *PresentQueue::BeginFrame () {
+   if ( Frames == NULL || Writing )
+      return NULL;
+
+   if ( WaitForSingleObject ( FreeFrames, INFINITE ) !=
+        WAIT_OBJECT_0 )
+      return NULL;
+
+   Writing = true;
+
+   return &Frames [ WriteIndex ];
+}
+
+bool PresentQueue::EndFrame () {
+   bool Lost;
+
+   if ( !Writing )
+      return false;
+
+   // Restoring and repainting surfaces, and ending the
+   // counters' frame, are done here on the drawing thread
+   // rather than by the present thread's Show. A loss the
+   // present thread ran into is restored once it is idle,
+   // since restoring touches Primary and the frames. A lost
+   // primary surface means every video memory surface was
+   // lost, so the sweep finds the rest:
+   EnterCriticalSection ( &Lock );
+   Lost = LossFound;
+   LossFound = false;
+   LeaveCriticalSection ( &Lock );
+
+   if ( Lost ) {
+      Flush ();
+
+      Manager->RestoreSurfaces ();
+   }
+
+   Manager->EndFrameCounters ();
+   AdvanceErrorFrame ();
+
+   QueryPerformanceCounter ( &SubmitTimes [ WriteIndex ] );
+
+   EnterCriticalSection ( &Lock );
+
+   Queued++;
+
+   QueueDepths [ WriteIndex ] = Queued;
+
+   Stats.Submitted++;
+
+   if ( Queued > Stats.MaxQueueDepth )
+      Stats.MaxQueueDepth = Queued;
+
+   LeaveCriticalSection ( &Lock );
+
+   WriteIndex = ( WriteIndex + 1 ) % FrameCount;
+   Writing = false;
+
+   ReleaseSemaphore ( QueuedFrames, 1, NULL );
+
+   return true;
+}
+
+bool PresentQueue::Flush () {
+   LONG Pending;
+
+   if ( Frames == NULL )
+      return false;
+
+   for ( ;; ) {
+      EnterCriticalSection ( &Lock );
+      Pending = Queued;
+      LeaveCriticalSection ( &Lock );
+
+      if ( Pending == 0 )
+         return true;
+
+      WaitForSingleObject ( Drained, INFINITE );
+   }
+}
+
+LONG PresentQueue::GetQueueDepth () {
+   LONG Depth;
+
+   EnterCriticalSection ( &Lock );
+   Depth = Queued;
+   LeaveCriticalSection ( &Lock );
+
+   return Depth;
+}
+
+DWORD WINAPI PresentQueue::PresentThread ( LPVOID Queue ) {
+   ( ( PresentQueue * ) Queue )->PresentFrames ();
+
+   return 0;
+}
+
+void PresentQueue::PresentFrames () {
+   LARGE_INTEGER Now, Done;
+   PresentFrameStats *Frame;
+   LONG Index, Depth;
+   bool Missed, Presented;
+   double Latency, Target;
+
+   for ( ;; ) {
+      if ( WaitForSingleObject ( QueuedFrames, INFINITE ) !=
+           WAIT_OBJECT_0 )
+         break;
+
+      EnterCriticalSection ( &Lock );
+
+      if ( Stopping && Queued == 0 ) {
+         LeaveCriticalSection ( &Lock );
+
+         break;
+      }
+
+      Index = ReadIndex;
+      Depth = QueueDepths [ Index ];
+
+      // Only this thread touches the deadline:
+      Target = TargetFrameTime;
+
+      if ( ResetPacing ) {
+         Deadline.QuadPart = 0;
+         ResetPacing = false;
+      }
+
+      LeaveCriticalSection ( &Lock );
+
+      // A frame that arrives after its deadline is shown
+      // at once, and pacing continues from there:
+      QueryPerformanceCounter ( &Now );
+
+      Missed = Target > 0.0 && Deadline.QuadPart != 0 &&
+         Now.QuadPart > Deadline.QuadPart;
+
+      WaitForDeadline ( Now, Target );
+
+      Presented = PresentFrame ( Frames [ Index ] );
+
+      QueryPerformanceCounter ( &Done );
+
+      Latency = ( double ) ( Done.QuadPart -
+         SubmitTimes [ Index ].QuadPart ) / TicksPerMillisecond;
+
+      EnterCriticalSection ( &Lock );
+
+      if ( Presented ) {
+         Frame = &History [ Stats.Presented % HistorySize ];
+
+         Frame->Frame           = Stats.Presented;
+         Frame->QueueDepth      = Depth;
+         Frame->MissedDeadline  = Missed;
+         Frame->SubmitToPresent = Latency;
+
+         Stats.Presented++;
+
+         TotalLatency += Latency;
+
+         Stats.AverageLatency = TotalLatency / Stats.Presented;
+
+         if ( Latency > Stats.WorstLatency )
+            Stats.WorstLatency = Latency;
+
+         if ( Missed )
+            Stats.MissedDeadlines++;
+      }
+      else Stats.Failures++;
+
+      ReadIndex = ( ReadIndex + 1 ) % FrameCount;
+      Queued--;
+
+      LeaveCriticalSection ( &Lock );
+
+      ReleaseSemaphore ( FreeFrames, 1, NULL );
+      SetEvent ( Drained );
+   }
+}
+
+void PresentQueue::WaitForDeadline ( LARGE_INTEGER &Now,
+        double Target ) {
+
+   LONGLONG FrameTicks;
+   double Remaining;
+
+   if ( Target <= 0.0 )
+      return;
+
+   FrameTicks = ( LONGLONG ) ( Target *
+      TicksPerMillisecond );
+
+   if ( Deadline.QuadPart == 0 ||
+        Now.QuadPart >= Deadline.QuadPart ) {
+
+      Deadline.QuadPart = Now.QuadPart + FrameTicks;
+
+      return;
+   }
+
+   // Sleep through most of the wait, and spin the last
+   // millisecond or two, since Sleep is coarse:
+   while ( Now.QuadPart < Deadline.QuadPart ) {
+      Remaining = ( double ) ( Deadline.QuadPart -
+         Now.QuadPart ) / TicksPerMillisecond;
+
+      if ( Remaining > 2.0 )
+         Sleep ( ( DWORD ) Remaining - 1 );
+
+      QueryPerformanceCounter ( &Now );
+   }
+
+   Deadline.QuadPart += FrameTicks;
+}
+
+bool PresentQueue::PresentFrame ( DirectDrawSurface &Frame ) {
+   LPDIRECTDRAWSURFACE7 Backbuffer, Source;
+   LPBYTE Dest, Src;
+   LONG Y, Bytes;
+   HRESULT Val;
+
+   // Copy the frame to the backbuffer and flip:
+
+   if ( Primary->IsSystemMemory () ) {
+      if ( !Frame.StartAccess ( ( LPVOID * ) &Src ) )
+         return false;
+
+      if ( !Primary->StartAccess ( ( LPVOID * ) &Dest ) ) {
+         Frame.EndAccess ();
+
+         return false;
+      }
+
+      Bytes = Frame.GetWidth () * Frame.GetBytesPerPixel ();
+
+      for ( Y = 0; Y < Frame.GetHeight (); Y++ )
+         memcpy ( Dest + Y * Primary->GetPitch (),
+            Src + Y * Frame.GetPitch (), Bytes );
+
+      Primary->EndAccess ();
+      Frame.EndAccess ();
+
+      return Primary->Show ( false );
+   }
+
+   if ( !Primary->GetBackBuffer ( 0, &Backbuffer ) )
+      return false;
+
+   if ( !Frame.GetInterface ( &Source ) ) {
+      Backbuffer->Release ();
+
+      return false;
+   }
+
+   Val = Backbuffer->Blt ( NULL, Source, NULL, DDBLT_WAIT,
+      NULL );
+
+   Source->Release ();
+   Backbuffer->Release ();
+
+   // A lost surface is restored by the next EndFrame; the
+   // frame is dropped rather than reported:
+   if ( Val == DDERR_SURFACELOST ) {
+      EnterCriticalSection ( &Lock );
+      LossFound = true;
+      LeaveCriticalSection ( &Lock );
+
+      return false;
+   }
+
+   if ( FAILED ( Val ) )
+      return PrintDirectDrawError ( Val );
+
+   // The whole backbuffer was replaced, which a partial
+   // present must copy:
+   Primary->MarkDirty ();
+
+   if ( Primary->Show ( false ) )
+      return true;
+
+   // The flip may have failed for a lost surface:
+   EnterCriticalSection ( &Lock );
+   LossFound = true;
+   LeaveCriticalSection ( &Lock );
+
+   return false;
+}
+
+void PresentQueue::GetStatistics (
+        PresentQueueStats &Statistics ) {
+
+   EnterCriticalSection ( &Lock );
+   Statistics = Stats;
+   LeaveCriticalSection ( &Lock );
+}
+
+bool PresentQueue::GetFrameStats ( LONG Age,
+        PresentFrameStats &Frame ) {
+
+   bool Found = false;
+
+   EnterCriticalSection ( &Lock );
+
+   if ( Age >= 0 && Age < HistorySize &&
+        ( DWORD ) Age < Stats.Presented ) {
+
+      Frame = History [ ( Stats.Presented - 1 - Age ) %
+         HistorySize ];
+
+      Found = true;
+   }
+
+   LeaveCriticalSection ( &Lock );
+
+   return Found;
+}
@@ -0,0 +1,109 @@
+//
+// File name: PresentQueue.hpp
+//
+// Description: Presents finished frames on a separate
+//              thread, paced to a target frame time.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __PRESENTQUEUEHPP__
+#define __PRESENTQUEUEHPP__
+
+#include "DirectDraw.hpp"
+
+// How one frame went through the queue (times are in
+// milliseconds):
+struct PresentFrameStats {
+   DWORD  Frame;
+   LONG   QueueDepth;
+   bool   MissedDeadline;
+
+   double SubmitToPresent;
+};
+
+struct PresentQueueStats {
+   DWORD  Submitted, Presented, MissedDeadlines, Failures;
+   LONG   MaxQueueDepth;
+
+   double AverageLatency, WorstLatency;
+};
+
+class PresentQueue {
+   public:
+      enum { MaxFrames = 8, HistorySize = 64 };
+
+   protected:
+      DirectDrawSurface *Primary, *Frames;
+      DirectDrawManager *Manager;
+
+      PresentFrameStats  History [ HistorySize ];
+      PresentQueueStats  Stats;
+
+      LARGE_INTEGER      SubmitTimes [ MaxFrames ];
+      LONG               QueueDepths [ MaxFrames ];
+
+      LONG   FrameCount, WriteIndex, ReadIndex, Queued;
+      bool   Writing, Stopping, ResetPacing, LossFound;
+
+      double TargetFrameTime, TicksPerMillisecond,
+             TotalLatency;
+
+      LARGE_INTEGER      Deadline;
+
+      HANDLE             Thread, FreeFrames, QueuedFrames,
+                         Drained;
+      CRITICAL_SECTION   Lock;
+
+      static DWORD WINAPI PresentThread ( LPVOID Queue );
+
+      void PresentFrames ();
+      void WaitForDeadline ( LARGE_INTEGER &Now,
+         double Target );
+      bool PresentFrame ( DirectDrawSurface &Frame );
+
+   public:
+      PresentQueue ();
+      ~PresentQueue ();
+
+      // Creates Count offscreen frames matching the primary
+      // surface and starts the present thread. While the
+      // queue runs, only the present thread uses Primary.
+      // Lost surfaces are restored, and counter frames
+      // ended, by EndFrame on the drawing thread, so each
+      // counter frame is a submitted frame; Primary's and
+      // the frames' own counts are taken on the present
+      // thread and may fall in the next:
+      bool Create ( DirectDrawManager &Manager,
+         DirectDrawSurface &Primary, LONG BPP,
+         LONG Count = 2 );
+      void Destroy ();
+
+      // A TargetFrameTime of zero presents frames as soon
+      // as they are submitted:
+      void SetTargetFrameTime ( double Milliseconds );
+
+      // BeginFrame waits only when every frame is queued;
+      // EndFrame hands the frame to the present thread:
+      DirectDrawSurface *BeginFrame ();
+      bool EndFrame ();
+
+      // Waits until every submitted frame was presented:
+      bool Flush ();
+
+      LONG GetQueueDepth ();
+
+      void GetStatistics ( PresentQueueStats &Statistics );
+
+      // Age zero is the frame presented last:
+      bool GetFrameStats ( LONG Age,
+         PresentFrameStats &Frame );
+};
+
+#endif
@@ -0,0 +1,381 @@
+//
+// File name: RLESprite.cpp
+//
+// Description: Colour keyed surface contents compiled to
+//              runs of transparent and opaque pixels.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include <Math.H>
+
+#include "RLESprite.hpp"
+
+static inline DWORD ReadRawPixel ( LPBYTE Pixel,
+        LONG BytesPerPixel ) {
+
+   switch ( BytesPerPixel ) {
+      case 1:
+         return Pixel [ 0 ];
+      case 2:
+         return *( WORD * ) Pixel;
+      case 3:
+         return Pixel [ 0 ] | ( Pixel [ 1 ] << 8 ) |
+            ( Pixel [ 2 ] << 16 );
+   }
+
+   return *( DWORD * ) Pixel;
+}
+
+static inline bool IsOpaque ( LPBYTE Pixel, LONG BytesPerPixel,
+        DWORD KeyLow, DWORD KeyHigh ) {
+
+   DWORD Raw = ReadRawPixel ( Pixel, BytesPerPixel );
+
+   return Raw < KeyLow || Raw > KeyHigh;
+}
+
+RLESprite::RLESprite () {
+   Data = NULL;
+   Rows = NULL;
+
+   Width = Height = BytesPerPixel = 0;
+
+   ZeroMemory ( &Stats, sizeof ( SpriteStats ) );
+}
+
+RLESprite::~RLESprite () {
+   Destroy ();
+}
+
+void RLESprite::Destroy () {
+   delete [] Data;
+   delete [] Rows;
+
+   Data = NULL;
+   Rows = NULL;
+
+   Width = Height = BytesPerPixel = 0;
+
+   ZeroMemory ( &Stats, sizeof ( SpriteStats ) );
+}
+
+bool RLESprite::Compile ( LPVOID Src, LONG Pitch,
+        LONG BytesPerPixel, LONG Width, LONG Height,
+        DWORD KeyLow, DWORD KeyHigh ) {
+
+   LPBYTE Row, Out;
+   DWORD Size;
+   LONG Pass, X, Y, Skip, Count;
+   Run Header;
+
+   if ( Src == NULL || BytesPerPixel < 1 || BytesPerPixel > 4 ||
+        Width <= 0 || Height <= 0 )
+      return false;
+
+   Destroy ();
+
+   Rows = new DWORD [ Height + 1 ];
+
+   if ( Rows == NULL )
+      return false;
+
+   // The first pass sizes the runs, the second writes
+   // them:
+   for ( Pass = 0; Pass < 2; Pass++ ) {
+      Size = 0;
+
+      for ( Y = 0; Y < Height; Y++ ) {
+         Row = ( LPBYTE ) Src + Y * Pitch;
+
+         Rows [ Y ] = Size;
+
+         for ( X = 0; X < Width; ) {
+            // Runs longer than a WORD are split, a long
+            // skip into runs that copy nothing:
+            Skip = Count = 0;
+
+            while ( X < Width && Skip < 0xFFFF &&
+                    !IsOpaque ( Row + X * BytesPerPixel,
+                       BytesPerPixel, KeyLow, KeyHigh ) ) {
+               X++; Skip++;
+            }
+
+            while ( X < Width && Count < 0xFFFF &&
+                    IsOpaque ( Row + X * BytesPerPixel,
+                       BytesPerPixel, KeyLow, KeyHigh ) ) {
+               X++; Count++;
+            }
+
+            // Nothing needs to skip to the end of the row:
+            if ( Count == 0 && X >= Width )
+               break;
+
+            if ( Pass == 1 ) {
+               Out = Data + Size;
+
+               Header.Skip  = ( WORD ) Skip;
+               Header.Count = ( WORD ) Count;
+
+               memcpy ( Out, &Header, sizeof ( Run ) );
+               memcpy ( Out + sizeof ( Run ),
+                  Row + ( X - Count ) * BytesPerPixel,
+                  Count * BytesPerPixel );
+
+               Stats.Runs++;
+               Stats.OpaquePixels += Count;
+            }
+
+            Size += sizeof ( Run ) + Count * BytesPerPixel;
+         }
+      }
+
+      Rows [ Height ] = Size;
+
+      if ( Pass == 0 ) {
+         // A sprite with nothing opaque still gets a block,
+         // so it counts as compiled:
+         Data = new BYTE [ Size > 0 ? Size : 1 ];
+
+         if ( Data == NULL ) {
+            Destroy ();
+            return false;
+         }
+      }
+   }
+
+   this->Width         = Width;
+   this->Height        = Height;
+   this->BytesPerPixel = BytesPerPixel;
+
+   Stats.DataBytes = Size;
+
+   return true;
+}
+
+bool RLESprite::Compile ( DirectDrawSurface &Surface,
+        RECT *Portion ) {
+
+   LPVOID Memory;
+   RECT Rect;
+   bool Result;
+
+   if ( !Surface.Created || Surface.PropCompression != BlockNone )
+      return false;
+
+   Rect.left = 0; Rect.right  = Surface.SurfWidth;
+   Rect.top  = 0; Rect.bottom = Surface.SurfHeight;
+
+   if ( Portion != NULL ) {
+      if ( Portion->left < 0 || Portion->top < 0 ||
+           Portion->right  > Surface.SurfWidth ||
+           Portion->bottom > Surface.SurfHeight ||
+           Portion->left >= Portion->right ||
+           Portion->top  >= Portion->bottom )
+         return false;
+
+      Rect = *Portion;
+   }
+
+   if ( !Surface.LockBuffer ( -1, &Memory, &Rect, true ) )
+      return false;
+
+   // Without a key nothing is transparent:
+   Result = Compile ( Memory, Surface.SurfPitch,
+      Surface.SurfBytesPerPixel, Rect.right - Rect.left,
+      Rect.bottom - Rect.top,
+      Surface.UseSourceColorKey ? Surface.KeyLow  : 1,
+      Surface.UseSourceColorKey ? Surface.KeyHigh : 0 );
+
+   Surface.UnlockBuffer ( -1, &Rect );
+
+   return Result;
+}
+
+bool RLESprite::Draw ( LPVOID Dest, LONG DestPitch,
+        LONG DestWidth, LONG DestHeight, LONG X, LONG Y,
+        RECT *Clip ) {
+
+   LPBYTE Runs, End, Pixels, Line;
+   LONG Left = 0, Top = 0, Right = DestWidth,
+      Bottom = DestHeight, First, Last, Row, PixelX, Start,
+      Stop;
+   Run Header;
+
+   if ( Data == NULL || Dest == NULL )
+      return false;
+
+   if ( Clip != NULL ) {
+      if ( Clip->left   > Left   ) Left   = Clip->left;
+      if ( Clip->top    > Top    ) Top    = Clip->top;
+      if ( Clip->right  < Right  ) Right  = Clip->right;
+      if ( Clip->bottom < Bottom ) Bottom = Clip->bottom;
+   }
+
+   First = Top    - Y > 0      ? Top    - Y : 0;
+   Last  = Bottom - Y < Height ? Bottom - Y : Height;
+
+   for ( Row = First; Row < Last; Row++ ) {
+      Runs = Data + Rows [ Row ];
+      End  = Data + Rows [ Row + 1 ];
+      Line = ( LPBYTE ) Dest + ( Y + Row ) * DestPitch;
+
+      PixelX = X;
+
+      // Runs to the left of the clip are stepped over,
+      // those to the right end the row:
+      while ( Runs < End ) {
+         memcpy ( &Header, Runs, sizeof ( Run ) );
+
+         Pixels  = Runs + sizeof ( Run );
+         PixelX += Header.Skip;
+
+         if ( PixelX >= Right )
+            break;
+
+         Start = PixelX > Left ? PixelX : Left;
+         Stop  = PixelX + Header.Count < Right ?
+            PixelX + Header.Count : Right;
+
+         if ( Start < Stop )
+            memcpy ( Line + Start * BytesPerPixel,
+               Pixels + ( Start - PixelX ) * BytesPerPixel,
+               ( Stop - Start ) * BytesPerPixel );
+
+         PixelX += Header.Count;
+         Runs    = Pixels + Header.Count * BytesPerPixel;
+      }
+   }
+
+   return true;
+}
+
+bool RLESprite::BlitTo ( DirectDrawSurface &Dest, LONG X,
+        LONG Y, RECT *Clip ) {
+
+   LPVOID Memory;
+   LONG DestBuffer;
+   RECT Rect;
+
+   if ( Data == NULL || !Dest.Created ||
+        Dest.PropCompression != BlockNone ||
+        Dest.SurfBytesPerPixel != BytesPerPixel )
+      return false;
+
+   // Only the part of the surface the sprite can reach is
+   // locked:
+   Rect.left  = X > 0 ? X : 0;
+   Rect.top   = Y > 0 ? Y : 0;
+   Rect.right = X + Width < Dest.SurfWidth ?
+      X + Width : Dest.SurfWidth;
+   Rect.bottom = Y + Height < Dest.SurfHeight ?
+      Y + Height : Dest.SurfHeight;
+
+   if ( Clip != NULL ) {
+      if ( Clip->left   > Rect.left   ) Rect.left   = Clip->left;
+      if ( Clip->top    > Rect.top    ) Rect.top    = Clip->top;
+      if ( Clip->right  < Rect.right  ) Rect.right  = Clip->right;
+      if ( Clip->bottom < Rect.bottom ) Rect.bottom = Clip->bottom;
+   }
+
+   if ( Rect.left >= Rect.right || Rect.top >= Rect.bottom )
+      return true;
+
+   // As with keyed blits, a pending clear shows through:
+   if ( !Dest.ResolveClear ( &Rect ) )
+      return false;
+
+   Dest.HiZ.Invalidate ( Rect );
+
+   // Write where blits would:
+   DestBuffer = Dest.PropSurfaceType == DirectDrawSurface::Primary &&
+      Dest.PartialPresent ? 0 : -1;
+
+   if ( !Dest.LockBuffer ( DestBuffer, &Memory, &Rect ) )
+      return false;
+
+   Draw ( Memory, Dest.SurfPitch, Rect.right - Rect.left,
+      Rect.bottom - Rect.top, X - Rect.left, Y - Rect.top );
+
+   return Dest.UnlockBuffer ( DestBuffer, &Rect );
+}
+
+double MeasureSpriteThroughput ( LONG BPP, LONG Size,
+        LONG Coverage, LONG Repeats, bool Compiled ) {
+
+   DirectDrawManager Manager ( DirectDrawManager::SystemMemory );
+   DirectDrawSurface Sprite, Dest;
+   RLESprite Runs;
+   LPBYTE Memory;
+   LONG BytesPerPixel, Repeat, X, Y, Centre;
+   LARGE_INTEGER Start, Stop, Frequency;
+   double Radius, Seconds;
+   DWORD Value;
+
+   if ( Size <= 0 || Repeats <= 0 || Coverage < 0 ||
+        Coverage > 100 )
+      return 0.0;
+
+   Sprite.SetSurfaceType ( DirectDrawSurface::Plain );
+   Sprite.SetGeneralOptions ( Size, Size, BPP );
+
+   Dest.SetSurfaceType ( DirectDrawSurface::Plain );
+   Dest.SetGeneralOptions ( Size * 2, Size * 2, BPP );
+
+   if ( !Manager.CreateSurface ( Sprite ) ||
+        !Manager.CreateSurface ( Dest ) )
+      return 0.0;
+
+   BytesPerPixel = Sprite.GetBytesPerPixel ();
+
+   // A disc covering Coverage percent of the sprite, in
+   // pixels that are never the key (0):
+   Radius = Size * sqrt ( Coverage / 100.0 / 3.14159265 );
+   Centre = Size / 2;
+
+   if ( !Sprite.StartAccess ( ( LPVOID * ) &Memory ) )
+      return 0.0;
+
+   for ( Y = 0; Y < Size; Y++ ) {
+      for ( X = 0; X < Size; X++ ) {
+         Value = ( X - Centre ) * ( X - Centre ) +
+            ( Y - Centre ) * ( Y - Centre ) <= Radius * Radius ?
+            ( DWORD ) ( X * 31 + Y * 17 ) | 1 : 0;
+
+         memcpy ( Memory + Y * Sprite.GetPitch () + X * BytesPerPixel,
+            &Value, BytesPerPixel );
+      }
+   }
+
+   Sprite.EndAccess ();
+
+   if ( !Sprite.SetTransparentColorRange ( 0, 0 ) ||
+        ( Compiled && !Runs.Compile ( Sprite ) ) )
+      return 0.0;
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ ) {
+      if ( Compiled )
+         Runs.BlitTo ( Dest, Size / 2, Size / 2 );
+      else
+         Sprite.BlitTo ( Dest, Size / 2, Size / 2 );
+   }
+
+   QueryPerformanceCounter ( &Stop );
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return ( double ) Size * Size * Repeats / Seconds / 1e6;
+}
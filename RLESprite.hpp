@@ -0,0 +1,90 @@
+//
+// File name: RLESprite.hpp
+//
+// Description: Colour keyed surface contents compiled to
+//              runs of transparent and opaque pixels.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __RLESPRITEHPP__
+#define __RLESPRITEHPP__
+
+#include "DirectDraw.hpp"
+
+struct SpriteStats {
+   DWORD Runs, OpaquePixels, DataBytes;
+};
+
+// Each row is stored as runs of pixels to skip followed by
+// pixels to copy, so drawing only touches the opaque
+// pixels and never tests a key. Sprites copy raw pixels,
+// so they can only be drawn to surfaces with as many bytes
+// per pixel as the one they were compiled from:
+class RLESprite {
+   protected:
+      // Every run is a Run header and Count raw pixels:
+      struct Run {
+         WORD Skip, Count;
+      };
+
+      LPBYTE Data;
+
+      // The start of each row's runs in Data; row Height
+      // is the end of the data:
+      DWORD *Rows;
+
+      LONG Width, Height, BytesPerPixel;
+
+      SpriteStats Stats;
+
+   public:
+      RLESprite ();
+      ~RLESprite ();
+
+      // Raw pixels from KeyLow to KeyHigh are transparent;
+      // with KeyLow above KeyHigh nothing is:
+      bool Compile ( LPVOID Src, LONG Pitch, LONG BytesPerPixel,
+         LONG Width, LONG Height, DWORD KeyLow, DWORD KeyHigh );
+
+      // Compile Portion (the whole surface by default) with
+      // the surface's colour key range:
+      bool Compile ( DirectDrawSurface &Surface,
+         RECT *Portion = NULL );
+
+      void Destroy ();
+
+      bool IsCompiled () { return Data != NULL; }
+
+      LONG GetWidth  () { return Width;  }
+      LONG GetHeight () { return Height; }
+      LONG GetBytesPerPixel () { return BytesPerPixel; }
+
+      void GetStats ( SpriteStats &Statistics ) { Statistics = Stats; }
+
+      // Draw with the top left corner at ( X, Y ) of a
+      // DestWidth x DestHeight image, clipped to its edges
+      // and to Clip when there is one:
+      bool Draw ( LPVOID Dest, LONG DestPitch, LONG DestWidth,
+         LONG DestHeight, LONG X, LONG Y, RECT *Clip = NULL );
+
+      // Draw to a surface as a keyed blit would:
+      bool BlitTo ( DirectDrawSurface &Dest, LONG X, LONG Y,
+         RECT *Clip = NULL );
+};
+
+// Draw a Size x Size sprite whose opaque pixels cover
+// about Coverage percent of it, to system memory surfaces
+// of BPP bits, Repeats times, as a compiled sprite or as a
+// colour keyed blit, and return the throughput in
+// megapixels (opaque or not) per second:
+double MeasureSpriteThroughput ( LONG BPP, LONG Size,
+   LONG Coverage, LONG Repeats, bool Compiled );
+
+#endif
@@ -0,0 +1,827 @@
+//
+// File name: Scale.cpp
+//
+// Description: Filtered scaling of images between
+//              surfaces, for stretched blits.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "Scale.hpp"
+
+#ifdef PIXELCONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+// Each task scales a band of rows covering about this
+// many bytes of 8888 pixels:
+const LONG BandBytes = 32768;
+
+// A box is at most this many source pixels across and
+// down, which keeps its sums in 32 bits:
+const LONG MaxBoxSpan = 4096;
+
+// The two texels a bilinear lookup blends along one axis,
+// and the weight (0 to 255) of the second:
+struct Sample {
+   LONG First, Second, Fraction;
+};
+
+// The source pixels First to End - 1 a box covers along
+// one axis:
+struct Span {
+   LONG First, End;
+};
+
+// Filtered rows are worked on in 8888, in a scratch
+// buffer per thread: two source rows (the bilinear filter
+// keeps the last two it read), the rows blended down, the
+// box sums and the scaled row in 8888 and in the
+// destination format. Positions are 16.16 source pixels:
+struct ScaleJob {
+   LPBYTE Dest, Src, Scratch;
+   LONG   DestPitch, SrcPitch, DestWidth, DestHeight, SrcWidth,
+          SrcHeight, SrcSize, DestSize, ScratchPitch,
+          SlotOffset, SecondSlotOffset, FilteredOffset,
+          AccumOffset, RecipOffset, OutOffset, PackedOffset,
+          CoverageOffset, RowsPerTask, OriginV, StepV;
+
+   LONG   *Columns;
+   Sample *Samples;
+   Span   *Spans;
+
+   DWORD  KeyLow, KeyHigh;
+
+   PALETTEENTRY *Palette;
+
+   PixelFormat DestFormat, SrcFormat;
+   ScaleFilter Filter;
+   bool        Keyed, Direct, UseSIMD;
+};
+
+static inline void FindSample ( LONG U, LONG Size,
+        Sample &Result ) {
+
+   // Lookups outside the image clamp to its edge:
+   if ( U <= 0 ) {
+      Result.First = Result.Second = Result.Fraction = 0;
+      return;
+   }
+
+   Result.First = U >> 16;
+
+   if ( Result.First >= Size - 1 ) {
+      Result.First = Result.Second = Size - 1;
+      Result.Fraction = 0;
+      return;
+   }
+
+   Result.Second   = Result.First + 1;
+   Result.Fraction = ( U >> 8 ) & 0xFF;
+}
+
+static inline void FindSpan ( LONG Index, LONG Size,
+        LONG Scaled, Span &Result ) {
+
+   Result.First = Index * Size / Scaled;
+   Result.End   = ( Index + 1 ) * Size / Scaled;
+
+   if ( Result.End <= Result.First )
+      Result.End = Result.First + 1;
+
+   if ( Result.End - Result.First > MaxBoxSpan )
+      Result.End = Result.First + MaxBoxSpan;
+}
+
+static inline DWORD ReadRawPixel ( LPBYTE Pixel,
+        LONG BytesPerPixel ) {
+
+   switch ( BytesPerPixel ) {
+      case 1:
+         return Pixel [ 0 ];
+      case 2:
+         return *( WORD * ) Pixel;
+      case 3:
+         return Pixel [ 0 ] | ( Pixel [ 1 ] << 8 ) |
+            ( Pixel [ 2 ] << 16 );
+   }
+
+   return *( DWORD * ) Pixel;
+}
+
+static inline bool IsKeyed ( ScaleJob &Job, LPBYTE Pixel ) {
+   DWORD Raw = ReadRawPixel ( Pixel, Job.SrcSize );
+
+   return Raw >= Job.KeyLow && Raw <= Job.KeyHigh;
+}
+
+//
+// Filters blend as ( A * ( 256 - F ) + B * F ) >> 8 and
+// boxes divide by multiplying with a 8.24 reciprocal, so
+// the scalar and SIMD kernels give the same pixels.
+//
+
+static inline DWORD LerpPixel ( DWORD A, DWORD B,
+        LONG Fraction ) {
+
+   DWORD Result = 0;
+   LONG Shift;
+
+   for ( Shift = 0; Shift < 32; Shift += 8 )
+      Result |= ( ( ( ( A >> Shift ) & 0xFF ) * ( 256 - Fraction ) +
+         ( ( B >> Shift ) & 0xFF ) * Fraction ) >> 8 ) << Shift;
+
+   return Result;
+}
+
+static void FilterRowScalar ( DWORD *Dest, DWORD *Row0,
+        DWORD *Row1, LONG Fraction, LONG First, LONG Count ) {
+
+   LONG X;
+
+   for ( X = First; X < Count; X++ )
+      Dest [ X ] = LerpPixel ( Row0 [ X ], Row1 [ X ], Fraction );
+}
+
+static void ExpandRowScalar ( ScaleJob &Job, DWORD *Dest,
+        DWORD *Filtered, LONG First ) {
+
+   Sample *Column;
+   LONG X;
+
+   for ( X = First; X < Job.DestWidth; X++ ) {
+      Column = &Job.Samples [ X ];
+
+      Dest [ X ] = LerpPixel ( Filtered [ Column->First ],
+         Filtered [ Column->Second ], Column->Fraction );
+   }
+}
+
+static void AccumulateRowScalar ( DWORD *Accum, DWORD *Row,
+        LONG First, LONG Count ) {
+
+   LONG X, Channel;
+
+   for ( X = First; X < Count; X++ )
+      for ( Channel = 0; Channel < 4; Channel++ )
+         Accum [ X * 4 + Channel ] +=
+            ( Row [ X ] >> ( Channel * 8 ) ) & 0xFF;
+}
+
+static void ReduceRowScalar ( ScaleJob &Job, DWORD *Dest,
+        DWORD *Accum, DWORD *Recip, LONG First ) {
+
+   DWORD Sum [ 4 ], Result, Value;
+   LONG X, I, Channel;
+   Span *Column;
+
+   for ( X = First; X < Job.DestWidth; X++ ) {
+      Column = &Job.Spans [ X ];
+
+      Sum [ 0 ] = Sum [ 1 ] = Sum [ 2 ] = Sum [ 3 ] = 0;
+
+      for ( I = Column->First; I < Column->End; I++ )
+         for ( Channel = 0; Channel < 4; Channel++ )
+            Sum [ Channel ] += Accum [ I * 4 + Channel ];
+
+      Result = 0;
+
+      for ( Channel = 0; Channel < 4; Channel++ ) {
+         Value = ( DWORD ) ( ( ( ULONGLONG ) Sum [ Channel ] *
+            Recip [ X ] + ( 1 << 23 ) ) >> 24 );
+
+         Result |= ( Value > 255 ? 255 : Value ) << ( Channel * 8 );
+      }
+
+      Dest [ X ] = Result;
+   }
+}
+
+#ifdef PIXELCONVERT_SSE2
+
+// Blend four pixels of A towards B, by a weight from 0 to
+// 255 in each 32-bit lane of Fraction:
+static inline __m128i LerpPixelsSSE2 ( __m128i A, __m128i B,
+        __m128i Fraction ) {
+
+   const __m128i Zero = _mm_setzero_si128 ();
+   const __m128i Full = _mm_set1_epi16 ( 256 );
+
+   __m128i Weights, WeightsLo, WeightsHi, Lo, Hi;
+
+   // Spread each weight over the four channels of its
+   // pixel:
+   Weights   = _mm_or_si128 ( Fraction, _mm_slli_epi32 ( Fraction, 16 ) );
+   WeightsLo = _mm_unpacklo_epi32 ( Weights, Weights );
+   WeightsHi = _mm_unpackhi_epi32 ( Weights, Weights );
+
+   Lo = _mm_add_epi16 (
+      _mm_mullo_epi16 ( _mm_unpacklo_epi8 ( A, Zero ),
+         _mm_sub_epi16 ( Full, WeightsLo ) ),
+      _mm_mullo_epi16 ( _mm_unpacklo_epi8 ( B, Zero ), WeightsLo ) );
+   Hi = _mm_add_epi16 (
+      _mm_mullo_epi16 ( _mm_unpackhi_epi8 ( A, Zero ),
+         _mm_sub_epi16 ( Full, WeightsHi ) ),
+      _mm_mullo_epi16 ( _mm_unpackhi_epi8 ( B, Zero ), WeightsHi ) );
+
+   return _mm_packus_epi16 ( _mm_srli_epi16 ( Lo, 8 ),
+      _mm_srli_epi16 ( Hi, 8 ) );
+}
+
+static LONG FilterRowSSE2 ( DWORD *Dest, DWORD *Row0,
+        DWORD *Row1, LONG Fraction, LONG Count ) {
+
+   __m128i Weight = _mm_set1_epi32 ( Fraction );
+   LONG X;
+
+   for ( X = 0; X + 4 <= Count; X += 4 )
+      _mm_storeu_si128 ( ( __m128i * ) &Dest [ X ],
+         LerpPixelsSSE2 (
+            _mm_loadu_si128 ( ( __m128i * ) &Row0 [ X ] ),
+            _mm_loadu_si128 ( ( __m128i * ) &Row1 [ X ] ),
+            Weight ) );
+
+   return X;
+}
+
+static LONG ExpandRowSSE2 ( ScaleJob &Job, DWORD *Dest,
+        DWORD *Filtered ) {
+
+   Sample *Column;
+   LONG X;
+
+   for ( X = 0; X + 4 <= Job.DestWidth; X += 4 ) {
+      Column = &Job.Samples [ X ];
+
+      _mm_storeu_si128 ( ( __m128i * ) &Dest [ X ],
+         LerpPixelsSSE2 (
+            _mm_set_epi32 ( Filtered [ Column [ 3 ].First ],
+               Filtered [ Column [ 2 ].First ],
+               Filtered [ Column [ 1 ].First ],
+               Filtered [ Column [ 0 ].First ] ),
+            _mm_set_epi32 ( Filtered [ Column [ 3 ].Second ],
+               Filtered [ Column [ 2 ].Second ],
+               Filtered [ Column [ 1 ].Second ],
+               Filtered [ Column [ 0 ].Second ] ),
+            _mm_set_epi32 ( Column [ 3 ].Fraction,
+               Column [ 2 ].Fraction, Column [ 1 ].Fraction,
+               Column [ 0 ].Fraction ) ) );
+   }
+
+   return X;
+}
+
+static LONG AccumulateRowSSE2 ( DWORD *Accum, DWORD *Row,
+        LONG Count ) {
+
+   const __m128i Zero = _mm_setzero_si128 ();
+
+   __m128i Pixels, Lo, Hi;
+   __m128i *Sums;
+   LONG X;
+
+   // Four pixels widen to sixteen 32-bit sums:
+   for ( X = 0; X + 4 <= Count; X += 4 ) {
+      Pixels = _mm_loadu_si128 ( ( __m128i * ) &Row [ X ] );
+      Sums   = ( __m128i * ) &Accum [ X * 4 ];
+
+      Lo = _mm_unpacklo_epi8 ( Pixels, Zero );
+      Hi = _mm_unpackhi_epi8 ( Pixels, Zero );
+
+      _mm_storeu_si128 ( &Sums [ 0 ], _mm_add_epi32 (
+         _mm_loadu_si128 ( &Sums [ 0 ] ), _mm_unpacklo_epi16 ( Lo, Zero ) ) );
+      _mm_storeu_si128 ( &Sums [ 1 ], _mm_add_epi32 (
+         _mm_loadu_si128 ( &Sums [ 1 ] ), _mm_unpackhi_epi16 ( Lo, Zero ) ) );
+      _mm_storeu_si128 ( &Sums [ 2 ], _mm_add_epi32 (
+         _mm_loadu_si128 ( &Sums [ 2 ] ), _mm_unpacklo_epi16 ( Hi, Zero ) ) );
+      _mm_storeu_si128 ( &Sums [ 3 ], _mm_add_epi32 (
+         _mm_loadu_si128 ( &Sums [ 3 ] ), _mm_unpackhi_epi16 ( Hi, Zero ) ) );
+   }
+
+   return X;
+}
+
+static LONG ReduceRowSSE2 ( ScaleJob &Job, DWORD *Dest,
+        DWORD *Accum, DWORD *Recip ) {
+
+   const __m128i Round = _mm_set_epi32 ( 0, 1 << 23, 0, 1 << 23 );
+
+   __m128i Sum, Factor, Even, Odd;
+   Span *Column;
+   LONG X, I;
+
+   // One pixel at a time, its four channel sums side by
+   // side; the 64-bit products take the even and odd
+   // channels in turn:
+   for ( X = 0; X < Job.DestWidth; X++ ) {
+      Column = &Job.Spans [ X ];
+
+      Sum = _mm_setzero_si128 ();
+
+      for ( I = Column->First; I < Column->End; I++ )
+         Sum = _mm_add_epi32 ( Sum,
+            _mm_loadu_si128 ( ( __m128i * ) &Accum [ I * 4 ] ) );
+
+      Factor = _mm_set1_epi32 ( Recip [ X ] );
+
+      Even = _mm_srli_epi64 ( _mm_add_epi64 (
+         _mm_mul_epu32 ( Sum, Factor ), Round ), 24 );
+      Odd  = _mm_srli_epi64 ( _mm_add_epi64 (
+         _mm_mul_epu32 ( _mm_srli_epi64 ( Sum, 32 ), Factor ),
+         Round ), 24 );
+
+      Sum = _mm_or_si128 ( Even, _mm_slli_epi64 ( Odd, 32 ) );
+      Sum = _mm_packs_epi32 ( Sum, Sum );
+
+      Dest [ X ] = _mm_cvtsi128_si32 ( _mm_packus_epi16 ( Sum, Sum ) );
+   }
+
+   return X;
+}
+
+#endif
+
+// Source row Y as 8888. With a key, keyed pixels become
+// transparent black and the rest opaque:
+static DWORD *LoadRow ( ScaleJob &Job, LONG Y, DWORD *Buffer ) {
+   LPBYTE Row = Job.Src + Y * Job.SrcPitch;
+   LONG X;
+   RECT Rect;
+
+   if ( Job.Direct )
+      return ( DWORD * ) Row;
+
+   Rect.left = 0; Rect.right  = Job.SrcWidth;
+   Rect.top  = 0; Rect.bottom = 1;
+
+   ConvertPixels ( Buffer, 0, Format8888, 0, 0, Row, 0,
+      Job.SrcFormat, Rect, 0, Job.Palette );
+
+   if ( Job.Keyed ) {
+      for ( X = 0; X < Job.SrcWidth; X++ ) {
+         if ( IsKeyed ( Job, Row + X * Job.SrcSize ) )
+            Buffer [ X ] = 0;
+         else
+            Buffer [ X ] |= 0xFF000000;
+      }
+   }
+
+   return Buffer;
+}
+
+// Keyed rows carry their coverage in alpha. Pixels at
+// least half covered are kept, their colour divided by the
+// coverage so keyed pixels do not darken the edges:
+static void ResolveCoverage ( DWORD *Row, LPBYTE Coverage,
+        LONG Count ) {
+
+   DWORD Alpha, Channel, Result;
+   LONG X, Shift;
+
+   for ( X = 0; X < Count; X++ ) {
+      Alpha = Row [ X ] >> 24;
+
+      Coverage [ X ] = ( BYTE ) ( Alpha >= 128 );
+
+      if ( Alpha < 128 || Alpha == 255 )
+         continue;
+
+      Result = 0xFF000000;
+
+      for ( Shift = 0; Shift < 24; Shift += 8 ) {
+         Channel = ( ( ( Row [ X ] >> Shift ) & 0xFF ) * 255 +
+            Alpha / 2 ) / Alpha;
+
+         Result |= ( Channel > 255 ? 255 : Channel ) << Shift;
+      }
+
+      Row [ X ] = Result;
+   }
+}
+
+// Write a scaled 8888 row, or with a key only its covered
+// pixels:
+static void StoreRow ( ScaleJob &Job, LPBYTE Scratch,
+        DWORD *Out, LONG Y ) {
+
+   LPBYTE Dest = Job.Dest + Y * Job.DestPitch,
+      Packed   = Scratch + Job.PackedOffset,
+      Coverage = Scratch + Job.CoverageOffset;
+   LONG X;
+   RECT Rect;
+
+   Rect.left = 0; Rect.right  = Job.DestWidth;
+   Rect.top  = 0; Rect.bottom = 1;
+
+   if ( !Job.Keyed ) {
+      ConvertPixels ( Dest, 0, Job.DestFormat, 0, 0, Out, 0,
+         Format8888, Rect );
+
+      return;
+   }
+
+   ResolveCoverage ( Out, Coverage, Job.DestWidth );
+
+   ConvertPixels ( Packed, 0, Job.DestFormat, 0, 0, Out, 0,
+      Format8888, Rect );
+
+   for ( X = 0; X < Job.DestWidth; X++ )
+      if ( Coverage [ X ] )
+         memcpy ( Dest + X * Job.DestSize,
+            Packed + X * Job.DestSize, Job.DestSize );
+}
+
+static void NearestRow ( ScaleJob &Job, LPBYTE Scratch,
+        LONG Y ) {
+
+   LPBYTE Src, Dest, Sampled, Packed;
+   LONG SrcY, X;
+   RECT Rect;
+
+   SrcY = ( LONG ) ( ( ( LONGLONG ) Y * 2 + 1 ) * Job.SrcHeight /
+      ( Job.DestHeight * 2 ) );
+
+   Src     = Job.Src  + SrcY * Job.SrcPitch;
+   Dest    = Job.Dest + Y * Job.DestPitch;
+   Sampled = Scratch  + Job.OutOffset;
+   Packed  = Scratch  + Job.PackedOffset;
+
+   // Gather the row in the source format first:
+   switch ( Job.SrcSize ) {
+      case 1:
+         for ( X = 0; X < Job.DestWidth; X++ )
+            Sampled [ X ] = Src [ Job.Columns [ X ] ];
+      break;
+      case 2:
+         for ( X = 0; X < Job.DestWidth; X++ )
+            ( ( WORD * ) Sampled ) [ X ] =
+               ( ( WORD * ) Src ) [ Job.Columns [ X ] ];
+      break;
+      case 3:
+         for ( X = 0; X < Job.DestWidth; X++ )
+            memcpy ( Sampled + X * 3, Src + Job.Columns [ X ] * 3, 3 );
+      break;
+      default:
+         for ( X = 0; X < Job.DestWidth; X++ )
+            ( ( DWORD * ) Sampled ) [ X ] =
+               ( ( DWORD * ) Src ) [ Job.Columns [ X ] ];
+      break;
+   }
+
+   // Unkeyed rows are converted straight to the
+   // destination:
+   if ( !Job.Keyed )
+      Packed = Dest;
+
+   if ( Job.SrcFormat == Job.DestFormat )
+      memcpy ( Packed, Sampled, Job.DestWidth * Job.DestSize );
+   else {
+      Rect.left = 0; Rect.right  = Job.DestWidth;
+      Rect.top  = 0; Rect.bottom = 1;
+
+      ConvertPixels ( Packed, 0, Job.DestFormat, 0, 0, Sampled, 0,
+         Job.SrcFormat, Rect, 0, Job.Palette );
+   }
+
+   if ( !Job.Keyed )
+      return;
+
+   for ( X = 0; X < Job.DestWidth; X++ )
+      if ( !IsKeyed ( Job, Sampled + X * Job.SrcSize ) )
+         memcpy ( Dest + X * Job.DestSize,
+            Packed + X * Job.DestSize, Job.DestSize );
+}
+
+static void BilinearRow ( ScaleJob &Job, LPBYTE Scratch,
+        LONG *Cached, LONG Y ) {
+
+   DWORD *Slots [ 2 ], *Row0, *Row1, *Filtered, *Out;
+   Sample Down;
+   LONG First;
+
+   Slots [ 0 ] = ( DWORD * ) ( Scratch + Job.SlotOffset );
+   Slots [ 1 ] = ( DWORD * ) ( Scratch + Job.SecondSlotOffset );
+   Filtered    = ( DWORD * ) ( Scratch + Job.FilteredOffset );
+   Out         = ( DWORD * ) ( Scratch + Job.OutOffset );
+
+   FindSample ( Job.OriginV + Y * Job.StepV, Job.SrcHeight, Down );
+
+   if ( Job.Direct ) {
+      Row0 = ( DWORD * ) ( Job.Src + Down.First  * Job.SrcPitch );
+      Row1 = ( DWORD * ) ( Job.Src + Down.Second * Job.SrcPitch );
+   }
+   else {
+      // Neighbouring rows go to different slots, so
+      // enlarging converts each source row once per band:
+      if ( Cached [ Down.First & 1 ] != Down.First ) {
+         LoadRow ( Job, Down.First, Slots [ Down.First & 1 ] );
+         Cached [ Down.First & 1 ] = Down.First;
+      }
+
+      if ( Cached [ Down.Second & 1 ] != Down.Second ) {
+         LoadRow ( Job, Down.Second, Slots [ Down.Second & 1 ] );
+         Cached [ Down.Second & 1 ] = Down.Second;
+      }
+
+      Row0 = Slots [ Down.First  & 1 ];
+      Row1 = Slots [ Down.Second & 1 ];
+   }
+
+   if ( Down.Fraction != 0 ) {
+      First = 0;
+
+#ifdef PIXELCONVERT_SSE2
+      if ( Job.UseSIMD )
+         First = FilterRowSSE2 ( Filtered, Row0, Row1,
+            Down.Fraction, Job.SrcWidth );
+#endif
+
+      FilterRowScalar ( Filtered, Row0, Row1, Down.Fraction,
+         First, Job.SrcWidth );
+
+      Row0 = Filtered;
+   }
+
+   First = 0;
+
+#ifdef PIXELCONVERT_SSE2
+   if ( Job.UseSIMD )
+      First = ExpandRowSSE2 ( Job, Out, Row0 );
+#endif
+
+   ExpandRowScalar ( Job, Out, Row0, First );
+
+   StoreRow ( Job, Scratch, Out, Y );
+}
+
+static void BoxRow ( ScaleJob &Job, LPBYTE Scratch,
+        LONG *Rows, LONG Y ) {
+
+   DWORD *Row, *Accum, *Recip, *Out, Count;
+   LONG SrcY, X, First;
+   Span Down;
+
+   Accum = ( DWORD * ) ( Scratch + Job.AccumOffset );
+   Recip = ( DWORD * ) ( Scratch + Job.RecipOffset );
+   Out   = ( DWORD * ) ( Scratch + Job.OutOffset );
+
+   FindSpan ( Y, Job.SrcHeight, Job.DestHeight, Down );
+
+   ZeroMemory ( Accum, Job.SrcWidth * 16 );
+
+   for ( SrcY = Down.First; SrcY < Down.End; SrcY++ ) {
+      Row = LoadRow ( Job, SrcY,
+         ( DWORD * ) ( Scratch + Job.SlotOffset ) );
+
+      First = 0;
+
+#ifdef PIXELCONVERT_SSE2
+      if ( Job.UseSIMD )
+         First = AccumulateRowSSE2 ( Accum, Row, Job.SrcWidth );
+#endif
+
+      AccumulateRowScalar ( Accum, Row, First, Job.SrcWidth );
+   }
+
+   // Boxes are only a row or two different in height, so
+   // the reciprocals are kept until the height changes:
+   if ( ( *Rows ) != Down.End - Down.First ) {
+      ( *Rows ) = Down.End - Down.First;
+
+      for ( X = 0; X < Job.DestWidth; X++ ) {
+         Count = ( DWORD ) ( Job.Spans [ X ].End -
+            Job.Spans [ X ].First ) * ( *Rows );
+
+         Recip [ X ] = ( DWORD ) ( ( ( ULONGLONG ) 1 << 24 ) +
+            Count / 2 ) / Count;
+      }
+   }
+
+   First = 0;
+
+#ifdef PIXELCONVERT_SSE2
+   if ( Job.UseSIMD )
+      First = ReduceRowSSE2 ( Job, Out, Accum, Recip );
+#endif
+
+   ReduceRowScalar ( Job, Out, Accum, Recip, First );
+
+   StoreRow ( Job, Scratch, Out, Y );
+}
+
+static void ScaleTask ( LONG Task, LONG Thread,
+        LPVOID Context ) {
+
+   ScaleJob &Job = *( ScaleJob * ) Context;
+   LPBYTE Scratch = Job.Scratch + Thread * Job.ScratchPitch;
+   LONG Y, Last = ( Task + 1 ) * Job.RowsPerTask,
+      Cached [ 2 ] = { -1, -1 }, Rows = 0;
+
+   if ( Last > Job.DestHeight )
+      Last = Job.DestHeight;
+
+   for ( Y = Task * Job.RowsPerTask; Y < Last; Y++ ) {
+      switch ( Job.Filter ) {
+         case ScaleBilinear:
+            BilinearRow ( Job, Scratch, Cached, Y );
+         break;
+         case ScaleBox:
+            BoxRow ( Job, Scratch, &Rows, Y );
+         break;
+         default:
+            NearestRow ( Job, Scratch, Y );
+         break;
+      }
+   }
+}
+
+static inline LONG AlignScratch ( LONG Bytes ) {
+   return ( Bytes + 15 ) & ~15;
+}
+
+bool ScalePixels ( LPVOID Dest, LONG DestPitch,
+        PixelFormat DestFormat, LONG DestWidth, LONG DestHeight,
+        LPVOID Src, LONG SrcPitch, PixelFormat SrcFormat,
+        LONG SrcWidth, LONG SrcHeight, ScaleFilter Filter,
+        PALETTEENTRY *Palette, bool Keyed, DWORD KeyLow,
+        DWORD KeyHigh, ThreadPool *Pool ) {
+
+   ScaleJob Job;
+   LONG Index, Threads, Tasks, StepU, OriginU, SrcRowBytes;
+   bool Result = true;
+
+   Job.SrcSize  = GetFormatBytesPerPixel ( SrcFormat );
+   Job.DestSize = GetFormatBytesPerPixel ( DestFormat );
+
+   if ( Dest == NULL || Src == NULL || Job.SrcSize == 0 ||
+        Job.DestSize == 0 || DestWidth <= 0 || DestHeight <= 0 ||
+        SrcWidth <= 0 || SrcHeight <= 0 )
+      return false;
+
+   // Indices can only be picked, never blended, and are
+   // only written from indices:
+   if ( DestFormat == Format8 && ( SrcFormat != Format8 ||
+        Filter != ScaleNearest ) )
+      return false;
+
+   if ( SrcFormat == Format8 && DestFormat != Format8 &&
+        Palette == NULL )
+      return false;
+
+   Job.Dest       = ( LPBYTE ) Dest;
+   Job.DestPitch  = DestPitch;
+   Job.DestFormat = DestFormat;
+   Job.DestWidth  = DestWidth;
+   Job.DestHeight = DestHeight;
+   Job.Src        = ( LPBYTE ) Src;
+   Job.SrcPitch   = SrcPitch;
+   Job.SrcFormat  = SrcFormat;
+   Job.SrcWidth   = SrcWidth;
+   Job.SrcHeight  = SrcHeight;
+   Job.Filter     = Filter;
+   Job.Palette    = Palette;
+   Job.Keyed      = Keyed;
+   Job.KeyLow     = KeyLow;
+   Job.KeyHigh    = KeyHigh;
+   Job.Direct     = SrcFormat == Format8888 && !Keyed;
+   Job.UseSIMD    = GetConversionPath () != ScalarPath;
+   Job.Columns    = NULL;
+   Job.Samples    = NULL;
+   Job.Spans      = NULL;
+
+   // Destination pixel centres are spread evenly over the
+   // source; bilinear lookups are relative to texel
+   // centres:
+   StepU       = ( LONG ) ( ( ( LONGLONG ) SrcWidth  << 16 ) / DestWidth );
+   Job.StepV   = ( LONG ) ( ( ( LONGLONG ) SrcHeight << 16 ) / DestHeight );
+   OriginU     = StepU / 2 - 0x8000;
+   Job.OriginV = Job.StepV / 2 - 0x8000;
+
+   switch ( Filter ) {
+      case ScaleBilinear:
+         Job.Samples = new Sample [ DestWidth ];
+
+         if ( Job.Samples == NULL )
+            return false;
+
+         for ( Index = 0; Index < DestWidth; Index++ )
+            FindSample ( OriginU + Index * StepU, SrcWidth,
+               Job.Samples [ Index ] );
+      break;
+      case ScaleBox:
+         Job.Spans = new Span [ DestWidth ];
+
+         if ( Job.Spans == NULL )
+            return false;
+
+         for ( Index = 0; Index < DestWidth; Index++ )
+            FindSpan ( Index, SrcWidth, DestWidth,
+               Job.Spans [ Index ] );
+      break;
+      default:
+         Job.Columns = new LONG [ DestWidth ];
+
+         if ( Job.Columns == NULL )
+            return false;
+
+         // Exactly, since centres often fall on a pixel
+         // edge:
+         for ( Index = 0; Index < DestWidth; Index++ )
+            Job.Columns [ Index ] = ( LONG ) ( ( ( LONGLONG ) Index *
+               2 + 1 ) * SrcWidth / ( DestWidth * 2 ) );
+      break;
+   }
+
+   SrcRowBytes = AlignScratch ( SrcWidth * 4 );
+
+   Job.SlotOffset       = 0;
+   Job.SecondSlotOffset = SrcRowBytes;
+   Job.FilteredOffset   = Job.SecondSlotOffset + SrcRowBytes;
+   Job.AccumOffset      = Job.FilteredOffset + SrcRowBytes;
+   Job.RecipOffset      = Job.AccumOffset + ( Filter == ScaleBox ?
+      SrcRowBytes * 4 : 0 );
+   Job.OutOffset        = Job.RecipOffset + AlignScratch ( DestWidth * 4 );
+   Job.PackedOffset     = Job.OutOffset + AlignScratch ( DestWidth * 4 );
+   Job.CoverageOffset   = Job.PackedOffset + AlignScratch ( DestWidth * 4 );
+   Job.ScratchPitch     = Job.CoverageOffset + AlignScratch ( DestWidth );
+
+   Job.RowsPerTask = BandBytes / ( DestWidth * 4 );
+
+   if ( Job.RowsPerTask < 1 )
+      Job.RowsPerTask = 1;
+
+   Tasks = ( DestHeight + Job.RowsPerTask - 1 ) / Job.RowsPerTask;
+
+   Threads = Pool != NULL && Tasks > 1 ?
+      Pool->GetThreadCount () : 1;
+
+   Job.Scratch = new BYTE [ Threads * Job.ScratchPitch ];
+
+   if ( Job.Scratch != NULL ) {
+      if ( Threads == 1 ) {
+         for ( Index = 0; Index < Tasks; Index++ )
+            ScaleTask ( Index, 0, &Job );
+      }
+      else Result = Pool->Run ( ScaleTask, &Job, Tasks );
+   }
+   else Result = false;
+
+   delete [] Job.Scratch;
+   delete [] Job.Columns;
+   delete [] Job.Samples;
+   delete [] Job.Spans;
+
+   return Result;
+}
+
+double MeasureScaleThroughput ( PixelFormat Format,
+        ScaleFilter Filter, LONG SrcSize, LONG DestSize,
+        LONG Repeats, ThreadPool *Pool ) {
+
+   LPBYTE Src, Dest;
+   LONG BytesPerPixel, Repeat, I;
+   LARGE_INTEGER Start, Stop, Frequency;
+   DWORD Seed = 12345;
+   double Seconds;
+
+   BytesPerPixel = GetFormatBytesPerPixel ( Format );
+
+   if ( SrcSize <= 0 || DestSize <= 0 || Repeats <= 0 ||
+        BytesPerPixel < 2 )
+      return 0.0;
+
+   Src  = new BYTE [ SrcSize * SrcSize * BytesPerPixel ];
+   Dest = new BYTE [ DestSize * DestSize * BytesPerPixel ];
+
+   for ( I = 0; I < SrcSize * SrcSize * BytesPerPixel; I++ ) {
+      Seed = Seed * 1103515245 + 12345;
+      Src [ I ] = ( BYTE ) ( Seed >> 16 );
+   }
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ )
+      ScalePixels ( Dest, DestSize * BytesPerPixel, Format,
+         DestSize, DestSize, Src, SrcSize * BytesPerPixel, Format,
+         SrcSize, SrcSize, Filter, NULL, false, 0, 0, Pool );
+
+   QueryPerformanceCounter ( &Stop );
+
+   delete [] Src;
+   delete [] Dest;
+
+   Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+      ( double ) Frequency.QuadPart;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return ( double ) DestSize * DestSize * Repeats / Seconds / 1e6;
+}
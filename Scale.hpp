@@ -0,0 +1,49 @@
+//
+// File name: Scale.hpp
+//
+// Description: Filtered scaling of images between
+//              surfaces, for stretched blits.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __SCALEHPP__
+#define __SCALEHPP__
+
+#include "PixelConvert.hpp"
+#include "ThreadPool.hpp"
+
+// Scale a SrcWidth x SrcHeight image to DestWidth x
+// DestHeight. ScaleNearest picks the source pixel under
+// each destination pixel's centre, ScaleBilinear blends
+// the four around it and ScaleBox averages every source
+// pixel the destination pixel covers (the nearest one
+// when enlarging). Format8 needs Palette, except between
+// two Format8 images, which can only use ScaleNearest.
+// With Keyed, raw source pixels from KeyLow to KeyHigh
+// are left out of the filter and the destination is only
+// written where at least half of what it was filtered
+// from was not keyed (keyed sources are otherwise taken
+// as opaque). With a Pool, bands of rows are scaled in
+// parallel:
+bool ScalePixels ( LPVOID Dest, LONG DestPitch,
+   PixelFormat DestFormat, LONG DestWidth, LONG DestHeight,
+   LPVOID Src, LONG SrcPitch, PixelFormat SrcFormat,
+   LONG SrcWidth, LONG SrcHeight, ScaleFilter Filter,
+   PALETTEENTRY *Palette = NULL, bool Keyed = false,
+   DWORD KeyLow = 0, DWORD KeyHigh = 0, ThreadPool *Pool = NULL );
+
+// Scale a SrcSize x SrcSize image of Format to DestSize x
+// DestSize Repeats times and return the throughput in
+// megapixels written per second:
+double MeasureScaleThroughput ( PixelFormat Format,
+   ScaleFilter Filter, LONG SrcSize, LONG DestSize,
+   LONG Repeats, ThreadPool *Pool = NULL );
+
+#endif
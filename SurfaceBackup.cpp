@@ -0,0 +1,471 @@
+//
+// File name: SurfaceBackup.cpp
+//
+// Description: Compressed system memory copies of surface
+//              contents, written back after a surface was
+//              lost.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "SurfaceBackup.hpp"
+#include "BlockCompress.hpp"
+#include "LZCodec.hpp"
+
+// Capturing compresses each chunk to its own slot of Temp;
+// chunks that are not contiguous in the surface are
+// gathered in the thread's Scratch first:
+struct CaptureJob {
+   SurfaceBackup *Backup;
+
+   LPBYTE Temp, Scratch;
+   DWORD  TempPitch, ScratchPitch;
+};
+
+// Restoring runs the chunks of every backup as one set of
+// tasks; FirstTask [ I ] is the first task of backup I:
+struct RestoreJob {
+   SurfaceBackup **Backups;
+   LONG *FirstTask, Count;
+
+   bool *Failed;
+
+   LPBYTE Scratch;
+   DWORD  ScratchPitch;
+};
+
+// The bytes per row and rows of a level, with compressed
+// surfaces counted in rows of blocks:
+static void GetLevelLayout ( DirectDrawSurface &Surface,
+        LONG Level, LONG &RowBytes, LONG &Rows ) {
+
+   LONG Width  = Surface.GetMipLevelWidth  ( Level ),
+        Height = Surface.GetMipLevelHeight ( Level );
+
+   if ( Surface.GetCompression () != BlockNone ) {
+      RowBytes = ( ( Width + 3 ) / 4 ) *
+         GetBlockBytes ( Surface.GetCompression () );
+      Rows     = ( Height + 3 ) / 4;
+   }
+   else {
+      RowBytes = Width * Surface.GetBytesPerPixel ();
+      Rows     = Height;
+   }
+}
+
+SurfaceBackup::SurfaceBackup () {
+   Data   = NULL;
+   Chunks = NULL;
+   Target = NULL;
+
+   DataBytes = RawBytes = 0;
+   ChunkCount = LargestChunk = LevelCount = LockedLevels = 0;
+}
+
+SurfaceBackup::~SurfaceBackup () {
+   Destroy ();
+}
+
+void SurfaceBackup::Destroy () {
+   delete [] Data;
+   delete [] Chunks;
+
+   Data   = NULL;
+   Chunks = NULL;
+
+   DataBytes = RawBytes = 0;
+   ChunkCount = LargestChunk = LevelCount = 0;
+}
+
+bool SurfaceBackup::Lock ( DirectDrawSurface &Surface ) {
+   LPVOID Memory;
+   LONG Bytes, Rows;
+
+   // The surface must be laid out as the copy was:
+   if ( Surface.GetMipLevelCount () < LevelCount )
+      return false;
+
+   Target = &Surface;
+
+   for ( LockedLevels = 0; LockedLevels < LevelCount;
+         LockedLevels++ ) {
+
+      GetLevelLayout ( Surface, LockedLevels, Bytes, Rows );
+
+      if ( Bytes != RowBytes [ LockedLevels ] ||
+           Rows  != RowCount [ LockedLevels ] ||
+           !Surface.StartMipLevelAccess ( LockedLevels, &Memory,
+              &LevelPitch [ LockedLevels ] ) ) {
+
+         Unlock ();
+
+         return false;
+      }
+
+      LevelMemory [ LockedLevels ] = ( LPBYTE ) Memory;
+   }
+
+   return true;
+}
+
+void SurfaceBackup::Unlock () {
+   while ( LockedLevels > 0 )
+      Target->EndMipLevelAccess ( --LockedLevels );
+
+   Target = NULL;
+}
+
+bool SurfaceBackup::DecodeChunk ( LONG Index, LPBYTE Scratch ) {
+   Chunk *Piece = &Chunks [ Index ];
+   LONG Bytes = RowBytes [ Piece->Level ],
+      Pitch = LevelPitch [ Piece->Level ], Row;
+   LPBYTE Dest = LevelMemory [ Piece->Level ] +
+      Piece->FirstRow * Pitch;
+
+   // Rows with no padding between them are decompressed
+   // straight into the surface:
+   if ( Pitch == Bytes )
+      return LZDecompress ( Data + Piece->Offset, Piece->Size,
+         Dest, Bytes * Piece->Rows );
+
+   if ( !LZDecompress ( Data + Piece->Offset, Piece->Size,
+           Scratch, Bytes * Piece->Rows ) )
+      return false;
+
+   for ( Row = 0; Row < Piece->Rows; Row++ )
+      memcpy ( Dest + Row * Pitch, Scratch + Row * Bytes, Bytes );
+
+   return true;
+}
+
+void SurfaceBackup::CaptureTask ( LONG Task, LONG Thread,
+        LPVOID Context ) {
+
+   CaptureJob *Job = ( CaptureJob * ) Context;
+   SurfaceBackup *Backup = Job->Backup;
+   Chunk *Piece = &Backup->Chunks [ Task ];
+   LONG Bytes = Backup->RowBytes [ Piece->Level ],
+      Pitch = Backup->LevelPitch [ Piece->Level ], Row;
+   LPBYTE Src = Backup->LevelMemory [ Piece->Level ] +
+      Piece->FirstRow * Pitch, Packed;
+
+   if ( Pitch != Bytes ) {
+      Packed = Job->Scratch + Thread * Job->ScratchPitch;
+
+      for ( Row = 0; Row < Piece->Rows; Row++ )
+         memcpy ( Packed + Row * Bytes, Src + Row * Pitch, Bytes );
+
+      Src = Packed;
+   }
+
+   Piece->Size = LZCompress ( Src, Bytes * Piece->Rows,
+      Job->Temp + Task * Job->TempPitch );
+}
+
+bool SurfaceBackup::Capture ( DirectDrawSurface &Surface,
+        ThreadPool *Pool ) {
+
+   CaptureJob Job;
+   LONG Level, Row, Rows, Index, Threads;
+
+   if ( !Surface.Created )
+      return false;
+
+   switch ( Surface.PropSurfaceType ) {
+      case DirectDrawSurface::Plain:
+      case DirectDrawSurface::Texture:
+      case DirectDrawSurface::Alpha:
+      case DirectDrawSurface::BumpMap:
+      case DirectDrawSurface::LightMap:
+         break;
+
+      default:
+         return false;
+   }
+
+   Destroy ();
+
+   // Lay out the chunks of every level:
+   LevelCount = Surface.GetMipLevelCount ();
+
+   for ( Level = 0; Level < LevelCount; Level++ ) {
+      GetLevelLayout ( Surface, Level, RowBytes [ Level ],
+         RowCount [ Level ] );
+
+      Rows = ChunkBytes / RowBytes [ Level ];
+      Rows = Rows > 0 ? Rows : 1;
+
+      ChunkCount += ( RowCount [ Level ] + Rows - 1 ) / Rows;
+   }
+
+   Chunks = new Chunk [ ChunkCount ];
+
+   if ( Chunks == NULL ) {
+      Destroy ();
+      return false;
+   }
+
+   Index = 0;
+
+   for ( Level = 0; Level < LevelCount; Level++ ) {
+      Rows = ChunkBytes / RowBytes [ Level ];
+      Rows = Rows > 0 ? Rows : 1;
+
+      for ( Row = 0; Row < RowCount [ Level ]; Row += Rows ) {
+         Chunks [ Index ].Level    = Level;
+         Chunks [ Index ].FirstRow = Row;
+         Chunks [ Index ].Rows     = Row + Rows < RowCount [ Level ] ?
+            Rows : RowCount [ Level ] - Row;
+
+         if ( Chunks [ Index ].Rows * RowBytes [ Level ] > LargestChunk )
+            LargestChunk = Chunks [ Index ].Rows * RowBytes [ Level ];
+
+         RawBytes += Chunks [ Index ].Rows * RowBytes [ Level ];
+
+         Index++;
+      }
+   }
+
+   Threads = Pool != NULL && ChunkCount > 1 ?
+      Pool->GetThreadCount () : 1;
+
+   Job.Backup       = this;
+   Job.TempPitch    = LZCompressBound ( LargestChunk );
+   Job.ScratchPitch = LargestChunk;
+   Job.Temp         = new BYTE [ ChunkCount * Job.TempPitch ];
+   Job.Scratch      = new BYTE [ Threads * Job.ScratchPitch ];
+
+   if ( Job.Temp == NULL || Job.Scratch == NULL ||
+        !Lock ( Surface ) ) {
+
+      delete [] Job.Temp;
+      delete [] Job.Scratch;
+
+      Destroy ();
+      return false;
+   }
+
+   if ( Threads == 1 ) {
+      for ( Index = 0; Index < ChunkCount; Index++ )
+         CaptureTask ( Index, 0, &Job );
+   }
+   else
+      Pool->Run ( CaptureTask, &Job, ChunkCount );
+
+   Unlock ();
+
+   // Pack the compressed chunks together:
+   for ( Index = 0; Index < ChunkCount; Index++ ) {
+      Chunks [ Index ].Offset = DataBytes;
+
+      DataBytes += Chunks [ Index ].Size;
+   }
+
+   Data = new BYTE [ DataBytes > 0 ? DataBytes : 1 ];
+
+   if ( Data != NULL ) {
+      for ( Index = 0; Index < ChunkCount; Index++ )
+         memcpy ( Data + Chunks [ Index ].Offset,
+            Job.Temp + Index * Job.TempPitch, Chunks [ Index ].Size );
+   }
+
+   delete [] Job.Temp;
+   delete [] Job.Scratch;
+
+   if ( Data == NULL ) {
+      Destroy ();
+      return false;
+   }
+
+   return true;
+}
+
+bool SurfaceBackup::Restore ( DirectDrawSurface &Surface,
+        ThreadPool *Pool ) {
+
+   SurfaceBackup *Backup = this;
+   DirectDrawSurface *Into = &Surface;
+   bool Restored;
+
+   return RestoreBackups ( &Backup, &Into, 1, &Restored,
+      Pool ) && Restored;
+}
+
+void SurfaceBackup::RestoreTask ( LONG Task, LONG Thread,
+        LPVOID Context ) {
+
+   RestoreJob *Job = ( RestoreJob * ) Context;
+   LONG Index = 0;
+
+   // Backups are few, so a scan finds the task's owner:
+   while ( Index + 1 < Job->Count &&
+           Job->FirstTask [ Index + 1 ] <= Task )
+      Index++;
+
+   if ( !Job->Backups [ Index ]->DecodeChunk (
+           Task - Job->FirstTask [ Index ],
+           Job->Scratch + Thread * Job->ScratchPitch ) )
+      Job->Failed [ Index ] = true;
+}
+
+bool RestoreBackups ( SurfaceBackup **Backups,
+        DirectDrawSurface **Surfaces, LONG Count, bool *Restored,
+        ThreadPool *Pool ) {
+
+   RestoreJob Job;
+   LONG Index, Tasks = 0, Threads, Largest = 0;
+
+   if ( Count <= 0 )
+      return true;
+
+   Job.Backups   = Backups;
+   Job.Count     = Count;
+   Job.FirstTask = new LONG [ Count ];
+   Job.Failed    = new bool [ Count ];
+
+   if ( Job.FirstTask == NULL || Job.Failed == NULL ) {
+      delete [] Job.FirstTask;
+      delete [] Job.Failed;
+
+      return false;
+   }
+
+   // A backup whose surface cannot be locked is left out,
+   // with no tasks:
+   for ( Index = 0; Index < Count; Index++ ) {
+      Job.FirstTask [ Index ] = Tasks;
+      Job.Failed    [ Index ] = !Backups [ Index ]->IsCaptured () ||
+         !Backups [ Index ]->Lock ( *Surfaces [ Index ] );
+
+      if ( Job.Failed [ Index ] )
+         continue;
+
+      Tasks += Backups [ Index ]->ChunkCount;
+
+      if ( Backups [ Index ]->LargestChunk > Largest )
+         Largest = Backups [ Index ]->LargestChunk;
+   }
+
+   Threads = Pool != NULL && Tasks > 1 ?
+      Pool->GetThreadCount () : 1;
+
+   Job.ScratchPitch = Largest;
+   Job.Scratch      = new BYTE [ Threads * Largest + 1 ];
+
+   if ( Job.Scratch == NULL ) {
+      for ( Index = 0; Index < Count; Index++ )
+         Job.Failed [ Index ] = true;
+   }
+   else if ( Threads == 1 ) {
+      for ( Index = 0; Index < Tasks; Index++ )
+         SurfaceBackup::RestoreTask ( Index, 0, &Job );
+   }
+   else
+      Pool->Run ( SurfaceBackup::RestoreTask, &Job, Tasks );
+
+   for ( Index = 0; Index < Count; Index++ ) {
+      if ( Backups [ Index ]->Target != NULL )
+         Backups [ Index ]->Unlock ();
+
+      Restored [ Index ] = !Job.Failed [ Index ];
+   }
+
+   delete [] Job.Scratch;
+   delete [] Job.FirstTask;
+   delete [] Job.Failed;
+
+   return true;
+}
+
+double MeasureBackupThroughput ( LONG Size, LONG Count,
+        LONG Repeats, ThreadPool *Pool, DWORD *Bytes ) {
+
+   DirectDrawManager Manager ( DirectDrawManager::SystemMemory );
+   DirectDrawSurface *Surfaces = NULL, **Targets = NULL;
+   SurfaceBackup *Copies = NULL, **Backups = NULL;
+   bool *Restored = NULL;
+   LARGE_INTEGER Start, Stop, Frequency;
+   LPBYTE Memory;
+   DWORD Seed = 1, Pixel;
+   LONG Index, Repeat, X, Y;
+   double Seconds = 0.0;
+   bool Ready = Size > 0 && Count > 0 && Repeats > 0;
+
+   if ( Ready ) {
+      Surfaces = new DirectDrawSurface [ Count ];
+      Targets  = new DirectDrawSurface * [ Count ];
+      Copies   = new SurfaceBackup [ Count ];
+      Backups  = new SurfaceBackup * [ Count ];
+      Restored = new bool [ Count ];
+
+      Ready = Surfaces != NULL && Targets != NULL &&
+         Copies != NULL && Backups != NULL && Restored != NULL;
+   }
+
+   // Smooth gradients with noise in the low bits, and a
+   // flat band, as painted textures tend to be:
+   for ( Index = 0; Ready && Index < Count; Index++ ) {
+      Surfaces [ Index ].SetSurfaceType ( DirectDrawSurface::Plain );
+      Surfaces [ Index ].SetGeneralOptions ( Size, Size, 32 );
+
+      if ( !Manager.CreateSurface ( Surfaces [ Index ] ) ||
+           !Surfaces [ Index ].StartAccess ( ( LPVOID * ) &Memory ) ) {
+         Ready = false;
+         break;
+      }
+
+      for ( Y = 0; Y < Size; Y++ ) {
+         for ( X = 0; X < Size; X++ ) {
+            Seed  = Seed * 1103515245 + 12345;
+            Pixel = Y < Size / 4 ? 0xFF204060 : 0xFF000000 |
+               ( ( X * 255 / Size ) << 16 ) |
+               ( ( Y * 255 / Size ) << 8 ) |
+               ( ( ( X + Y ) & 0xF0 ) + ( ( Seed >> 16 ) & 3 ) );
+
+            ( ( DWORD * ) ( Memory + Y *
+               Surfaces [ Index ].GetPitch () ) ) [ X ] = Pixel;
+         }
+      }
+
+      Surfaces [ Index ].EndAccess ();
+
+      Targets [ Index ] = &Surfaces [ Index ];
+      Backups [ Index ] = &Copies [ Index ];
+
+      Ready = Copies [ Index ].Capture ( Surfaces [ Index ], Pool );
+   }
+
+   if ( Ready ) {
+      if ( Bytes != NULL )
+         ( *Bytes ) = Copies [ 0 ].GetBytes ();
+
+      QueryPerformanceFrequency ( &Frequency );
+      QueryPerformanceCounter ( &Start );
+
+      for ( Repeat = 0; Repeat < Repeats; Repeat++ )
+         RestoreBackups ( Backups, Targets, Count, Restored, Pool );
+
+      QueryPerformanceCounter ( &Stop );
+
+      Seconds = ( double ) ( Stop.QuadPart - Start.QuadPart ) /
+         ( double ) Frequency.QuadPart;
+   }
+
+   delete [] Restored;
+   delete [] Backups;
+   delete [] Copies;
+   delete [] Targets;
+   delete [] Surfaces;
+
+   if ( Seconds <= 0.0 )
+      return 0.0;
+
+   return ( double ) Size * Size * 4 * Count * Repeats /
+      Seconds / 1e6;
+}
@@ -0,0 +1,109 @@
+//
+// File name: SurfaceBackup.hpp
+//
+// Description: Compressed system memory copies of surface
+//              contents, written back after a surface was
+//              lost.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __SURFACEBACKUPHPP__
+#define __SURFACEBACKUPHPP__
+
+#include "DirectDraw.hpp"
+#include "ThreadPool.hpp"
+
+// Every mip level of a surface, compressed with LZCompress
+// in chunks of rows that are restored independently:
+class SurfaceBackup {
+   public:
+      // Chunks hold whole rows, as many as fit in the
+      // codec's window (at least one):
+      enum { ChunkBytes = 65536 };
+
+   protected:
+      struct Chunk {
+         DWORD Offset, Size;
+         LONG  Level, FirstRow, Rows;
+      };
+
+      LPBYTE Data;
+      DWORD  DataBytes, RawBytes;
+
+      Chunk *Chunks;
+      LONG   ChunkCount, LargestChunk;
+
+      LONG LevelCount;
+      LONG RowBytes [ DirectDrawSurface::MaxMipLevels ],
+           RowCount [ DirectDrawSurface::MaxMipLevels ];
+
+      // The surface while it is locked for writing back:
+      DirectDrawSurface *Target;
+
+      LPBYTE LevelMemory [ DirectDrawSurface::MaxMipLevels ];
+      LONG   LevelPitch  [ DirectDrawSurface::MaxMipLevels ];
+
+      LONG LockedLevels;
+
+      bool Lock ( DirectDrawSurface &Surface );
+      void Unlock ();
+
+      bool DecodeChunk ( LONG Index, LPBYTE Scratch );
+
+      static void CaptureTask ( LONG Task, LONG Thread,
+         LPVOID Context );
+      static void RestoreTask ( LONG Task, LONG Thread,
+         LPVOID Context );
+
+      friend bool RestoreBackups ( SurfaceBackup **Backups,
+         DirectDrawSurface **Surfaces, LONG Count,
+         bool *Restored, ThreadPool *Pool );
+
+   public:
+      SurfaceBackup ();
+      ~SurfaceBackup ();
+
+      // Compress the current contents of every level of a
+      // Plain, Texture, Alpha, BumpMap or LightMap surface,
+      // with chunks spread over Pool when there is one:
+      bool Capture ( DirectDrawSurface &Surface,
+         ThreadPool *Pool = NULL );
+
+      // Write the copy back to the surface it was taken
+      // from (or one laid out the same way):
+      bool Restore ( DirectDrawSurface &Surface,
+         ThreadPool *Pool = NULL );
+
+      void Destroy ();
+
+      bool IsCaptured () { return Data != NULL; }
+
+      // The memory the copy takes, and the size of the
+      // pixels it holds:
+      DWORD GetBytes    () { return DataBytes; }
+      DWORD GetRawBytes () { return RawBytes;  }
+};
+
+// Lock every surface, decompress the chunks of all of
+// them as one set of tasks over Pool, then unlock. Each
+// Restored flag tells whether that surface was written:
+bool RestoreBackups ( SurfaceBackup **Backups,
+   DirectDrawSurface **Surfaces, LONG Count, bool *Restored,
+   ThreadPool *Pool = NULL );
+
+// Capture Count Size x Size 32-bit system memory surfaces
+// of texture-like content, then restore them all Repeats
+// times, and return the throughput in megabytes of pixels
+// written per second. The compressed size of one surface
+// goes to Bytes:
+double MeasureBackupThroughput ( LONG Size, LONG Count,
+   LONG Repeats, ThreadPool *Pool = NULL, DWORD *Bytes = NULL );
+
+#endif
@@ -0,0 +1,342 @@
+//
+// File name: SurfacePool.cpp
+//
+// Description: Recycles DirectDraw surfaces of the same
+//              type, size and format.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "SurfacePool.hpp"
+
+SurfacePool::SurfacePool ( DirectDrawManager &Manager,
+        DWORD MemoryCap ) {
+
+   LONG Slot;
+
+   this->Manager   = &Manager;
+   this->MemoryCap = MemoryCap;
+
+   for ( Slot = 0; Slot < BucketSlots; Slot++ )
+      Buckets [ Slot ] = NULL;
+
+   LruHead = LruTail = SpareNodes = NULL;
+   Loans = NULL;
+
+   ZeroMemory ( &Stats, sizeof ( SurfacePoolStats ) );
+}
+
+SurfacePool::~SurfacePool () {
+   PoolBucket *Bucket;
+   PoolNode *Node;
+   LONG Slot;
+
+   DirectDrawSurface *Surface;
+
+   // Surfaces still acquired belong to the application
+   // from here on, and forget the pool; only the free ones
+   // are destroyed:
+   while ( Loans != NULL ) {
+      Surface = Loans;
+      Loans   = Surface->NextLoan;
+
+      Surface->Lender   = NULL;
+      Surface->NextLoan = Surface->PreviousLoan = NULL;
+   }
+
+   Trim ( 0 );
+
+   while ( SpareNodes != NULL ) {
+      Node = SpareNodes;
+      SpareNodes = Node->BucketNext;
+
+      delete Node;
+   }
+
+   for ( Slot = 0; Slot < BucketSlots; Slot++ ) {
+      while ( Buckets [ Slot ] != NULL ) {
+         Bucket = Buckets [ Slot ];
+         Buckets [ Slot ] = Bucket->Next;
+
+         delete Bucket;
+      }
+   }
+}
+
+SurfacePool::PoolBucket *SurfacePool::FindBucket ( int Type,
+        LONG Width, LONG Height, LONG BPP, bool Alpha,
+        bool Create ) {
+
+   PoolBucket *Bucket;
+   DWORD Hash;
+
+   Hash = ( DWORD ) Type * 0x9E3779B1;
+   Hash = ( Hash ^ ( DWORD ) Width  ) * 0x85EBCA6B;
+   Hash = ( Hash ^ ( DWORD ) Height ) * 0xC2B2AE35;
+   Hash = ( Hash ^ ( DWORD ) BPP    ) * 0x27D4EB2F;
+   Hash = ( Hash ^ ( Hash >> 16 ) ^ ( Alpha ? 1 : 0 ) ) %
+      BucketSlots;
+
+   for ( Bucket = Buckets [ Hash ]; Bucket != NULL;
+         Bucket = Bucket->Next ) {
+
+      if ( Bucket->Type == Type && Bucket->Width == Width &&
+           Bucket->Height == Height && Bucket->BPP == BPP &&
+           Bucket->Alpha == Alpha )
+         return Bucket;
+   }
+
+   if ( !Create )
+      return NULL;
+
+   Bucket = new PoolBucket;
+
+   if ( Bucket == NULL )
+      return NULL;
+
+   Bucket->Type   = Type;
+   Bucket->Width  = Width;
+   Bucket->Height = Height;
+   Bucket->BPP    = BPP;
+   Bucket->Alpha  = Alpha;
+   Bucket->Bytes  = 0;
+   Bucket->Free   = NULL;
+
+   Bucket->Next = Buckets [ Hash ];
+   Buckets [ Hash ] = Bucket;
+
+   return Bucket;
+}
+
+void SurfacePool::Unlink ( PoolNode *Node ) {
+   // Remove a free node from its bucket and from the
+   // least-recently-released list:
+
+   if ( Node->BucketPrev != NULL )
+      Node->BucketPrev->BucketNext = Node->BucketNext;
+   else Node->Bucket->Free = Node->BucketNext;
+
+   if ( Node->BucketNext != NULL )
+      Node->BucketNext->BucketPrev = Node->BucketPrev;
+
+   if ( Node->LruPrev != NULL )
+      Node->LruPrev->LruNext = Node->LruNext;
+   else LruHead = Node->LruNext;
+
+   if ( Node->LruNext != NULL )
+      Node->LruNext->LruPrev = Node->LruPrev;
+   else LruTail = Node->LruPrev;
+
+   // Keep the node for the next release:
+   Node->BucketNext = SpareNodes;
+   SpareNodes = Node;
+}
+
+void SurfacePool::Evict ( PoolNode *Node ) {
+   Unlink ( Node );
+
+   delete Node->Surface;
+
+   Stats.SurfacesFree--;
+   Stats.BytesFree -= Node->Bytes;
+   Stats.Evictions++;
+}
+
+void SurfacePool::Fit ( DWORD Bytes ) {
+   // Evict the oldest free surfaces until Bytes more fit
+   // under the cap (or nothing is left to evict):
+
+   if ( MemoryCap == 0 )
+      return;
+
+   while ( LruTail != NULL && Stats.BytesInUse +
+           Stats.BytesFree + Bytes > MemoryCap )
+      Evict ( LruTail );
+}
+
+DirectDrawSurface *SurfacePool::Acquire (
+        DirectDrawSurface::SurfaceType Type, LONG Width,
+        LONG Height, LONG BPP, bool Alpha ) {
+
+   PoolBucket *Bucket;
+   PoolNode *Node;
+   DirectDrawSurface *Surface;
+   DWORD Bytes;
+
+   // Flip chains own their backbuffers and cannot be
+   // handed from one user to the next:
+   if ( Type == DirectDrawSurface::Primary ||
+        Type == DirectDrawSurface::Chain )
+      return NULL;
+
+   Bucket = FindBucket ( Type, Width, Height, BPP, Alpha,
+      true );
+
+   if ( Bucket == NULL )
+      return NULL;
+
+   if ( Bucket->Free != NULL ) {
+      // Reuse the most recently released surface:
+      Node    = Bucket->Free;
+      Surface = Node->Surface;
+      Bytes   = Node->Bytes;
+
+      Unlink ( Node );
+
+      Stats.Hits++;
+      Stats.SurfacesFree--;
+      Stats.BytesFree -= Bytes;
+   }
+   else {
+      // Room is made before creating, by the size the
+      // bucket's surfaces were measured at (their pitch is
+      // only known once one exists), and settled after:
+      if ( Bucket->Bytes != 0 )
+         Fit ( Bucket->Bytes );
+      else Fit ( Width * Height * ( ( BPP + 7 ) / 8 ) );
+
+      Surface = new DirectDrawSurface;
+
+      if ( Surface == NULL )
+         return NULL;
+
+      Surface->SetSurfaceType    ( Type );
+      Surface->SetGeneralOptions ( Width, Height, BPP );
+      Surface->SetTextureOptions ( Alpha );
+
+      if ( !Manager->CreateSurface ( *Surface ) ) {
+         delete Surface;
+
+         return NULL;
+      }
+
+      Bytes = Surface->SurfPitch * Surface->SurfHeight;
+
+      Bucket->Bytes = Bytes;
+
+      Fit ( Bytes );
+
+      Stats.Misses++;
+   }
+
+   Surface->Lender = this;
+
+   Surface->PreviousLoan = NULL;
+   Surface->NextLoan     = Loans;
+
+   if ( Loans != NULL )
+      Loans->PreviousLoan = Surface;
+
+   Loans = Surface;
+
+   Stats.SurfacesInUse++;
+   Stats.BytesInUse += Bytes;
+
+   if ( Stats.BytesInUse + Stats.BytesFree > Stats.PeakBytes )
+      Stats.PeakBytes = Stats.BytesInUse + Stats.BytesFree;
+
+   return Surface;
+}
+
+bool SurfacePool::Release ( DirectDrawSurface *Surface ) {
+   PoolBucket *Bucket;
+   PoolNode *Node;
+
+   // Only surfaces acquired from this pool, and each only
+   // once:
+   if ( Surface == NULL || !Surface->Created ||
+        Surface->Lender != this )
+      return false;
+
+   Bucket = FindBucket ( Surface->PropSurfaceType,
+      Surface->PropWidth, Surface->PropHeight,
+      Surface->PropBPP, Surface->PropAlpha, true );
+
+   if ( Bucket == NULL )
+      return false;
+
+   if ( SpareNodes != NULL ) {
+      Node = SpareNodes;
+      SpareNodes = Node->BucketNext;
+   }
+   else {
+      Node = new PoolNode;
+
+      if ( Node == NULL )
+         return false;
+   }
+
+   Node->Surface = Surface;
+   Node->Bytes   = Surface->SurfPitch * Surface->SurfHeight;
+   Node->Bucket  = Bucket;
+
+   // The next user starts from a surface as it was
+   // created:
+   Surface->ResetState ();
+
+   Unlend ( *Surface );
+
+   Node->BucketPrev = NULL;
+   Node->BucketNext = Bucket->Free;
+
+   if ( Bucket->Free != NULL )
+      Bucket->Free->BucketPrev = Node;
+
+   Bucket->Free = Node;
+
+   Node->LruPrev = NULL;
+   Node->LruNext = LruHead;
+
+   if ( LruHead != NULL )
+      LruHead->LruPrev = Node;
+   else LruTail = Node;
+
+   LruHead = Node;
+
+   Stats.SurfacesFree++;
+   Stats.BytesFree += Node->Bytes;
+
+   Fit ( 0 );
+
+   return true;
+}
+
+void SurfacePool::Unlend ( DirectDrawSurface &Surface ) {
+   if ( Surface.PreviousLoan != NULL )
+      Surface.PreviousLoan->NextLoan = Surface.NextLoan;
+   else Loans = Surface.NextLoan;
+
+   if ( Surface.NextLoan != NULL )
+      Surface.NextLoan->PreviousLoan = Surface.PreviousLoan;
+
+   Surface.Lender   = NULL;
+   Surface.NextLoan = Surface.PreviousLoan = NULL;
+
+   Stats.SurfacesInUse--;
+   Stats.BytesInUse -= Surface.SurfPitch * Surface.SurfHeight;
+}
+
+void SurfacePool::SetMemoryCap ( DWORD Bytes ) {
+   MemoryCap = Bytes;
+
+   Fit ( 0 );
+}
+
+void SurfacePool::Trim ( DWORD FreeBytes ) {
+   // Destroy the oldest free surfaces until no more than
+   // FreeBytes are held:
+   while ( LruTail != NULL && Stats.BytesFree > FreeBytes )
+      Evict ( LruTail );
+}
+
+void SurfacePool::GetStatistics (
+        SurfacePoolStats &Statistics ) {
+
+   Statistics = Stats;
+}
@@ -0,0 +1,105 @@
+//
+// File name: SurfacePool.hpp
+//
+// Description: Recycles DirectDraw surfaces of the same
+//              type, size and format.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __SURFACEPOOLHPP__
+#define __SURFACEPOOLHPP__
+
+#include "DirectDraw.hpp"
+
+struct SurfacePoolStats {
+   DWORD SurfacesInUse, SurfacesFree,
+         BytesInUse,    BytesFree,   PeakBytes,
+         Hits,          Misses,      Evictions;
+};
+
+class SurfacePool {
+   protected:
+      struct PoolBucket;
+
+      // A released surface waiting to be reused. Nodes are
+      // linked into their bucket's free list and into one
+      // least-recently-released list for the whole pool:
+      struct PoolNode {
+         DirectDrawSurface *Surface;
+         DWORD              Bytes;
+         PoolBucket        *Bucket;
+         PoolNode          *BucketPrev, *BucketNext,
+                           *LruPrev,    *LruNext;
+      };
+
+      // Bytes is what one of the bucket's surfaces counts
+      // against the cap, pitch times height, once one was
+      // created:
+      struct PoolBucket {
+         int         Type;
+         LONG        Width, Height, BPP;
+         bool        Alpha;
+         DWORD       Bytes;
+         PoolNode   *Free;
+         PoolBucket *Next;
+      };
+
+      enum { BucketSlots = 64 };
+
+      DirectDrawManager *Manager;
+
+      PoolBucket *Buckets [ BucketSlots ];
+      PoolNode   *LruHead, *LruTail, *SpareNodes;
+
+      // The surfaces acquired and not yet released, linked
+      // through the surfaces:
+      DirectDrawSurface *Loans;
+
+      DWORD MemoryCap;
+
+      SurfacePoolStats Stats;
+
+      PoolBucket *FindBucket ( int Type, LONG Width,
+         LONG Height, LONG BPP, bool Alpha, bool Create );
+
+      void Unlink ( PoolNode *Node );
+      void Evict  ( PoolNode *Node );
+      void Fit    ( DWORD Bytes );
+
+      // Take a surface off the loans, when it is released
+      // or destroyed while still acquired:
+      void Unlend ( DirectDrawSurface &Surface );
+
+      friend class DirectDrawSurface;
+
+   public:
+      // A MemoryCap of zero means the pool never evicts on
+      // its own:
+      SurfacePool ( DirectDrawManager &Manager,
+         DWORD MemoryCap = 0 );
+      ~SurfacePool ();
+
+      DirectDrawSurface *Acquire (
+         DirectDrawSurface::SurfaceType Type, LONG Width,
+         LONG Height, LONG BPP, bool Alpha = false );
+
+      // Hand back a surface acquired from this pool. Its
+      // palette, colour key, blend mode, fast clear, depth
+      // pyramid, repaint callback and backup are dropped and
+      // its statistics reset for the next user:
+      bool Release ( DirectDrawSurface *Surface );
+
+      void SetMemoryCap ( DWORD Bytes );
+      void Trim ( DWORD FreeBytes = 0 );
+
+      void GetStatistics ( SurfacePoolStats &Statistics );
+};
+
+#endif
@@ -0,0 +1,284 @@
+//
+// File name: ThreadPool.cpp
+//
+// Description: A small work-stealing thread pool for
+//              running numbered tasks in parallel.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries:
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool ( LONG Threads ) {
+   LARGE_INTEGER Frequency;
+   SYSTEM_INFO SystemInfo;
+   DWORD ThreadID;
+   LONG Index;
+
+   if ( Threads <= 0 ) {
+      GetSystemInfo ( &SystemInfo );
+
+      Threads = ( LONG ) SystemInfo.dwNumberOfProcessors;
+   }
+
+   if ( Threads < 1 )
+      Threads = 1;
+
+   if ( Threads > MaxThreads )
+      Threads = MaxThreads;
+
+   Deterministic = Quitting = InRun = false;
+
+   Function = NULL;
+   Context  = NULL;
+   Running  = 0;
+
+   QueryPerformanceFrequency ( &Frequency );
+
+   TicksPerMicrosecond = ( double ) Frequency.QuadPart / 1e6;
+
+   ZeroMemory ( Stats, sizeof ( Stats ) );
+
+   InitializeCriticalSection ( &RunLock );
+
+   for ( Index = 0; Index < MaxThreads; Index++ ) {
+      InitializeCriticalSection ( &Ranges [ Index ].Lock );
+
+      Ranges [ Index ].Begin = Ranges [ Index ].End = 0;
+   }
+
+   Finished = CreateEvent ( NULL, FALSE, FALSE, NULL );
+
+   // The calling thread is thread zero, so only the others
+   // need threads of their own:
+   for ( ThreadCount = 1; ThreadCount < Threads; ThreadCount++ ) {
+      Workers [ ThreadCount ].Pool  = this;
+      Workers [ ThreadCount ].Index = ThreadCount;
+      Workers [ ThreadCount ].Start = CreateEvent ( NULL, FALSE,
+         FALSE, NULL );
+
+      if ( Workers [ ThreadCount ].Start == NULL )
+         break;
+
+      Workers [ ThreadCount ].Thread = CreateThread ( NULL, 0,
+         WorkerThread, &Workers [ ThreadCount ], 0, &ThreadID );
+
+      if ( Workers [ ThreadCount ].Thread == NULL ) {
+         CloseHandle ( Workers [ ThreadCount ].Start );
+
+         break;
+      }
+   }
+}
+
+ThreadPool::~ThreadPool () {
+   LONG Index;
+
+   Quitting = true;
+
+   for ( Index = 1; Index < ThreadCount; Index++ )
+      SetEvent ( Workers [ Index ].Start );
+
+   for ( Index = 1; Index < ThreadCount; Index++ ) {
+      WaitForSingleObject ( Workers [ Index ].Thread, INFINITE );
+
+      CloseHandle ( Workers [ Index ].Thread );
+      CloseHandle ( Workers [ Index ].Start );
+   }
+
+   for ( Index = 0; Index < MaxThreads; Index++ )
+      DeleteCriticalSection ( &Ranges [ Index ].Lock );
+
+   DeleteCriticalSection ( &RunLock );
+
+   if ( Finished != NULL )
+      CloseHandle ( Finished );
+}
+
+DWORD WINAPI ThreadPool::WorkerThread ( LPVOID Parameter ) {
+   Worker *Self = ( Worker * ) Parameter;
+   ThreadPool *Pool = Self->Pool;
+
+   for ( ;; ) {
+      WaitForSingleObject ( Self->Start, INFINITE );
+
+      if ( Pool->Quitting )
+         break;
+
+      Pool->RunTasks ( Self->Index );
+
+      if ( InterlockedDecrement ( &Pool->Running ) == 0 )
+         SetEvent ( Pool->Finished );
+   }
+
+   return 0;
+}
+
+bool ThreadPool::Run ( TaskFunction Function, LPVOID Context,
+        LONG Tasks ) {
+
+   if ( Function == NULL || Tasks < 0 )
+      return false;
+
+   EnterCriticalSection ( &RunLock );
+
+   // The lock is recursive, so a task on the calling thread
+   // calling Run again would get through it:
+   if ( InRun ) {
+      LeaveCriticalSection ( &RunLock );
+
+      return false;
+   }
+
+   InRun = true;
+
+   RunLocked ( Function, Context, Tasks );
+
+   InRun = false;
+
+   LeaveCriticalSection ( &RunLock );
+
+   return true;
+}
+
+void ThreadPool::RunLocked ( TaskFunction Function,
+        LPVOID Context, LONG Tasks ) {
+
+   LARGE_INTEGER Start, Stop;
+   LONG Index;
+
+   ZeroMemory ( Stats, sizeof ( Stats ) );
+
+   if ( Tasks == 0 )
+      return;
+
+   if ( Deterministic || ThreadCount == 1 ) {
+      for ( Index = 0; Index < Tasks; Index++ ) {
+         QueryPerformanceCounter ( &Start );
+
+         Function ( Index, 0, Context );
+
+         QueryPerformanceCounter ( &Stop );
+
+         Stats [ 0 ].Tasks++;
+         Stats [ 0 ].BusyMicroseconds += ( double ) ( Stop.QuadPart -
+            Start.QuadPart ) / TicksPerMicrosecond;
+      }
+
+      return;
+   }
+
+   // Give every thread an equal, contiguous share of the
+   // tasks; threads that run out steal from the others:
+   for ( Index = 0; Index < ThreadCount; Index++ ) {
+      Ranges [ Index ].Begin = ( LONG ) ( ( LONGLONG ) Tasks *
+         Index / ThreadCount );
+      Ranges [ Index ].End   = ( LONG ) ( ( LONGLONG ) Tasks *
+         ( Index + 1 ) / ThreadCount );
+   }
+
+   this->Function = Function;
+   this->Context  = Context;
+
+   Running = ThreadCount - 1;
+
+   for ( Index = 1; Index < ThreadCount; Index++ )
+      SetEvent ( Workers [ Index ].Start );
+
+   RunTasks ( 0 );
+
+   WaitForSingleObject ( Finished, INFINITE );
+}
+
+void ThreadPool::RunTasks ( LONG Thread ) {
+   LARGE_INTEGER Start, Stop;
+   LONG Task;
+
+   do {
+      while ( TakeTask ( Thread, &Task ) ) {
+         QueryPerformanceCounter ( &Start );
+
+         Function ( Task, Thread, Context );
+
+         QueryPerformanceCounter ( &Stop );
+
+         Stats [ Thread ].Tasks++;
+         Stats [ Thread ].BusyMicroseconds += ( double ) (
+            Stop.QuadPart - Start.QuadPart ) / TicksPerMicrosecond;
+      }
+   } while ( StealTasks ( Thread ) );
+}
+
+bool ThreadPool::TakeTask ( LONG Thread, LONG *Task ) {
+   TaskRange &Range = Ranges [ Thread ];
+   bool Taken = false;
+
+   EnterCriticalSection ( &Range.Lock );
+
+   if ( Range.Begin < Range.End ) {
+      ( *Task ) = Range.Begin++;
+
+      Taken = true;
+   }
+
+   LeaveCriticalSection ( &Range.Lock );
+
+   return Taken;
+}
+
+bool ThreadPool::StealTasks ( LONG Thread ) {
+   LONG Offset, Victim, Count, Begin;
+
+   // Take the back half of the first thread that still has
+   // tasks left, so neighbouring tasks stay together:
+
+   for ( Offset = 1; Offset < ThreadCount; Offset++ ) {
+      Victim = ( Thread + Offset ) % ThreadCount;
+
+      EnterCriticalSection ( &Ranges [ Victim ].Lock );
+
+      Count = Ranges [ Victim ].End - Ranges [ Victim ].Begin;
+
+      if ( Count <= 0 ) {
+         LeaveCriticalSection ( &Ranges [ Victim ].Lock );
+
+         continue;
+      }
+
+      Begin = Ranges [ Victim ].End - ( Count + 1 ) / 2;
+
+      Ranges [ Victim ].End = Begin;
+
+      LeaveCriticalSection ( &Ranges [ Victim ].Lock );
+
+      EnterCriticalSection ( &Ranges [ Thread ].Lock );
+
+      Ranges [ Thread ].Begin = Begin;
+      Ranges [ Thread ].End   = Begin + ( Count + 1 ) / 2;
+
+      LeaveCriticalSection ( &Ranges [ Thread ].Lock );
+
+      Stats [ Thread ].Steals++;
+
+      return true;
+   }
+
+   return false;
+}
+
+bool ThreadPool::GetThreadStats ( LONG Thread,
+        ThreadStats &Statistics ) {
+
+   if ( Thread < 0 || Thread >= ThreadCount )
+      return false;
+
+   Statistics = Stats [ Thread ];
+
+   return true;
+}
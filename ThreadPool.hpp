@@ -0,0 +1,103 @@
+//
+// File name: ThreadPool.hpp
+//
+// Description: A small work-stealing thread pool for
+//              running numbered tasks in parallel.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries:
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __THREADPOOLHPP__
+#define __THREADPOOLHPP__
+
+#include <Windows.H>
+
+// Task numbers run from zero; Thread is the index of the
+// pool thread running the task (zero is the caller):
+typedef void ( *TaskFunction ) ( LONG Task, LONG Thread,
+   LPVOID Context );
+
+struct ThreadStats {
+   DWORD  Tasks, Steals;
+
+   double BusyMicroseconds;
+};
+
+class ThreadPool {
+   public:
+      enum { MaxThreads = 32 };
+
+   protected:
+      // The tasks a thread still has to run. The owner takes
+      // tasks from the front, thieves take the back half:
+      struct TaskRange {
+         LONG             Begin, End;
+         CRITICAL_SECTION Lock;
+      };
+
+      struct Worker {
+         ThreadPool *Pool;
+         LONG        Index;
+         HANDLE      Thread, Start;
+      };
+
+      Worker      Workers [ MaxThreads ];
+      TaskRange   Ranges  [ MaxThreads ];
+      ThreadStats Stats   [ MaxThreads ];
+
+      LONG         ThreadCount;
+      bool         Deterministic, Quitting;
+
+      TaskFunction Function;
+      LPVOID       Context;
+
+      LONG volatile Running;
+      HANDLE       Finished;
+
+      // Held for the whole of a Run, so that callers on
+      // different threads take turns with the pool:
+      CRITICAL_SECTION RunLock;
+      bool         InRun;
+
+      double       TicksPerMicrosecond;
+
+      static DWORD WINAPI WorkerThread ( LPVOID Parameter );
+
+      void RunLocked ( TaskFunction Function, LPVOID Context,
+         LONG Tasks );
+      void RunTasks ( LONG Thread );
+      bool TakeTask ( LONG Thread, LONG *Task );
+      bool StealTasks ( LONG Thread );
+
+   public:
+      // Zero threads means one per processor:
+      ThreadPool ( LONG Threads = 0 );
+      ~ThreadPool ();
+
+      // Runs Function once for every task number below
+      // Tasks and returns when all of them have finished.
+      // Runs from several threads are serialized. A task
+      // must not call Run on its own pool: on the calling
+      // thread that fails, and on a pool thread it would
+      // never return:
+      bool Run ( TaskFunction Function, LPVOID Context,
+         LONG Tasks );
+
+      // In deterministic mode every task runs on the calling
+      // thread, in order:
+      void SetDeterministic ( bool Enable ) { Deterministic = Enable; }
+      bool IsDeterministic () { return Deterministic; }
+
+      LONG GetThreadCount () { return ThreadCount; }
+
+      // Statistics cover the last Run:
+      bool GetThreadStats ( LONG Thread, ThreadStats &Statistics );
+};
+
+#endif
@@ -0,0 +1,526 @@
+//
+// File name: Trace.cpp
+//
+// Description: A timeline of surface operations, recorded
+//              per thread and written out as a Chrome trace
+//              or a Perfetto trace.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#include <Stdio.H>
+
+#include "Trace.hpp"
+
+// Each thread records into a ring of its own, found through
+// a TLS slot, so recording takes no locks. Written counts
+// every event the thread recorded; the ring holds the last
+// TraceBufferEvents of them, from Floor on:
+struct TraceBuffer {
+   TraceEvent Events [ TraceBufferEvents ];
+
+   volatile LONG Written, Floor;
+
+   DWORD Thread;
+
+   TraceBuffer *Next;
+};
+
+volatile bool TraceEnabled = false;
+
+static volatile LONG TlsSlot = ( LONG ) TLS_OUT_OF_INDEXES;
+
+static TraceBuffer *volatile Buffers = NULL;
+
+static volatile LONG BufferCount, SurfaceIds;
+
+static LONGLONG TraceStart;
+
+static inline LONGLONG ReadTraceTicks () {
+   LARGE_INTEGER Ticks;
+
+   QueryPerformanceCounter ( &Ticks );
+
+   return Ticks.QuadPart;
+}
+
+static TraceBuffer *ThreadBuffer () {
+   TraceBuffer *Buffer, *Head;
+   DWORD Slot;
+
+   if ( TlsSlot == ( LONG ) TLS_OUT_OF_INDEXES ) {
+      Slot = TlsAlloc ();
+
+      // Another thread may have got there first:
+      if ( InterlockedCompareExchange ( &TlsSlot, ( LONG ) Slot,
+              ( LONG ) TLS_OUT_OF_INDEXES ) !=
+           ( LONG ) TLS_OUT_OF_INDEXES )
+         TlsFree ( Slot );
+   }
+
+   Buffer = ( TraceBuffer * ) TlsGetValue ( ( DWORD ) TlsSlot );
+
+   if ( Buffer != NULL )
+      return Buffer;
+
+   Buffer = new TraceBuffer;
+
+   if ( Buffer == NULL )
+      return NULL;
+
+   Buffer->Written = Buffer->Floor = 0;
+   Buffer->Thread  = GetCurrentThreadId ();
+
+   do {
+      Head         = Buffers;
+      Buffer->Next = Head;
+   } while ( InterlockedCompareExchangePointer (
+                ( void *volatile * ) &Buffers, Buffer, Head ) != Head );
+
+   InterlockedIncrement ( &BufferCount );
+
+   TlsSetValue ( ( DWORD ) TlsSlot, Buffer );
+
+   return Buffer;
+}
+
+void EnableTrace ( bool Enable ) {
+   if ( Enable && TraceStart == 0 )
+      TraceStart = ReadTraceTicks ();
+
+   TraceEnabled = Enable;
+}
+
+bool IsTraceEnabled () {
+   return TraceEnabled;
+}
+
+void ClearTrace () {
+   TraceBuffer *Buffer;
+
+   for ( Buffer = Buffers; Buffer != NULL; Buffer = Buffer->Next )
+      InterlockedExchange ( &Buffer->Floor, Buffer->Written );
+}
+
+DWORD NewTraceId () {
+   return ( DWORD ) InterlockedIncrement ( &SurfaceIds );
+}
+
+void RecordTraceEvent ( CounterOperation Operation,
+        TracePhase Phase, DWORD Surface, DWORD Source, LONG Width,
+        LONG Height ) {
+
+   TraceBuffer *Buffer = ThreadBuffer ();
+   TraceEvent *Event;
+   LONG Written;
+
+   if ( Buffer == NULL )
+      return;
+
+   Written = Buffer->Written;
+   Event   = &Buffer->Events [ Written & ( TraceBufferEvents - 1 ) ];
+
+   Event->Ticks     = ReadTraceTicks ();
+   Event->Surface   = Surface;
+   Event->Source    = Source;
+   Event->Width     = Width;
+   Event->Height    = Height;
+   Event->Operation = ( BYTE ) Operation;
+   Event->Phase     = ( BYTE ) Phase;
+
+   // Publish the event only once it is complete:
+   InterlockedExchange ( &Buffer->Written, Written + 1 );
+}
+
+// Copy the events a buffer still holds to Events, oldest
+// first, and return how many there were:
+static LONG CopyEvents ( TraceBuffer *Buffer, TraceEvent *Events ) {
+   LONG First, Last, Oldest, Index;
+
+   Last  = InterlockedCompareExchange ( &Buffer->Written, 0, 0 );
+   First = Last - TraceBufferEvents;
+
+   if ( First < Buffer->Floor )
+      First = Buffer->Floor;
+
+   for ( Index = First; Index < Last; Index++ )
+      Events [ Index - First ] =
+         Buffer->Events [ Index & ( TraceBufferEvents - 1 ) ];
+
+   // Whatever the thread went on to write over while they
+   // were copied is dropped, including the slot it may be
+   // writing now:
+   Oldest = InterlockedCompareExchange ( &Buffer->Written, 0, 0 ) -
+      TraceBufferEvents + 1;
+
+   if ( Oldest <= First )
+      return Last - First;
+
+   if ( Oldest >= Last )
+      return 0;
+
+   memmove ( Events, Events + ( Oldest - First ),
+      ( Last - Oldest ) * sizeof ( TraceEvent ) );
+
+   return Last - Oldest;
+}
+
+// Output is gathered into blocks before it is written:
+struct TraceFile {
+   HANDLE File;
+
+   BYTE  Buffer [ 65536 ];
+   DWORD Used;
+
+   bool Failed;
+};
+
+static void FlushTraceFile ( TraceFile &Out ) {
+   DWORD Written;
+
+   if ( Out.Used == 0 )
+      return;
+
+   if ( !WriteFile ( Out.File, Out.Buffer, Out.Used, &Written, NULL ) ||
+        Written != Out.Used )
+      Out.Failed = true;
+
+   Out.Used = 0;
+}
+
+static void WriteTraceFile ( TraceFile &Out, const void *Data,
+        DWORD Bytes ) {
+
+   if ( Out.Used + Bytes > sizeof ( Out.Buffer ) )
+      FlushTraceFile ( Out );
+
+   memcpy ( Out.Buffer + Out.Used, Data, Bytes );
+
+   Out.Used += Bytes;
+}
+
+static void WriteTraceText ( TraceFile &Out, const char *Text ) {
+   WriteTraceFile ( Out, Text, ( DWORD ) strlen ( Text ) );
+}
+
+static TraceFile *OpenTraceFile ( LPCSTR FileName ) {
+   TraceFile *Out = new TraceFile;
+
+   if ( Out == NULL )
+      return NULL;
+
+   Out->File = CreateFile ( FileName, GENERIC_WRITE, 0, NULL,
+      CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+
+   if ( Out->File == INVALID_HANDLE_VALUE ) {
+      delete Out;
+      return NULL;
+   }
+
+   Out->Used   = 0;
+   Out->Failed = false;
+
+   return Out;
+}
+
+static bool CloseTraceFile ( TraceFile *Out ) {
+   bool Result;
+
+   FlushTraceFile ( *Out );
+
+   Result = !Out->Failed;
+
+   CloseHandle ( Out->File );
+
+   delete Out;
+
+   return Result;
+}
+
+static double TraceNanoseconds ( LONGLONG Ticks ) {
+   LARGE_INTEGER Frequency;
+
+   QueryPerformanceFrequency ( &Frequency );
+
+   return ( double ) ( Ticks - TraceStart ) * 1e9 /
+      ( double ) Frequency.QuadPart;
+}
+
+bool WriteChromeTrace ( LPCSTR FileName ) {
+   // Instants are drawn across their thread only:
+   static const char *Phases [ 3 ] = { "B", "E", "i\",\"s\":\"t" };
+
+   TraceBuffer *Buffer;
+   TraceEvent *Events, *Event;
+   TraceFile *Out;
+   LONG Count, Index;
+   char Line [ 320 ];
+   bool First = true;
+
+   Events = new TraceEvent [ TraceBufferEvents ];
+
+   if ( Events == NULL )
+      return false;
+
+   Out = OpenTraceFile ( FileName );
+
+   if ( Out == NULL ) {
+      delete [] Events;
+      return false;
+   }
+
+   WriteTraceText ( *Out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+
+   for ( Buffer = Buffers; Buffer != NULL; Buffer = Buffer->Next ) {
+      sprintf ( Line, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+         "\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"Thread %lu\"}}",
+         First ? "" : ",", Buffer->Thread, Buffer->Thread );
+
+      WriteTraceText ( *Out, Line );
+
+      First = false;
+
+      Count = CopyEvents ( Buffer, Events );
+
+      for ( Index = 0; Index < Count; Index++ ) {
+         Event = &Events [ Index ];
+
+         // Timestamps are in microseconds:
+         sprintf ( Line, ",\n{\"name\":\"%s\",\"cat\":\"DirectDraw\","
+            "\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%lu,"
+            "\"args\":{\"surface\":%lu,\"source\":%lu,"
+            "\"width\":%ld,\"height\":%ld}}",
+            GetCounterName ( ( CounterOperation ) Event->Operation ),
+            Phases [ Event->Phase ],
+            TraceNanoseconds ( Event->Ticks ) / 1000.0,
+            Buffer->Thread, Event->Surface, Event->Source,
+            Event->Width, Event->Height );
+
+         WriteTraceText ( *Out, Line );
+      }
+   }
+
+   WriteTraceText ( *Out, "\n]}\n" );
+
+   delete [] Events;
+
+   return CloseTraceFile ( Out );
+}
+
+// Perfetto traces are protocol buffers: a Trace is a series
+// of TracePacket messages in field 1. The field numbers
+// below are those of perfetto's trace protos:
+enum {
+   ProtoVarint = 0, ProtoBytes = 2,
+
+   TracePacketField = 1,
+
+   PacketTimestamp = 8, PacketSequenceId = 10,
+   PacketTrackEvent = 11, PacketTrackDescriptor = 60,
+
+   TrackUuid = 1, TrackThread = 4,
+   ThreadPid = 1, ThreadTid = 2, ThreadName = 5,
+
+   EventAnnotations = 4, EventType = 9, EventTrackUuid = 11,
+   EventName = 23,
+
+   AnnotationInteger = 4, AnnotationName = 10,
+
+   SliceBegin = 1, SliceEnd = 2, SliceInstant = 3
+};
+
+static LPBYTE PutVarint ( LPBYTE Out, ULONGLONG Value ) {
+   while ( Value >= 0x80 ) {
+      *Out++ = ( BYTE ) ( Value | 0x80 );
+      Value >>= 7;
+   }
+
+   *Out++ = ( BYTE ) Value;
+
+   return Out;
+}
+
+static LPBYTE PutInteger ( LPBYTE Out, DWORD Field,
+        ULONGLONG Value ) {
+
+   Out = PutVarint ( Out, Field << 3 | ProtoVarint );
+
+   return PutVarint ( Out, Value );
+}
+
+static LPBYTE PutBytes ( LPBYTE Out, DWORD Field,
+        const void *Data, DWORD Size ) {
+
+   Out = PutVarint ( Out, Field << 3 | ProtoBytes );
+   Out = PutVarint ( Out, Size );
+
+   memcpy ( Out, Data, Size );
+
+   return Out + Size;
+}
+
+static LPBYTE PutString ( LPBYTE Out, DWORD Field,
+        const char *Text ) {
+
+   return PutBytes ( Out, Field, Text, ( DWORD ) strlen ( Text ) );
+}
+
+static LPBYTE PutAnnotation ( LPBYTE Out, const char *Name,
+        LONGLONG Value ) {
+
+   BYTE Annotation [ 32 ];
+   LPBYTE End;
+
+   End = PutString ( Annotation, AnnotationName, Name );
+   End = PutInteger ( End, AnnotationInteger, ( ULONGLONG ) Value );
+
+   return PutBytes ( Out, EventAnnotations, Annotation,
+      ( DWORD ) ( End - Annotation ) );
+}
+
+static void WritePacket ( TraceFile &Out, LPBYTE Packet,
+        LPBYTE End ) {
+
+   BYTE Header [ 16 ];
+   LPBYTE HeaderEnd;
+
+   HeaderEnd = PutVarint ( Header, TracePacketField << 3 | ProtoBytes );
+   HeaderEnd = PutVarint ( HeaderEnd, ( DWORD ) ( End - Packet ) );
+
+   WriteTraceFile ( Out, Header, ( DWORD ) ( HeaderEnd - Header ) );
+   WriteTraceFile ( Out, Packet, ( DWORD ) ( End - Packet ) );
+}
+
+bool WritePerfettoTrace ( LPCSTR FileName ) {
+   static const DWORD Types [ 3 ] = { SliceBegin, SliceEnd,
+      SliceInstant };
+
+   TraceBuffer *Buffer;
+   TraceEvent *Events, *Event;
+   TraceFile *Out;
+   BYTE Packet [ 256 ], Inner [ 192 ], Thread [ 64 ];
+   LPBYTE End, InnerEnd, ThreadEnd;
+   LONG Count, Index, Sequence = 0;
+   char Name [ 32 ];
+
+   Events = new TraceEvent [ TraceBufferEvents ];
+
+   if ( Events == NULL )
+      return false;
+
+   Out = OpenTraceFile ( FileName );
+
+   if ( Out == NULL ) {
+      delete [] Events;
+      return false;
+   }
+
+   for ( Buffer = Buffers; Buffer != NULL; Buffer = Buffer->Next ) {
+      Sequence++;
+
+      // Each thread is a track, described once, and a
+      // sequence of its own:
+      sprintf ( Name, "Thread %lu", Buffer->Thread );
+
+      ThreadEnd = PutInteger ( Thread, ThreadPid, 1 );
+      ThreadEnd = PutInteger ( ThreadEnd, ThreadTid, Buffer->Thread );
+      ThreadEnd = PutString ( ThreadEnd, ThreadName, Name );
+
+      InnerEnd = PutInteger ( Inner, TrackUuid, Sequence );
+      InnerEnd = PutBytes ( InnerEnd, TrackThread, Thread,
+         ( DWORD ) ( ThreadEnd - Thread ) );
+
+      End = PutInteger ( Packet, PacketSequenceId, Sequence );
+      End = PutBytes ( End, PacketTrackDescriptor, Inner,
+         ( DWORD ) ( InnerEnd - Inner ) );
+
+      WritePacket ( *Out, Packet, End );
+
+      Count = CopyEvents ( Buffer, Events );
+
+      for ( Index = 0; Index < Count; Index++ ) {
+         Event = &Events [ Index ];
+
+         InnerEnd = PutInteger ( Inner, EventType,
+            Types [ Event->Phase ] );
+         InnerEnd = PutInteger ( InnerEnd, EventTrackUuid, Sequence );
+
+         if ( Event->Phase != TraceEnd ) {
+            InnerEnd = PutString ( InnerEnd, EventName,
+               GetCounterName ( ( CounterOperation ) Event->Operation ) );
+
+            InnerEnd = PutAnnotation ( InnerEnd, "surface",
+               Event->Surface );
+            InnerEnd = PutAnnotation ( InnerEnd, "source",
+               Event->Source );
+            InnerEnd = PutAnnotation ( InnerEnd, "width",
+               Event->Width );
+            InnerEnd = PutAnnotation ( InnerEnd, "height",
+               Event->Height );
+         }
+
+         // Timestamps are in nanoseconds:
+         End = PutInteger ( Packet, PacketTimestamp, ( ULONGLONG )
+            TraceNanoseconds ( Event->Ticks ) );
+         End = PutInteger ( End, PacketSequenceId, Sequence );
+         End = PutBytes ( End, PacketTrackEvent, Inner,
+            ( DWORD ) ( InnerEnd - Inner ) );
+
+         WritePacket ( *Out, Packet, End );
+      }
+   }
+
+   delete [] Events;
+
+   return CloseTraceFile ( Out );
+}
+
+void GetTraceStats ( TraceStats &Stats ) {
+   TraceBuffer *Buffer;
+   LONG Written;
+
+   Stats.Threads     = ( DWORD ) BufferCount;
+   Stats.Recorded    = 0;
+   Stats.Overwritten = 0;
+
+   for ( Buffer = Buffers; Buffer != NULL; Buffer = Buffer->Next ) {
+      Written = Buffer->Written;
+
+      Stats.Recorded += Written;
+
+      if ( Written > TraceBufferEvents )
+         Stats.Overwritten += Written - TraceBufferEvents;
+   }
+}
+
+double MeasureTraceCost ( LONG Repeats ) {
+   LARGE_INTEGER Start, Stop, Frequency;
+   bool Enabled = TraceEnabled;
+   LONG Repeat;
+
+   if ( Repeats <= 0 )
+      return 0.0;
+
+   EnableTrace ( true );
+
+   QueryPerformanceFrequency ( &Frequency );
+   QueryPerformanceCounter ( &Start );
+
+   // As a blit records itself:
+   for ( Repeat = 0; Repeat < Repeats; Repeat++ ) {
+      TraceScope Slice ( CounterBlit, 1, 2, 64, 64 );
+   }
+
+   QueryPerformanceCounter ( &Stop );
+
+   EnableTrace ( Enabled );
+
+   return ( double ) ( Stop.QuadPart - Start.QuadPart ) * 1e9 /
+      ( double ) Frequency.QuadPart / ( double ) Repeats;
+}
@@ -0,0 +1,127 @@
+//
+// File name: Trace.hpp
+//
+// Description: A timeline of surface operations, recorded
+//              per thread and written out as a Chrome trace
+//              or a Perfetto trace.
+//
+// Author: John De Goes
+//
+// Project:
+//
+// Import libraries: Ddraw.lib
+//
+// Copyright (C) 1999 John De Goes -- All Rights Reserved
+//
+
+#ifndef __TRACEHPP__
+#define __TRACEHPP__
+
+#include <Windows.H>
+
+#include "Counters.hpp"
+
+// The events each thread keeps; older ones are overwritten:
+#define TraceBufferEvents 16384
+
+enum TracePhase { TraceBegin, TraceEnd, TraceInstant };
+
+// Operations are named as counters are (see Counters.hpp).
+// Surface is the surface's trace id; Source is that of the
+// surface a blit reads from, or 0. Width and Height are the
+// size of the rect locked, blitted or cleared:
+struct TraceEvent {
+   LONGLONG Ticks;
+
+   DWORD Surface, Source;
+   LONG  Width, Height;
+
+   BYTE Operation, Phase;
+};
+
+struct TraceStats {
+   DWORD Threads, Recorded, Overwritten;
+};
+
+// Read before every event, so a disabled trace costs one
+// test per operation:
+extern volatile bool TraceEnabled;
+
+// Start or stop recording; may be called at any time, from
+// any thread. Timestamps count from the first start:
+void EnableTrace ( bool Enable );
+bool IsTraceEnabled ();
+
+// Forget every event recorded so far:
+void ClearTrace ();
+
+// Add an event to the calling thread's buffer, whether or
+// not tracing is enabled:
+void RecordTraceEvent ( CounterOperation Operation,
+   TracePhase Phase, DWORD Surface, DWORD Source, LONG Width,
+   LONG Height );
+
+// A new surface's trace id, from 1 up:
+DWORD NewTraceId ();
+
+// Write every event still held, in the JSON format
+// chrome://tracing and Perfetto's UI open, or as a
+// Perfetto protobuf trace. Best done while no operations
+// are running, since events overwritten during the write
+// are left out:
+bool WriteChromeTrace   ( LPCSTR FileName );
+bool WritePerfettoTrace ( LPCSTR FileName );
+
+void GetTraceStats ( TraceStats &Stats );
+
+// Record Repeats begin and end pairs with tracing enabled
+// and return the cost of each pair in nanoseconds. The
+// events are left in the trace:
+double MeasureTraceCost ( LONG Repeats );
+
+// Records the rest of the block it is declared in as one
+// slice, if tracing was enabled when it began:
+class TraceScope {
+   protected:
+      CounterOperation Operation;
+      DWORD            Surface, Source;
+      LONG             Width, Height;
+      bool             Began;
+
+   public:
+      TraceScope ( CounterOperation Traced, DWORD Id,
+            DWORD SourceId, LONG SliceWidth, LONG SliceHeight ) {
+
+         Began = TraceEnabled;
+
+         if ( !Began )
+            return;
+
+         Operation = Traced;
+         Surface   = Id;
+         Source    = SourceId;
+         Width     = SliceWidth;
+         Height    = SliceHeight;
+
+         RecordTraceEvent ( Operation, TraceBegin, Surface,
+            Source, Width, Height );
+      }
+
+      ~TraceScope () {
+         if ( Began )
+            RecordTraceEvent ( Operation, TraceEnd, Surface,
+               Source, Width, Height );
+      }
+};
+
+// Used inside DirectDrawSurface and DirectDrawManager, where
+// Surface is a surface with a TraceId:
+#define TRACE_SCOPE(Surface, Operation, Source, Width, Height) \
+   TraceScope TraceSlice ( Operation, ( Surface ).TraceId, \
+      Source, Width, Height )
+
+#define TRACE_EVENT(Surface, Operation, Phase, Width, Height) \
+   ( TraceEnabled ? RecordTraceEvent ( Operation, Phase, \
+      ( Surface ).TraceId, 0, Width, Height ) : ( void ) 0 )
+
+#endif